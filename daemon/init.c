@@ -19,10 +19,13 @@
 #include "opd_stats.h"
 #include "opd_sfile.h"
 #include "opd_pipe.h"
+#include "opd_control.h"
 #include "opd_kernel.h"
 #include "opd_trans.h"
 #include "opd_anon.h"
 #include "opd_perfmon.h"
+#include "opd_pipeline.h"
+#include "opd_capture.h"
 #include "opd_printf.h"
 
 #include "op_version.h"
@@ -31,6 +34,8 @@
 #include "op_get_time.h"
 #include "op_libiberty.h"
 #include "op_fileio.h"
+#include "op_file.h"
+#include "odb.h"
 
 #include <fcntl.h>
 #include <stdio.h>
@@ -40,15 +45,24 @@
 #include <sys/time.h>
 #include <wait.h>
 #include <string.h>
+#include <unistd.h>
+
+/* staged samples no dump waits for are written at most this often, in
+ * micro-seconds */
+#define FLUSH_PERIOD 1000000ULL
 
 size_t kernel_pointer_size;
 
 static fd_t devfd;
-static char * sbuf;
 static size_t s_buf_bytesize;
 extern char * session_dir;
 static char start_time_str[32];
 static int jit_conversion_running;
+/** time spent decoding buffers and flushing samples, in micro-seconds */
+static unsigned long long decode_usecs;
+static unsigned long long flush_usecs;
+/** when the staged samples were last written */
+static unsigned long long last_flush_usecs;
 
 static void opd_sighup(void);
 static void opd_alarm(void);
@@ -56,6 +70,14 @@ static void opd_sigterm(void);
 static void opd_sigchild(void);
 static void opd_do_jitdumps(void);
 
+
+static unsigned long long opd_usecs(void)
+{
+	struct timeval tv;
+	gettimeofday(&tv, NULL);
+	return tv.tv_sec * 1000000ULL + tv.tv_usec;
+}
+
 /**
  * opd_open_files - open necessary files
  *
@@ -122,6 +144,46 @@ retry:
 	fclose(status_file);
 }
 
+
+/** return non-zero if a dump waits for the samples to be written */
+static int opd_dump_pending(void)
+{
+	/* opcontrol removes the file before asking for a dump */
+	return opd_control_pending() || access(op_dump_status, F_OK);
+}
+
+
+/** write the samples processed and answer the dump requests done */
+static void opd_flush_dump(void)
+{
+	unsigned long long start = opd_usecs();
+
+	sfile_flush_samples();
+	complete_dump();
+	opd_control_dump_done(opd_pipeline_done_seq());
+	opd_pipeline_sync(0);
+	last_flush_usecs = opd_usecs();
+	flush_usecs += last_flush_usecs - start;
+}
+
+
+/**
+ * Write the staged samples if they were last written FLUSH_PERIOD ago.
+ * Flushing drains the writer threads, so it isn't done for each buffer.
+ */
+static void opd_flush_periodic(void)
+{
+	unsigned long long start = opd_usecs();
+
+	if (start - last_flush_usecs < FLUSH_PERIOD)
+		return;
+
+	sfile_flush_samples();
+	opd_pipeline_sync(0);
+	last_flush_usecs = opd_usecs();
+	flush_usecs += last_flush_usecs - start;
+}
+
  
 /**
  * opd_do_samples - process a sample buffer
@@ -134,15 +196,41 @@ retry:
  */
 static void opd_do_samples(char const * opd_buf, ssize_t count)
 {
+	static int nr_deferred_dumps;
 	size_t num = count / kernel_pointer_size;
+	struct opd_histogram * hist = &opd_stage_hists[OPD_STAGE_DO_SAMPLES];
+	unsigned long long stage_start = opd_stage_begin(hist, OPD_TIME_ALL);
+	unsigned long long start = opd_usecs();
  
 	opd_stats[OPD_DUMP_COUNT]++;
+	opd_buffer_hist.calls++;
+	opd_hist_add(&opd_buffer_hist, count);
 
 	verbprintf(vmisc, "Read buffer of %d entries.\n", (unsigned int)num);
  
 	opd_process_samples(opd_buf, num);
 
-	complete_dump();
+	/* after processing, so a replay finds the lookups done to
+	 * decode it before the buffer */
+	opd_capture_buffer(opd_buf, count);
+
+	decode_usecs += opd_usecs() - start;
+
+	/* A dump request is only complete once the buffers already
+	 * queued by the reader thread are processed too, but don't let
+	 * a continuously busy ring starve opcontrol --dump.
+	 */
+	if (!opd_dump_pending()) {
+		nr_deferred_dumps = 0;
+		opd_flush_periodic();
+	} else if (opd_pipeline_idle() ||
+	           ++nr_deferred_dumps >= nr_ring_buffers) {
+		nr_deferred_dumps = 0;
+		opd_flush_dump();
+	}
+
+	opd_stage_end(hist, stage_start);
+	opd_update_stats_file();
 }
  
 static void opd_do_jitdumps(void)
@@ -190,22 +278,20 @@ static void opd_do_jitdumps(void)
 
 /**
  * opd_do_read - enter processing loop
- * @param buf  buffer to read into
- * @param size  size of buffer
  *
- * Read some of a buffer from the device and process
- * the contents.
+ * Process the buffers read from the device by the
+ * reader thread.
  */
-static void opd_do_read(char * buf, size_t size)
+static void opd_do_read(void)
 {
 	opd_open_pipe();
 
 	while (1) {
-		ssize_t count = -1;
+		struct opd_buffer * buf = NULL;
 
 		/* loop to handle EINTR */
-		while (count < 0) {
-			count = op_read_device(devfd, buf, size);
+		while (!buf) {
+			buf = opd_pipeline_get_buffer();
 
 			/* we can lose an alarm or a hup but
 			 * we don't care.
@@ -242,28 +328,72 @@ static void opd_do_read(char * buf, size_t size)
 			}
 		}
 
-		opd_do_samples(buf, count);
+		opd_do_samples(buf->data, buf->count);
+		/* no later buffer will complete the dump */
+		if (opd_pipeline_put_buffer(buf) && opd_dump_pending())
+			opd_flush_dump();
 	}
 	
 	opd_close_pipe();
 }
 
 
-/** opd_alarm - sync files and report stats */
-static void opd_alarm(void)
+/**
+ * opd_sync_all - sync all the sample files to disk
+ *
+ * The pages queued to the sync thread are synced first, so the files
+ * are written in order.
+ */
+static void opd_sync_all(void)
 {
+	sfile_flush_samples();
+	opd_pipeline_sync(1);
+	opd_pipeline_sync_wait();
 	sfile_sync_files();
+}
+
+
+/** opd_alarm - queue the dirty sample file pages for sync, report stats */
+static void opd_alarm(void)
+{
+	sfile_flush_samples();
+	opd_pipeline_sync(1);
 	opd_print_stats();
 	alarm(60 * 10);
 }
  
 
+/**
+ * open the container holding all the sample files with --packed-session,
+ * it stays open until the next SIGHUP so each sample file open doesn't
+ * have to read it again
+ */
+static void opd_open_samples_pack(void)
+{
+	int err;
+
+	create_path(op_samples_pack_file);
+	err = odb_pack_open(op_samples_pack_file, ODB_RDWR);
+	if (err) {
+		fprintf(stderr, "oprofiled: couldn't open %s: %s\n",
+		        op_samples_pack_file, strerror(err));
+		exit(EXIT_FAILURE);
+	}
+}
+
+
 /** re-open files for logrotate/opcontrol --reset */
 static void opd_sighup(void)
 {
 	printf("Received SIGHUP.\n");
 	/* We just close them, and re-open them lazily as usual. */
+	opd_sync_all();
 	sfile_close_files();
+	/* opcontrol --reset removed the container */
+	if (packed_session) {
+		odb_pack_close(op_samples_pack_file);
+		opd_open_samples_pack();
+	}
 	close(1);
 	close(2);
 	opd_open_logfile();
@@ -273,12 +403,17 @@ static void opd_sighup(void)
 static void clean_exit(void)
 {
 	perfmon_exit();
-	unlink(op_lock_file);
+	opd_control_stop();
+	/* a replay doesn't own the lock file */
+	if (!opd_capture_replaying())
+		unlink(op_lock_file);
+	opd_capture_close();
 }
 
 
 static void opd_sigterm(void)
 {
+	opd_sync_all();
 	opd_do_jitdumps();
 	opd_print_stats();
 	printf("oprofiled stopped %s", op_get_time());
@@ -303,31 +438,57 @@ static void opd_sigchild(void)
 static void opd_26_init(void)
 {
 	size_t i;
-	size_t opd_buf_size;
+	size_t opd_buf_size = 0;
 	unsigned long long start_time = 0ULL;
 	struct timeval tv;
 
 	opd_create_vmlinux(vmlinux, kernel_range);
 	opd_create_xen(xenimage, xen_range);
 
-	opd_buf_size = opd_read_fs_int("/dev/oprofile/", "buffer_size", 1);
-	kernel_pointer_size = opd_read_fs_int("/dev/oprofile/", "pointer_size", 1);
+	if (opd_capture_replaying()) {
+		char const * size = opd_capture_get_option("pointer-size");
+		kernel_pointer_size = size ? atoi(size) : 0;
+		if (kernel_pointer_size != 4 && kernel_pointer_size != 8) {
+			fprintf(stderr, "oprofiled: invalid pointer size "
+				"in the capture file\n");
+			exit(EXIT_FAILURE);
+		}
+	} else {
+		char size[16];
 
-	s_buf_bytesize = opd_buf_size * kernel_pointer_size;
+		opd_buf_size = opd_read_fs_int("/dev/oprofile/",
+		                               "buffer_size", 1);
+		kernel_pointer_size = opd_read_fs_int("/dev/oprofile/",
+		                                      "pointer_size", 1);
+
+		snprintf(size, sizeof(size), "%lu",
+		         (unsigned long)kernel_pointer_size);
+		opd_capture_set_option("pointer-size", size);
+	}
 
-	sbuf = xmalloc(s_buf_bytesize);
+	s_buf_bytesize = opd_buf_size * kernel_pointer_size;
 
 	opd_reread_module_info();
 
 	for (i = 0; i < OPD_MAX_STATS; i++)
 		opd_stats[i] = 0;
 
-	perfmon_init();
+	/* no hardware is used by a replay */
+	if (!opd_capture_replaying())
+		perfmon_init();
 
 	cookie_init();
 	sfile_init();
 	anon_init();
 
+	/* sample files are named after op_samples_current_dir, they are
+	 * now stored in the container */
+	if (packed_session) {
+		opd_open_samples_pack();
+		strcpy(op_samples_current_dir, op_samples_pack_file);
+		strcat(op_samples_current_dir, "/");
+	}
+
 	/* must be /after/ perfmon_init() at least */
 	if (atexit(clean_exit)) {
 		perfmon_exit();
@@ -336,7 +497,8 @@ static void opd_26_init(void)
 	}
 
 	/* trigger kernel module setup before returning control to opcontrol */
-	opd_open_files();
+	if (!opd_capture_replaying())
+		opd_open_files();
 	gettimeofday(&tv, NULL);
 	start_time = 0ULL;
 	start_time = tv.tv_sec;
@@ -345,19 +507,70 @@ static void opd_26_init(void)
 }
 
 
+/**
+ * opd_replay - process the buffers of the capture file
+ *
+ * Report the throughput and where the time went, the capture file is
+ * only read in the remaining time.
+ */
+static void opd_replay(void)
+{
+	char const * buf;
+	size_t count;
+	unsigned long long start, total;
+	unsigned long nr_buffers = 0;
+	unsigned long long nr_entries = 0;
+
+	opd_pipeline_start(-1, 0, 0, nr_worker_threads);
+
+	start = opd_usecs();
+	while ((buf = opd_capture_next_buffer(&count))) {
+		opd_do_samples(buf, count);
+		++nr_buffers;
+		nr_entries += count / kernel_pointer_size;
+	}
+	total = opd_usecs() - start;
+	if (!total)
+		total = 1;
+
+	/* OPD_SAMPLES doesn't count the samples of a cached sfile, the
+	 * buffer entries are the actual input */
+	printf("Replayed %lu buffers, %llu entries in %.3f s: "
+	       "%.0f entries/sec\n", nr_buffers, nr_entries,
+	       total / 1e6, nr_entries * 1e6 / total);
+	printf("decoding: %.3f s (%.1f%%)\n", decode_usecs / 1e6,
+	       decode_usecs * 100.0 / total);
+	printf("sample file flush: %.3f s (%.1f%%)\n", flush_usecs / 1e6,
+	       flush_usecs * 100.0 / total);
+	printf("capture read: %.3f s (%.1f%%)\n",
+	       (total - decode_usecs - flush_usecs) / 1e6,
+	       (total - decode_usecs - flush_usecs) * 100.0 / total);
+	fflush(stdout);
+}
+
+
 static void opd_26_start(void)
 {
-	/* simple sleep-then-process loop */
-	opd_do_read(sbuf, s_buf_bytesize);
+	if (opd_capture_replaying()) {
+		opd_replay();
+		return;
+	}
+
+	/* threads must be started after opd_go_daemon() forked */
+	opd_pipeline_start(devfd, s_buf_bytesize, nr_ring_buffers,
+	                   nr_worker_threads);
+	opd_control_start();
+
+	opd_do_read();
 }
 
 
 static void opd_26_exit(void)
 {
+	opd_sync_all();
 	opd_print_stats();
 	printf("oprofiled stopped %s", op_get_time());
 
-	free(sbuf);
 	free(vmlinux);
 	/* FIXME: free kernel images, sfiles etc. */
 }
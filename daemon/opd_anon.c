@@ -21,6 +21,8 @@
 #include "opd_trans.h"
 #include "opd_sfile.h"
 #include "opd_printf.h"
+#include "opd_capture.h"
+#include "opd_stats.h"
 #include "op_libiberty.h"
 
 #include <limits.h>
@@ -33,131 +35,348 @@
 
 /*
  * Note that this value is tempered by the fact that when we miss in the
- * anon cache, we'll tear down all the mappings for that tgid. Thus, LRU
- * of a mapping can potentially clear out a much larger number of
+ * anon cache, we'll re-read all the mappings for that tgid. Thus, LRU
+ * of a mapping can potentially cause re-reading a much larger number of
  * mappings.
  */
 #define LRU_SIZE 8192
 #define LRU_AMOUNT (LRU_SIZE/8)
 
+/**
+ * All the anon mappings of a tgid/app pair. Mappings of a process can't
+ * overlap so they are kept sorted by start address and looked up by
+ * binary search.
+ */
+struct anon_maps {
+	/** tgid of the app */
+	pid_t tgid;
+	/** cookie of the app */
+	cookie_t app_cookie;
+	/** hash list */
+	struct list_head list;
+	/** mappings sorted by start address */
+	struct anon_mapping ** mappings;
+	/** nr. of mappings */
+	size_t nr;
+};
+
+/** a mapping as read from /proc/pid/maps */
+struct maps_line {
+	vma_t start;
+	vma_t end;
+	char name[MAX_IMAGE_NAME_SIZE + 1];
+};
+
 static struct list_head hashes[HASH_SIZE];
 static struct list_head lru;
 static size_t nr_lru;
 
-static void do_lru(struct transient * trans)
+
+static unsigned long hash_anon(pid_t tgid, cookie_t app)
 {
-	size_t nr_to_kill = LRU_AMOUNT;
+	return ((app >> DCOOKIE_SHIFT) ^ (tgid >> 2)) & (HASH_SIZE - 1);
+}
+
+
+static struct anon_maps * get_anon_maps(pid_t tgid, cookie_t app)
+{
+	unsigned long hash = hash_anon(tgid, app);
 	struct list_head * pos;
-	struct list_head * pos2;
-	struct anon_mapping * entry;
+	struct anon_maps * maps;
 
-	list_for_each_safe(pos, pos2, &lru) {
-		entry = list_entry(pos, struct anon_mapping, lru_list);
-		if (trans->anon == entry)
-			clear_trans_current(trans);
-		if (trans->last_anon == entry)
-			clear_trans_last(trans);
-		sfile_clear_anon(entry);
-		list_del(&entry->list);
-		list_del(&entry->lru_list);
-		--nr_lru;
-		free(entry);
-		if (nr_to_kill-- == 0)
-			break;
+	list_for_each(pos, &hashes[hash]) {
+		maps = list_entry(pos, struct anon_maps, list);
+		if (maps->tgid == tgid && maps->app_cookie == app)
+			return maps;
 	}
+
+	maps = xmalloc(sizeof(struct anon_maps));
+	maps->tgid = tgid;
+	maps->app_cookie = app;
+	maps->mappings = NULL;
+	maps->nr = 0;
+	list_add(&maps->list, &hashes[hash]);
+	return maps;
 }
 
 
-static unsigned long hash_anon(pid_t tgid, cookie_t app)
+static void free_anon_maps(struct anon_maps * maps)
 {
-	return ((app >> DCOOKIE_SHIFT) ^ (tgid >> 2)) & (HASH_SIZE - 1);
+	list_del(&maps->list);
+	free(maps->mappings);
+	free(maps);
 }
- 
 
-static void clear_anon_maps(struct transient * trans)
+
+/** return the index of the first mapping starting after pc */
+static size_t upper_bound(struct anon_maps const * maps, vma_t pc)
 {
-	unsigned long hash = hash_anon(trans->tgid, trans->app_cookie);
-	pid_t tgid = trans->tgid;
-	cookie_t app = trans->app_cookie;
+	size_t first = 0;
+	size_t last = maps->nr;
+
+	while (first < last) {
+		size_t mid = first + (last - first) / 2;
+		if (maps->mappings[mid]->start <= pc)
+			first = mid + 1;
+		else
+			last = mid;
+	}
+
+	return first;
+}
+
+
+static struct anon_mapping *
+lookup_anon_mapping(struct anon_maps const * maps, vma_t pc)
+{
+	size_t index = upper_bound(maps, pc);
+
+	if (index && maps->mappings[index - 1]->end > pc)
+		return maps->mappings[index - 1];
+
+	return NULL;
+}
+
+
+/** forget about a mapping, the caller removes it from its anon_maps */
+static void free_anon_mapping(struct transient * trans,
+                              struct anon_mapping * entry)
+{
+	if (trans->anon == entry)
+		clear_trans_current(trans);
+	if (trans->last_anon == entry)
+		clear_trans_last(trans);
+	sfile_clear_anon(entry);
+	list_del(&entry->lru_list);
+	--nr_lru;
+
+	if (vmisc) {
+		char const * name = verbose_cookie(entry->app_cookie);
+		printf("Removed anon map 0x%llx-0x%llx for tgid %u (%s).\n",
+		       entry->start, entry->end, entry->tgid, name);
+	}
+
+	free(entry);
+}
+
+
+static void do_lru(struct transient * trans, struct anon_maps * keep)
+{
+	size_t nr_to_kill = LRU_AMOUNT;
 	struct list_head * pos;
 	struct list_head * pos2;
 	struct anon_mapping * entry;
 
-	clear_trans_current(trans);
-
-	list_for_each_safe(pos, pos2, &hashes[hash]) {
-		entry = list_entry(pos, struct anon_mapping, list);
-		if (entry->tgid == tgid && entry->app_cookie == app) {
-			if (trans->last_anon == entry)
-				clear_trans_last(trans);
-			sfile_clear_anon(entry);
-			list_del(&entry->list);
-			list_del(&entry->lru_list);
-			--nr_lru;
-			free(entry);
-		}
-	}
+	list_for_each_safe(pos, pos2, &lru) {
+		struct anon_maps * maps;
+		size_t index;
 
-	if (vmisc) {
-		char const * name = verbose_cookie(app);
-		printf("Cleared anon maps for tgid %u (%s).\n", tgid, name);
+		entry = list_entry(pos, struct anon_mapping, lru_list);
+		maps = entry->maps;
+		index = upper_bound(maps, entry->start) - 1;
+		memmove(&maps->mappings[index], &maps->mappings[index + 1],
+		        (maps->nr - index - 1) * sizeof(struct anon_mapping *));
+		--maps->nr;
+		free_anon_mapping(trans, entry);
+		if (!maps->nr && maps != keep)
+			free_anon_maps(maps);
+		if (nr_to_kill-- == 0)
+			break;
 	}
 }
 
 
-static void
-add_anon_mapping(struct transient * trans, vma_t start, vma_t end, char * name)
+static struct anon_mapping *
+new_anon_mapping(struct anon_maps * maps, struct maps_line const * line)
 {
-	unsigned long hash = hash_anon(trans->tgid, trans->app_cookie);
 	struct anon_mapping * m = xmalloc(sizeof(struct anon_mapping));
-	m->tgid = trans->tgid;
-	m->app_cookie = trans->app_cookie;
-	m->start = start;
-	m->end = end;
-	strncpy(m->name, name, MAX_IMAGE_NAME_SIZE + 1);
-	list_add_tail(&m->list, &hashes[hash]);
+	m->tgid = maps->tgid;
+	m->app_cookie = maps->app_cookie;
+	m->maps = maps;
+	m->start = line->start;
+	m->end = line->end;
+	strcpy(m->name, line->name);
 	list_add_tail(&m->lru_list, &lru);
-	if (++nr_lru == LRU_SIZE)
-		do_lru(trans);
+	++nr_lru;
 	if (vmisc) {
 		char const * name = verbose_cookie(m->app_cookie);
 		printf("Added anon map 0x%llx-0x%llx for tgid %u (%s).\n",
-		       start, end, m->tgid, name);
+		       m->start, m->end, m->tgid, name);
+	}
+	return m;
+}
+
+
+static char * parse_hex(char * str, vma_t * val)
+{
+	*val = 0;
+	for (;; ++str) {
+		if (*str >= '0' && *str <= '9')
+			*val = (*val << 4) | (*str - '0');
+		else if (*str >= 'a' && *str <= 'f')
+			*val = (*val << 4) | (*str - 'a' + 10);
+		else
+			return str;
+	}
+}
+
+
+static char * skip_blank(char * str)
+{
+	while (*str == ' ' || *str == '\t')
+		++str;
+	return str;
+}
+
+
+/**
+ * Parse a /proc/pid/maps line:
+ * 42000000-4212f000 r-xp 00000000 16:03 424334 /lib/tls/libc-2.3.2.so
+ *
+ * Some anon maps have labels like [heap], [stack], [vdso], [vsyscall] ...
+ * Keep track of these labels. If a map has no name, call it "anon".
+ * Return 0 if the line is malformed.
+ */
+static int parse_maps_line(char * str, struct maps_line * line)
+{
+	size_t len;
+	int i;
+
+	str = parse_hex(str, &line->start);
+	if (*str != '-')
+		return 0;
+	str = parse_hex(str + 1, &line->end);
+
+	/* permissions, offset, device and inode */
+	for (i = 0; i < 4; ++i) {
+		str = skip_blank(str);
+		if (*str == '\0' || *str == '\n')
+			return 0;
+		str += strcspn(str, " \t\n");
+	}
+
+	str = skip_blank(str);
+	len = strcspn(str, " \t\n");
+	if (!len) {
+		strcpy(line->name, "anon");
+		return 1;
 	}
+
+	if (len > MAX_IMAGE_NAME_SIZE)
+		len = MAX_IMAGE_NAME_SIZE;
+	memcpy(line->name, str, len);
+	line->name[len] = '\0';
+	return 1;
+}
+
+
+static int maps_line_compare(void const * lhs, void const * rhs)
+{
+	struct maps_line const * l1 = lhs;
+	struct maps_line const * l2 = rhs;
+
+	if (l1->start != l2->start)
+		return l1->start < l2->start ? -1 : 1;
+	return 0;
 }
 
 
-/* 42000000-4212f000 r-xp 00000000 16:03 424334 /lib/tls/libc-2.3.2.so */
-static void get_anon_maps(struct transient * trans)
+/**
+ * read the anon mappings of a tgid, sorted by start address, return the
+ * nr. of mappings read
+ */
+static size_t read_anon_maps(pid_t tgid, struct maps_line ** lines)
 {
 	FILE * fp = NULL;
 	char buf[PATH_MAX];
-	vma_t start, end;
-	int ret;
+	size_t nr = 0;
+	size_t size = 0;
+	int sorted = 1;
 
-	snprintf(buf, PATH_MAX, "/proc/%d/maps", trans->tgid);
-	fp = fopen(buf, "r");
+	*lines = NULL;
+
+	snprintf(buf, PATH_MAX, "/proc/%d/maps", tgid);
+	fp = opd_capture_fopen(buf);
 	if (!fp)
-		return;
+		return 0;
 
 	while (fgets(buf, PATH_MAX, fp) != NULL) {
-		char tmp[MAX_IMAGE_NAME_SIZE + 1];
-		char name[MAX_IMAGE_NAME_SIZE + 1];
-		/* Some anon maps have labels like
-		 * [heap], [stack], [vdso], [vsyscall] ...
-		 * Keep track of these labels. If a map has no name, call it "anon".
-		 * Ignore all mappings starting with "/" (file or shared memory object)
-		 */
-		strcpy(name, "anon");
-		ret = sscanf(buf, "%llx-%llx %20s %20s %20s %20s %20s",
-		             &start, &end, tmp, tmp, tmp, tmp, name);
-		if (ret < 6 || name[0] == '/')
+		struct maps_line line;
+
+		/* Ignore all mappings starting with "/" (file or shared
+		 * memory object) */
+		if (!parse_maps_line(buf, &line) || line.name[0] == '/')
 			continue;
 
-		add_anon_mapping(trans, start, end, name);
+		if (nr == size) {
+			size = size ? size * 2 : 64;
+			*lines = xrealloc(*lines, size * sizeof(struct maps_line));
+		}
+		if (nr && (*lines)[nr - 1].start > line.start)
+			sorted = 0;
+		(*lines)[nr++] = line;
 	}
 
 	fclose(fp);
+
+	/* the kernel gives them sorted, but don't rely on it */
+	if (!sorted)
+		qsort(*lines, nr, sizeof(struct maps_line), maps_line_compare);
+
+	return nr;
+}
+
+
+/**
+ * Re-read the mappings of maps, mappings which didn't change are kept so
+ * their sample files stay open, the others are removed or added.
+ */
+static void refresh_anon_maps(struct transient * trans,
+                              struct anon_maps * maps)
+{
+	struct anon_mapping ** old = maps->mappings;
+	size_t nr_old = maps->nr;
+	struct maps_line * lines;
+	size_t nr_lines;
+	size_t i = 0, j = 0;
+
+	clear_trans_current(trans);
+
+	nr_lines = read_anon_maps(maps->tgid, &lines);
+
+	maps->mappings = xmalloc((nr_lines + 1) * sizeof(struct anon_mapping *));
+	maps->nr = 0;
+
+	/* merge the two sorted lists */
+	while (i < nr_old || j < nr_lines) {
+		struct anon_mapping * entry = i < nr_old ? old[i] : NULL;
+		struct maps_line * line = j < nr_lines ? &lines[j] : NULL;
+
+		if (entry && line && entry->start == line->start &&
+		    entry->end == line->end && !strcmp(entry->name, line->name)) {
+			maps->mappings[maps->nr++] = entry;
+			++i;
+			++j;
+		} else if (entry && (!line || entry->start <= line->start)) {
+			free_anon_mapping(trans, entry);
+			++i;
+		} else {
+			maps->mappings[maps->nr++] = new_anon_mapping(maps, line);
+			++j;
+		}
+	}
+
+	free(old);
+	free(lines);
+
+	if (vmisc) {
+		char const * name = verbose_cookie(maps->app_cookie);
+		printf("Refreshed anon maps for tgid %u (%s).\n",
+		       maps->tgid, name);
+	}
+
+	while (nr_lru >= LRU_SIZE)
+		do_lru(trans, maps);
 }
 
 
@@ -176,39 +395,29 @@ anon_match(struct transient const * trans, struct anon_mapping const * anon)
 }
 
 
-struct anon_mapping * find_anon_mapping(struct transient * trans)
+static struct anon_mapping * lookup_anon(struct transient * trans)
 {
-	unsigned long hash = hash_anon(trans->tgid, trans->app_cookie);
-	struct list_head * pos;
+	struct anon_maps * maps;
 	struct anon_mapping * entry;
-	int tried = 0;
 
 	if (anon_match(trans, trans->anon))
 		return (trans->anon);
 
-retry:
-	list_for_each(pos, &hashes[hash]) {
-		entry = list_entry(pos, struct anon_mapping, list);
-		if (anon_match(trans, entry))
-			goto success;
-	}
+	maps = get_anon_maps(trans->tgid, trans->app_cookie);
 
-	if (!tried) {
-		clear_anon_maps(trans);
-		get_anon_maps(trans);
-		tried = 1;
-		goto retry;
+	entry = lookup_anon_mapping(maps, trans->pc);
+	if (!entry) {
+		refresh_anon_maps(trans, maps);
+		/* e.g. the process exited, don't keep an entry per tgid */
+		if (!maps->nr) {
+			free_anon_maps(maps);
+			return NULL;
+		}
+		entry = lookup_anon_mapping(maps, trans->pc);
 	}
 
-	return NULL;
-
-success:
-	/*
-	 * Typically, there's one big mapping that matches. Let's go
-	 * faster.
-	 */
-	list_del(&entry->list);
-	list_add(&entry->list, &hashes[hash]);
+	if (!entry)
+		return NULL;
 
 	verbprintf(vmisc, "Found range 0x%llx-0x%llx for tgid %u, pc %llx.\n",
 	           entry->start, entry->end, (unsigned int)entry->tgid,
@@ -217,6 +426,17 @@ success:
 }
 
 
+struct anon_mapping * find_anon_mapping(struct transient * trans)
+{
+	struct opd_histogram * hist = &opd_stage_hists[OPD_STAGE_FIND_ANON];
+	unsigned long long start = opd_stage_begin(hist, OPD_TIME_SAMPLED);
+	struct anon_mapping * entry = lookup_anon(trans);
+
+	opd_stage_end(hist, start);
+	return entry;
+}
+
+
 void anon_init(void)
 {
 	size_t i;
@@ -28,6 +28,8 @@ struct transient;
 /* Maximum size of the image name considered */
 #define MAX_IMAGE_NAME_SIZE 20
 
+struct anon_maps;
+
 struct anon_mapping {
 	/** start of the mapping */
 	vma_t start;
@@ -37,8 +39,8 @@ struct anon_mapping {
 	pid_t tgid;
 	/** cookie of the app */
 	cookie_t app_cookie;
-	/** hash list */
-	struct list_head list;
+	/** all the mappings of this tgid and app */
+	struct anon_maps * maps;
 	/** lru list */
 	struct list_head lru_list;
 	char name[MAX_IMAGE_NAME_SIZE+1];
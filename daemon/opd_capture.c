@@ -0,0 +1,493 @@
+/**
+ * @file daemon/opd_capture.c
+ * Record and replay of the daemon input
+ *
+ * @remark Copyright 2010 OProfile authors
+ * @remark Read the file COPYING
+ */
+
+/* need this for fmemopen() in <stdio.h> with older glibc */
+#define _GNU_SOURCE
+
+#include "opd_capture.h"
+
+#include "op_libiberty.h"
+#include "op_string.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+enum capture_mode { CAPTURE_NONE, CAPTURE_RECORD, CAPTURE_REPLAY };
+
+/* must be powers of two */
+#define COOKIE_HASH_SIZE 4096
+#define FILE_HASH_SIZE 1024
+
+/** a replayed dcookie lookup, name is NULL if it failed */
+struct capture_cookie {
+	cookie_t cookie;
+	char * name;
+	struct capture_cookie * next;
+};
+
+/**
+ * A replayed file read, the reads of a path are chained in the order
+ * they were recorded, content is NULL if the file couldn't be read.
+ */
+struct capture_file {
+	char * path;
+	char * content;
+	size_t size;
+	struct capture_file * next;
+};
+
+static enum capture_mode mode;
+static FILE * capture_fp;
+static char const * capture_name;
+
+/** replayed options, "name=value" strings */
+static char ** options;
+static size_t nr_options;
+
+static struct capture_cookie * cookies[COOKIE_HASH_SIZE];
+static struct capture_file * files[FILE_HASH_SIZE];
+
+/** the next buffer record, read ahead by read_until_buffer() */
+static char * pending_buffer;
+static size_t pending_size;
+static int has_pending;
+/** the buffer returned by opd_capture_next_buffer() */
+static char * current_buffer;
+
+/** content of the last file returned by opd_capture_fopen() */
+static char * last_content;
+
+
+static void capture_error(char const * what)
+{
+	fprintf(stderr, "oprofiled: %s capture file %s: %s\n",
+		what, capture_name, errno ? strerror(errno) : "truncated");
+	exit(EXIT_FAILURE);
+}
+
+
+static void write_record(uint32_t type, uint64_t key,
+                         void const * data1, size_t size1,
+                         void const * data2, size_t size2)
+{
+	struct opd_capture_record rec;
+
+	rec.type = type;
+	rec.reserved = 0;
+	rec.key = key;
+	rec.size = size1 + size2;
+
+	errno = 0;
+	if (fwrite(&rec, sizeof(rec), 1, capture_fp) != 1 ||
+	    (size1 && fwrite(data1, size1, 1, capture_fp) != 1) ||
+	    (size2 && fwrite(data2, size2, 1, capture_fp) != 1))
+		capture_error("couldn't write");
+}
+
+
+/** return 0 at the end of the file, data is allocated with xmalloc() */
+static int read_record(struct opd_capture_record * rec, char ** data)
+{
+	errno = 0;
+	if (fread(rec, sizeof(*rec), 1, capture_fp) != 1) {
+		if (feof(capture_fp) && !ferror(capture_fp))
+			return 0;
+		capture_error("couldn't read");
+	}
+
+	/* keep a nul after the data, strings are stored without */
+	*data = xmalloc(rec->size + 1);
+	if (rec->size && fread(*data, rec->size, 1, capture_fp) != 1)
+		capture_error("couldn't read");
+	(*data)[rec->size] = '\0';
+
+	return 1;
+}
+
+
+static struct capture_cookie ** cookie_bucket(cookie_t cookie)
+{
+	unsigned long hash = (unsigned long)(cookie >> DCOOKIE_SHIFT);
+	return &cookies[hash & (COOKIE_HASH_SIZE - 1)];
+}
+
+
+static struct capture_file ** file_bucket(char const * path)
+{
+	return &files[op_hash_string(path) & (FILE_HASH_SIZE - 1)];
+}
+
+
+static void add_cookie(cookie_t cookie, char * name)
+{
+	struct capture_cookie ** bucket = cookie_bucket(cookie);
+	struct capture_cookie * entry = xmalloc(sizeof(*entry));
+
+	entry->cookie = cookie;
+	entry->name = name;
+	entry->next = *bucket;
+	*bucket = entry;
+}
+
+
+static void add_file(char * data, size_t size, int missing)
+{
+	struct capture_file ** pos;
+	struct capture_file * entry = xmalloc(sizeof(*entry));
+	size_t const path_len = strlen(data);
+
+	entry->path = data;
+	entry->content = NULL;
+	entry->size = 0;
+	if (!missing) {
+		entry->content = data + path_len + 1;
+		entry->size = path_len < size ? size - path_len - 1 : 0;
+	}
+	entry->next = NULL;
+
+	/* reads of a path must be replayed in order */
+	for (pos = file_bucket(entry->path); *pos; pos = &(*pos)->next)
+		;
+	*pos = entry;
+}
+
+
+/**
+ * Read the records up to the next buffer, which is kept in
+ * pending_buffer. Return 0 at the end of the file.
+ */
+static int read_until_buffer(void)
+{
+	struct opd_capture_record rec;
+	char * data;
+
+	if (has_pending)
+		return 1;
+
+	while (read_record(&rec, &data)) {
+		switch (rec.type) {
+		case OPD_CAPTURE_OPTION:
+			options = xrealloc(options,
+				(nr_options + 1) * sizeof(char *));
+			options[nr_options++] = data;
+			break;
+		case OPD_CAPTURE_BUFFER:
+			pending_buffer = data;
+			pending_size = rec.size;
+			has_pending = 1;
+			return 1;
+		case OPD_CAPTURE_COOKIE:
+			add_cookie(rec.key, data);
+			break;
+		case OPD_CAPTURE_COOKIE_FAILED:
+			add_cookie(rec.key, NULL);
+			free(data);
+			break;
+		case OPD_CAPTURE_FILE:
+			add_file(data, rec.size, 0);
+			break;
+		case OPD_CAPTURE_FILE_MISSING:
+			add_file(data, rec.size, 1);
+			break;
+		default:
+			fprintf(stderr, "oprofiled: unknown record %u in "
+				"capture file %s\n", rec.type, capture_name);
+			exit(EXIT_FAILURE);
+		}
+	}
+
+	return 0;
+}
+
+
+static FILE * open_capture(char const * filename, char const * how)
+{
+	FILE * fp = fopen(filename, how);
+	capture_name = filename;
+	if (!fp)
+		capture_error("couldn't open");
+	return fp;
+}
+
+
+void opd_capture_record(char const * filename)
+{
+	capture_fp = open_capture(filename, "w");
+	mode = CAPTURE_RECORD;
+
+	errno = 0;
+	if (fwrite(OPD_CAPTURE_MAGIC, strlen(OPD_CAPTURE_MAGIC), 1,
+	           capture_fp) != 1)
+		capture_error("couldn't write");
+}
+
+
+void opd_capture_replay(char const * filename)
+{
+	char magic[sizeof(OPD_CAPTURE_MAGIC)];
+
+	capture_fp = open_capture(filename, "r");
+	mode = CAPTURE_REPLAY;
+
+	errno = 0;
+	if (fread(magic, strlen(OPD_CAPTURE_MAGIC), 1, capture_fp) != 1)
+		capture_error("couldn't read");
+	if (memcmp(magic, OPD_CAPTURE_MAGIC, strlen(OPD_CAPTURE_MAGIC))) {
+		fprintf(stderr, "oprofiled: %s is not a capture file\n",
+			filename);
+		exit(EXIT_FAILURE);
+	}
+
+	read_until_buffer();
+}
+
+
+int opd_capture_recording(void)
+{
+	return mode == CAPTURE_RECORD;
+}
+
+
+int opd_capture_replaying(void)
+{
+	return mode == CAPTURE_REPLAY;
+}
+
+
+void opd_capture_close(void)
+{
+	if (mode == CAPTURE_NONE)
+		return;
+
+	if (fclose(capture_fp) && mode == CAPTURE_RECORD) {
+		mode = CAPTURE_NONE;
+		capture_error("couldn't write");
+	}
+	mode = CAPTURE_NONE;
+}
+
+
+void opd_capture_set_option(char const * name, char const * value)
+{
+	char * option;
+
+	if (mode != CAPTURE_RECORD || !value)
+		return;
+
+	option = xmalloc(strlen(name) + strlen(value) + 2);
+	strcpy(option, name);
+	strcat(option, "=");
+	strcat(option, value);
+	write_record(OPD_CAPTURE_OPTION, 0, option, strlen(option), NULL, 0);
+	free(option);
+}
+
+
+char const * opd_capture_get_option(char const * name)
+{
+	size_t const len = strlen(name);
+	size_t i;
+
+	for (i = 0; i < nr_options; ++i) {
+		if (!strncmp(options[i], name, len) && options[i][len] == '=')
+			return options[i] + len + 1;
+	}
+
+	return NULL;
+}
+
+
+void opd_capture_buffer(char const * buf, size_t count)
+{
+	if (mode == CAPTURE_RECORD)
+		write_record(OPD_CAPTURE_BUFFER, 0, buf, count, NULL, 0);
+}
+
+
+char const * opd_capture_next_buffer(size_t * count)
+{
+	free(current_buffer);
+	current_buffer = NULL;
+
+	if (!read_until_buffer())
+		return NULL;
+
+	current_buffer = pending_buffer;
+	*count = pending_size;
+	has_pending = 0;
+	return current_buffer;
+}
+
+
+void opd_capture_cookie(cookie_t cookie, char const * name)
+{
+	if (mode != CAPTURE_RECORD)
+		return;
+
+	if (name) {
+		write_record(OPD_CAPTURE_COOKIE, cookie, name, strlen(name),
+		             NULL, 0);
+	} else {
+		write_record(OPD_CAPTURE_COOKIE_FAILED, cookie, NULL, 0,
+		             NULL, 0);
+	}
+}
+
+
+static struct capture_cookie * find_cookie_entry(cookie_t cookie)
+{
+	struct capture_cookie * entry = *cookie_bucket(cookie);
+
+	for (; entry; entry = entry->next) {
+		if (entry->cookie == cookie)
+			return entry;
+	}
+
+	return NULL;
+}
+
+
+int opd_capture_lookup_cookie(cookie_t cookie, char * buf, size_t size)
+{
+	struct capture_cookie * entry = find_cookie_entry(cookie);
+	size_t len;
+
+	/* not yet read if the replay doesn't follow the recording */
+	if (!entry && read_until_buffer())
+		entry = find_cookie_entry(cookie);
+
+	if (!entry || !entry->name) {
+		errno = ENOENT;
+		return -1;
+	}
+
+	len = strlen(entry->name);
+	if (len >= size) {
+		errno = ERANGE;
+		return -1;
+	}
+
+	memcpy(buf, entry->name, len);
+	return len;
+}
+
+
+void opd_capture_file(char const * path, char const * content, size_t size)
+{
+	if (mode != CAPTURE_RECORD)
+		return;
+
+	if (content) {
+		write_record(OPD_CAPTURE_FILE, 0, path, strlen(path) + 1,
+		             content, size);
+	} else {
+		write_record(OPD_CAPTURE_FILE_MISSING, 0, path, strlen(path),
+		             NULL, 0);
+	}
+}
+
+
+/** remove and return the first file read of path */
+static struct capture_file * pop_file(char const * path)
+{
+	struct capture_file ** pos = file_bucket(path);
+
+	for (; *pos; pos = &(*pos)->next) {
+		struct capture_file * entry = *pos;
+		if (!strcmp(entry->path, path)) {
+			*pos = entry->next;
+			return entry;
+		}
+	}
+
+	return NULL;
+}
+
+
+/** read all of fp, return the content allocated with xmalloc() */
+static char * read_all(FILE * fp, size_t * size)
+{
+	size_t capacity = 4096;
+	char * content = xmalloc(capacity);
+	size_t count;
+
+	*size = 0;
+	while ((count = fread(content + *size, 1, capacity - *size, fp))) {
+		*size += count;
+		if (*size == capacity) {
+			capacity *= 2;
+			content = xrealloc(content, capacity);
+		}
+	}
+
+	return content;
+}
+
+
+/**
+ * return a FILE reading content, the previous content is released so the
+ * previous file must have been closed
+ */
+static FILE * open_content(char * content, size_t size)
+{
+	free(last_content);
+	last_content = content;
+
+	/* old glibc refuse a zero size */
+	if (!size)
+		return fopen("/dev/null", "r");
+
+	return fmemopen(content, size, "r");
+}
+
+
+FILE * opd_capture_fopen(char const * path)
+{
+	struct capture_file * entry;
+	char * content;
+	size_t size;
+	FILE * fp;
+
+	switch (mode) {
+	case CAPTURE_NONE:
+		return fopen(path, "r");
+
+	case CAPTURE_RECORD:
+		fp = fopen(path, "r");
+		if (!fp) {
+			opd_capture_file(path, NULL, 0);
+			return NULL;
+		}
+		content = read_all(fp, &size);
+		fclose(fp);
+		opd_capture_file(path, content, size);
+		return open_content(content, size);
+
+	case CAPTURE_REPLAY:
+		entry = pop_file(path);
+		if (!entry && read_until_buffer())
+			entry = pop_file(path);
+		if (!entry || !entry->content) {
+			if (entry) {
+				free(entry->path);
+				free(entry);
+			}
+			errno = ENOENT;
+			return NULL;
+		}
+		/* the content is in the same block as the path */
+		content = entry->path;
+		memmove(content, entry->content, entry->size);
+		size = entry->size;
+		free(entry);
+		return open_content(content, size);
+	}
+
+	return NULL;
+}
@@ -0,0 +1,127 @@
+/**
+ * @file daemon/opd_capture.h
+ * Record and replay of the daemon input
+ *
+ * @remark Copyright 2010 OProfile authors
+ * @remark Read the file COPYING
+ *
+ * With --record, the buffers read from the kernel are written to a
+ * capture file, together with everything the daemon resolved from the
+ * running system while decoding them: dcookie names, /proc/modules and
+ * /proc/pid/maps. With --replay, the buffers are decoded again from the
+ * capture file, with no driver, each lookup being served from the
+ * capture rather than from the system.
+ *
+ * A capture file is a header followed by records, each one being a
+ * struct opd_capture_record and size bytes of data. Buffer records are
+ * written after the buffer is processed so the lookups done while
+ * decoding it come first, a replay can then read the file only once.
+ * The data is in the byte order of the recording host.
+ */
+
+#ifndef OPD_CAPTURE_H
+#define OPD_CAPTURE_H
+
+#include "opd_cookie.h"
+
+#include <stdio.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#define OPD_CAPTURE_MAGIC "OPDCAP1\n"
+
+enum opd_capture_type {
+	/** a daemon setting, data is "name=value" */
+	OPD_CAPTURE_OPTION = 1,
+	/** a buffer read from the kernel */
+	OPD_CAPTURE_BUFFER,
+	/** the name of the dcookie in key */
+	OPD_CAPTURE_COOKIE,
+	/** failed lookup of the dcookie in key */
+	OPD_CAPTURE_COOKIE_FAILED,
+	/** a file read, data is its path, a nul and its content */
+	OPD_CAPTURE_FILE,
+	/** a file which can't be opened, data is its path */
+	OPD_CAPTURE_FILE_MISSING
+};
+
+struct opd_capture_record {
+	uint32_t type;
+	uint32_t reserved;
+	uint64_t key;
+	uint64_t size;
+};
+
+/**
+ * opd_capture_record - start recording to the given file
+ *
+ * Failure is fatal.
+ */
+void opd_capture_record(char const * filename);
+
+/**
+ * opd_capture_replay - start replaying the given file
+ *
+ * The leading option records are read at once, see
+ * opd_capture_get_option(). Failure is fatal.
+ */
+void opd_capture_replay(char const * filename);
+
+/** return non-zero if recording */
+int opd_capture_recording(void);
+
+/** return non-zero if replaying */
+int opd_capture_replaying(void);
+
+/** flush and close the capture file */
+void opd_capture_close(void);
+
+/**
+ * opd_capture_set_option - record a setting needed for the replay
+ *
+ * Options must be recorded before the first buffer, value can be NULL
+ * if the setting is unset.
+ */
+void opd_capture_set_option(char const * name, char const * value);
+
+/** return the value of an option in the replayed file, NULL if none */
+char const * opd_capture_get_option(char const * name);
+
+/** record a buffer once it has been processed */
+void opd_capture_buffer(char const * buf, size_t count);
+
+/**
+ * opd_capture_next_buffer - return the next replayed buffer
+ * @param count  set to the buffer size in bytes
+ *
+ * Return NULL at the end of the capture file. The buffer is valid until
+ * the next call.
+ */
+char const * opd_capture_next_buffer(size_t * count);
+
+/** record the result of a dcookie lookup, name is NULL if it failed */
+void opd_capture_cookie(cookie_t cookie, char const * name);
+
+/**
+ * opd_capture_lookup_cookie - dcookie lookup from the replayed file
+ *
+ * Same return as the lookup_dcookie syscall, with errno set to ENOENT
+ * if the cookie is not in the capture.
+ */
+int opd_capture_lookup_cookie(cookie_t cookie, char * buf, size_t size);
+
+/** record the content of a file, content is NULL if it can't be read */
+void opd_capture_file(char const * path, char const * content, size_t size);
+
+/**
+ * opd_capture_fopen - open a file for reading, recorded or replayed
+ *
+ * When replaying, the file content is the one recorded for the next
+ * read of this path, NULL is returned if there is none or if the file
+ * couldn't be read when recording. Otherwise it is read from the
+ * system, and recorded if needed. The file must be closed with
+ * fclose().
+ */
+FILE * opd_capture_fopen(char const * path);
+
+#endif /* OPD_CAPTURE_H */
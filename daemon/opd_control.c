@@ -0,0 +1,597 @@
+/**
+ * @file daemon/opd_control.c
+ * Dump requests on the $SESSIONDIR/opd_control socket
+ * NOTE: This code is dealing with potentially insecure input.
+ *
+ * @remark Copyright 2010 OProfile authors
+ * @remark Read the file COPYING
+ */
+
+#include "opd_control.h"
+#include "opd_pipeline.h"
+
+#include "op_config.h"
+#include "op_libiberty.h"
+#include "op_string.h"
+
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <pthread.h>
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#define DUMP_DEVICE "/dev/oprofile/dump"
+/* must be a power of two */
+#define WRITTEN_HASH_SIZE 1024
+/* a client not sending its request or reading its answer in time is
+ * dropped, so it can't stall the other clients. Answers are written by
+ * the control thread, the decoding thread never blocks on a client. In ms */
+#define CLIENT_TIMEOUT 5000
+/* the accept()s wait while this many clients are served */
+#define MAX_CLIENTS 64
+
+enum client_state {
+	/** reading the newline terminated request */
+	CLIENT_READING,
+	/** its dump request waits for opd_control_dump_done() */
+	CLIENT_WAITING,
+	/** writing the answer */
+	CLIENT_WRITING,
+	/** to be closed */
+	CLIENT_DONE
+};
+
+/** a connection on the control socket, only used by the control thread */
+struct client {
+	int fd;
+	enum client_state state;
+	char buf[64];
+	size_t len;
+	char * answer;
+	size_t sent;
+	/** CLOCK_MONOTONIC ms the client is dropped at if reading or
+	 * writing */
+	unsigned long long deadline;
+	struct client * next;
+};
+
+struct dump_request {
+	struct client * client;
+	/** non-zero to list the sample files written since the last dirty
+	 * request */
+	int dirty;
+	/** last read before the flush, the answer waits for a later read
+	 * to be processed or dropped */
+	unsigned long seq;
+	/** what to write to the client, set once the dump is done */
+	char * answer;
+	struct dump_request * next;
+};
+
+struct written_file {
+	char * filename;
+	struct written_file * next;
+};
+
+static int control_fd = -1;
+static pthread_t control;
+
+static pthread_mutex_t request_lock = PTHREAD_MUTEX_INITIALIZER;
+/** requests waiting for the next dump */
+static struct dump_request * requests;
+/** requests done, their answer waits for the control thread */
+static struct dump_request * answered;
+/** written to wake up the control thread when answered is filled */
+static int wake_pipe[2] = { -1, -1 };
+
+static struct client * clients;
+static size_t nr_clients;
+
+/** sample files written and closed since the last dirty request answered,
+ * only accessed by the decoding thread. The open ones are flagged in
+ * their odb_data_t. */
+static struct written_file * written[WRITTEN_HASH_SIZE];
+
+
+static unsigned long long now_ms(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000ULL + ts.tv_nsec / 1000000;
+}
+
+
+/** write answer to the client, which owns it */
+static void start_answer(struct client * client, char * answer)
+{
+	client->state = CLIENT_WRITING;
+	client->answer = answer;
+	client->sent = 0;
+	client->deadline = now_ms() + CLIENT_TIMEOUT;
+}
+
+
+/** ask the kernel to flush its buffers to the daemon */
+static int trigger_dump(void)
+{
+	int fd = open(DUMP_DEVICE, O_WRONLY);
+	int err = 0;
+
+	if (fd < 0)
+		return errno;
+	if (write(fd, "1\n", 2) < 0)
+		err = errno;
+	close(fd);
+	return err;
+}
+
+
+/** remove req from the pending requests, return 0 if already answered */
+static int cancel_request(struct dump_request * req)
+{
+	struct dump_request ** pos;
+	int found = 0;
+
+	pthread_mutex_lock(&request_lock);
+	for (pos = &requests; *pos; pos = &(*pos)->next) {
+		if (*pos == req) {
+			*pos = req->next;
+			found = 1;
+			break;
+		}
+	}
+	pthread_mutex_unlock(&request_lock);
+
+	return found;
+}
+
+
+/** queue the dump request read from client */
+static void handle_request(struct client * client)
+{
+	struct dump_request * req;
+	int err;
+
+	if (strcmp(client->buf, OP_CONTROL_DUMP) &&
+	    strcmp(client->buf, OP_CONTROL_DUMP_DIRTY)) {
+		start_answer(client, xstrdup("error: unknown request\n"));
+		return;
+	}
+
+	req = xmalloc(sizeof(struct dump_request));
+	req->client = client;
+	req->dirty = !strcmp(client->buf, OP_CONTROL_DUMP_DIRTY);
+	req->answer = NULL;
+	client->state = CLIENT_WAITING;
+
+	/* The buffers read so far, queued in the ring or being processed,
+	 * can't hold the flushed samples. The read the flush wakes up can
+	 * complete before trigger_dump() returns, so the number must be
+	 * taken before. The request is queued before the flush so its
+	 * buffer can't be processed before the request is seen.
+	 */
+	req->seq = opd_pipeline_read_seq();
+	pthread_mutex_lock(&request_lock);
+	req->next = requests;
+	requests = req;
+	pthread_mutex_unlock(&request_lock);
+
+	err = trigger_dump();
+	if (err && cancel_request(req)) {
+		free(req);
+		start_answer(client, xstrdup("error: couldn't write to "
+		                             DUMP_DEVICE "\n"));
+	}
+}
+
+
+/** read what the client sent so far, the request once complete */
+static void read_client(struct client * client)
+{
+	size_t const size = sizeof(client->buf);
+	char * newline;
+	ssize_t count;
+
+	count = read(client->fd, client->buf + client->len,
+	             size - 1 - client->len);
+	if (count < 0 && (errno == EINTR || errno == EAGAIN))
+		return;
+	if (count <= 0) {
+		client->state = CLIENT_DONE;
+		return;
+	}
+
+	client->len += count;
+	client->buf[client->len] = '\0';
+	newline = strchr(client->buf, '\n');
+	if (newline) {
+		*newline = '\0';
+		handle_request(client);
+	} else if (client->len == size - 1) {
+		client->state = CLIENT_DONE;
+	}
+}
+
+
+/** write what the client accepts of its answer, errors are ignored: the
+ * client went away */
+static void write_client(struct client * client)
+{
+	size_t const len = strlen(client->answer);
+	ssize_t count;
+
+	count = send(client->fd, client->answer + client->sent,
+	             len - client->sent, MSG_NOSIGNAL);
+	if (count < 0 && (errno == EINTR || errno == EAGAIN))
+		return;
+	if (count <= 0) {
+		client->state = CLIENT_DONE;
+		return;
+	}
+
+	client->sent += count;
+	client->deadline = now_ms() + CLIENT_TIMEOUT;
+	if (client->sent == len)
+		client->state = CLIENT_DONE;
+}
+
+
+static void accept_client(void)
+{
+	struct client * client;
+	int fd = accept(control_fd, NULL, NULL);
+
+	if (fd < 0)
+		return;
+
+	/* not inherited by opjitconv */
+	fcntl(fd, F_SETFD, FD_CLOEXEC);
+	fcntl(fd, F_SETFL, O_NONBLOCK);
+
+	client = xmalloc(sizeof(struct client));
+	client->fd = fd;
+	client->state = CLIENT_READING;
+	client->len = 0;
+	client->answer = NULL;
+	client->sent = 0;
+	client->deadline = now_ms() + CLIENT_TIMEOUT;
+	client->next = clients;
+	clients = client;
+	++nr_clients;
+}
+
+
+/** close the clients done or too slow to read or write */
+static void drop_clients(void)
+{
+	unsigned long long const now = now_ms();
+	struct client ** pos = &clients;
+
+	while (*pos) {
+		struct client * client = *pos;
+		if (client->state == CLIENT_DONE ||
+		    (client->state != CLIENT_WAITING &&
+		     now >= client->deadline)) {
+			*pos = client->next;
+			close(client->fd);
+			free(client->answer);
+			free(client);
+			--nr_clients;
+		} else {
+			pos = &client->next;
+		}
+	}
+}
+
+
+/** start writing the answers of the requests done */
+static void send_answers(void)
+{
+	struct dump_request * req;
+	char buf[64];
+
+	while (read(wake_pipe[0], buf, sizeof(buf)) > 0)
+		;
+
+	pthread_mutex_lock(&request_lock);
+	req = answered;
+	answered = NULL;
+	pthread_mutex_unlock(&request_lock);
+
+	while (req) {
+		struct dump_request * next = req->next;
+		start_answer(req->client, req->answer);
+		free(req);
+		req = next;
+	}
+}
+
+
+/**
+ * Serve the clients from a single poll() loop: their sockets are
+ * non-blocking, so a client sending its request or reading its answer
+ * slowly only costs a poll() round, and is dropped at its deadline.
+ * A client waiting for its dump isn't polled, its answer is written
+ * once opd_control_dump_done() queued it.
+ */
+static void * control_thread(void * arg __attribute__((unused)))
+{
+	struct pollfd fds[2 + MAX_CLIENTS];
+	struct client * polled[MAX_CLIENTS];
+
+	fds[0].fd = control_fd;
+	fds[1].fd = wake_pipe[0];
+	fds[1].events = POLLIN;
+
+	while (1) {
+		unsigned long long const now = now_ms();
+		int timeout = -1;
+		struct client * client;
+		size_t nr = 0;
+		size_t i;
+
+		fds[0].events = nr_clients < MAX_CLIENTS ? POLLIN : 0;
+
+		for (client = clients; client; client = client->next) {
+			int left;
+
+			if (client->state == CLIENT_WAITING)
+				continue;
+
+			fds[2 + nr].fd = client->fd;
+			fds[2 + nr].events =
+				client->state == CLIENT_READING ? POLLIN : POLLOUT;
+			polled[nr++] = client;
+
+			left = client->deadline > now
+				? client->deadline - now : 0;
+			if (timeout < 0 || left < timeout)
+				timeout = left;
+		}
+
+		if (poll(fds, 2 + nr, timeout) < 0) {
+			if (errno != EINTR)
+				perror("oprofiled: control thread poll failed: ");
+			continue;
+		}
+
+		for (i = 0; i < nr; ++i) {
+			if (!fds[2 + i].revents)
+				continue;
+			if (polled[i]->state == CLIENT_READING)
+				read_client(polled[i]);
+			else
+				write_client(polled[i]);
+		}
+
+		if (fds[1].revents)
+			send_answers();
+
+		drop_clients();
+
+		if (fds[0].revents)
+			accept_client();
+	}
+
+	return NULL;
+}
+
+
+void opd_control_start(void)
+{
+	struct sockaddr_un addr;
+	mode_t orig_umask;
+	int i;
+
+	if (strlen(op_control_socket) >= sizeof(addr.sun_path)) {
+		printf("Warning: %s path too long, dump requests disabled\n",
+		       op_control_socket);
+		return;
+	}
+
+	memset(&addr, '\0', sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	strcpy(addr.sun_path, op_control_socket);
+
+	control_fd = socket(AF_UNIX, SOCK_STREAM, 0);
+	if (control_fd < 0) {
+		perror("Warning: couldn't create control socket: ");
+		return;
+	}
+
+	/* not inherited by opjitconv, a client gone before accept()
+	 * doesn't block the control thread */
+	fcntl(control_fd, F_SETFD, FD_CLOEXEC);
+	fcntl(control_fd, F_SETFL, O_NONBLOCK);
+
+	if (pipe(wake_pipe)) {
+		perror("Warning: couldn't create control pipe: ");
+		close(control_fd);
+		control_fd = -1;
+		return;
+	}
+	for (i = 0; i < 2; ++i) {
+		fcntl(wake_pipe[i], F_SETFD, FD_CLOEXEC);
+		fcntl(wake_pipe[i], F_SETFL, O_NONBLOCK);
+	}
+
+	/* left by a daemon which didn't exit cleanly */
+	unlink(op_control_socket);
+
+	/* dumps can only be requested by root, as with the dump file */
+	orig_umask = umask(0077);
+	if (bind(control_fd, (struct sockaddr *)&addr, sizeof(addr)) ||
+	    listen(control_fd, 16)) {
+		umask(orig_umask);
+		perror("Warning: couldn't listen on control socket: ");
+		close(control_fd);
+		control_fd = -1;
+		return;
+	}
+	umask(orig_umask);
+
+	opd_create_thread(&control, control_thread, NULL);
+}
+
+
+void opd_control_stop(void)
+{
+	if (control_fd != -1)
+		unlink(op_control_socket);
+}
+
+
+static void clear_written(void)
+{
+	size_t i;
+
+	for (i = 0; i < WRITTEN_HASH_SIZE; ++i) {
+		while (written[i]) {
+			struct written_file * file = written[i];
+			written[i] = file->next;
+			free(file->filename);
+			free(file);
+		}
+	}
+}
+
+
+static void add_written(char const * filename,
+                        void * arg __attribute__((unused)))
+{
+	struct written_file ** bucket;
+	struct written_file * file;
+
+	bucket = &written[op_hash_string(filename) & (WRITTEN_HASH_SIZE - 1)];
+	for (file = *bucket; file; file = file->next) {
+		if (!strcmp(file->filename, filename))
+			return;
+	}
+
+	file = xmalloc(sizeof(struct written_file));
+	file->filename = xstrdup(filename);
+	file->next = *bucket;
+	*bucket = file;
+}
+
+
+/** return the answer to a dirty request, the written files then ok */
+static char * written_answer(void)
+{
+	size_t i;
+	size_t size = strlen(OP_CONTROL_OK "\n") + 1;
+	struct written_file * file;
+	char * answer;
+	char * pos;
+
+	for (i = 0; i < WRITTEN_HASH_SIZE; ++i) {
+		for (file = written[i]; file; file = file->next)
+			size += strlen(file->filename) + 1;
+	}
+
+	answer = pos = xmalloc(size);
+	for (i = 0; i < WRITTEN_HASH_SIZE; ++i) {
+		for (file = written[i]; file; file = file->next) {
+			size_t len = strlen(file->filename);
+			memcpy(pos, file->filename, len);
+			pos[len] = '\n';
+			pos += len + 1;
+		}
+	}
+	strcpy(pos, OP_CONTROL_OK "\n");
+
+	return answer;
+}
+
+
+int opd_control_pending(void)
+{
+	int pending;
+
+	pthread_mutex_lock(&request_lock);
+	pending = requests != NULL;
+	pthread_mutex_unlock(&request_lock);
+
+	return pending;
+}
+
+
+void opd_control_dump_done(unsigned long seq)
+{
+	struct dump_request * req = NULL;
+	struct dump_request * last;
+	struct dump_request ** pos;
+	char * answer = NULL;
+	int dirty = 0;
+
+	if (control_fd == -1)
+		return;
+
+	/* take the requests whose flushed buffer has been processed */
+	pthread_mutex_lock(&request_lock);
+	pos = &requests;
+	while (*pos) {
+		struct dump_request * done = *pos;
+		if (done->seq < seq) {
+			*pos = done->next;
+			done->next = req;
+			req = done;
+		} else {
+			pos = &done->next;
+		}
+	}
+	pthread_mutex_unlock(&request_lock);
+
+	if (!req)
+		return;
+
+	for (last = req; last; last = last->next)
+		dirty |= last->dirty;
+
+	/* the open files written, which clears their flag, with the closed
+	 * ones. They are kept for the next dirty request if none is done. */
+	if (dirty) {
+		odb_collect_written(add_written, NULL);
+		answer = written_answer();
+		clear_written();
+	}
+
+	for (last = req; ; last = last->next) {
+		if (last->dirty)
+			last->answer = xstrdup(answer);
+		else
+			last->answer = xstrdup(OP_CONTROL_OK "\n");
+		if (!last->next)
+			break;
+	}
+	free(answer);
+
+	/* the control thread writes them, a client can't block us */
+	pthread_mutex_lock(&request_lock);
+	last->next = answered;
+	answered = req;
+	pthread_mutex_unlock(&request_lock);
+
+	/* a full pipe already wakes it up */
+	if (write(wake_pipe[1], "", 1) < 0 && errno != EAGAIN)
+		perror("oprofiled: couldn't wake up the control thread: ");
+}
+
+
+void opd_control_closing(odb_t const * file)
+{
+	if (control_fd == -1)
+		return;
+
+	/* the flag goes with the last reference */
+	if (odb_open_count(file) == 1 && file->data->written)
+		add_written(file->data->filename, NULL);
+}
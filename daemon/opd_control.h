@@ -0,0 +1,56 @@
+/**
+ * @file daemon/opd_control.h
+ * Dump requests on the $SESSIONDIR/opd_control socket
+ *
+ * @remark Copyright 2010 OProfile authors
+ * @remark Read the file COPYING
+ *
+ * A client asks for a dump and blocks until the daemon answers, once
+ * the samples read after the kernel buffer flush are in the sample
+ * files, rather than polling for the complete_dump file.
+ */
+
+#ifndef OPD_CONTROL_H
+#define OPD_CONTROL_H
+
+#include "odb.h"
+
+/**
+ * opd_control_start - listen for dump requests
+ *
+ * Requests are accepted by a thread which triggers the kernel buffer
+ * flush. If the socket can't be created, a warning is logged and only
+ * the complete_dump file signals dumps.
+ */
+void opd_control_start(void);
+
+/** opd_control_stop - remove the socket */
+void opd_control_stop(void);
+
+/** opd_control_pending - return non-zero if a dump request waits */
+int opd_control_pending(void);
+
+/**
+ * opd_control_dump_done - answer the pending dump requests
+ * @param seq  number of the last read processed or dropped, see
+ *  opd_pipeline_done_seq()
+ *
+ * Called by the decoding thread once the sample files are up to date.
+ * Only the requests whose flush was triggered before read seq are
+ * answered. The answers are built here and written by the control
+ * thread, so a client not reading its answer doesn't stall decoding.
+ */
+void opd_control_dump_done(unsigned long seq);
+
+/**
+ * opd_control_closing - remember a sample file written before its close
+ * @param file  the sample file about to be closed
+ *
+ * The files written since the last OP_CONTROL_DUMP_DIRTY request are
+ * listed in the answer to the next one, the open ones are found through
+ * odb_collect_written(). Called by the decoding thread, with no writer
+ * thread running.
+ */
+void opd_control_closing(odb_t const * file);
+
+#endif /* OPD_CONTROL_H */
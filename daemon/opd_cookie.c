@@ -9,8 +9,9 @@
  */
 
 #include "opd_cookie.h"
+#include "opd_capture.h"
+#include "opd_stats.h"
 #include "oprofiled.h"
-#include "op_list.h"
 #include "op_libiberty.h"
 
 #include <sys/syscall.h>
@@ -18,6 +19,7 @@
 #include <limits.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <errno.h>
 
 #ifndef __NR_lookup_dcookie
@@ -86,36 +88,130 @@ static inline int lookup_dcookie(cookie_t cookie, char * buf, size_t size)
 #endif
 
 
+/**
+ * An entry of the cookie table, value is NO_COOKIE if the slot is
+ * empty, name is NULL if the lookup failed.
+ */
 struct cookie_entry {
 	cookie_t value;
-	char * name;
+	char const * name;
 	int ignored;
-	struct list_head list;
 };
 
 
-#define HASH_SIZE 512
-#define HASH_BITS (HASH_SIZE - 1)
+/* initial cookie table size, must be a power of two */
+#define TABLE_INIT_SIZE 512
+
+/* cookie names are allocated from chunks of this size */
+#define ARENA_CHUNK_SIZE (64 * 1024)
+
+/** linear probing table of all looked up cookies */
+static struct cookie_entry * cookie_table;
+static size_t table_size;
+static size_t table_nr;
+
+/** the cookie names arena, names are never freed */
+static char * arena_pos;
+static size_t arena_left;
+
+
+/** copy a name in the names arena */
+static char const * arena_strdup(char const * name, size_t len)
+{
+	char * str;
+
+	if (len + 1 > arena_left) {
+		arena_left = ARENA_CHUNK_SIZE;
+		if (len + 1 > arena_left)
+			arena_left = len + 1;
+		arena_pos = xmalloc(arena_left);
+	}
+
+	str = arena_pos;
+	memcpy(str, name, len + 1);
+	arena_pos += len + 1;
+	arena_left -= len + 1;
+
+	return str;
+}
+
+
+/* Cookie monster want cookie! */
+static unsigned long hash_cookie(cookie_t cookie)
+{
+	cookie >>= DCOOKIE_SHIFT;
+	cookie *= 0x9e3779b97f4a7c15ULL;
+	return (unsigned long)(cookie ^ (cookie >> 32));
+}
+
+
+/** return the slot holding cookie or the empty slot to insert it in */
+static struct cookie_entry * lookup_cookie(cookie_t cookie)
+{
+	size_t mask = table_size - 1;
+	size_t i = hash_cookie(cookie) & mask;
+
+	while (cookie_table[i].value != NO_COOKIE &&
+	       cookie_table[i].value != cookie)
+		i = (i + 1) & mask;
+
+	return &cookie_table[i];
+}
+
+
+static void grow_table(void)
+{
+	struct cookie_entry * old_table = cookie_table;
+	size_t old_size = table_size;
+	size_t i;
+
+	table_size *= 2;
+	cookie_table = xcalloc(table_size, sizeof(struct cookie_entry));
+
+	for (i = 0; i < old_size; ++i) {
+		if (old_table[i].value != NO_COOKIE)
+			*lookup_cookie(old_table[i].value) = old_table[i];
+	}
+
+	free(old_table);
+}
 
-static struct list_head hashes[HASH_SIZE];
 
 static struct cookie_entry * create_cookie(cookie_t cookie)
 {
+	static char buf[PATH_MAX + 1];
+	struct cookie_entry * entry;
 	int err;
-	struct cookie_entry * entry = xmalloc(sizeof(struct cookie_entry));
 
+	/* keep the load factor below 1/2 */
+	if ((table_nr + 1) * 2 > table_size)
+		grow_table();
+
+	entry = lookup_cookie(cookie);
 	entry->value = cookie;
-	entry->name = xmalloc(PATH_MAX + 1);
+	++table_nr;
 
-	err = lookup_dcookie(cookie, entry->name, PATH_MAX);
+	if (opd_capture_replaying()) {
+		err = opd_capture_lookup_cookie(cookie, buf, PATH_MAX);
+	} else {
+		err = lookup_dcookie(cookie, buf, PATH_MAX);
+		if (opd_capture_recording()) {
+			int const saved_errno = errno;
+			if (err >= 0)
+				buf[err] = '\0';
+			opd_capture_cookie(cookie, err < 0 ? NULL : buf);
+			errno = saved_errno;
+		}
+	}
 
 	if (err < 0) {
 		fprintf(stderr, "Lookup of cookie %llx failed, errno=%d\n",
 		       cookie, errno); 
-		free(entry->name);
 		entry->name = NULL;
 		entry->ignored = 0;
 	} else {
+		buf[err] = '\0';
+		entry->name = arena_strdup(buf, strlen(buf));
 		entry->ignored = is_image_ignored(entry->name);
 	}
 
@@ -123,62 +219,45 @@ static struct cookie_entry * create_cookie(cookie_t cookie)
 }
 
 
-/* Cookie monster want cookie! */
-static unsigned long hash_cookie(cookie_t cookie)
+static struct cookie_entry * find_or_create_cookie(cookie_t cookie)
 {
-	return (cookie >> DCOOKIE_SHIFT) & (HASH_SIZE - 1);
+	struct cookie_entry * entry = lookup_cookie(cookie);
+
+	if (entry->value == cookie)
+		return entry;
+
+	/* not sure this can ever happen due to is_cookie_ignored */
+	return create_cookie(cookie);
 }
- 
+
 
 char const * find_cookie(cookie_t cookie)
 {
-	unsigned long hash = hash_cookie(cookie);
-	struct list_head * pos;
-	struct cookie_entry * entry;
+	struct opd_histogram * hist = &opd_stage_hists[OPD_STAGE_FIND_COOKIE];
+	unsigned long long start;
+	char const * name;
 
 	if (cookie == INVALID_COOKIE || cookie == NO_COOKIE)
 		return NULL;
 
-	list_for_each(pos, &hashes[hash]) {
-		entry = list_entry(pos, struct cookie_entry, list);
-		if (entry->value == cookie)
-			goto out;
-	}
-
-	/* not sure this can ever happen due to is_cookie_ignored */
-	entry = create_cookie(cookie);
-	list_add(&entry->list, &hashes[hash]);
-out:
-	return entry->name;
+	start = opd_stage_begin(hist, OPD_TIME_ALL);
+	name = find_or_create_cookie(cookie)->name;
+	opd_stage_end(hist, start);
+	return name;
 }
 
 
 int is_cookie_ignored(cookie_t cookie)
 {
-	unsigned long hash = hash_cookie(cookie);
-	struct list_head * pos;
-	struct cookie_entry * entry;
-
 	if (cookie == INVALID_COOKIE || cookie == NO_COOKIE)
 		return 1;
 
-	list_for_each(pos, &hashes[hash]) {
-		entry = list_entry(pos, struct cookie_entry, list);
-		if (entry->value == cookie)
-			goto out;
-	}
-
-	entry = create_cookie(cookie);
-	list_add(&entry->list, &hashes[hash]);
-out:
-	return entry->ignored;
+	return find_or_create_cookie(cookie)->ignored;
 }
 
 
 char const * verbose_cookie(cookie_t cookie)
 {
-	unsigned long hash = hash_cookie(cookie);
-	struct list_head * pos;
 	struct cookie_entry * entry;
 
 	if (cookie == INVALID_COOKIE)
@@ -187,23 +266,20 @@ char const * verbose_cookie(cookie_t cookie)
 	if (cookie == NO_COOKIE)
 		return "anonymous";
 
-	list_for_each(pos, &hashes[hash]) {
-		entry = list_entry(pos, struct cookie_entry, list);
-		if (entry->value == cookie) {
-			if (!entry->name)
-				return "failed lookup";
-			return entry->name;
-		}
-	}
+	entry = lookup_cookie(cookie);
+	if (entry->value != cookie)
+		return "not hashed";
+
+	if (!entry->name)
+		return "failed lookup";
 
-	return "not hashed";
+	return entry->name;
 }
 
 
 void cookie_init(void)
 {
-	size_t i;
-
-	for (i = 0; i < HASH_SIZE; ++i)
-		list_init(&hashes[i]);
+	table_size = TABLE_INIT_SIZE;
+	table_nr = 0;
+	cookie_table = xcalloc(table_size, sizeof(struct cookie_entry));
 }
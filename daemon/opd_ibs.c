@@ -15,6 +15,7 @@
 #include "op_events.h"
 #include "op_string.h"
 #include "op_libiberty.h"
+#include "op_sample_file.h"
 #include "opd_printf.h"
 #include "opd_trans.h"
 #include "opd_events.h"
@@ -27,6 +28,7 @@
 #include "opd_ibs.h"
 #include "opd_ibs_trans.h"
 #include "opd_ibs_macro.h"
+#include "opd_control.h"
 
 #include <stdlib.h>
 #include <stdio.h>
@@ -152,7 +154,9 @@ out:
 
 void code_ibs_fetch_sample(struct transient * trans)
 {
-	struct ibs_fetch_sample * trans_fetch = NULL;
+	struct ibs_sample sample;
+	struct ibs_fetch_sample fetch;
+	struct ibs_fetch_sample * trans_fetch = &fetch;
 
 	if (!enough_remaining(trans, 7)) {
 		verbprintf(vext, "not enough remaining\n");
@@ -163,9 +167,11 @@ void code_ibs_fetch_sample(struct transient * trans)
 
 	ibs_fetch_sample_stats++;
 
-	trans->ext = xmalloc(sizeof(struct ibs_sample));
-	((struct ibs_sample*)(trans->ext))->fetch = xmalloc(sizeof(struct ibs_fetch_sample));
-	trans_fetch = ((struct ibs_sample*)(trans->ext))->fetch;
+	/* the sample only lives while it is logged, so it does not need
+	 * to be allocated */
+	sample.fetch = trans_fetch;
+	sample.op = NULL;
+	trans->ext = &sample;
 
 	trans_fetch->rip = pop_buffer_value(trans);
 
@@ -194,15 +200,15 @@ void code_ibs_fetch_sample(struct transient * trans)
 
 	opd_put_ibs_sample(trans);
 
-	free(trans_fetch);
-	free(trans->ext);
 	trans->ext = NULL;
 }
 
 
 void code_ibs_op_sample(struct transient * trans)
 {
-	struct ibs_op_sample * trans_op= NULL;
+	struct ibs_sample sample;
+	struct ibs_op_sample op;
+	struct ibs_op_sample * trans_op = &op;
 
 	if (!enough_remaining(trans, 13)) {
 		verbprintf(vext, "not enough remaining\n");
@@ -213,9 +219,9 @@ void code_ibs_op_sample(struct transient * trans)
 
 	ibs_op_sample_stats++;
 
-	trans->ext = xmalloc(sizeof(struct ibs_sample));
-	((struct ibs_sample*)(trans->ext))->op = xmalloc(sizeof(struct ibs_op_sample));
-	trans_op = ((struct ibs_sample*)(trans->ext))->op;
+	sample.fetch = NULL;
+	sample.op = trans_op;
+	trans->ext = &sample;
 
 	trans_op->rip = pop_buffer_value(trans);
 
@@ -251,8 +257,6 @@ void code_ibs_op_sample(struct transient * trans)
 
 	opd_put_ibs_sample(trans);
 
-	free(trans_op);
-	free(trans->ext);
 	trans->ext = NULL;
 }
 
@@ -294,6 +298,16 @@ void opd_log_ibs_count(unsigned int event,
 }
 
 
+void opd_log_ibs_data(unsigned int event,
+			struct transient * trans,
+			unsigned long long addr)
+{
+	ibs_derived_event_stats++;
+	trans->event = event;
+	sfile_log_data_sample(trans, addr >> IBS_DATA_SHIFT(event));
+}
+
+
 static unsigned long get_ibs_vci_key(unsigned int event)
 {
 	unsigned long key = ibs_event_to_counter(event);
@@ -575,8 +589,10 @@ static int ibs_sfile_close(struct sfile * sf)
 {
 	unsigned int i;
 	if (sf->ext_files != NULL) {
-		for (i = 0; i < ibs_selected_size ; ++i)
+		for (i = 0; i < ibs_selected_size ; ++i) {
+			opd_control_closing(&sf->ext_files[i]);
 			odb_close(&sf->ext_files[i]);
+		}
 
 		free(sf->ext_files);
 		sf->ext_files= NULL;
@@ -643,8 +659,15 @@ static odb_t * ibs_sfile_get(struct transient const * trans, int is_cg)
 	file = &(cg->to.ext_files[ibs_vci]);
 
 open:
-	if (!odb_open_count(file))
+	if (!odb_open_count(file)) {
 		opd_open_sample_file(file, last, sf, counter, is_cg);
+		/* arcs are logged by pc only, see sfile_log_data_sample() */
+		if (odb_open_count(file) && !is_cg
+		    && IS_IBS_DATA(trans->event)) {
+			struct opd_header * header = odb_get_data(file);
+			header->data_shift = IBS_DATA_SHIFT(trans->event);
+		}
+	}
 
 	/* Error is logged by opd_open_sample_file */
 	if (!odb_open_count(file))
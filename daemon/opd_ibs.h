@@ -133,5 +133,8 @@ extern void opd_log_ibs_event(unsigned int event, struct transient * trans);
 /** Log the specified IBS cycle count. */
 extern void opd_log_ibs_count(unsigned int event, struct transient * trans, unsigned int count);
 
+/** Log the specified IBS derived event at the given data address. */
+extern void opd_log_ibs_data(unsigned int event, struct transient * trans, unsigned long long addr);
+
 
 #endif /*OPD_IBS_H*/
@@ -160,9 +160,11 @@
 #define DE_IBS_LS_L2_DTLB_1G     0xf217
 #define DE_IBS_LS_L2_DTLB_RES2   0xf218
 #define DE_IBS_LS_DC_LOAD_LAT    0xf219
+#define DE_IBS_LS_DC_MISS_LINE   0xf21a
+#define DE_IBS_LS_DATA_PAGE      0xf21b
 
 #define IBS_OP_LS_BASE           0xf200
-#define IBS_OP_LS_END            0xf219
+#define IBS_OP_LS_END            0xf21b
 #define IBS_OP_LS_MAX            (IBS_OP_LS_END - IBS_OP_LS_BASE + 1)
 #define IS_IBS_OP_LS(x)          (IBS_OP_LS_BASE <= x && x <= IBS_OP_LS_END)
 #define IBS_OP_LS_OFFSET(x)      (x - IBS_OP_LS_BASE)
@@ -195,6 +197,16 @@
 
 #define OP_MAX_IBS_COUNTERS      (IBS_FETCH_MAX + IBS_OP_MAX + IBS_OP_LS_MAX + IBS_OP_NB_MAX)
 
+/**
+ * Data address events are logged per data address >> shift, in the
+ * sample file of the image of the pc. The shift gives the granularity
+ * of the data address.
+ */
+#define IBS_DATA_LINE_SHIFT      6
+#define IBS_DATA_PAGE_SHIFT      12
+#define IS_IBS_DATA(x)           (x == DE_IBS_LS_DC_MISS_LINE || x == DE_IBS_LS_DATA_PAGE)
+#define IBS_DATA_SHIFT(x)        (x == DE_IBS_LS_DC_MISS_LINE ? IBS_DATA_LINE_SHIFT : IBS_DATA_PAGE_SHIFT)
+
 
 /**
  * These macro decodes IBS hardware-level event flags and fields.
@@ -343,6 +355,13 @@
 /** 17 IbsDcLinAddrValid: Data cache linear address valid */
 #define IBS_OP_IBS_DC_LIN_ADDR_VALID(x)         ((x->ibs_op_data3_low & DC_MASK_LIN_ADDR_VALID) != 0)
 
+/**
+ * MSRC001_1038 IBS DC Linear Address Register
+ *
+ * Bits 63:0   IbsDcLinAddr, valid if IBS_OP_IBS_DC_LIN_ADDR_VALID
+ */
+#define IBS_OP_DC_LINEAR_ADDR(x)                (((unsigned long long)x->ibs_op_ldst_linaddr_high << 32) | x->ibs_op_ldst_linaddr_low)
+
 /** 18 ibs_dc_phy_addr_valid: Data cache physical address valid */
 #define IBS_OP_IBS_DC_PHY_ADDR_VALID(x)         ((x->ibs_op_data3_low & DC_MASK_PHY_ADDR_VALID) != 0)
 
@@ -362,5 +381,11 @@
  */
 #define AGG_IBS_COUNT(EV, COUNT)        opd_log_ibs_count(EV, trans, COUNT)
 
+/**
+ * Aggregate the IBS derived event by data address. Increase the
+ * count of the sampled data address >> IBS_DATA_SHIFT(EV) by one.
+ */
+#define AGG_IBS_DATA(EV, ADDR)          opd_log_ibs_data(EV, trans, ADDR)
+
 
 #endif /*OPD_IBS_MACRO_H*/
@@ -430,6 +430,19 @@ void trans_ibs_op_ls (struct transient * trans, unsigned int selected_flag, unsi
 					      IBS_OP_DC_MISS_LATENCY(trans_op)) ;
 			break;
 
+		case DE_IBS_LS_DC_MISS_LINE:
+			if (IBS_OP_IBS_DC_MISS(trans_op)
+			    && IBS_OP_IBS_DC_LIN_ADDR_VALID(trans_op))
+				AGG_IBS_DATA(DE_IBS_LS_DC_MISS_LINE,
+					     IBS_OP_DC_LINEAR_ADDR(trans_op));
+			break;
+
+		case DE_IBS_LS_DATA_PAGE:
+			if (IBS_OP_IBS_DC_LIN_ADDR_VALID(trans_op))
+				AGG_IBS_DATA(DE_IBS_LS_DATA_PAGE,
+					     IBS_OP_DC_LINEAR_ADDR(trans_op));
+			break;
+
 		default:
 			break;
 		}
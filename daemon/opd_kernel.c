@@ -17,6 +17,7 @@
 #include "opd_trans.h"
 #include "opd_printf.h"
 #include "opd_stats.h"
+#include "opd_capture.h"
 #include "oprofiled.h"
 
 #include "op_fileio.h"
@@ -28,8 +29,22 @@
 #include <errno.h>
 #include <assert.h>
 
+/* nr. of per-CPU last hit module cache entries, must be a power of two */
+#define LAST_HIT_SIZE 64
+
+/* below this many modules a linear scan beats the search and the cache,
+ * measured with the modules workload of make bench */
+#define MODULE_SEARCH_MIN 128
+
 static LIST_HEAD(modules);
 
+/** modules sorted by start address, for binary search */
+static struct kernel_image ** sorted_modules;
+static size_t nr_modules;
+
+/** per-CPU last module a sample hit, indexed by CPU nr. */
+static struct kernel_image * last_hit[LAST_HIT_SIZE];
+
 static struct kernel_image vmlinux_image;
 
 static struct kernel_image xen_image;
@@ -124,11 +139,85 @@ static void opd_clear_modules(void)
 
 	list_init(&modules);
 
+	free(sorted_modules);
+	sorted_modules = NULL;
+	nr_modules = 0;
+	memset(last_hit, '\0', sizeof(last_hit));
+
 	/* clear out lingering references */
 	sfile_clear_kernel();
 }
 
 
+static int module_compare(void const * lhs, void const * rhs)
+{
+	struct kernel_image const * m1 = *(struct kernel_image * const *)lhs;
+	struct kernel_image const * m2 = *(struct kernel_image * const *)rhs;
+
+	if (m1->start != m2->start)
+		return m1->start < m2->start ? -1 : 1;
+	return 0;
+}
+
+
+/** build the sorted module array from the module list */
+static void opd_sort_modules(void)
+{
+	struct list_head * pos;
+	size_t i = 0;
+
+	list_for_each(pos, &modules)
+		++nr_modules;
+
+	if (!nr_modules)
+		return;
+
+	sorted_modules = xmalloc(nr_modules * sizeof(struct kernel_image *));
+	list_for_each(pos, &modules)
+		sorted_modules[i++] = list_entry(pos, struct kernel_image, list);
+
+	qsort(sorted_modules, nr_modules, sizeof(struct kernel_image *),
+	      module_compare);
+}
+
+
+/** binary search the module containing pc, NULL if none */
+static struct kernel_image * find_module(vma_t pc)
+{
+	size_t first = 0;
+	size_t last = nr_modules;
+
+	/* find the first module starting after pc */
+	while (first < last) {
+		size_t mid = first + (last - first) / 2;
+		if (sorted_modules[mid]->start <= pc)
+			first = mid + 1;
+		else
+			last = mid;
+	}
+
+	/* so the one before is the only candidate */
+	if (first && sorted_modules[first - 1]->end > pc)
+		return sorted_modules[first - 1];
+
+	return NULL;
+}
+
+
+/** linear scan of the sorted modules for pc, NULL if none */
+static struct kernel_image * scan_modules(vma_t pc)
+{
+	size_t i;
+
+	for (i = 0; i < nr_modules && sorted_modules[i]->start <= pc; ++i) {
+		if (sorted_modules[i]->end > pc)
+			return sorted_modules[i];
+	}
+
+	return NULL;
+}
+
+
 /*
  * each line is in the format:
  *
@@ -156,7 +245,7 @@ void opd_reread_module_info(void)
 
 	printf("Reading module info.\n");
 
-	fp = op_try_open_file("/proc/modules", "r");
+	fp = opd_capture_fopen("/proc/modules");
 
 	if (!fp) {
 		printf("oprofiled: /proc/modules not readable, "
@@ -194,21 +283,15 @@ void opd_reread_module_info(void)
 	}
 
 	op_close_file(fp);
+
+	opd_sort_modules();
 }
 
 
-/**
- * find a kernel image by PC value
- * @param trans holds PC value to look up
- *
- * find the kernel image which contains this PC.
- *
- * Return %NULL if not found.
- */
-struct kernel_image * find_kernel_image(struct transient const * trans)
+static struct kernel_image * lookup_kernel_image(struct transient const * trans)
 {
-	struct list_head * pos;
 	struct kernel_image * image = &vmlinux_image;
+	struct kernel_image ** cache;
 
 	if (no_vmlinux)
 		return image;
@@ -216,14 +299,45 @@ struct kernel_image * find_kernel_image(struct transient const * trans)
 	if (image->start <= trans->pc && image->end > trans->pc)
 		return image;
 
-	list_for_each(pos, &modules) {
-		image = list_entry(pos, struct kernel_image, list);
-		if (image->start <= trans->pc && image->end > trans->pc)
+	if (nr_modules < MODULE_SEARCH_MIN) {
+		image = scan_modules(trans->pc);
+	} else {
+		/* samples on a CPU tend to hit the same module in a row */
+		cache = &last_hit[trans->cpu & (LAST_HIT_SIZE - 1)];
+		image = *cache;
+		if (image && image->start <= trans->pc &&
+		    image->end > trans->pc)
 			return image;
+
+		image = find_module(trans->pc);
+		if (image)
+			*cache = image;
 	}
 
+	if (image)
+		return image;
+
 	if (xen_image.start <= trans->pc && xen_image.end > trans->pc)
 		return &xen_image;
 
 	return NULL;
 }
+
+
+/**
+ * find a kernel image by PC value
+ * @param trans holds PC value to look up
+ *
+ * find the kernel image which contains this PC.
+ *
+ * Return %NULL if not found.
+ */
+struct kernel_image * find_kernel_image(struct transient const * trans)
+{
+	struct opd_histogram * hist = &opd_stage_hists[OPD_STAGE_FIND_KERNEL];
+	unsigned long long start = opd_stage_begin(hist, OPD_TIME_SAMPLED);
+	struct kernel_image * image = lookup_kernel_image(trans);
+
+	opd_stage_end(hist, start);
+	return image;
+}
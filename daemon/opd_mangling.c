@@ -154,7 +154,9 @@ int opd_open_sample_file(odb_t *file, struct sfile *last,
 
 	verbprintf(vsfile, "Opening \"%s\"\n", mangled);
 
-	create_path(mangled);
+	/* the container holds the whole tree */
+	if (!packed_session)
+		create_path(mangled);
 
 	/* locking sf will lock associated cg files too */
 	sfile_get(sf);
@@ -166,7 +168,9 @@ retry:
 
 	/* This can naturally happen when racing against opcontrol --reset. */
 	if (err) {
-		if (err == EMFILE) {
+		/* ENOMEM: too many mappings, tables of a container have no
+		 * file descriptor but each one is mapped */
+		if (err == EMFILE || err == ENOMEM) {
 			if (sfile_lru_clear()) {
 				printf("LRU cleared but odb_open() fails for %s.\n", mangled);
 				abort();
@@ -0,0 +1,600 @@
+/**
+ * @file daemon/opd_pipeline.c
+ * Threaded buffer reading and sample file writing
+ *
+ * @remark Copyright 2010 OProfile authors
+ * @remark Read the file COPYING
+ */
+
+#include "opd_pipeline.h"
+#include "opd_stats.h"
+
+#include "op_libiberty.h"
+#include "op_list.h"
+
+#include <sys/mman.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+/* sample file updates are handed to a writer by batch to amortize locking */
+#define BATCH_SIZE 1024
+/* max number of batches queued to one writer before the decoder waits */
+#define MAX_QUEUED_BATCHES 64
+/* dirty sample file pages are queued for sync at most this often, seconds */
+#define SYNC_PERIOD 60
+/* the sync thread pauses after each SYNC_STEP bytes synced */
+#define SYNC_STEP (4 * 1024 * 1024)
+#define SYNC_PAUSE_USECS 10000
+
+struct opd_update {
+	odb_t * file;
+	odb_key_t key;
+	unsigned long count;
+};
+
+struct opd_batch {
+	struct list_head next;
+	size_t nr;
+	struct opd_update updates[BATCH_SIZE];
+};
+
+struct opd_writer {
+	pthread_t thread;
+	pthread_mutex_t lock;
+	/** signalled when a batch is queued or has been written */
+	pthread_cond_t cond;
+	/** batches waiting to be written */
+	struct list_head queue;
+	/** nr. of batches in queue */
+	size_t depth;
+	/** non-zero while a batch is being written */
+	int busy;
+	/** written batches, ready for re-use */
+	struct list_head free_list;
+	/** batch being filled, only accessed by the decoding thread */
+	struct opd_batch * current;
+	/** time of the updates written */
+	struct opd_histogram update_hist;
+};
+
+/** a dirty range of a mapped sample file */
+struct opd_sync_range {
+	void * start;
+	size_t size;
+};
+
+static pthread_t reader;
+static fd_t devfd;
+static size_t buf_size;
+static int nr_buffers;
+static struct opd_buffer * buffers;
+/** where the reader reads when the ring is full, contents are dropped */
+static char * spill_buf;
+
+static pthread_mutex_t ring_lock = PTHREAD_MUTEX_INITIALIZER;
+/** FIFO of buffers waiting to be processed */
+static struct opd_buffer ** full_ring;
+static size_t full_head;
+static size_t nr_full;
+/** stack of buffers available to the reader */
+static struct opd_buffer ** free_ring;
+static size_t nr_free;
+/** number of the last read, queued or dropped */
+static unsigned long read_seq;
+/** a read was dropped with no buffer queued to process after it */
+static int unseen_drop;
+/** the reader writes a byte here for each buffer it queues */
+static int notify_pipe[2];
+
+static int nr_writers;
+static struct opd_writer * writers;
+
+static pthread_t syncer;
+static pthread_mutex_t sync_lock = PTHREAD_MUTEX_INITIALIZER;
+/** signalled when ranges are queued or have been synced */
+static pthread_cond_t sync_cond = PTHREAD_COND_INITIALIZER;
+/** ranges waiting to be synced */
+static struct opd_sync_range * sync_ranges;
+static size_t nr_sync_ranges;
+static size_t max_sync_ranges;
+/** non-zero while the sync thread works on ranges it took */
+static int syncing;
+/** non-zero while opd_pipeline_sync_wait() waits: don't pause */
+static int sync_hurry;
+static time_t last_sync;
+
+
+void opd_create_thread(pthread_t * thread, void * (*func)(void *),
+                       void * arg)
+{
+	sigset_t all_signals;
+	sigset_t old_signals;
+	int err;
+
+	/* signals must all be delivered to the main thread */
+	sigfillset(&all_signals);
+	pthread_sigmask(SIG_SETMASK, &all_signals, &old_signals);
+	err = pthread_create(thread, NULL, func, arg);
+	pthread_sigmask(SIG_SETMASK, &old_signals, NULL);
+
+	if (err) {
+		fprintf(stderr, "oprofiled: couldn't create thread: %s\n",
+			strerror(err));
+		exit(EXIT_FAILURE);
+	}
+}
+
+
+static struct opd_buffer * get_free_buffer(void)
+{
+	struct opd_buffer * buf = NULL;
+
+	pthread_mutex_lock(&ring_lock);
+	if (nr_free)
+		buf = free_ring[--nr_free];
+	pthread_mutex_unlock(&ring_lock);
+
+	return buf;
+}
+
+
+static void queue_full_buffer(struct opd_buffer * buf)
+{
+	pthread_mutex_lock(&ring_lock);
+	buf->seq = ++read_seq;
+	full_ring[(full_head + nr_full) % nr_buffers] = buf;
+	++nr_full;
+	if (nr_full > opd_stats[OPD_RING_MAX_DEPTH])
+		opd_stats[OPD_RING_MAX_DEPTH] = nr_full;
+	pthread_mutex_unlock(&ring_lock);
+
+	/* non-blocking: a full pipe already guarantees a wake up */
+	if (write(notify_pipe[1], "", 1) < 0 && errno != EAGAIN) {
+		perror("oprofiled: couldn't notify buffer read: ");
+		exit(EXIT_FAILURE);
+	}
+}
+
+
+/** a dropped read still counts, so a dump waiting for it completes */
+static void drop_read(void)
+{
+	pthread_mutex_lock(&ring_lock);
+	++read_seq;
+	opd_stats[OPD_RING_DROPPED]++;
+	if (!nr_full)
+		unseen_drop = 1;
+	pthread_mutex_unlock(&ring_lock);
+}
+
+
+static void * reader_thread(void * arg __attribute__((unused)))
+{
+	struct opd_buffer * buf = NULL;
+
+	while (1) {
+		ssize_t count;
+
+		if (!buf)
+			buf = get_free_buffer();
+
+		/* Keep draining the kernel buffer even if we are late;
+		 * each read starts with a full context so dropping a
+		 * whole read is safe.
+		 */
+		count = op_read_device(devfd, buf ? buf->data : spill_buf,
+		                       buf_size);
+		if (count < 0)
+			continue;
+
+		if (!buf) {
+			drop_read();
+			continue;
+		}
+
+		buf->count = count;
+		queue_full_buffer(buf);
+		buf = NULL;
+	}
+
+	return NULL;
+}
+
+
+struct opd_buffer * opd_pipeline_get_buffer(void)
+{
+	struct opd_buffer * buf = NULL;
+	char notifications[64];
+
+	while (1) {
+		pthread_mutex_lock(&ring_lock);
+		if (nr_full) {
+			buf = full_ring[full_head];
+			full_head = (full_head + 1) % nr_buffers;
+			--nr_full;
+		}
+		pthread_mutex_unlock(&ring_lock);
+
+		if (buf)
+			return buf;
+
+		/* interrupted by a signal: let the caller process it */
+		if (read(notify_pipe[0], notifications,
+		         sizeof(notifications)) < 0) {
+			if (errno == EINTR)
+				return NULL;
+			perror("oprofiled: couldn't wait for buffer read: ");
+			exit(EXIT_FAILURE);
+		}
+	}
+}
+
+
+int opd_pipeline_put_buffer(struct opd_buffer * buf)
+{
+	int dropped;
+
+	pthread_mutex_lock(&ring_lock);
+	free_ring[nr_free++] = buf;
+	dropped = unseen_drop;
+	unseen_drop = 0;
+	pthread_mutex_unlock(&ring_lock);
+
+	return dropped;
+}
+
+
+int opd_pipeline_idle(void)
+{
+	int idle;
+
+	pthread_mutex_lock(&ring_lock);
+	idle = nr_full == 0;
+	pthread_mutex_unlock(&ring_lock);
+
+	return idle;
+}
+
+
+unsigned long opd_pipeline_read_seq(void)
+{
+	unsigned long seq;
+
+	pthread_mutex_lock(&ring_lock);
+	seq = read_seq;
+	pthread_mutex_unlock(&ring_lock);
+
+	return seq;
+}
+
+
+unsigned long opd_pipeline_done_seq(void)
+{
+	unsigned long seq;
+
+	pthread_mutex_lock(&ring_lock);
+	/* the reads before the oldest queued buffer are processed or
+	 * dropped */
+	seq = nr_full ? full_ring[full_head]->seq - 1 : read_seq;
+	unseen_drop = 0;
+	pthread_mutex_unlock(&ring_lock);
+
+	return seq;
+}
+
+
+static void update_node(odb_t * file, odb_key_t key, unsigned long count,
+                        struct opd_histogram * hist)
+{
+	unsigned long long start = opd_stage_begin(hist, OPD_TIME_SAMPLED);
+	int err = odb_update_node_with_offset(file, key, count);
+	opd_stage_end(hist, start);
+	if (err) {
+		fprintf(stderr, "%s: %s\n", __FUNCTION__, strerror(err));
+		abort();
+	}
+}
+
+
+static void * writer_thread(void * arg)
+{
+	struct opd_writer * writer = arg;
+	struct opd_histogram hist;
+
+	pthread_mutex_lock(&writer->lock);
+
+	while (1) {
+		struct opd_batch * batch;
+		size_t i;
+
+		while (list_empty(&writer->queue))
+			pthread_cond_wait(&writer->cond, &writer->lock);
+
+		batch = list_entry(writer->queue.next, struct opd_batch, next);
+		list_del(&batch->next);
+		--writer->depth;
+		writer->busy = 1;
+		pthread_mutex_unlock(&writer->lock);
+
+		/* keep the writer's calls count so the timed ones are spread */
+		memset(&hist, '\0', sizeof(hist));
+		hist.calls = writer->update_hist.calls;
+		for (i = 0; i < batch->nr; ++i) {
+			struct opd_update * update = &batch->updates[i];
+			update_node(update->file, update->key, update->count,
+			            &hist);
+		}
+		hist.calls -= writer->update_hist.calls;
+
+		pthread_mutex_lock(&writer->lock);
+		opd_hist_merge(&writer->update_hist, &hist);
+		list_add(&batch->next, &writer->free_list);
+		writer->busy = 0;
+		pthread_cond_broadcast(&writer->cond);
+	}
+
+	return NULL;
+}
+
+
+/*
+ * The same odb data can be shared by different sfiles through
+ * odb_open(), so shard on it rather than on the sfile, to ensure
+ * a sample file is only ever written by one thread.
+ */
+static struct opd_writer * file_writer(odb_t const * file)
+{
+	uint64_t hash = (uintptr_t)file->data * 0x9e3779b97f4a7c15ULL;
+	return &writers[(hash >> 32) % nr_writers];
+}
+
+
+static struct opd_batch * get_batch(struct opd_writer * writer)
+{
+	struct opd_batch * batch = NULL;
+
+	pthread_mutex_lock(&writer->lock);
+	if (!list_empty(&writer->free_list)) {
+		batch = list_entry(writer->free_list.next,
+		                   struct opd_batch, next);
+		list_del(&batch->next);
+	}
+	pthread_mutex_unlock(&writer->lock);
+
+	if (!batch)
+		batch = xmalloc(sizeof(struct opd_batch));
+	batch->nr = 0;
+	return batch;
+}
+
+
+static void queue_batch(struct opd_writer * writer)
+{
+	pthread_mutex_lock(&writer->lock);
+
+	while (writer->depth >= MAX_QUEUED_BATCHES) {
+		opd_stats[OPD_WRITER_STALLS]++;
+		pthread_cond_wait(&writer->cond, &writer->lock);
+	}
+
+	list_add_tail(&writer->current->next, &writer->queue);
+	++writer->depth;
+	if (writer->depth > opd_stats[OPD_WRITER_MAX_DEPTH])
+		opd_stats[OPD_WRITER_MAX_DEPTH] = writer->depth;
+	pthread_cond_broadcast(&writer->cond);
+
+	pthread_mutex_unlock(&writer->lock);
+
+	writer->current = NULL;
+}
+
+
+void opd_pipeline_update(odb_t * file, odb_key_t key, unsigned long count)
+{
+	struct opd_writer * writer;
+	struct opd_update * update;
+
+	if (!nr_writers) {
+		update_node(file, key, count,
+		            &opd_stage_hists[OPD_STAGE_ODB_UPDATE]);
+		return;
+	}
+
+	writer = file_writer(file);
+	if (!writer->current)
+		writer->current = get_batch(writer);
+
+	update = &writer->current->updates[writer->current->nr++];
+	update->file = file;
+	update->key = key;
+	update->count = count;
+
+	if (writer->current->nr == BATCH_SIZE)
+		queue_batch(writer);
+}
+
+
+void opd_pipeline_drain(void)
+{
+	int i;
+
+	for (i = 0; i < nr_writers; ++i) {
+		struct opd_writer * writer = &writers[i];
+
+		if (writer->current && writer->current->nr)
+			queue_batch(writer);
+
+		pthread_mutex_lock(&writer->lock);
+		while (writer->depth || writer->busy)
+			pthread_cond_wait(&writer->cond, &writer->lock);
+		pthread_mutex_unlock(&writer->lock);
+	}
+}
+
+
+void opd_pipeline_update_hist(struct opd_histogram * hist)
+{
+	int i;
+
+	for (i = 0; i < nr_writers; ++i) {
+		pthread_mutex_lock(&writers[i].lock);
+		opd_hist_merge(hist, &writers[i].update_hist);
+		pthread_mutex_unlock(&writers[i].lock);
+	}
+}
+
+
+static void * sync_thread(void * arg __attribute__((unused)))
+{
+	pthread_mutex_lock(&sync_lock);
+
+	while (1) {
+		struct opd_sync_range * ranges;
+		size_t nr, i;
+		size_t done = 0;
+
+		while (!nr_sync_ranges)
+			pthread_cond_wait(&sync_cond, &sync_lock);
+
+		ranges = sync_ranges;
+		nr = nr_sync_ranges;
+		sync_ranges = NULL;
+		nr_sync_ranges = max_sync_ranges = 0;
+		syncing = 1;
+		pthread_mutex_unlock(&sync_lock);
+
+		for (i = 0; i < nr; ++i) {
+			/* the file may have been grown or closed since, the
+			 * range is then unmapped and msync() harmlessly fails;
+			 * the new mapping is queued again as a whole */
+			msync(ranges[i].start, ranges[i].size, MS_SYNC);
+			done += ranges[i].size;
+			/* don't compete with the decoding thread for the disk */
+			if (done >= SYNC_STEP && !sync_hurry) {
+				usleep(SYNC_PAUSE_USECS);
+				done = 0;
+			}
+		}
+		free(ranges);
+
+		pthread_mutex_lock(&sync_lock);
+		syncing = 0;
+		pthread_cond_broadcast(&sync_cond);
+	}
+
+	return NULL;
+}
+
+
+static void queue_sync_range(void * start, size_t size,
+                             void * arg __attribute__((unused)))
+{
+	if (nr_sync_ranges == max_sync_ranges) {
+		max_sync_ranges = max_sync_ranges ? max_sync_ranges * 2 : 256;
+		sync_ranges = xrealloc(sync_ranges, max_sync_ranges *
+		                       sizeof(struct opd_sync_range));
+	}
+	sync_ranges[nr_sync_ranges].start = start;
+	sync_ranges[nr_sync_ranges].size = size;
+	++nr_sync_ranges;
+}
+
+
+void opd_pipeline_sync(int force)
+{
+	time_t const now = time(NULL);
+
+	if (!force && now - last_sync < SYNC_PERIOD)
+		return;
+	last_sync = now;
+
+	pthread_mutex_lock(&sync_lock);
+	odb_collect_dirty(queue_sync_range, NULL);
+	if (nr_sync_ranges)
+		pthread_cond_broadcast(&sync_cond);
+	pthread_mutex_unlock(&sync_lock);
+}
+
+
+void opd_pipeline_sync_wait(void)
+{
+	pthread_mutex_lock(&sync_lock);
+	sync_hurry = 1;
+	while (nr_sync_ranges || syncing)
+		pthread_cond_wait(&sync_cond, &sync_lock);
+	sync_hurry = 0;
+	pthread_mutex_unlock(&sync_lock);
+}
+
+
+static void start_writers(int nr)
+{
+	int i;
+
+	nr_writers = nr;
+	if (!nr_writers)
+		return;
+
+	writers = xmalloc(nr_writers * sizeof(struct opd_writer));
+
+	for (i = 0; i < nr_writers; ++i) {
+		struct opd_writer * writer = &writers[i];
+
+		pthread_mutex_init(&writer->lock, NULL);
+		pthread_cond_init(&writer->cond, NULL);
+		list_init(&writer->queue);
+		list_init(&writer->free_list);
+		writer->depth = 0;
+		writer->busy = 0;
+		writer->current = NULL;
+		memset(&writer->update_hist, '\0', sizeof(struct opd_histogram));
+
+		opd_create_thread(&writer->thread, writer_thread, writer);
+	}
+}
+
+
+void opd_pipeline_start(fd_t fd, size_t size, int nr_bufs, int nr_wr)
+{
+	int i;
+
+	last_sync = time(NULL);
+	opd_create_thread(&syncer, sync_thread, NULL);
+
+	if (fd == -1) {
+		start_writers(nr_wr);
+		return;
+	}
+
+	devfd = fd;
+	buf_size = size;
+	nr_buffers = nr_bufs;
+
+	buffers = xmalloc(nr_buffers * sizeof(struct opd_buffer));
+	full_ring = xmalloc(nr_buffers * sizeof(struct opd_buffer *));
+	free_ring = xmalloc(nr_buffers * sizeof(struct opd_buffer *));
+	for (i = 0; i < nr_buffers; ++i) {
+		buffers[i].data = xmalloc(buf_size);
+		buffers[i].count = 0;
+		free_ring[nr_free++] = &buffers[i];
+	}
+	spill_buf = xmalloc(buf_size);
+
+	if (pipe(notify_pipe) ||
+	    fcntl(notify_pipe[1], F_SETFL, O_NONBLOCK)) {
+		perror("oprofiled: couldn't create notification pipe: ");
+		exit(EXIT_FAILURE);
+	}
+
+	start_writers(nr_wr);
+
+	opd_create_thread(&reader, reader_thread, NULL);
+}
@@ -0,0 +1,126 @@
+/**
+ * @file daemon/opd_pipeline.h
+ * Threaded buffer reading and sample file writing
+ *
+ * @remark Copyright 2010 OProfile authors
+ * @remark Read the file COPYING
+ *
+ * The event buffer is drained by a dedicated reader thread into a ring
+ * of buffers, which the main thread decodes. Sample file updates can
+ * optionally be handed to a set of writer threads; each odb file is
+ * always updated by the same writer thread so no locking is needed on
+ * the mmapped sample data.
+ */
+
+#ifndef OPD_PIPELINE_H
+#define OPD_PIPELINE_H
+
+#include "opd_stats.h"
+
+#include "odb.h"
+#include "op_deviceio.h"
+
+#include <sys/types.h>
+#include <pthread.h>
+
+/** a buffer read from the kernel, owned by the pipeline */
+struct opd_buffer {
+	/** raw data as read from the device */
+	char * data;
+	/** number of bytes read into data */
+	ssize_t count;
+	/** number of the read, reads are numbered from 1 in read order,
+	 * including the dropped ones */
+	unsigned long seq;
+};
+
+/**
+ * opd_pipeline_start - start the reader, writer and sync threads
+ * @param devfd  the event buffer device, -1 to only start the writers
+ *  when the buffers don't come from the kernel
+ * @param buf_size  size in bytes of one read
+ * @param nr_buffers  number of buffers in the read ring
+ * @param nr_writers  number of sample file writer threads, 0 to update
+ *  sample files directly from the caller of opd_pipeline_update()
+ *
+ * Must be called after the daemon has forked. Failure is fatal.
+ */
+void opd_pipeline_start(fd_t devfd, size_t buf_size,
+                        int nr_buffers, int nr_writers);
+
+/**
+ * opd_create_thread - create a daemon thread
+ *
+ * The thread blocks all signals, they must be handled by the main
+ * thread. Failure is fatal.
+ */
+void opd_create_thread(pthread_t * thread, void * (*func)(void *),
+                       void * arg);
+
+/**
+ * opd_pipeline_get_buffer - wait for the next buffer read by the reader
+ *
+ * Returns NULL if the wait was interrupted by a signal, to let the
+ * caller process it. The buffer must be given back with
+ * opd_pipeline_put_buffer() once processed.
+ */
+struct opd_buffer * opd_pipeline_get_buffer(void);
+
+/**
+ * opd_pipeline_put_buffer - give back a buffer returned by
+ * opd_pipeline_get_buffer()
+ *
+ * Returns non-zero if a read was dropped while no buffer was queued, no
+ * later buffer will then complete a dump waiting for this read: the
+ * caller must do it, see opd_pipeline_done_seq().
+ */
+int opd_pipeline_put_buffer(struct opd_buffer * buf);
+
+/** return non-zero if no read buffer is waiting to be processed */
+int opd_pipeline_idle(void);
+
+/** return the number of the last read, 0 if none */
+unsigned long opd_pipeline_read_seq(void);
+
+/**
+ * opd_pipeline_done_seq - number of the last read whose samples are
+ * processed, or dropped
+ *
+ * Called by the decoding thread once it has processed the buffer it
+ * holds, if any.
+ */
+unsigned long opd_pipeline_done_seq(void);
+
+/**
+ * opd_pipeline_update - add count to the value at key in file
+ *
+ * The update is queued to the writer thread owning this file. The file
+ * must stay open until the next opd_pipeline_drain(). Failure is fatal.
+ */
+void opd_pipeline_update(odb_t * file, odb_key_t key, unsigned long count);
+
+/**
+ * opd_pipeline_drain - wait for all queued sample file updates
+ *
+ * Must be called before any sample file is synced or closed.
+ */
+void opd_pipeline_drain(void);
+
+/**
+ * opd_pipeline_sync - queue the sample file pages dirtied since the last call
+ * @param force  queue them even if the last call is recent
+ *
+ * The pages are msync()ed by a background thread, a few at a time, so the
+ * caller never waits for the disk. Without force the pages are only queued
+ * once per period. Must be called after opd_pipeline_drain(), with no
+ * update in between.
+ */
+void opd_pipeline_sync(int force);
+
+/** opd_pipeline_sync_wait - wait for all the queued pages to be synced */
+void opd_pipeline_sync_wait(void);
+
+/** add the odb_update_node() timings of the writer threads to hist */
+void opd_pipeline_update_hist(struct opd_histogram * hist);
+
+#endif /* OPD_PIPELINE_H */
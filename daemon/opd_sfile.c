@@ -14,6 +14,8 @@
 #include "opd_trans.h"
 #include "opd_kernel.h"
 #include "opd_mangling.h"
+#include "opd_pipeline.h"
+#include "opd_control.h"
 #include "opd_anon.h"
 #include "opd_printf.h"
 #include "opd_stats.h"
@@ -22,59 +24,222 @@
 
 #include "op_libiberty.h"
 
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 
-#define HASH_SIZE 2048
-#define HASH_BITS (HASH_SIZE - 1)
+/* initial sfile table size, must be a power of two */
+#define TABLE_INIT_SIZE 2048
 
-/** All sfiles are hashed into these lists */
-static struct list_head hashes[HASH_SIZE];
+/* staging table size, must be a power of two */
+#define STAGE_SIZE 128
+#define STAGE_BITS 7
+/* flush a staging table when this many slots are used */
+#define STAGE_MAX_USED (STAGE_SIZE * 3 / 4)
+/* bound the memory used by staging tables */
+#define MAX_STAGES 512
+
+/**
+ * The fields of a sfile compared to find the sfile of a sample, fields
+ * not relevant to the current separation options are set to a fixed
+ * value so keys can be compared field by field.
+ */
+struct sfile_key {
+	cookie_t cookie;
+	cookie_t app_cookie;
+	struct kernel_image const * kernel;
+	struct anon_mapping const * anon;
+	pid_t tid;
+	pid_t tgid;
+	unsigned int cpu;
+};
+
+/**
+ * An entry of the sfile table, the key is stored inline so a lookup
+ * does not touch the sfile until the key matches.
+ */
+struct sfile_slot {
+	struct sfile_key key;
+	unsigned long hash;
+	/** NULL if the slot is empty */
+	struct sfile * sf;
+};
+
+/**
+ * All sfiles are hashed in this linear probing table, cg sfiles are
+ * stored in their owner sfile.
+ */
+static struct sfile_slot * sfile_table;
+/** table size, a power of two */
+static size_t table_size;
+/** nr. of used slots */
+static size_t table_nr;
 
 /** All sfiles are on this list. */
 static LIST_HEAD(lru_list);
 
+/** a sample count waiting to be added to a sample file */
+struct stage_entry {
+	odb_t * file;
+	odb_key_t key;
+	unsigned long count;
+};
 
-/* FIXME: can undoubtedly improve this hashing */
-/** Hash the transient parameters for lookup. */
-static unsigned long
-sfile_hash(struct transient const * trans, struct kernel_image * ki)
+/**
+ * Samples logged through a sfile are merged here, so hot PCs cost one
+ * sample file update per flush rather than one per sample.
+ */
+struct sfile_stage {
+	/** on dirty_stages while owned by a sfile, else on free_stages */
+	struct list_head next;
+	/** the sfile owning this stage, if any */
+	struct sfile * owner;
+	/** nr. of used entries */
+	size_t nr;
+	/** open addressing table, an entry is used if count != 0 */
+	struct stage_entry entries[STAGE_SIZE];
+};
+
+/** staging tables owned by a sfile */
+static LIST_HEAD(dirty_stages);
+/** staging tables ready for re-use */
+static LIST_HEAD(free_stages);
+static size_t nr_stages;
+
+
+/** fill the sfile table key of a sample, must match do_match() */
+static void
+make_key(struct sfile_key * key, struct transient const * trans,
+         struct kernel_image const * ki)
 {
-	unsigned long val = 0;
-	
+	key->kernel = ki;
+	key->tid = (pid_t)-1;
+	key->tgid = (pid_t)-1;
+	key->cpu = 0;
+	key->app_cookie = INVALID_COOKIE;
+
 	if (separate_thread) {
-		val ^= trans->tid << 2;
-		val ^= trans->tgid << 2;
+		key->tid = trans->tid;
+		key->tgid = trans->tgid;
 	}
 
-	if (separate_kernel || ((trans->anon || separate_lib) && !ki))
-		val ^= trans->app_cookie >> (DCOOKIE_SHIFT + 3);
-
 	if (separate_cpu)
-		val ^= trans->cpu;
+		key->cpu = trans->cpu;
 
-	/* cookie meaningless for kernel, shouldn't hash */
-	if (trans->in_kernel) {
-		val ^= ki->start >> 14;
-		val ^= ki->end >> 7;
-		return val & HASH_BITS;
+	if (separate_kernel || ((trans->anon || separate_lib) && !ki))
+		key->app_cookie = trans->app_cookie;
+
+	/* cookie meaningless for kernel, see do_match() */
+	if (ki) {
+		key->cookie = INVALID_COOKIE;
+		key->anon = NULL;
+	} else {
+		key->cookie = trans->cookie;
+		key->anon = trans->anon;
 	}
+}
+
+
+static int
+key_equal(struct sfile_key const * lhs, struct sfile_key const * rhs)
+{
+	return lhs->cookie == rhs->cookie &&
+	       lhs->kernel == rhs->kernel &&
+	       lhs->anon == rhs->anon &&
+	       lhs->app_cookie == rhs->app_cookie &&
+	       lhs->tid == rhs->tid &&
+	       lhs->tgid == rhs->tgid &&
+	       lhs->cpu == rhs->cpu;
+}
+
+
+static inline uint64_t hash_mix(uint64_t h, uint64_t val)
+{
+	h = (h ^ val) * 0xff51afd7ed558ccdULL;
+	return h ^ (h >> 33);
+}
+
+
+/** Hash a sfile table key */
+static unsigned long sfile_hash(struct sfile_key const * key)
+{
+	uint64_t h = 0;
+
+	h = hash_mix(h, key->cookie >> DCOOKIE_SHIFT);
+	h = hash_mix(h, key->app_cookie >> DCOOKIE_SHIFT);
+	h = hash_mix(h, (uintptr_t)key->kernel);
+	h = hash_mix(h, (uintptr_t)key->anon);
+	h = hash_mix(h, ((uint64_t)(uint32_t)key->tid << 32) |
+	                (uint32_t)key->tgid);
+	h = hash_mix(h, key->cpu);
+
+	return (unsigned long)h;
+}
+
+
+/** Insert a sfile known not to be in the table, without growing it */
+static void table_insert(struct sfile_key const * key, unsigned long hash,
+                         struct sfile * sf)
+{
+	size_t mask = table_size - 1;
+	size_t i = hash & mask;
+
+	while (sfile_table[i].sf)
+		i = (i + 1) & mask;
+
+	sfile_table[i].key = *key;
+	sfile_table[i].hash = hash;
+	sfile_table[i].sf = sf;
+}
 
-	if (trans->cookie != NO_COOKIE) {
-		val ^= trans->cookie >> DCOOKIE_SHIFT;
-		return val & HASH_BITS;
+
+static void table_resize(size_t new_size)
+{
+	struct sfile_slot * old_table = sfile_table;
+	size_t old_size = table_size;
+	size_t i;
+
+	sfile_table = xcalloc(new_size, sizeof(struct sfile_slot));
+	table_size = new_size;
+
+	for (i = 0; i < old_size; ++i) {
+		if (old_table[i].sf) {
+			table_insert(&old_table[i].key, old_table[i].hash,
+			             old_table[i].sf);
+		}
 	}
 
-	if (!separate_thread)
-		val ^= trans->tgid << 2;
+	free(old_table);
+}
+
+
+/** Remove a sfile from the table, if it is stored in it */
+static void table_remove(struct sfile const * sf)
+{
+	size_t mask = table_size - 1;
+	size_t i = sf->hashval & mask;
+	size_t j;
+
+	while (sfile_table[i].sf != sf) {
+		/* cg sfiles are not in the table */
+		if (!sfile_table[i].sf)
+			return;
+		i = (i + 1) & mask;
+	}
 
-	if (trans->anon) {
-		val ^= trans->anon->start >> VMA_SHIFT;
-		val ^= trans->anon->end >> (VMA_SHIFT + 1);
+	/* backward shift the following slots, so no tombstone is needed */
+	for (j = (i + 1) & mask; sfile_table[j].sf; j = (j + 1) & mask) {
+		size_t home = sfile_table[j].hash & mask;
+		/* the slot can move to i if i is between its home and j */
+		if (((j - home) & mask) >= ((j - i) & mask)) {
+			sfile_table[i] = sfile_table[j];
+			i = j;
+		}
 	}
 
-	return val & HASH_BITS;
+	sfile_table[i].sf = NULL;
+	--table_nr;
 }
 
 
@@ -118,15 +283,6 @@ do_match(struct sfile const * sf, cookie_t cookie, cookie_t app_cookie,
 }
 
 
-static int
-trans_match(struct transient const * trans, struct sfile const * sfile,
-            struct kernel_image const * ki)
-{
-	return do_match(sfile, trans->cookie, trans->app_cookie, ki,
-	                trans->anon, trans->tgid, trans->tid, trans->cpu);
-}
-
-
 int
 sfile_equal(struct sfile const * sf, struct sfile const * sf2)
 {
@@ -180,6 +336,7 @@ create_sfile(unsigned long hash, struct transient const * trans,
 	sf->cpu = 0;
 	sf->kernel = ki;
 	sf->anon = trans->anon;
+	sf->stage = NULL;
 
 	for (i = 0 ; i < op_nr_counters ; ++i)
 		odb_init(&sf->files[i]);
@@ -217,12 +374,13 @@ create_sfile(unsigned long hash, struct transient const * trans,
 }
 
 
-struct sfile * sfile_find(struct transient const * trans)
+static struct sfile * lookup_sfile(struct transient const * trans)
 {
 	struct sfile * sf;
-	struct list_head * pos;
 	struct kernel_image * ki = NULL;
+	struct sfile_key key;
 	unsigned long hash;
+	size_t mask, i;
 
 	if (trans->tracing != TRACING_ON) {
 		opd_stats[OPD_SAMPLES]++;
@@ -257,17 +415,25 @@ struct sfile * sfile_find(struct transient const * trans)
 		return NULL;
 	}
 
-	hash = sfile_hash(trans, ki);
-	list_for_each(pos, &hashes[hash]) {
-		sf = list_entry(pos, struct sfile, hash);
-		if (trans_match(trans, sf, ki)) {
+	make_key(&key, trans, ki);
+	hash = sfile_hash(&key);
+	mask = table_size - 1;
+	for (i = hash & mask; sfile_table[i].sf; i = (i + 1) & mask) {
+		if (sfile_table[i].hash == hash &&
+		    key_equal(&sfile_table[i].key, &key)) {
+			sf = sfile_table[i].sf;
 			sfile_get(sf);
 			goto lru;
 		}
 	}
 
 	sf = create_sfile(hash, trans, ki);
-	list_add(&sf->hash, &hashes[hash]);
+
+	/* keep the load factor below 3/4 */
+	if ((table_nr + 1) * 4 > table_size * 3)
+		table_resize(table_size * 2);
+	table_insert(&key, hash, sf);
+	++table_nr;
 
 lru:
 	sfile_put(sf);
@@ -275,6 +441,17 @@ lru:
 }
 
 
+struct sfile * sfile_find(struct transient const * trans)
+{
+	struct opd_histogram * hist = &opd_stage_hists[OPD_STAGE_SFILE_FIND];
+	unsigned long long start = opd_stage_begin(hist, OPD_TIME_SAMPLED);
+	struct sfile * sf = lookup_sfile(trans);
+
+	opd_stage_end(hist, start);
+	return sf;
+}
+
+
 void sfile_dup(struct sfile * to, struct sfile * from)
 {
 	size_t i;
@@ -289,8 +466,8 @@ void sfile_dup(struct sfile * to, struct sfile * from)
 	for (i = 0; i < CG_HASH_SIZE; ++i)
 		list_init(&to->cg_hash[i]);
 
-	list_init(&to->hash);
 	list_init(&to->lru);
+	to->stage = NULL;
 }
 
 
@@ -336,8 +513,13 @@ static odb_t * get_file(struct transient const * trans, int is_cg)
 	file = &cg->to.files[trans->event];
 
 open:
-	if (!odb_open_count(file))
+	if (!odb_open_count(file)) {
+		struct opd_histogram * hist =
+			&opd_stage_hists[OPD_STAGE_ODB_OPEN];
+		unsigned long long start = opd_stage_begin(hist, OPD_TIME_ALL);
 		opd_open_sample_file(file, last, sf, trans->event, is_cg);
+		opd_stage_end(hist, start);
+	}
 
 	/* Error is logged by opd_open_sample_file */
 	if (!odb_open_count(file))
@@ -347,6 +529,148 @@ open:
 }
 
 
+static unsigned int stage_hash(odb_t const * file, odb_key_t key)
+{
+	uint32_t val = (uint32_t)(key ^ (key >> 32)) ^
+		(uint32_t)((uintptr_t)file->data >> 4);
+	return (val * 0x9e3779b9U) >> (32 - STAGE_BITS);
+}
+
+
+static int stage_entry_compare(void const * lhs, void const * rhs)
+{
+	struct stage_entry const * e1 = lhs;
+	struct stage_entry const * e2 = rhs;
+
+	if (e1->file != e2->file)
+		return e1->file < e2->file ? -1 : 1;
+	if (e1->key != e2->key)
+		return e1->key < e2->key ? -1 : 1;
+	return 0;
+}
+
+
+/** write the staged samples in key order, then empty the stage */
+static void flush_stage(struct sfile_stage * stage)
+{
+	size_t i, nr = 0;
+
+	/* pack the used entries to sort them */
+	for (i = 0; i < STAGE_SIZE; ++i) {
+		if (!stage->entries[i].count)
+			continue;
+		/* the moved entry must not stay used in the hash */
+		if (i != nr) {
+			stage->entries[nr] = stage->entries[i];
+			stage->entries[i].count = 0;
+		}
+		++nr;
+	}
+
+	qsort(stage->entries, nr, sizeof(struct stage_entry),
+	      stage_entry_compare);
+
+	for (i = 0; i < nr; ++i) {
+		struct stage_entry * entry = &stage->entries[i];
+		opd_pipeline_update(entry->file, entry->key, entry->count);
+	}
+
+	memset(stage->entries, '\0', nr * sizeof(struct stage_entry));
+	stage->nr = 0;
+}
+
+
+static struct sfile_stage * get_stage(struct sfile * sf)
+{
+	struct sfile_stage * stage;
+
+	if (sf->stage)
+		return sf->stage;
+
+	if (!list_empty(&free_stages)) {
+		stage = list_entry(free_stages.next, struct sfile_stage, next);
+		list_del(&stage->next);
+	} else if (nr_stages < MAX_STAGES) {
+		stage = xmalloc(sizeof(struct sfile_stage));
+		memset(stage, '\0', sizeof(struct sfile_stage));
+		++nr_stages;
+	} else {
+		return NULL;
+	}
+
+	list_add(&stage->next, &dirty_stages);
+	stage->owner = sf;
+	sf->stage = stage;
+	return stage;
+}
+
+
+/**
+ * Add count to the staged value for key in file, the stage belongs to
+ * the sfile the sample is logged through, so it can't outlive file.
+ */
+static void stage_update(struct sfile * sf, odb_t * file, odb_key_t key,
+                         unsigned long count)
+{
+	struct sfile_stage * stage = get_stage(sf);
+	struct stage_entry * entry;
+	unsigned int index;
+
+	/* too many sfiles are logging samples, don't stage */
+	if (!stage) {
+		opd_pipeline_update(file, key, count);
+		return;
+	}
+
+	index = stage_hash(file, key);
+	entry = &stage->entries[index];
+	while (entry->count) {
+		if (entry->file == file && entry->key == key) {
+			opd_stats[OPD_STAGED_MERGES]++;
+			entry->count += count;
+			return;
+		}
+		index = (index + 1) & (STAGE_SIZE - 1);
+		entry = &stage->entries[index];
+	}
+
+	/* zero count are no-op and must not use an entry */
+	if (!count)
+		return;
+
+	entry->file = file;
+	entry->key = key;
+	entry->count = count;
+	if (++stage->nr >= STAGE_MAX_USED)
+		flush_stage(stage);
+}
+
+
+void sfile_flush_samples(void)
+{
+	struct list_head * pos;
+	struct list_head * pos2;
+
+	list_for_each_safe(pos, pos2, &dirty_stages) {
+		struct sfile_stage * stage =
+			list_entry(pos, struct sfile_stage, next);
+		flush_stage(stage);
+		/* sfiles can be freed once flushed, stop tracking them */
+		stage->owner->stage = NULL;
+		stage->owner = NULL;
+		list_del(&stage->next);
+		list_add(&stage->next, &free_stages);
+	}
+
+	/* sample files can't be read, synced or closed under a writer
+	 * thread */
+	opd_pipeline_drain();
+
+	/* the samples written are complete, tell the readers */
+	odb_commit_writes();
+}
+
+
 static void verbose_print_sample(struct sfile * sf, vma_t pc, uint counter)
 {
 	char const * app = verbose_cookie(sf->app_cookie);
@@ -385,7 +709,6 @@ verbose_arc(struct transient const * trans, vma_t from, vma_t to)
 
 static void sfile_log_arc(struct transient const * trans)
 {
-	int err;
 	vma_t from = trans->pc;
 	vma_t to = trans->last_pc;
 	uint64_t key;
@@ -418,11 +741,7 @@ static void sfile_log_arc(struct transient const * trans)
 	key = to & (0xffffffff);
 	key |= ((uint64_t)from) << 32;
 
-	err = odb_update_node(file, key);
-	if (err) {
-		fprintf(stderr, "%s: %s\n", __FUNCTION__, strerror(err));
-		abort();
-	}
+	stage_update(trans->current, file, key, 1);
 }
 
 
@@ -432,11 +751,26 @@ void sfile_log_sample(struct transient const * trans)
 }
 
 
+/** return the pc of the sample as an offset in its sfile */
+static vma_t sample_offset(struct transient const * trans)
+{
+	vma_t pc = trans->pc;
+
+	/* absolute value -> offset */
+	if (trans->current->kernel)
+		pc -= trans->current->kernel->start;
+
+	if (trans->current->anon)
+		pc -= trans->current->anon->start;
+
+	return pc;
+}
+
+
 void sfile_log_sample_count(struct transient const * trans,
                             unsigned long int count)
 {
-	int err;
-	vma_t pc = trans->pc;
+	vma_t pc;
 	odb_t * file;
 
 	if (trans->tracing == TRACING_ON) {
@@ -449,12 +783,7 @@ void sfile_log_sample_count(struct transient const * trans,
 
 	file = get_file(trans, 0);
 
-	/* absolute value -> offset */
-	if (trans->current->kernel)
-		pc -= trans->current->kernel->start;
-
-	if (trans->current->anon)
-		pc -= trans->current->anon->start;
+	pc = sample_offset(trans);
 
 	if (vsamples)
 		verbose_sample(trans, pc);
@@ -464,13 +793,37 @@ void sfile_log_sample_count(struct transient const * trans,
 		return;
 	}
 
-	err = odb_update_node_with_offset(file,
-					  (odb_key_t)pc,
-					  count);
-	if (err) {
-		fprintf(stderr, "%s: %s\n", __FUNCTION__, strerror(err));
-		abort();
+	stage_update(trans->current, file, (odb_key_t)pc, count);
+}
+
+
+void sfile_log_data_sample(struct transient const * trans, uint64_t data)
+{
+	vma_t pc;
+	odb_t * file;
+
+	/* the arc key has no room for the data address */
+	if (trans->tracing == TRACING_ON) {
+		sfile_log_sample_count(trans, 1);
+		return;
 	}
+
+	file = get_file(trans, 0);
+
+	pc = sample_offset(trans);
+
+	if (vsamples)
+		verbose_sample(trans, pc);
+
+	if (!file) {
+		opd_stats[OPD_LOST_SAMPLEFILE]++;
+		return;
+	}
+
+	/* the whole line or page number is the key, the pc would leave
+	 * it only 32 bits. The pc samples of the image come from the
+	 * event counting the same ops by pc. */
+	stage_update(trans->current, file, (odb_key_t)data, 1);
 }
 
 
@@ -479,8 +832,10 @@ static int close_sfile(struct sfile * sf, void * data __attribute__((unused)))
 	size_t i;
 
 	/* it's OK to close a non-open odb file */
-	for (i = 0; i < op_nr_counters; ++i)
+	for (i = 0; i < op_nr_counters; ++i) {
+		opd_control_closing(&sf->files[i]);
 		odb_close(&sf->files[i]);
+	}
 
 	opd_ext_sfile_close(sf);
 
@@ -491,7 +846,7 @@ static int close_sfile(struct sfile * sf, void * data __attribute__((unused)))
 static void kill_sfile(struct sfile * sf)
 {
 	close_sfile(sf, NULL);
-	list_del(&sf->hash);
+	table_remove(sf);
 	list_del(&sf->lru);
 }
 
@@ -555,6 +910,9 @@ static void for_each_sfile(sfile_func func, void * data)
 	struct list_head * pos;
 	struct list_head * pos2;
 
+	/* staged samples can refer to any sfile */
+	sfile_flush_samples();
+
 	list_for_each_safe(pos, pos2, &lru_list) {
 		struct sfile * sf = list_entry(pos, struct sfile, lru);
 		for_one_sfile(sf, func, data);
@@ -608,6 +966,8 @@ int sfile_lru_clear(void)
 	if (list_empty(&lru_list))
 		return 1;
 
+	sfile_flush_samples();
+
 	list_for_each_safe(pos, pos2, &lru_list) {
 		struct sfile * sf;
 		if (!--amount)
@@ -636,8 +996,7 @@ void sfile_put(struct sfile * sf)
 
 void sfile_init(void)
 {
-	size_t i = 0;
-
-	for (; i < HASH_SIZE; ++i)
-		list_init(&hashes[i]);
+	table_size = TABLE_INIT_SIZE;
+	table_nr = 0;
+	sfile_table = xcalloc(table_size, sizeof(struct sfile_slot));
 }
@@ -23,6 +23,7 @@
 
 struct kernel_image;
 struct transient;
+struct sfile_stage;
 
 #define CG_HASH_SIZE 16
 #define UNUSED_EMBEDDED_OFFSET ~0LLU
@@ -32,7 +33,7 @@ struct transient;
  * types) will have one of these for it. We match against the
  * descriptions here to find which sample DB file we need to modify.
  *
- * cg files are stored in the hash.
+ * cg files are stored in the hash, other sfiles in the sfile table.
  */
 struct sfile {
 	/** hash value for this sfile */
@@ -54,8 +55,6 @@ struct sfile {
 	/** embedded offset for Cell BE SPU */
 	uint64_t embedded_offset;
 
-	/** hash table link */
-	struct list_head hash;
 	/** lru list */
 	struct list_head lru;
 	/** true if this file should be ignored in profiles */
@@ -66,6 +65,9 @@ struct sfile {
 	odb_t * ext_files;
 	/** hash table of opened cg sample files */
 	struct list_head cg_hash[CG_HASH_SIZE];
+	/** samples logged through this sfile not yet written to sample
+	 * files, NULL if none */
+	struct sfile_stage * stage;
 };
 
 /** a call-graph entry */
@@ -113,6 +115,19 @@ void sfile_log_sample(struct transient const * trans);
 void sfile_log_sample_count(struct transient const * trans,
                             unsigned long int count);
 
+/**
+ * Log a sample keyed by a data value rather than by its pc, in the
+ * sample file of the image the pc is in. Used for data address
+ * profiling, see opd_header::data_shift.
+ */
+void sfile_log_data_sample(struct transient const * trans, uint64_t data);
+
+/**
+ * Write all staged samples to the sample files and wait for them to
+ * be written. Must be called before sample files are read.
+ */
+void sfile_flush_samples(void);
+
 /** initialise hashes */
 void sfile_init(void);
 
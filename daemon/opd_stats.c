@@ -11,15 +11,145 @@
 
 #include "opd_stats.h"
 #include "opd_extended.h"
+#include "opd_pipeline.h"
 #include "oprofiled.h"
 
+#include "op_config.h"
 #include "op_get_time.h"
 
 #include <dirent.h>
+#include <limits.h>
 #include <stdlib.h>
 #include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
 
 unsigned long opd_stats[OPD_MAX_STATS];
+struct opd_histogram opd_stage_hists[OPD_MAX_STAGES];
+struct opd_histogram opd_buffer_hist;
+
+/* names in the stats file */
+static char const * const stat_names[OPD_MAX_STATS] = {
+	"samples",
+	"kernel_samples",
+	"process_samples",
+	"lost_no_ctx",
+	"lost_kernel",
+	"lost_sample_file",
+	"lost_no_mapping",
+	"dump_count",
+	"dangling_code",
+	"ring_dropped",
+	"ring_max_depth",
+	"writer_max_depth",
+	"writer_stalls",
+	"staged_merges",
+};
+
+static char const * const stage_names[OPD_MAX_STAGES] = {
+	"do_samples",
+	"sfile_find",
+	"find_cookie",
+	"find_anon_mapping",
+	"find_kernel_image",
+	"odb_open",
+	"odb_update_node",
+};
+
+/* the driver counters, summed over the cpus for the per cpu ones */
+static char const * const driver_stats[] = {
+	"event_lost_overflow",
+	"sample_lost_no_mapping",
+	"bt_lost_no_mapping",
+	"sample_lost_no_mm",
+	NULL
+};
+
+static char const * const driver_cpu_stats[] = {
+	"sample_lost_overflow",
+	"sample_lost_task_exit",
+	"sample_received",
+	"backtrace_aborted",
+	"sample_invalid_eip",
+	NULL
+};
+
+
+static unsigned long long opd_clock_ns(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+
+void opd_hist_add(struct opd_histogram * hist, unsigned long long value)
+{
+	unsigned int bucket = 0;
+
+	while (value >> bucket && bucket < OPD_HIST_BUCKETS - 1)
+		++bucket;
+
+	hist->buckets[bucket]++;
+	hist->timed++;
+	hist->total += value;
+}
+
+
+void opd_hist_merge(struct opd_histogram * dest,
+                    struct opd_histogram const * src)
+{
+	size_t i;
+
+	dest->calls += src->calls;
+	dest->timed += src->timed;
+	dest->total += src->total;
+	for (i = 0; i < OPD_HIST_BUCKETS; ++i)
+		dest->buckets[i] += src->buckets[i];
+}
+
+
+unsigned long long opd_stage_begin(struct opd_histogram * hist,
+                                   unsigned int period)
+{
+	if (hist->calls++ & (period - 1))
+		return 0;
+	return opd_clock_ns();
+}
+
+
+void opd_stage_end(struct opd_histogram * hist, unsigned long long start)
+{
+	if (start)
+		opd_hist_add(hist, opd_clock_ns() - start);
+}
+
+
+/** upper bound of the values below which fraction of them are */
+static unsigned long long hist_percentile(struct opd_histogram const * hist,
+                                          double fraction)
+{
+	unsigned long long const wanted = hist->timed * fraction;
+	unsigned long long seen = 0;
+	size_t i;
+
+	for (i = 0; i < OPD_HIST_BUCKETS; ++i) {
+		seen += hist->buckets[i];
+		if (seen > wanted)
+			break;
+	}
+
+	return i ? 1ULL << i : 0;
+}
+
+
+/** the stage histograms including the ones of the writer threads */
+static void get_stage_hists(struct opd_histogram * hists)
+{
+	memcpy(hists, opd_stage_hists, sizeof(opd_stage_hists));
+	opd_pipeline_update_hist(&hists[OPD_STAGE_ODB_UPDATE]);
+}
 
 /**
  * print_if - print an integer value read from file filename,
@@ -33,12 +163,55 @@ static void print_if(char const * fmt, char const * path, char const * filename,
 }
 
 /**
- * opd_print_stats - print out latest statistics
+ * for_each_cpu_stats - call fn for each per-CPU driver stats directory
+ * return -1 if the driver stats directory can't be read
  */
-void opd_print_stats(void)
+static int for_each_cpu_stats(void (*fn)(int cpu_nr, char const * path,
+                                         void * data), void * data)
 {
 	DIR * dir;
 	struct dirent * dirent;
+	char path[PATH_MAX];
+
+	if (!(dir = opendir("/dev/oprofile/stats/")))
+		return -1;
+	while ((dirent = readdir(dir))) {
+		int cpu_nr;
+		if (sscanf(dirent->d_name, "cpu%d", &cpu_nr) != 1)
+			continue;
+		snprintf(path, sizeof(path), "/dev/oprofile/stats/%s",
+		         dirent->d_name);
+		fn(cpu_nr, path, data);
+	}
+	closedir(dir);
+	return 0;
+}
+
+
+static void print_cpu_stats(int cpu_nr, char const * path,
+                            void * data __attribute__((unused)))
+{
+	printf("\n---- Statistics for cpu : %d\n", cpu_nr);
+	print_if("Nr. samples lost cpu buffer overflow: %u\n",
+	     path, "sample_lost_overflow", 1);
+	print_if("Nr. samples lost task exit: %u\n",
+	     path, "sample_lost_task_exit", 0);
+	print_if("Nr. samples received: %u\n",
+	     path, "sample_received", 1);
+	print_if("Nr. backtrace aborted: %u\n",
+	     path, "backtrace_aborted", 0);
+	print_if("Nr. samples lost invalid pc: %u\n",
+	     path, "sample_invalid_eip", 0);
+}
+
+
+/**
+ * opd_print_stats - print out latest statistics
+ */
+void opd_print_stats(void)
+{
+	struct opd_histogram hists[OPD_MAX_STAGES];
+	size_t i;
 
 	printf("\n%s\n", op_get_time());
 	printf("\n-- OProfile Statistics --\n");
@@ -52,6 +225,14 @@ void opd_print_stats(void)
 		opd_stats[OPD_LOST_SAMPLEFILE]);
 	printf("Nr. samples lost due to no permanent mapping: %lu\n",
 		opd_stats[OPD_LOST_NO_MAPPING]);
+	printf("Nr. buffers lost due to read ring overflow: %lu\n",
+		opd_stats[OPD_RING_DROPPED]);
+	printf("Max. read ring depth: %lu\n", opd_stats[OPD_RING_MAX_DEPTH]);
+	printf("Max. writer queue depth: %lu\n",
+		opd_stats[OPD_WRITER_MAX_DEPTH]);
+	printf("Nr. writer queue stalls: %lu\n", opd_stats[OPD_WRITER_STALLS]);
+	printf("Nr. samples merged in staging: %lu\n",
+		opd_stats[OPD_STAGED_MERGES]);
 	print_if("Nr. event lost due to buffer overflow: %u\n",
 	       "/dev/oprofile/stats", "event_lost_overflow", 1);
 	print_if("Nr. samples lost due to no mapping: %u\n",
@@ -63,28 +244,124 @@ void opd_print_stats(void)
 
 	opd_ext_print_stats();
 
-	if (!(dir = opendir("/dev/oprofile/stats/")))
-		goto out;
-	while ((dirent = readdir(dir))) {
-		int cpu_nr;
-		char path[256];
-		if (sscanf(dirent->d_name, "cpu%d", &cpu_nr) != 1)
+	get_stage_hists(hists);
+	for (i = 0; i < OPD_MAX_STAGES; ++i) {
+		if (!hists[i].timed)
 			continue;
-		snprintf(path, 256, "/dev/oprofile/stats/%s", dirent->d_name);
-
-		printf("\n---- Statistics for cpu : %d\n", cpu_nr);
-		print_if("Nr. samples lost cpu buffer overflow: %u\n",
-		     path, "sample_lost_overflow", 1);
-		print_if("Nr. samples lost task exit: %u\n",
-		     path, "sample_lost_task_exit", 0);
-		print_if("Nr. samples received: %u\n",
-		     path, "sample_received", 1);
-		print_if("Nr. backtrace aborted: %u\n", 
-		     path, "backtrace_aborted", 0);
-		print_if("Nr. samples lost invalid pc: %u\n", 
-		     path, "sample_invalid_eip", 0);
+		printf("Stage %s: %lu calls, mean %llu ns, 99%% below %llu ns\n",
+		       stage_names[i], hists[i].calls,
+		       hists[i].total / hists[i].timed,
+		       hist_percentile(&hists[i], 0.99));
 	}
-	closedir(dir);
-out:
+
+	for_each_cpu_stats(print_cpu_stats, NULL);
+
 	fflush(stdout);
+	opd_write_stats_file();
+}
+
+
+static void write_hist(FILE * fp, char const * name,
+                       struct opd_histogram const * hist)
+{
+	size_t i;
+
+	fprintf(fp, "%s %lu %lu %llu", name, hist->calls, hist->timed,
+	        hist->total);
+	for (i = 0; i < OPD_HIST_BUCKETS; ++i)
+		fprintf(fp, " %lu", hist->buckets[i]);
+	fputc('\n', fp);
+}
+
+
+static void sum_cpu_stats(int cpu_nr __attribute__((unused)),
+                          char const * path, void * data)
+{
+	unsigned long long * cpu_totals = data;
+	size_t i;
+	int value;
+
+	for (i = 0; driver_cpu_stats[i]; ++i) {
+		value = opd_read_fs_int(path, driver_cpu_stats[i], 0);
+		if (value != -1)
+			cpu_totals[i] += value;
+	}
+}
+
+
+static void write_driver_stats(FILE * fp)
+{
+	unsigned long long cpu_totals[sizeof(driver_cpu_stats) /
+	                              sizeof(driver_cpu_stats[0])];
+	size_t i;
+	int value;
+
+	for (i = 0; driver_stats[i]; ++i) {
+		value = opd_read_fs_int("/dev/oprofile/stats",
+		                        driver_stats[i], 0);
+		if (value != -1)
+			fprintf(fp, "driver_%s %d\n", driver_stats[i], value);
+	}
+
+	memset(cpu_totals, '\0', sizeof(cpu_totals));
+	if (for_each_cpu_stats(sum_cpu_stats, cpu_totals))
+		return;
+
+	for (i = 0; driver_cpu_stats[i]; ++i)
+		fprintf(fp, "driver_%s %llu\n", driver_cpu_stats[i],
+		        cpu_totals[i]);
+}
+
+
+void opd_write_stats_file(void)
+{
+	struct opd_histogram hists[OPD_MAX_STAGES];
+	char temp[PATH_MAX];
+	FILE * fp;
+	size_t i;
+
+	snprintf(temp, PATH_MAX, "%s.tmp", op_stats_file);
+	fp = fopen(temp, "w");
+	if (!fp) {
+		perror("oprofiled: couldn't write stats file: ");
+		return;
+	}
+
+	fprintf(fp, "# oprofiled statistics, counters are since the start\n");
+	fprintf(fp, "# histogram lines: calls, values, sum of the values, "
+	        "then the nr. of values\n# equal to 0, below 2, 4, 8 ... "
+	        "2^%d, and larger, stages are in ns\n",
+	        OPD_HIST_BUCKETS - 2);
+	fprintf(fp, "time %lu\n", (unsigned long)time(NULL));
+
+	for (i = 0; i < OPD_MAX_STATS; ++i)
+		fprintf(fp, "%s %lu\n", stat_names[i], opd_stats[i]);
+
+	write_driver_stats(fp);
+
+	get_stage_hists(hists);
+	for (i = 0; i < OPD_MAX_STAGES; ++i) {
+		char name[64];
+		snprintf(name, sizeof(name), "stage_%s", stage_names[i]);
+		write_hist(fp, name, &hists[i]);
+	}
+	write_hist(fp, "buffer_bytes", &opd_buffer_hist);
+
+	if (fclose(fp) || rename(temp, op_stats_file)) {
+		perror("oprofiled: couldn't write stats file: ");
+		unlink(temp);
+	}
+}
+
+
+void opd_update_stats_file(void)
+{
+	static time_t last_write;
+	time_t now = time(NULL);
+
+	if (now == last_write)
+		return;
+
+	last_write = now;
+	opd_write_stats_file();
 }
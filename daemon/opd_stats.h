@@ -23,9 +23,81 @@ enum {	OPD_SAMPLES, /**< nr. samples */
 	OPD_LOST_NO_MAPPING, /**< nr samples lost due to no mapping */
 	OPD_DUMP_COUNT, /**< nr. of times buffer is read */
 	OPD_DANGLING_CODE, /**< nr. partial code notifications (buffer overflow */
+	OPD_RING_DROPPED, /**< nr. buffers read while the read ring was full */
+	OPD_RING_MAX_DEPTH, /**< max nr. of read buffers waiting processing */
+	OPD_WRITER_MAX_DEPTH, /**< max nr. of batches queued to a writer */
+	OPD_WRITER_STALLS, /**< nr. of waits for a writer to catch up */
+	OPD_STAGED_MERGES, /**< nr. samples merged before reaching sample files */
 	OPD_MAX_STATS /**< end of stats */
 };
 
+/** stages of the sample processing timed into a histogram */
+enum {	OPD_STAGE_DO_SAMPLES, /**< processing of a kernel buffer */
+	OPD_STAGE_SFILE_FIND, /**< sfile_find() */
+	OPD_STAGE_FIND_COOKIE, /**< find_cookie() */
+	OPD_STAGE_FIND_ANON, /**< find_anon_mapping() */
+	OPD_STAGE_FIND_KERNEL, /**< find_kernel_image() */
+	OPD_STAGE_ODB_OPEN, /**< opening a sample file */
+	OPD_STAGE_ODB_UPDATE, /**< odb_update_node() */
+	OPD_MAX_STAGES /**< end of stages */
+};
+
+/** time every call of a stage */
+#define OPD_TIME_ALL 1
+/** time one call in this many of a stage run for each sample */
+#define OPD_TIME_SAMPLED 16
+
+#define OPD_HIST_BUCKETS 40
+
+/**
+ * A log2 histogram: bucket 0 counts the zero values, bucket i the values
+ * in [2^(i-1), 2^i), the last bucket also counts the larger values.
+ */
+struct opd_histogram {
+	unsigned long calls; /**< nr. of calls, timed or not */
+	unsigned long timed; /**< nr. of values added */
+	unsigned long long total; /**< sum of the values added */
+	unsigned long buckets[OPD_HIST_BUCKETS];
+};
+
+/** time in ns of the stages run by the decoding thread */
+extern struct opd_histogram opd_stage_hists[OPD_MAX_STAGES];
+
+/** size in bytes of the kernel buffers read */
+extern struct opd_histogram opd_buffer_hist;
+
+/** add a value to a histogram */
+void opd_hist_add(struct opd_histogram * hist, unsigned long long value);
+
+/** add all the values of src to dest */
+void opd_hist_merge(struct opd_histogram * dest,
+                    struct opd_histogram const * src);
+
+/**
+ * opd_stage_begin - start timing a call of a stage
+ * @param hist  the stage histogram
+ * @param period  one call in period is timed, a power of two
+ *
+ * Return the value to pass to opd_stage_end(), 0 if this call is not
+ * timed.
+ */
+unsigned long long opd_stage_begin(struct opd_histogram * hist,
+                                   unsigned int period);
+
+/** add the time elapsed since opd_stage_begin() returned start */
+void opd_stage_end(struct opd_histogram * hist, unsigned long long start);
+
 void opd_print_stats(void);
 
+/**
+ * opd_write_stats_file - write the statistics and histograms
+ *
+ * The file op_stats_file is replaced at once, a reader never sees it
+ * partially written. opd_print_stats() also writes it.
+ */
+void opd_write_stats_file(void);
+
+/** opd_write_stats_file() if it is more than a second old */
+void opd_update_stats_file(void);
+
 #endif /* OPD_STATS_H */
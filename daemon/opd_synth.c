@@ -0,0 +1,283 @@
+/**
+ * @file daemon/opd_synth.c
+ * Write synthetic capture files for oprofiled --replay
+ *
+ * @remark Copyright 2010 OProfile authors
+ * @remark Read the file COPYING
+ *
+ * Generate the buffers a kernel driver would give for a few typical
+ * workloads, so the daemon throughput can be measured without any
+ * driver nor recorded session:
+ *
+ * kernel: samples in vmlinux and modules
+ * modules: samples in modules only, among a given number of them, so
+ *   the cost of the module lookup can be compared across module counts
+ * anon: samples in anonymous mappings, as JIT compiled code
+ * callgraph: user space samples with a call chain each
+ */
+
+#include "opd_capture.h"
+#include "opd_interface.h"
+
+#include "op_cpu_type.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* entries per buffer, as the default kernel buffer_size */
+#define BUFFER_ENTRIES 131072
+/* samples between two context switches */
+#define SAMPLES_PER_CONTEXT 256
+
+#define NR_APPS 32
+/* modules of the kernel workload, default for the modules one */
+#define NR_MODULES 32
+#define NR_ANON_MAPPINGS 16
+#define CALLGRAPH_DEPTH 8
+
+#define KERNEL_START 0xffffffff81000000ULL
+#define KERNEL_END 0xffffffff81800000ULL
+#define MODULE_START 0xffffffffa0000000ULL
+#define MODULE_SIZE 0x40000ULL
+#define ANON_START 0x7f0000000000ULL
+#define ANON_SIZE 0x100000ULL
+#define APP_SIZE 0x400000ULL
+/* distinct pc per image or mapping, a sample file holds as many entries */
+#define HOT_PCS 4096
+
+static unsigned long buffer[BUFFER_ENTRIES];
+static size_t nr_entries;
+static unsigned long long seed = 1;
+static int nr_modules = NR_MODULES;
+
+
+static unsigned long random_below(unsigned long long max)
+{
+	seed = seed * 6364136223846793005ULL + 1442695040888963407ULL;
+	return (seed >> 33) % max;
+}
+
+
+/** a random pc among the HOT_PCS ones of a range */
+static unsigned long hot_pc(unsigned long long start, unsigned long long size)
+{
+	return start + random_below(HOT_PCS) * (size / HOT_PCS);
+}
+
+
+static cookie_t app_cookie(int app)
+{
+	return (cookie_t)(app + 1) << DCOOKIE_SHIFT;
+}
+
+
+static pid_t app_tgid(int app)
+{
+	return 1000 + app;
+}
+
+
+static void push(unsigned long value)
+{
+	buffer[nr_entries++] = value;
+}
+
+
+static void push_code(unsigned long code)
+{
+	push(~0UL);
+	push(code);
+}
+
+
+static void flush_buffer(void)
+{
+	opd_capture_buffer((char const *)buffer,
+	                   nr_entries * sizeof(unsigned long));
+	nr_entries = 0;
+}
+
+
+/** switch to a random app, return it */
+static int switch_context(int in_kernel)
+{
+	int const app = random_below(NR_APPS);
+
+	push_code(CPU_SWITCH_CODE);
+	push(random_below(4));
+	push_code(CTX_SWITCH_CODE);
+	push(app_tgid(app));
+	push(app_cookie(app));
+	push_code(CTX_TGID_CODE);
+	push(app_tgid(app));
+	push_code(in_kernel ? KERNEL_ENTER_SWITCH_CODE : USER_ENTER_SWITCH_CODE);
+	return app;
+}
+
+
+static unsigned long module_pc(void)
+{
+	return hot_pc(MODULE_START + random_below(nr_modules) * MODULE_SIZE,
+	              MODULE_SIZE);
+}
+
+
+static unsigned long kernel_pc(void)
+{
+	if (random_below(10) < 7)
+		return hot_pc(KERNEL_START, KERNEL_END - KERNEL_START);
+
+	return module_pc();
+}
+
+
+static unsigned long anon_pc(int app)
+{
+	return hot_pc(ANON_START + (app * NR_ANON_MAPPINGS +
+	              random_below(NR_ANON_MAPPINGS)) * ANON_SIZE, ANON_SIZE);
+}
+
+
+/** add one context and its samples to the buffer, return their nr. */
+static size_t add_context(char const * workload)
+{
+	size_t i, j;
+	int app;
+
+	if (!strcmp(workload, "kernel")) {
+		switch_context(1);
+		for (i = 0; i < SAMPLES_PER_CONTEXT; ++i) {
+			push(kernel_pc());
+			push(0);
+		}
+		return SAMPLES_PER_CONTEXT;
+	}
+
+	if (!strcmp(workload, "modules")) {
+		switch_context(1);
+		for (i = 0; i < SAMPLES_PER_CONTEXT; ++i) {
+			push(module_pc());
+			push(0);
+		}
+		return SAMPLES_PER_CONTEXT;
+	}
+
+	if (!strcmp(workload, "anon")) {
+		app = switch_context(0);
+		push_code(COOKIE_SWITCH_CODE);
+		push(NO_COOKIE);
+		for (i = 0; i < SAMPLES_PER_CONTEXT; ++i) {
+			push(anon_pc(app));
+			push(0);
+		}
+		return SAMPLES_PER_CONTEXT;
+	}
+
+	/* callgraph */
+	app = switch_context(0);
+	push_code(COOKIE_SWITCH_CODE);
+	push(app_cookie(app));
+	for (i = 0; i < SAMPLES_PER_CONTEXT / CALLGRAPH_DEPTH; ++i) {
+		push_code(TRACE_BEGIN_CODE);
+		for (j = 0; j < CALLGRAPH_DEPTH; ++j) {
+			push(hot_pc(0, APP_SIZE));
+			push(0);
+		}
+	}
+	/* a caller sample is as costly as the sample itself */
+	return SAMPLES_PER_CONTEXT;
+}
+
+
+static void write_lookups(void)
+{
+	char buf[256];
+	char * content;
+	size_t size = 0;
+	int i, j;
+
+	for (i = 0; i < NR_APPS; ++i) {
+		snprintf(buf, sizeof(buf), "/synthetic/bin/app%d", i);
+		opd_capture_cookie(app_cookie(i), buf);
+	}
+
+	content = malloc(nr_modules * 128);
+	for (i = 0; i < nr_modules; ++i) {
+		size += sprintf(content + size,
+			"mod%d %llu 0 - Live 0x%llx\n", i, MODULE_SIZE,
+			MODULE_START + i * MODULE_SIZE);
+	}
+	opd_capture_file("/proc/modules", content, size);
+	free(content);
+
+	content = malloc(NR_ANON_MAPPINGS * 128);
+	for (i = 0; i < NR_APPS; ++i) {
+		size = 0;
+		for (j = 0; j < NR_ANON_MAPPINGS; ++j) {
+			unsigned long long start = ANON_START +
+				(i * NR_ANON_MAPPINGS + j) * ANON_SIZE;
+			size += sprintf(content + size,
+				"%llx-%llx rwxp 00000000 00:00 0\n",
+				start, start + ANON_SIZE);
+		}
+		snprintf(buf, sizeof(buf), "/proc/%d/maps", app_tgid(i));
+		opd_capture_file(buf, content, size);
+	}
+	free(content);
+}
+
+
+int main(int argc, char const * argv[])
+{
+	char const * workload;
+	unsigned long nr_samples = 10000000;
+	unsigned long done = 0;
+	char buf[64];
+
+	if (argc < 3 || argc > 5 ||
+	    (strcmp(argv[1], "kernel") && strcmp(argv[1], "modules") &&
+	     strcmp(argv[1], "anon") && strcmp(argv[1], "callgraph"))) {
+		fprintf(stderr, "usage: %s kernel|modules|anon|callgraph file "
+			"[nr_samples [nr_modules]]\n", argv[0]);
+		exit(EXIT_FAILURE);
+	}
+
+	workload = argv[1];
+	if (argc >= 4)
+		nr_samples = strtoul(argv[3], NULL, 0);
+	if (argc == 5)
+		nr_modules = atoi(argv[4]);
+	if (nr_modules < 1 ||
+	    MODULE_START + nr_modules * MODULE_SIZE < MODULE_START) {
+		fprintf(stderr, "%s: bad number of modules %s\n",
+			argv[0], argv[4]);
+		exit(EXIT_FAILURE);
+	}
+
+	opd_capture_record(argv[2]);
+
+	snprintf(buf, sizeof(buf), "%d", CPU_TIMER_INT);
+	opd_capture_set_option("cpu-type", buf);
+	opd_capture_set_option("events", "TIMER:0:0:0:0:1:1");
+	opd_capture_set_option("no-vmlinux", "0");
+	opd_capture_set_option("vmlinux", "/synthetic/vmlinux");
+	snprintf(buf, sizeof(buf), "%llx,%llx", KERNEL_START, KERNEL_END);
+	opd_capture_set_option("kernel-range", buf);
+	snprintf(buf, sizeof(buf), "%lu", (unsigned long)sizeof(unsigned long));
+	opd_capture_set_option("pointer-size", buf);
+
+	write_lookups();
+
+	/* largest context: a switch and its samples, with call chains */
+	while (done < nr_samples) {
+		if (nr_entries + 16 + 2 * SAMPLES_PER_CONTEXT +
+		    2 * SAMPLES_PER_CONTEXT / CALLGRAPH_DEPTH > BUFFER_ENTRIES)
+			flush_buffer();
+		done += add_context(workload);
+	}
+	flush_buffer();
+
+	opd_capture_close();
+	return EXIT_SUCCESS;
+}
@@ -18,6 +18,7 @@
 #include "opd_printf.h"
 #include "opd_events.h"
 #include "opd_extended.h"
+#include "opd_capture.h"
 
 #include "op_config.h"
 #include "op_version.h"
@@ -64,6 +65,9 @@ int separate_lib;
 int separate_kernel;
 int separate_thread;
 int separate_cpu;
+int nr_ring_buffers = 4;
+int nr_worker_threads;
+int packed_session;
 int no_vmlinux;
 char * vmlinux;
 char * kernel_range;
@@ -75,6 +79,8 @@ static char * verbose;
 static char * binary_name_filter;
 static char * events;
 static char * ext_feature;
+static char * record_file;
+static char * replay_file;
 static int showvers;
 static struct oprofiled_ops * opd_ops;
 extern struct oprofiled_ops opd_24_ops;
@@ -95,10 +101,15 @@ static struct poptOption options[] = {
 	{ "separate-kernel", 0, POPT_ARG_INT, &separate_kernel, 0, "separate kernel samples for each distinct application", "[0|1]", },
 	{ "separate-thread", 0, POPT_ARG_INT, &separate_thread, 0, "thread-profiling mode", "[0|1]" },
 	{ "separate-cpu", 0, POPT_ARG_INT, &separate_cpu, 0, "separate samples for each CPU", "[0|1]" },
+	{ "ring-buffers", 0, POPT_ARG_INT, &nr_ring_buffers, 0, "number of kernel buffer reads queued for processing", "num" },
+	{ "worker-threads", 0, POPT_ARG_INT, &nr_worker_threads, 0, "number of threads writing sample files", "num" },
+	{ "packed-session", 0, POPT_ARG_INT, &packed_session, 0, "store all sample files in a single container file", "[0|1]" },
 	{ "events", 'e', POPT_ARG_STRING, &events, 0, "events list", "[events]" },
 	{ "version", 'v', POPT_ARG_NONE, &showvers, 0, "show version", NULL, },
 	{ "verbose", 'V', POPT_ARG_STRING, &verbose, 0, "be verbose in log file", "all,sfile,arcs,samples,module,misc", },
 	{ "ext-feature", 'x', POPT_ARG_STRING, &ext_feature, 1, "enable extended feature", "<extended-feature-name>:[args]", },
+	{ "record", 0, POPT_ARG_STRING, &record_file, 0, "record the kernel buffers and what is needed to decode them", "file", },
+	{ "replay", 0, POPT_ARG_STRING, &replay_file, 0, "process the buffers recorded in file instead of the kernel ones", "file", },
 	POPT_AUTOHELP
 	{ NULL, 0, 0, NULL, 0, NULL, NULL, },
 };
@@ -395,6 +406,53 @@ static void opd_parse_verbose(void)
 }
 
 
+/**
+ * save in the capture file the settings the recorded buffers must be
+ * replayed with
+ */
+static void opd_record_options(void)
+{
+	char cpu[16];
+
+	snprintf(cpu, sizeof(cpu), "%d", cpu_type);
+	opd_capture_set_option("cpu-type", cpu);
+	opd_capture_set_option("events", events);
+	opd_capture_set_option("no-vmlinux", no_vmlinux ? "1" : "0");
+	opd_capture_set_option("vmlinux", vmlinux);
+	opd_capture_set_option("kernel-range", kernel_range);
+	opd_capture_set_option("xen-image", xenimage);
+	opd_capture_set_option("xen-range", xen_range);
+}
+
+
+/** use the recorded settings not given on the command line */
+static void opd_replay_options(void)
+{
+	char const * value;
+
+	if (!opd_capture_get_option("cpu-type")) {
+		fprintf(stderr, "oprofiled: %s has no cpu type\n",
+			replay_file);
+		exit(EXIT_FAILURE);
+	}
+
+	if (!events && (value = opd_capture_get_option("events")))
+		events = xstrdup(value);
+	if (!vmlinux && !no_vmlinux) {
+		value = opd_capture_get_option("no-vmlinux");
+		no_vmlinux = value && atoi(value);
+		if ((value = opd_capture_get_option("vmlinux")))
+			vmlinux = xstrdup(value);
+	}
+	if (!kernel_range && (value = opd_capture_get_option("kernel-range")))
+		kernel_range = xstrdup(value);
+	if (!xenimage && (value = opd_capture_get_option("xen-image")))
+		xenimage = xstrdup(value);
+	if (!xen_range && (value = opd_capture_get_option("xen-range")))
+		xen_range = xstrdup(value);
+}
+
+
 static void opd_options(int argc, char const * argv[])
 {
 	poptContext optcon;
@@ -410,7 +468,26 @@ static void opd_options(int argc, char const * argv[])
 	if (separate_kernel)
 		separate_lib = 1;
 
-	cpu_type = op_get_cpu_type();
+	if (nr_ring_buffers < 1 || nr_worker_threads < 0) {
+		fprintf(stderr, "oprofiled: invalid ring buffers or worker "
+			"threads number.\n");
+		poptPrintHelp(optcon, stderr, 0);
+		exit(EXIT_FAILURE);
+	}
+
+	if (record_file && replay_file) {
+		fprintf(stderr, "oprofiled: --record and --replay are "
+			"mutually exclusive.\n");
+		exit(EXIT_FAILURE);
+	}
+
+	if (replay_file) {
+		opd_capture_replay(replay_file);
+		opd_replay_options();
+		cpu_type = atoi(opd_capture_get_option("cpu-type"));
+	} else {
+		cpu_type = op_get_cpu_type();
+	}
 	op_nr_counters = op_get_nr_counters(cpu_type);
 
 	if (!no_vmlinux) {
@@ -467,6 +544,11 @@ static void opd_options(int argc, char const * argv[])
 
 	opd_parse_image_filter();
 
+	if (record_file) {
+		opd_capture_record(record_file);
+		opd_record_options();
+	}
+
 	poptFreeContext(optcon);
 }
 
@@ -509,19 +591,31 @@ int main(int argc, char const * argv[])
 
 	opd_write_abi();
 
-	opd_ops = get_ops();
+	if (replay_file) {
+		opd_ops = &opd_26_ops;
+	} else {
+		opd_ops = get_ops();
+		if (record_file && opd_ops != &opd_26_ops) {
+			fprintf(stderr, "oprofiled: --record needs the 2.6 "
+				"kernel interface.\n");
+			exit(EXIT_FAILURE);
+		}
+	}
 
 	opd_ops->init();
 
-	opd_go_daemon();
+	/* a replay runs in the foreground and stops at the end of file */
+	if (!replay_file) {
+		opd_go_daemon();
 
-	/* clean up every 10 minutes */
-	alarm(60 * 10);
+		/* clean up every 10 minutes */
+		alarm(60 * 10);
 
-	if (op_write_lock_file(op_lock_file)) {
-		fprintf(stderr, "oprofiled: could not create lock file %s\n",
-			op_lock_file);
-		exit(EXIT_FAILURE);
+		if (op_write_lock_file(op_lock_file)) {
+			fprintf(stderr, "oprofiled: could not create lock "
+				"file %s\n", op_lock_file);
+			exit(EXIT_FAILURE);
+		}
 	}
 
 	opd_ops->start();
@@ -59,6 +59,9 @@ extern int separate_lib;
 extern int separate_kernel;
 extern int separate_thread;
 extern int separate_cpu;
+extern int nr_ring_buffers;
+extern int nr_worker_threads;
+extern int packed_session;
 extern int no_vmlinux;
 extern char * vmlinux;
 extern char * kernel_range;
@@ -40,6 +40,7 @@ static struct op_abi_entry const abi_entries[] = {
 	
 	{ "offsetof_descr_size", offsetof(odb_descr_t, size) },
 	{ "offsetof_descr_current_size", offsetof(odb_descr_t, current_size) },
+	{ "offsetof_descr_format", offsetof(odb_descr_t, format) },
 	
 	{ "offsetof_header_magic", offsetof(struct opd_header, magic) },
 	{ "offsetof_header_version", offsetof(struct opd_header, version) },
@@ -53,6 +54,7 @@ static struct op_abi_entry const abi_entries[] = {
 	{ "offsetof_header_cg_to_is_kernel", offsetof(struct opd_header, cg_to_is_kernel), },
 	{ "offsetof_header_anon_start", offsetof(struct opd_header, anon_start) },
 	{ "offsetof_header_cg_to_anon_start", offsetof(struct opd_header, cg_to_anon_start) },
+	{ "offsetof_header_data_shift", offsetof(struct opd_header, data_shift) },
 	
 	{ NULL, 0 },
 };
@@ -12,6 +12,7 @@
 #include "odb.h"
 #include "popt_options.h"
 #include "op_sample_file.h"
+#include "op_config.h"
 
 #include <fstream>
 #include <iostream>
@@ -131,30 +132,62 @@ void import_from_abi(abi const & abi, void const * srcv,
 		"offsetof_header_anon_start");
 	ext.extract(head->cg_to_anon_start, src, "sizeof_u32",
 		"offsetof_header_cg_to_anon_start");
+	// abi written before data address samples have no data_shift field
+	head->data_shift = 0;
+	try {
+		ext.extract(head->data_shift, src, "sizeof_u32",
+			"offsetof_header_data_shift");
+	} catch (abi_exception &) {
+	}
+	// the destination is written in the current format
+	head->version = OPD_VERSION;
 	src += abi.need("sizeof_struct_opd_header");
 	// done extracting opd header
 
 	// begin extracting necessary parts of descr
+	// abi written before the hashed format have no format field, their
+	// sample files are all chained
+	unsigned int format = ODB_FORMAT_CHAINED;
+	try {
+		ext.extract(format, src, "sizeof_unsigned_int",
+			    "offsetof_descr_format");
+	} catch (abi_exception &) {
+	}
+
 	odb_node_nr_t node_nr;
-	ext.extract(node_nr, src, "sizeof_odb_node_nr_t", "offsetof_descr_current_size");
-	src += abi.need("sizeof_odb_descr_t");
+	odb_node_nr_t first_node;
+	if (format == ODB_FORMAT_HASHED) {
+		// the whole node table must be walked
+		ext.extract(node_nr, src, "sizeof_odb_node_nr_t", "offsetof_descr_size");
+		size_t offset = abi.need("sizeof_struct_opd_header") +
+			abi.need("sizeof_odb_descr_t");
+		offset = (offset + ODB_CACHE_LINE - 1) & ~(ODB_CACHE_LINE - 1);
+		src = begin + offset;
+		first_node = 0;
+	} else {
+		ext.extract(node_nr, src, "sizeof_odb_node_nr_t", "offsetof_descr_current_size");
+		src += abi.need("sizeof_odb_descr_t");
+		// skip node zero, it is reserved and contains nothing usefull
+		src += abi.need("sizeof_odb_node_t");
+		first_node = 1;
+	}
 	// done extracting descr
 
-	// skip node zero, it is reserved and contains nothing usefull
-	src += abi.need("sizeof_odb_node_t");
-
 	// begin extracting nodes
 	unsigned int step = abi.need("sizeof_odb_node_t");
 	if (verbose)
 		cerr << "extracting " << node_nr << " nodes of " << step << " bytes each " << endl;
 
-	assert(src + (node_nr * step) <= begin + len);
+	assert(src + ((node_nr - first_node) * step) <= begin + len);
 
-	for (odb_node_nr_t i = 1 ; i < node_nr ; ++i, src += step) {
+	for (odb_node_nr_t i = first_node ; i < node_nr ; ++i, src += step) {
 		odb_key_t key;
 		odb_value_t val;
 		ext.extract(key, src, "sizeof_odb_key_t", "offsetof_node_key");
 		ext.extract(val, src, "sizeof_odb_value_t", "offsetof_node_value");
+		// unused node of an hashed table
+		if (!val)
+			continue;
 		int rc = odb_add_node(dest, key, val);
 		if (rc != EXIT_SUCCESS) {
 			cerr << strerror(rc) << endl;
@@ -86,6 +86,47 @@ static int check_redundant_key(odb_data_t const * data, odb_key_t max)
 	return 0;
 }
 
+/* ODB_FORMAT_HASHED: each used node must be the first node for its key
+ * in the probe sequence starting at its hash group */
+static int check_hashed_table(odb_data_t const * data)
+{
+	odb_node_nr_t pos;
+	odb_node_nr_t nr_node = 0;
+	int ret = 0;
+
+	for (pos = 0 ; pos < data->descr->size ; ++pos) {
+		odb_node_t const * node = &data->node_base[pos];
+		odb_index_t index;
+
+		if (!node->value)
+			continue;
+
+		++nr_node;
+
+		index = odb_do_hash(data, node->key);
+		while (index != pos) {
+			if (!data->node_base[index].value) {
+				printf("unreachable node %d\n", pos);
+				return 1;
+			}
+			if (data->node_base[index].key == node->key) {
+				printf("redundant key found %lld\n",
+				       (unsigned long long)node->key);
+				return 1;
+			}
+			index = (index + 1) & (data->descr->size - 1);
+		}
+	}
+
+	if (nr_node != data->descr->current_size) {
+		printf("hash table walk found %d node expect %d node\n",
+		       nr_node, data->descr->current_size);
+		ret = 1;
+	}
+
+	return ret;
+}
+
 int odb_check_hash(odb_t const * odb)
 {
 	odb_node_nr_t pos;
@@ -95,6 +136,9 @@ int odb_check_hash(odb_t const * odb)
 	odb_key_t max = 0;
 	odb_data_t * data = odb->data;
 
+	if (data->format == ODB_FORMAT_HASHED)
+		return check_hashed_table(data);
+
 	for (pos = 0 ; pos < data->descr->size * BUCKET_FACTOR ; ++pos) {
 		odb_index_t index = data->hash_base[pos];
 		while (index) {
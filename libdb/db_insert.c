@@ -46,9 +46,66 @@ static inline int add_node(odb_data_t * data, odb_key_t key, odb_value_t value)
 	/* FIXME: we need wrmb() here */
 	odb_commit_reservation(data);
 
+	odb_mark_dirty(data, node, sizeof(odb_node_t));
+	odb_mark_dirty(data, &data->hash_base[index], sizeof(odb_index_t));
+	odb_mark_dirty(data, data->descr, sizeof(odb_descr_t));
+
+	return 0;
+}
+
+
+/**
+ * ODB_FORMAT_HASHED: add offset to the node for key, creating it if needed.
+ * The probe sequence for a key stops at the first unused node so a lookup
+ * only touch the cache lines between the key hash group and the key node.
+ */
+static int update_hashed_node(odb_data_t * data, odb_key_t key,
+                              unsigned long int offset)
+{
+	odb_index_t index;
+	odb_node_t * node;
+
+	index = odb_do_hash(data, key);
+	node = &data->node_base[index];
+	while (node->value) {
+		if (node->key == key) {
+			/* saturate: a zero value would mark the node unused
+			 * and hide the keys probed after it */
+			if (offset > (odb_value_t)~0 - node->value)
+				node->value = (odb_value_t)~0;
+			else
+				node->value += offset;
+			odb_mark_dirty(data, node, sizeof(odb_node_t));
+			return 0;
+		}
+		index = (index + 1) & (data->descr->size - 1);
+		node = &data->node_base[index];
+	}
+
+	/* a zero value node is an unused node */
+	if (!offset)
+		return 0;
+
+	/* keep at least a quarter of the table free to bound probe length */
+	if ((data->descr->current_size + 1) * 4 > data->descr->size * 3) {
+		if (odb_grow_hashtable(data))
+			return EINVAL;
+		return update_hashed_node(data, key, offset);
+	}
+
+	/* the node is visible to iteration once value is set */
+	node->key = key;
+	/* FIXME: we need wrmb() here */
+	node->value = offset > (odb_value_t)~0 ? (odb_value_t)~0 : offset;
+	data->descr->current_size++;
+
+	odb_mark_dirty(data, node, sizeof(odb_node_t));
+	odb_mark_dirty(data, data->descr, sizeof(odb_descr_t));
+
 	return 0;
 }
 
+
 int odb_update_node(odb_t * odb, odb_key_t key)
 {
 	return odb_update_node_with_offset(odb, key, 1);
@@ -63,6 +120,9 @@ int odb_update_node_with_offset(odb_t * odb,
 	odb_data_t * data;
 
 	data = odb->data;
+	if (data->format == ODB_FORMAT_HASHED)
+		return update_hashed_node(data, key, offset);
+
 	index = data->hash_base[odb_do_hash(data, key)];
 	while (index) {
 		node = &data->node_base[index];
@@ -93,6 +153,7 @@ int odb_update_node_with_offset(odb_t * odb,
 				 * store a value)
 				 */
 			}
+			odb_mark_dirty(data, node, sizeof(odb_node_t));
 			return 0;
 		}
 
@@ -105,5 +166,7 @@ int odb_update_node_with_offset(odb_t * odb,
 
 int odb_add_node(odb_t * odb, odb_key_t key, odb_value_t value)
 {
+	if (odb->data->format == ODB_FORMAT_HASHED)
+		return update_hashed_node(odb->data, key, value);
 	return add_node(odb->data, key, value);
 }
@@ -15,12 +15,14 @@
 #include <sys/mman.h>
 #include <sys/types.h>
 #include <sys/stat.h>
+#include <sys/time.h>
 #include <unistd.h>
 #include <errno.h>
 #include <string.h>
 #include <stdio.h>
 
 #include "odb.h"
+#include "db_pack.h"
 #include "op_string.h"
 #include "op_libiberty.h"
 
@@ -39,12 +41,54 @@ static __inline odb_node_t * odb_to_node_base(odb_data_t * data)
  
 static __inline odb_index_t * odb_to_hash_base(odb_data_t * data)
 {
+	if (data->format == ODB_FORMAT_HASHED)
+		return NULL;
+
 	return (odb_index_t *)(((char *)data->base_memory) + 
 				data->offset_node +
 				(data->descr->size * sizeof(odb_node_t)));
 }
 
+
+static __inline odb_hash_mask_t odb_to_hash_mask(odb_data_t * data)
+{
+	if (data->format == ODB_FORMAT_HASHED)
+		return (data->descr->size / ODB_NODES_PER_LINE) - 1;
+
+	return (data->descr->size * BUCKET_FACTOR) - 1;
+}
+
+
+/**
+ * return the offset of the node array, ODB_FORMAT_HASHED node array
+ * is cache line aligned (in the file, so mmap keep the alignment)
+ */
+static size_t node_offset(size_t sizeof_header, unsigned int format)
+{
+	size_t offset = sizeof_header + sizeof(odb_descr_t);
+
+	if (format == ODB_FORMAT_HASHED)
+		offset = (offset + ODB_CACHE_LINE - 1) & ~(ODB_CACHE_LINE - 1);
+
+	return offset;
+}
+
  
+/**
+ * the write_gen of a new DB file, it must not repeat the ones of a file
+ * removed and created again, whose readers can have kept the last one
+ */
+static unsigned int first_write_gen(void)
+{
+	struct timeval tv;
+	unsigned int gen;
+
+	gettimeofday(&tv, NULL);
+	gen = (tv.tv_sec * 1000000 + tv.tv_usec) << 1;
+	return gen ? gen : 2;
+}
+
+
 /**
  * return the number of bytes used by hash table, node table and header.
  */
@@ -52,14 +96,161 @@ static unsigned int tables_size(odb_data_t const * data, odb_node_nr_t node_nr)
 {
 	size_t size;
 
-	size = node_nr * (sizeof(odb_index_t) * BUCKET_FACTOR);
-	size += node_nr * sizeof(odb_node_t);
+	size = node_nr * sizeof(odb_node_t);
+	if (data->format == ODB_FORMAT_CHAINED)
+		size += node_nr * (sizeof(odb_index_t) * BUCKET_FACTOR);
 	size += data->offset_node;
 
 	return size;
 }
 
 
+/**
+ * map size bytes of fd at offset as the table of data. A table in a
+ * container is not page aligned, the mapping starts at the page holding it
+ * returns 0 on success, errno on failure
+ */
+static int map_table(odb_data_t * data, int fd, uint64_t offset, size_t size,
+                     int mmflags)
+{
+	uint64_t map_offset = offset & ~(uint64_t)(getpagesize() - 1);
+	size_t map_size = size + (offset - map_offset);
+	void * map;
+
+	map = mmap(0, map_size, mmflags, MAP_SHARED, fd, map_offset);
+	if (map == MAP_FAILED)
+		return errno;
+
+	data->map_memory = map;
+	data->map_size = map_size;
+	data->base_memory = (char *)map + (offset - map_offset);
+	return 0;
+}
+
+
+/** ODB_FORMAT_HASHED: insert nr nodes in an empty table */
+static void insert_hashed_nodes(odb_data_t * data, odb_node_t const * nodes,
+                                odb_node_nr_t nr)
+{
+	odb_node_nr_t pos;
+
+	for (pos = 0; pos < nr; ++pos) {
+		odb_node_t * node;
+		odb_index_t index;
+
+		if (!nodes[pos].value)
+			continue;
+
+		index = odb_do_hash(data, nodes[pos].key);
+		node = &data->node_base[index];
+		while (node->value) {
+			index = (index + 1) & (data->descr->size - 1);
+			node = &data->node_base[index];
+		}
+		*node = nodes[pos];
+	}
+}
+
+
+/**
+ * ODB_FORMAT_HASHED: nodes can't stay in place when the table grow, save
+ * them, double and clear the table, then re-insert them
+ */
+static int grow_hashed_table(odb_data_t * data)
+{
+	unsigned int old_file_size;
+	unsigned int new_file_size;
+	odb_node_nr_t old_size;
+	odb_node_t * old_nodes;
+	void * new_map;
+
+	old_size = data->descr->size;
+	old_file_size = tables_size(data, old_size);
+	new_file_size = tables_size(data, old_size * 2);
+
+	old_nodes = malloc(old_size * sizeof(odb_node_t));
+	if (!old_nodes)
+		return 1;
+	memcpy(old_nodes, data->node_base, old_size * sizeof(odb_node_t));
+
+	if (ftruncate(data->fd, new_file_size))
+		goto fail;
+
+	new_map = mremap(data->base_memory,
+			 old_file_size, new_file_size, MREMAP_MAYMOVE);
+
+	if (new_map == MAP_FAILED)
+		goto fail;
+
+	data->map_memory = data->base_memory = new_map;
+	data->map_size = new_file_size;
+	data->descr = odb_to_descr(data);
+	data->descr->size *= 2;
+	data->node_base = odb_to_node_base(data);
+	data->hash_mask = odb_to_hash_mask(data);
+
+	/* the grown part is already zeroed by ftruncate() */
+	memset(data->node_base, '\0', old_size * sizeof(odb_node_t));
+
+	insert_hashed_nodes(data, old_nodes, old_size);
+	odb_mark_all_dirty(data);
+
+	free(old_nodes);
+	return 0;
+
+fail:
+	free(old_nodes);
+	return 1;
+}
+
+
+/**
+ * ODB_FORMAT_HASHED table in a container: the grown table is built in a
+ * new record, a reader sees the old table until the new one is committed
+ */
+static int grow_pack_table(odb_data_t * data)
+{
+	odb_data_t old = *data;
+	odb_node_nr_t old_size = data->descr->size;
+	unsigned int new_table_size = tables_size(data, old_size * 2);
+	uint64_t offset;
+	int err;
+
+	err = odb_pack_alloc(data->pack, data->pack_member, new_table_size,
+	                     &offset);
+	if (!err) {
+		err = map_table(data, odb_pack_fd(data->pack), offset,
+		                new_table_size, PROT_READ | PROT_WRITE);
+	}
+	if (err) {
+		errno = err;
+		return 1;
+	}
+
+	/* header and descr, the new node array is zeroed */
+	memcpy(data->base_memory, old.base_memory, data->offset_node);
+	data->descr = odb_to_descr(data);
+	data->descr->size *= 2;
+	data->node_base = odb_to_node_base(data);
+	data->hash_mask = odb_to_hash_mask(data);
+
+	insert_hashed_nodes(data, old.node_base, old_size);
+
+	err = odb_pack_commit(data->pack, data->pack_member, offset,
+	                      new_table_size);
+	if (err) {
+		munmap(data->map_memory, data->map_size);
+		*data = old;
+		errno = err;
+		return 1;
+	}
+
+	munmap(old.map_memory, old.map_size);
+	odb_mark_all_dirty(data);
+	return 0;
+}
+
+
 int odb_grow_hashtable(odb_data_t * data)
 {
 	unsigned int old_file_size;
@@ -67,6 +258,11 @@ int odb_grow_hashtable(odb_data_t * data)
 	unsigned int pos;
 	void * new_map;
 
+	if (data->pack)
+		return grow_pack_table(data);
+	if (data->format == ODB_FORMAT_HASHED)
+		return grow_hashed_table(data);
+
 	old_file_size = tables_size(data, data->descr->size);
 	new_file_size = tables_size(data, data->descr->size * 2);
 
@@ -79,12 +275,13 @@ int odb_grow_hashtable(odb_data_t * data)
 	if (new_map == MAP_FAILED)
 		return 1;
 
-	data->base_memory = new_map;
+	data->map_memory = data->base_memory = new_map;
+	data->map_size = new_file_size;
 	data->descr = odb_to_descr(data);
 	data->descr->size *= 2;
 	data->node_base = odb_to_node_base(data);
 	data->hash_base = odb_to_hash_base(data);
-	data->hash_mask = (data->descr->size * BUCKET_FACTOR) - 1;
+	data->hash_mask = odb_to_hash_mask(data);
 
 	/* rebuild the hash table, node zero is never used. This works
 	 * because layout of file is node table then hash table,
@@ -113,6 +310,7 @@ int odb_grow_hashtable(odb_data_t * data)
 		data->hash_base[index] = pos;
 	}
 
+	odb_mark_all_dirty(data);
 	return 0;
 }
 
@@ -159,6 +357,81 @@ find_samples_data(size_t hash, char const * filename)
 }
 
 
+/**
+ * open the table filename stored in a container, the container is found
+ * by looking for a regular file in the directories of filename
+ * returns 0 on success, ENOTDIR if no container exists, errno on failure
+ */
+static int open_pack_table(odb_data_t * data, char const * filename,
+                           enum odb_rw rw, int mmflags)
+{
+	char const * member;
+	odb_node_nr_t nr_node;
+	uint64_t offset;
+	uint64_t size;
+	int new_table = 0;
+	int err;
+
+	err = odb_pack_find(filename, rw, 1, &data->pack, &member);
+	if (err)
+		return err;
+	if (!data->pack)
+		return ENOTDIR;
+	data->pack_member = data->filename + (member - filename);
+
+	/* containers only hold ODB_FORMAT_HASHED tables */
+	data->format = ODB_FORMAT_HASHED;
+	data->offset_node = node_offset(data->sizeof_header, data->format);
+
+	if (odb_pack_lookup(data->pack, member, &offset, &size)) {
+		if (size < data->offset_node) {
+			err = EINVAL;
+			goto fail;
+		}
+		nr_node = (size - data->offset_node) / sizeof(odb_node_t);
+	} else {
+		if (rw == ODB_RDONLY) {
+			err = ENOENT;
+			goto fail;
+		}
+		nr_node = DEFAULT_NODE_NR(data->offset_node);
+		size = tables_size(data, nr_node);
+		err = odb_pack_alloc(data->pack, member, size, &offset);
+		if (err)
+			goto fail;
+		new_table = 1;
+	}
+
+	err = map_table(data, odb_pack_fd(data->pack), offset, size, mmflags);
+	if (err)
+		goto fail;
+
+	data->descr = odb_to_descr(data);
+	if (new_table) {
+		data->descr->size = nr_node;
+		data->descr->format = data->format;
+		data->descr->current_size = 0;
+		data->descr->write_gen = first_write_gen();
+		err = odb_pack_commit(data->pack, member, offset, size);
+	} else if (data->descr->format != ODB_FORMAT_HASHED ||
+	           data->descr->size != nr_node) {
+		err = EINVAL;
+	}
+
+	if (err) {
+		munmap(data->map_memory, data->map_size);
+		goto fail;
+	}
+
+	return 0;
+
+fail:
+	odb_pack_put(data->pack);
+	data->pack = NULL;
+	return err;
+}
+
+
 int odb_open(odb_t * odb, char const * filename, enum odb_rw rw,
 	     size_t sizeof_header)
 {
@@ -182,7 +455,6 @@ int odb_open(odb_t * odb, char const * filename, enum odb_rw rw,
 	data = xmalloc(sizeof(odb_data_t));
 	memset(data, '\0', sizeof(odb_data_t));
 	list_init(&data->list);
-	data->offset_node = sizeof_header + sizeof(odb_descr_t);
 	data->sizeof_header = sizeof_header;
 	data->ref_count = 1;
 	data->filename = xstrdup(filename);
@@ -190,7 +462,12 @@ int odb_open(odb_t * odb, char const * filename, enum odb_rw rw,
 	data->fd = open(filename, flags, 0644);
 	if (data->fd < 0) {
 		err = errno;
-		goto out;
+		/* a path component is a file, it can be a container */
+		if (err == ENOTDIR)
+			err = open_pack_table(data, filename, rw, mmflags);
+		if (err)
+			goto fail_free;
+		goto opened;
 	}
 
 	if (fstat(data->fd, &stat_buf)) {
@@ -206,6 +483,8 @@ int odb_open(odb_t * odb, char const * filename, enum odb_rw rw,
 			goto fail;
 		}
 
+		data->format = ODB_FORMAT_HASHED;
+		data->offset_node = node_offset(sizeof_header, data->format);
 		nr_node = DEFAULT_NODE_NR(data->offset_node);
 
 		file_size = tables_size(data, nr_node);
@@ -214,25 +493,46 @@ int odb_open(odb_t * odb, char const * filename, enum odb_rw rw,
 			goto fail;
 		}
 	} else {
+		odb_descr_t descr;
+		size_t node_size = sizeof(odb_node_t);
+
+		/* the layout depends on the format, get it first */
+		if (pread(data->fd, &descr, sizeof(descr), sizeof_header) !=
+		    sizeof(descr)) {
+			err = EINVAL;
+			goto fail;
+		}
+
+		data->format = descr.format;
+		if (data->format == ODB_FORMAT_CHAINED) {
+			node_size += sizeof(odb_index_t) * BUCKET_FACTOR;
+		} else if (data->format != ODB_FORMAT_HASHED) {
+			err = EINVAL;
+			goto fail;
+		}
+
+		data->offset_node = node_offset(sizeof_header, data->format);
+		if (stat_buf.st_size < (off_t)data->offset_node) {
+			err = EINVAL;
+			goto fail;
+		}
+
 		/* Calculate nr node allowing a sanity check later */
-		nr_node = (stat_buf.st_size - data->offset_node) /
-			((sizeof(odb_index_t) * BUCKET_FACTOR) + sizeof(odb_node_t));
+		nr_node = (stat_buf.st_size - data->offset_node) / node_size;
 	}
 
-	data->base_memory = mmap(0, tables_size(data, nr_node), mmflags,
-				MAP_SHARED, data->fd, 0);
-
-	if (data->base_memory == MAP_FAILED) {
-		err = errno;
+	err = map_table(data, data->fd, 0, tables_size(data, nr_node), mmflags);
+	if (err)
 		goto fail;
-	}
 
 	data->descr = odb_to_descr(data);
 
 	if (stat_buf.st_size == 0) {
 		data->descr->size = nr_node;
-		/* page zero is not used */
-		data->descr->current_size = 1;
+		data->descr->format = data->format;
+		/* all node of the hashed table are free */
+		data->descr->current_size = 0;
+		data->descr->write_gen = first_write_gen();
 	} else {
 		/* file already exist, sanity check nr node */
 		if (nr_node != data->descr->size) {
@@ -241,18 +541,23 @@ int odb_open(odb_t * odb, char const * filename, enum odb_rw rw,
 		}
 	}
 
+opened:
 	data->hash_base = odb_to_hash_base(data);
 	data->node_base = odb_to_node_base(data);
-	data->hash_mask = (data->descr->size * BUCKET_FACTOR) - 1;
+	data->hash_mask = odb_to_hash_mask(data);
+	/* the caller can write the header of a new file */
+	if (rw == ODB_RDWR)
+		odb_mark_all_dirty(data);
 
 	list_add(&data->list, &files_hash[hash]);
 	odb->data = data;
 out:
 	return err;
 fail_unmap:
-	munmap(data->base_memory, tables_size(data, nr_node));
+	munmap(data->map_memory, data->map_size);
 fail:
 	close(data->fd);
+fail_free:
 	free(data->filename);
 	free(data);
 	odb->data = NULL;
@@ -267,11 +572,14 @@ void odb_close(odb_t * odb)
 	if (data) {
 		data->ref_count--;
 		if (data->ref_count == 0) {
-			size_t size = tables_size(data, data->descr->size);
+			if (data->writing)
+				++data->descr->write_gen;
 			list_del(&data->list);
-			munmap(data->base_memory, size);
+			munmap(data->map_memory, data->map_size);
 			if (data->fd >= 0)
 				close(data->fd);
+			if (data->pack)
+				odb_pack_put(data->pack);
 			free(data->filename);
 			free(data);
 			odb->data = NULL;
@@ -297,11 +605,96 @@ void * odb_get_data(odb_t * odb)
 void odb_sync(odb_t const * odb)
 {
 	odb_data_t * data = odb->data;
-	size_t size;
 
 	if (!data)
 		return;
 
-	size = tables_size(data, data->descr->size);
-	msync(data->base_memory, size, MS_ASYNC);
+	msync(data->map_memory, data->map_size, MS_ASYNC);
+}
+
+
+void odb_collect_dirty(odb_dirty_func func, void * arg)
+{
+	size_t const page_mask = getpagesize() - 1;
+	struct list_head * pos;
+	size_t i;
+
+	/* no file opened yet */
+	if (files_hash[0].next == NULL)
+		return;
+
+	for (i = 0; i < FILES_HASH_SIZE; ++i) {
+		list_for_each(pos, &files_hash[i]) {
+			odb_data_t * data =
+				list_entry(pos, odb_data_t, list);
+			size_t start, end;
+
+			if (!data->dirty_end)
+				continue;
+
+			start = data->dirty_start & ~page_mask;
+			end = (data->dirty_end + page_mask) & ~page_mask;
+			if (end > data->map_size)
+				end = data->map_size;
+			data->dirty_end = 0;
+
+			func((char *)data->map_memory + start, end - start,
+			     arg);
+		}
+	}
+}
+
+
+void odb_start_writes(odb_data_t * data)
+{
+	data->writing = 1;
+	/* odd already if the last writer didn't end its writes */
+	data->descr->write_gen |= 1;
+	odb_mark_dirty(data, data->descr, sizeof(odb_descr_t));
+}
+
+
+void odb_commit_writes(void)
+{
+	struct list_head * pos;
+	size_t i;
+
+	/* no file opened yet */
+	if (files_hash[0].next == NULL)
+		return;
+
+	/* readers see the even value through the page cache at once, the
+	 * next odb_collect_dirty() or the kernel writes it back */
+	for (i = 0; i < FILES_HASH_SIZE; ++i) {
+		list_for_each(pos, &files_hash[i]) {
+			odb_data_t * data =
+				list_entry(pos, odb_data_t, list);
+			if (!data->writing)
+				continue;
+			data->writing = 0;
+			++data->descr->write_gen;
+		}
+	}
+}
+
+
+void odb_collect_written(odb_written_func func, void * arg)
+{
+	struct list_head * pos;
+	size_t i;
+
+	/* no file opened yet */
+	if (files_hash[0].next == NULL)
+		return;
+
+	for (i = 0; i < FILES_HASH_SIZE; ++i) {
+		list_for_each(pos, &files_hash[i]) {
+			odb_data_t * data =
+				list_entry(pos, odb_data_t, list);
+			if (!data->written)
+				continue;
+			data->written = 0;
+			func(data->filename, arg);
+		}
+	}
 }
@@ -0,0 +1,597 @@
+/**
+ * @file db_pack.c
+ * Tables packed in a single container file
+ *
+ * @remark Copyright 2010 OProfile authors
+ * @remark Read the file COPYING
+ */
+
+#define _GNU_SOURCE
+
+#include <stdlib.h>
+#include <sys/fcntl.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <errno.h>
+#include <string.h>
+#include <limits.h>
+#include <pthread.h>
+
+#include "odb.h"
+#include "db_pack.h"
+#include "op_string.h"
+#include "op_libiberty.h"
+
+#define ODB_PACK_MAGIC		"ODBPACK\n"
+#define ODB_PACK_VERSION	1
+/** "ODBR" */
+#define ODB_RECORD_MAGIC	0x5242444f
+/** the container file is grown by this amount to avoid a ftruncate() by
+ * allocation */
+#define ODB_PACK_GROW_SIZE	(1024 * 1024)
+
+enum odb_record_state {
+	ODB_RECORD_LIVE = 1,
+	ODB_RECORD_DEAD = 2
+};
+
+struct odb_pack_header {
+	char magic[8];
+	uint32_t version;
+	uint32_t padding;
+	/** end of the committed records */
+	uint64_t end;
+	char reserved[40];
+};
+
+struct odb_pack_record {
+	/** written last, a record is ignored until its magic is set */
+	uint32_t magic;
+	uint32_t state;			/**< enum odb_record_state */
+	uint64_t size;			/**< table size */
+	uint32_t name_len;
+	uint32_t padding;
+};
+
+/** a live record, in the in memory directory */
+struct pack_entry {
+	char * name;			/**< NULL for an unused entry */
+	uint64_t record;		/**< record offset */
+	uint64_t offset;		/**< table offset */
+	uint64_t size;			/**< table size */
+};
+
+struct odb_pack {
+	char * path;
+	size_t path_len;
+	int fd;
+	enum odb_rw rw;
+	int ref_count;
+	/** ODB_RDWR: end of the allocated records, ODB_RDONLY: end of the
+	 * records already read */
+	uint64_t end;
+	/** container file size */
+	uint64_t file_size;
+	/** hash table of the records, open addressing */
+	struct pack_entry * entries;
+	size_t nr_entries;
+	size_t hash_size;		/**< power of two */
+	struct list_head list;
+};
+
+/** protect open_packs and all odb_pack, the daemon writer threads can
+ * grow tables concurrently */
+static pthread_mutex_t pack_lock = PTHREAD_MUTEX_INITIALIZER;
+static LIST_HEAD(open_packs);
+
+
+static __inline uint64_t pack_align(uint64_t offset)
+{
+	return (offset + ODB_CACHE_LINE - 1) & ~(uint64_t)(ODB_CACHE_LINE - 1);
+}
+
+
+static __inline uint64_t table_offset(uint64_t record, size_t name_len)
+{
+	return pack_align(record + sizeof(struct odb_pack_record) + name_len);
+}
+
+
+static struct pack_entry * find_entry(struct odb_pack * pack, char const * name)
+{
+	size_t index = op_hash_string(name) & (pack->hash_size - 1);
+
+	while (pack->entries[index].name) {
+		if (!strcmp(pack->entries[index].name, name))
+			break;
+		index = (index + 1) & (pack->hash_size - 1);
+	}
+
+	return &pack->entries[index];
+}
+
+
+static void grow_entries(struct odb_pack * pack)
+{
+	struct pack_entry * old_entries = pack->entries;
+	size_t old_size = pack->hash_size;
+	size_t i;
+
+	pack->hash_size = old_size ? old_size * 2 : 256;
+	pack->entries = xcalloc(pack->hash_size, sizeof(struct pack_entry));
+
+	for (i = 0; i < old_size; ++i) {
+		if (old_entries[i].name)
+			*find_entry(pack, old_entries[i].name) = old_entries[i];
+	}
+
+	free(old_entries);
+}
+
+
+/** add or replace the directory entry of a record */
+static void add_entry(struct odb_pack * pack, char const * name,
+                      uint64_t record, uint64_t offset, uint64_t size)
+{
+	struct pack_entry * entry;
+
+	if ((pack->nr_entries + 1) * 2 > pack->hash_size)
+		grow_entries(pack);
+
+	entry = find_entry(pack, name);
+	if (!entry->name) {
+		entry->name = xstrdup(name);
+		++pack->nr_entries;
+	}
+	entry->record = record;
+	entry->offset = offset;
+	entry->size = size;
+}
+
+
+/**
+ * read the records from pack->end to the end of the committed records,
+ * a record replaces the previous records of the same name
+ */
+static int read_records(struct odb_pack * pack)
+{
+	struct odb_pack_header header;
+	uint64_t pending = 0;
+	uint64_t record;
+	char name[PATH_MAX];
+
+	if (pread(pack->fd, &header, sizeof(header), 0) != sizeof(header))
+		return EINVAL;
+	if (memcmp(header.magic, ODB_PACK_MAGIC, sizeof(header.magic)) ||
+	    header.version != ODB_PACK_VERSION)
+		return EINVAL;
+
+	record = pack->end;
+	while (record + sizeof(struct odb_pack_record) <= header.end) {
+		struct odb_pack_record rec;
+		uint64_t offset;
+
+		if (pread(pack->fd, &rec, sizeof(rec), record) != sizeof(rec))
+			return EINVAL;
+		/* a record not yet committed or broken by a crash */
+		if (!rec.size || rec.name_len >= sizeof(name))
+			break;
+
+		offset = table_offset(record, rec.name_len);
+		if (rec.magic != ODB_RECORD_MAGIC) {
+			if (!pending)
+				pending = record;
+		} else if (rec.state == ODB_RECORD_LIVE) {
+			if (pread(pack->fd, name, rec.name_len,
+			          record + sizeof(rec)) != rec.name_len)
+				return EINVAL;
+			name[rec.name_len] = '\0';
+			add_entry(pack, name, record, offset, rec.size);
+		}
+
+		record = pack_align(offset + rec.size);
+	}
+
+	/* a reader must read again the records following one not yet
+	 * committed, records are read in order so the last one wins */
+	pack->end = (pack->rw == ODB_RDONLY && pending) ? pending : record;
+	return 0;
+}
+
+
+static int init_header(int fd)
+{
+	struct odb_pack_header header;
+
+	memset(&header, '\0', sizeof(header));
+	memcpy(header.magic, ODB_PACK_MAGIC, sizeof(header.magic));
+	header.version = ODB_PACK_VERSION;
+	header.end = pack_align(sizeof(header));
+
+	if (pwrite(fd, &header, sizeof(header), 0) != sizeof(header))
+		return errno;
+	return 0;
+}
+
+
+static void free_pack(struct odb_pack * pack)
+{
+	size_t i;
+
+	for (i = 0; i < pack->hash_size; ++i)
+		free(pack->entries[i].name);
+	free(pack->entries);
+	if (pack->fd >= 0)
+		close(pack->fd);
+	free(pack->path);
+	free(pack);
+}
+
+
+/** open the container path, called with pack_lock held */
+static int open_pack(char const * path, enum odb_rw rw,
+                     struct odb_pack ** result)
+{
+	int flags = (rw == ODB_RDWR) ? (O_CREAT | O_RDWR) : O_RDONLY;
+	struct odb_pack * pack;
+	struct stat stat_buf;
+	int err = 0;
+
+	pack = xcalloc(1, sizeof(struct odb_pack));
+	pack->path = xstrdup(path);
+	pack->path_len = strlen(path);
+	pack->rw = rw;
+	pack->ref_count = 1;
+	pack->end = pack_align(sizeof(struct odb_pack_header));
+	grow_entries(pack);
+
+	pack->fd = open(path, flags, 0644);
+	if (pack->fd < 0) {
+		err = errno;
+		goto fail;
+	}
+
+	if (fstat(pack->fd, &stat_buf)) {
+		err = errno;
+		goto fail;
+	}
+	pack->file_size = stat_buf.st_size;
+
+	if (stat_buf.st_size == 0) {
+		if (rw == ODB_RDONLY) {
+			err = EIO;
+			goto fail;
+		}
+		err = init_header(pack->fd);
+	} else {
+		err = read_records(pack);
+	}
+	if (err)
+		goto fail;
+
+	list_add(&pack->list, &open_packs);
+	*result = pack;
+	return 0;
+
+fail:
+	free_pack(pack);
+	return err;
+}
+
+
+static void put_pack(struct odb_pack * pack)
+{
+	if (--pack->ref_count == 0) {
+		list_del(&pack->list);
+		free_pack(pack);
+	}
+}
+
+
+/** return the open container holding filename, or named filename */
+static struct odb_pack * find_open_pack(char const * filename, int exact)
+{
+	struct list_head * pos;
+
+	list_for_each(pos, &open_packs) {
+		struct odb_pack * pack = list_entry(pos, struct odb_pack, list);
+		char end;
+		if (strncmp(filename, pack->path, pack->path_len))
+			continue;
+		end = filename[pack->path_len];
+		if ((exact && end == '\0') || (!exact && end == '/'))
+			return pack;
+	}
+
+	return NULL;
+}
+
+
+/** open the first regular file found in the directories of filename */
+static int probe_pack(char const * filename, enum odb_rw rw,
+                      struct odb_pack ** pack)
+{
+	char * path = xstrdup(filename);
+	char * pos = path[0] == '/' ? path + 1 : path;
+	int err = 0;
+
+	for (; (pos = strchr(pos, '/')) != NULL; ++pos) {
+		struct stat stat_buf;
+
+		*pos = '\0';
+		if (stat(path, &stat_buf))
+			break;
+		if (S_ISREG(stat_buf.st_mode)) {
+			err = open_pack(path, rw, pack);
+			break;
+		}
+		*pos = '/';
+	}
+
+	free(path);
+	return err;
+}
+
+
+int odb_pack_find(char const * filename, enum odb_rw rw, int probe,
+                  struct odb_pack ** pack, char const ** member)
+{
+	int err = 0;
+
+	pthread_mutex_lock(&pack_lock);
+
+	*pack = find_open_pack(filename, 0);
+	if (*pack) {
+		if (rw == ODB_RDWR && (*pack)->rw == ODB_RDONLY) {
+			*pack = NULL;
+			err = EROFS;
+		} else {
+			++(*pack)->ref_count;
+		}
+	} else if (probe) {
+		err = probe_pack(filename, rw, pack);
+	}
+
+	if (*pack)
+		*member = filename + (*pack)->path_len + 1;
+
+	pthread_mutex_unlock(&pack_lock);
+
+	return err;
+}
+
+
+void odb_pack_put(struct odb_pack * pack)
+{
+	pthread_mutex_lock(&pack_lock);
+	put_pack(pack);
+	pthread_mutex_unlock(&pack_lock);
+}
+
+
+int odb_pack_fd(struct odb_pack const * pack)
+{
+	return pack->fd;
+}
+
+
+int odb_pack_lookup(struct odb_pack * pack, char const * member,
+                    uint64_t * offset, uint64_t * size)
+{
+	struct pack_entry * entry;
+	int found;
+
+	pthread_mutex_lock(&pack_lock);
+
+	/* the daemon can have added records since the container was read */
+	entry = find_entry(pack, member);
+	if (!entry->name && pack->rw == ODB_RDONLY) {
+		read_records(pack);
+		entry = find_entry(pack, member);
+	}
+
+	found = entry->name != NULL;
+	if (found) {
+		*offset = entry->offset;
+		*size = entry->size;
+	}
+
+	pthread_mutex_unlock(&pack_lock);
+
+	return found;
+}
+
+
+int odb_pack_alloc(struct odb_pack * pack, char const * member,
+                   uint64_t size, uint64_t * offset)
+{
+	struct odb_pack_record rec;
+	size_t name_len = strlen(member);
+	uint64_t record;
+	uint64_t end;
+	int err = 0;
+
+	if (pack->rw == ODB_RDONLY)
+		return EROFS;
+
+	pthread_mutex_lock(&pack_lock);
+
+	record = pack->end;
+	*offset = table_offset(record, name_len);
+	end = pack_align(*offset + size);
+
+	if (end > pack->file_size) {
+		uint64_t file_size = end + ODB_PACK_GROW_SIZE;
+		if (ftruncate(pack->fd, file_size)) {
+			err = errno;
+			goto out;
+		}
+		pack->file_size = file_size;
+	}
+
+	memset(&rec, '\0', sizeof(rec));
+	rec.state = ODB_RECORD_LIVE;
+	rec.size = size;
+	rec.name_len = name_len;
+	if (pwrite(pack->fd, &rec, sizeof(rec), record) != sizeof(rec) ||
+	    pwrite(pack->fd, member, name_len, record + sizeof(rec)) !=
+	    (ssize_t)name_len) {
+		err = errno;
+		goto out;
+	}
+
+	pack->end = end;
+out:
+	pthread_mutex_unlock(&pack_lock);
+	return err;
+}
+
+
+int odb_pack_commit(struct odb_pack * pack, char const * member,
+                    uint64_t offset, uint64_t size)
+{
+	uint32_t const magic = ODB_RECORD_MAGIC;
+	uint32_t const dead = ODB_RECORD_DEAD;
+	struct pack_entry * entry;
+	uint64_t record;
+	int err = 0;
+
+	record = offset - pack_align(sizeof(struct odb_pack_record) +
+	                             strlen(member));
+
+	pthread_mutex_lock(&pack_lock);
+
+	/* a reader seeing both records keeps the last one */
+	if (pwrite(pack->fd, &magic, sizeof(magic), record) != sizeof(magic)) {
+		err = errno;
+		goto out;
+	}
+
+	entry = find_entry(pack, member);
+	if (entry->name) {
+		pwrite(pack->fd, &dead, sizeof(dead), entry->record +
+		       offsetof(struct odb_pack_record, state));
+	}
+	add_entry(pack, member, record, offset, size);
+
+	if (pwrite(pack->fd, &pack->end, sizeof(pack->end),
+	           offsetof(struct odb_pack_header, end)) !=
+	    sizeof(pack->end))
+		err = errno;
+out:
+	pthread_mutex_unlock(&pack_lock);
+	return err;
+}
+
+
+int odb_pack_open(char const * path, enum odb_rw rw)
+{
+	struct odb_pack * pack;
+	int err = 0;
+
+	pthread_mutex_lock(&pack_lock);
+
+	pack = find_open_pack(path, 1);
+	if (pack)
+		++pack->ref_count;
+	else
+		err = open_pack(path, rw, &pack);
+
+	pthread_mutex_unlock(&pack_lock);
+
+	return err;
+}
+
+
+void odb_pack_close(char const * path)
+{
+	struct odb_pack * pack;
+
+	pthread_mutex_lock(&pack_lock);
+
+	pack = find_open_pack(path, 1);
+	if (pack)
+		put_pack(pack);
+
+	pthread_mutex_unlock(&pack_lock);
+}
+
+
+int odb_pack_list(char const * path,
+                  void (*func)(char const * name, void * arg), void * arg)
+{
+	struct odb_pack * pack;
+	size_t i;
+	int err;
+
+	err = odb_pack_open(path, ODB_RDONLY);
+	if (err)
+		return err;
+
+	pthread_mutex_lock(&pack_lock);
+	pack = find_open_pack(path, 1);
+	if (pack->rw == ODB_RDONLY)
+		read_records(pack);
+	for (i = 0; i < pack->hash_size; ++i) {
+		if (pack->entries[i].name)
+			func(pack->entries[i].name, arg);
+	}
+	pthread_mutex_unlock(&pack_lock);
+
+	odb_pack_close(path);
+
+	return 0;
+}
+
+
+char * odb_pack_container(char const * filename)
+{
+	struct odb_pack * pack;
+	char const * member;
+	char * path;
+
+	if (odb_pack_find(filename, ODB_RDONLY, 1, &pack, &member) || !pack)
+		return NULL;
+
+	path = xstrdup(pack->path);
+	odb_pack_put(pack);
+	return path;
+}
+
+
+int odb_read_header(char const * filename, void * header, size_t size)
+{
+	struct odb_pack * pack;
+	char const * member;
+	uint64_t offset;
+	uint64_t table_size;
+	int err;
+	int fd;
+
+	fd = open(filename, O_RDONLY);
+	if (fd >= 0) {
+		err = 0;
+		if (read(fd, header, size) != (ssize_t)size)
+			err = EIO;
+		close(fd);
+		return err;
+	}
+
+	err = errno;
+	if (err != ENOTDIR)
+		return err;
+
+	if (odb_pack_find(filename, ODB_RDONLY, 1, &pack, &member) || !pack)
+		return err;
+
+	err = 0;
+	if (!odb_pack_lookup(pack, member, &offset, &table_size))
+		err = ENOENT;
+	else if (table_size < size ||
+	         pread(pack->fd, header, size, offset) != (ssize_t)size)
+		err = EIO;
+
+	odb_pack_put(pack);
+	return err;
+}
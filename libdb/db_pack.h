@@ -0,0 +1,91 @@
+/**
+ * @file db_pack.h
+ * Tables packed in a single container file, libdb internal interface
+ *
+ * @remark Copyright 2010 OProfile authors
+ * @remark Read the file COPYING
+ *
+ * A container is a regular file used as a directory: the table named
+ * "dir/container/name" is stored in the file "dir/container" as a record
+ * named "name". Records are only appended, a grown table is copied to a
+ * new record then the old one is marked dead so a concurrent reader
+ * always see a complete table.
+ *
+ * the file layout is:
+ *  struct odb_pack_header
+ *  records, each one ODB_CACHE_LINE aligned:
+ *   struct odb_pack_record
+ *   the record name, not nul terminated
+ *   padding up to ODB_CACHE_LINE alignment
+ *   the table, as it is stored in a file by db_manage.c
+ */
+
+#ifndef DB_PACK_H
+#define DB_PACK_H
+
+#include <stdint.h>
+
+#include "odb.h"
+
+struct odb_pack;
+
+/**
+ * odb_pack_find - get the container holding a table
+ * @param filename  the table file name
+ * @param rw  the access needed to the table
+ * @param probe  if non zero, look for a container in filename directories
+ * @param pack  set to the container or NULL if none holds filename
+ * @param member  set to the table name in the container
+ *
+ * Only already opened containers are searched if probe is zero. The
+ * container must be released with odb_pack_put().
+ * returns 0 on success, errno on failure
+ */
+int odb_pack_find(char const * filename, enum odb_rw rw, int probe,
+                  struct odb_pack ** pack, char const ** member);
+
+/** release a container got from odb_pack_find() */
+void odb_pack_put(struct odb_pack * pack);
+
+/** return the container file descriptor */
+int odb_pack_fd(struct odb_pack const * pack);
+
+/**
+ * odb_pack_lookup - find a table in a container
+ * @param pack  the container
+ * @param member  the table name
+ * @param offset  set to the table offset in the container file
+ * @param size  set to the table size
+ *
+ * returns non zero if the table exists
+ */
+int odb_pack_lookup(struct odb_pack * pack, char const * member,
+                    uint64_t * offset, uint64_t * size);
+
+/**
+ * odb_pack_alloc - allocate a zero filled table at the container end
+ * @param pack  the container
+ * @param member  the table name
+ * @param size  the table size
+ * @param offset  set to the table offset in the container file
+ *
+ * The table is not visible until odb_pack_commit() is called.
+ * returns 0 on success, errno on failure
+ */
+int odb_pack_alloc(struct odb_pack * pack, char const * member,
+                   uint64_t size, uint64_t * offset);
+
+/**
+ * odb_pack_commit - make visible a table allocated by odb_pack_alloc()
+ * @param pack  the container
+ * @param member  the table name
+ * @param offset  the offset returned by odb_pack_alloc()
+ * @param size  the table size
+ *
+ * The previous table of this name, if any, is marked dead.
+ * returns 0 on success, errno on failure
+ */
+int odb_pack_commit(struct odb_pack * pack, char const * member,
+                    uint64_t offset, uint64_t size);
+
+#endif /* !DB_PACK_H */
@@ -25,6 +25,39 @@ struct odb_hash_stat_t {
 	/* do we need variance ? */
 };
 
+/* ODB_FORMAT_HASHED: list length is the number of node probed to find a
+ * node, i.e. its distance from its hash group + 1 */
+static void hashed_table_stat(odb_data_t const * data,
+                              odb_hash_stat_t * result)
+{
+	size_t max_length = 0;
+	double total_length = 0.0;
+	size_t pos;
+
+	result->hash_table_size = data->hash_mask + 1;
+
+	for (pos = 0 ; pos < data->descr->size ; ++pos) {
+		odb_node_t const * node = &data->node_base[pos];
+		size_t cur_length;
+
+		if (!node->value)
+			continue;
+
+		result->total_count += node->value;
+		cur_length = ((pos - odb_do_hash(data, node->key)) &
+		              (data->descr->size - 1)) + 1;
+		if (cur_length > max_length)
+			max_length = cur_length;
+		total_length += cur_length;
+	}
+
+	result->max_list_length = max_length;
+	if (data->descr->current_size)
+		result->average_list_length =
+			total_length / data->descr->current_size;
+}
+
+
 odb_hash_stat_t * odb_hash_stat(odb_t const * odb)
 {
 	size_t max_length = 0;
@@ -41,6 +74,12 @@ odb_hash_stat_t * odb_hash_stat(odb_t const * odb)
 
 	result->node_nr = data->descr->size;
 	result->used_node_nr = data->descr->current_size;
+
+	if (data->format == ODB_FORMAT_HASHED) {
+		hashed_table_stat(data, result);
+		return result;
+	}
+
 	result->hash_table_size = data->descr->size * BUCKET_FACTOR;
 
 	/* FIXME: I'm dubious if this do right statistics for hash table
@@ -12,6 +12,12 @@
 
 odb_node_t * odb_get_iterator(odb_t const * odb, odb_node_nr_t * nr)
 {
+	/* the whole table must be walked, unused node have a zero value */
+	if (odb->data->format == ODB_FORMAT_HASHED) {
+		*nr = odb->data->descr->size;
+		return odb->data->node_base;
+	}
+
 	/* node zero is unused */
 	*nr = odb->data->descr->current_size - 1;
 	return odb->data->node_base + 1;
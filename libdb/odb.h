@@ -38,21 +38,42 @@ typedef odb_index_t odb_hash_mask_t;
  */
 #define BUCKET_FACTOR 1
 
+/** the layout of the tables following odb_descr_t */
+enum odb_format {
+	/** node array followed by a hash table of chained node indexes */
+	ODB_FORMAT_CHAINED = 0,
+	/** open addressing, linear probing, node array used as hash table */
+	ODB_FORMAT_HASHED = 1
+};
+
+/** ODB_FORMAT_HASHED node array alignment, the node array is probed by
+ * group of ODB_NODES_PER_LINE nodes sharing the same cache line */
+#define ODB_CACHE_LINE 64
+#define ODB_NODES_PER_LINE (ODB_CACHE_LINE / sizeof(odb_node_t))
+
 /** a db hash node */
 typedef struct {
 	odb_key_t key;			/**< eip */
-	odb_value_t value;		/**< samples count */
-	odb_index_t next;		/**< next entry for this bucket */
+	odb_value_t value;		/**< samples count, 0 if node unused */
+	odb_index_t next;		/**< next entry for this bucket, unused by
+					  * ODB_FORMAT_HASHED */
 } odb_node_t;
 
 /** the minimal information which must be stored in the file to reload
  * properly the data base, following this header is the node array then
- * the hash table (when growing we avoid to copy node array)
+ * for ODB_FORMAT_CHAINED the hash table (when growing we avoid to copy
+ * node array)
  */
 typedef struct {
 	odb_node_nr_t size;		/**< in node nr (power of two) */
-	odb_node_nr_t current_size;	/**< nr used node + 1, node 0 unused */
-	int padding[6];			/**< for padding and future use */
+	odb_node_nr_t current_size;	/**< ODB_FORMAT_CHAINED: nr used node
+					  * + 1, node 0 unused,
+					  * ODB_FORMAT_HASHED: nr used node */
+	unsigned int format;		/**< enum odb_format */
+	unsigned int write_gen;		/**< changes when the DB is written,
+					  * odd until odb_commit_writes(), 0 if
+					  * written by an older libdb */
+	int padding[4];			/**< for padding and future use */
 } odb_descr_t;
 
 /** a "database". this is an in memory only description.
@@ -68,22 +89,48 @@ typedef struct {
  * the internal memory layout from base_memory is:
  *  the unknown header (sizeof_header)
  *  odb_descr_t
- *  the node array: (descr->size * sizeof(odb_node_t) entries
- *  the hash table: array of odb_index_t indexing the node array 
- *    (descr->size * BUCKET_FACTOR) entries
+ *  ODB_FORMAT_CHAINED:
+ *   the node array: (descr->size * sizeof(odb_node_t) entries
+ *   the hash table: array of odb_index_t indexing the node array
+ *     (descr->size * BUCKET_FACTOR) entries
+ *  ODB_FORMAT_HASHED:
+ *   padding up to ODB_CACHE_LINE alignment
+ *   the node array: (descr->size * sizeof(odb_node_t) entries, a node
+ *     is stored in the first free node from the start of its hash group
+ *
+ * New files are always created in ODB_FORMAT_HASHED.
+ *
+ * A table can also be stored in a container file, see odb_pack_open(), it
+ * is then mapped from the container and fd is -1.
  */
+struct odb_pack;
+
 typedef struct odb_data {
 	odb_node_t * node_base;		/**< base memory area of the page */
-	odb_index_t * hash_base;	/**< base memory of hash table */
+	odb_index_t * hash_base;	/**< base memory of hash table, NULL for
+					  * ODB_FORMAT_HASHED */
 	odb_descr_t * descr;		/**< the current state of database */
-	odb_hash_mask_t hash_mask;	/**< == descr->size - 1 */
+	odb_hash_mask_t hash_mask;	/**< == descr->size - 1, for
+					  * ODB_FORMAT_HASHED nr group - 1 */
+	unsigned int format;		/**< enum odb_format */
 	unsigned int sizeof_header;	/**< from base_memory to odb header */
 	unsigned int offset_node;	/**< from base_memory to node array */
 	void * base_memory;		/**< base memory of the maped memory */
+	void * map_memory;		/**< start of the mapping, page aligned */
+	size_t map_size;		/**< size of the mapping */
 	int fd;				/**< mmaped memory file descriptor */
+	struct odb_pack * pack;		/**< container of the table or NULL */
+	char const * pack_member;	/**< name of the table in pack */
 	char * filename;                /**< full path name of sample file */
 	int ref_count;                  /**< reference count */
 	struct list_head list;          /**< hash bucket list */
+	size_t dirty_start;		/**< from map_memory, range written */
+	size_t dirty_end;		/**< since odb_collect_dirty(), empty
+					  if dirty_end == 0 */
+	int written;			/**< written since
+					  odb_collect_written() */
+	int writing;			/**< written since
+					  odb_commit_writes() */
 } odb_data_t;
 
 typedef struct {
@@ -118,6 +165,8 @@ void odb_init(odb_t * odb);
  * The sizeof_header parameter allows the data file to have a header
  * at the start of the file which is skipped.
  * odb_open() always preallocate a few number of pages.
+ * Existing files are accessed in their own format, new files are created
+ * in ODB_FORMAT_HASHED.
  * returns 0 on success, errno on failure
  */
 int odb_open(odb_t * odb, char const * filename,
@@ -135,9 +184,52 @@ void * odb_get_data(odb_t * odb);
 /** issue a msync on the used size of the mmaped file */
 void odb_sync(odb_t const * odb);
 
+typedef void (*odb_dirty_func)(void * start, size_t size, void * arg);
+
 /**
- * grow the hashtable in such way current_size is the index of the first free
- * node. Take care all node pointer can be invalidated by this call.
+ * odb_collect_dirty - get the pages written in the open DB files
+ * @param func  called with each page aligned range of mapped memory written
+ *  since the last call
+ * @param arg  passed to func
+ *
+ * The DB files are then clean. The ranges can be msync()ed later, from
+ * another thread: msync() fails harmlessly on a range unmapped meanwhile.
+ * Must not be called while a DB file is updated.
+ */
+void odb_collect_dirty(odb_dirty_func func, void * arg);
+
+typedef void (*odb_written_func)(char const * filename, void * arg);
+
+/**
+ * odb_collect_written - get the open DB files written since the last call
+ * @param func  called with the filename of each DB file written
+ * @param arg  passed to func
+ *
+ * Unlike odb_collect_dirty(), a DB file closed meanwhile is forgotten,
+ * the caller must look at odb_data_t::written before closing it.
+ * Must not be called while a DB file is updated.
+ */
+void odb_collect_written(odb_written_func func, void * arg);
+
+/**
+ * odb_commit_writes - end the writes to the open DB files
+ *
+ * The first write to a DB file makes odb_descr_t::write_gen odd, this
+ * makes it even again, with a value it didn't have before. A reader
+ * seeing the same even write_gen twice knows the DB didn't change in
+ * between. Closing a DB file also ends its writes.
+ * Must not be called while a DB file is updated.
+ */
+void odb_commit_writes(void);
+
+/** make write_gen odd on the first write, see odb_commit_writes() */
+void odb_start_writes(odb_data_t * data);
+
+/**
+ * ODB_FORMAT_CHAINED: grow the hashtable in such way current_size is the
+ * index of the first free node. ODB_FORMAT_HASHED: double the node array
+ * and re-insert all the nodes. Take care all node pointer can be
+ * invalidated by this call.
  *
  * Node allocation is done in a two step way 1st) ensure a free node exist
  * eventually, caller can setup it, 2nd) commit the node allocation with
@@ -151,16 +243,94 @@ void odb_sync(odb_t const * odb);
  */
 int odb_grow_hashtable(odb_data_t * data);
 /**
- * commit a previously successfull node reservation. This can't fail.
+ * commit a previously successfull ODB_FORMAT_CHAINED node reservation.
+ * This can't fail.
  */
 static __inline void odb_commit_reservation(odb_data_t * data)
 {
 	++data->descr->current_size;
 }
 
+/** record that size bytes at ptr in the mapped memory were written */
+static __inline void
+odb_mark_dirty(odb_data_t * data, void const * ptr, size_t size)
+{
+	size_t start = (char const *)ptr - (char const *)data->map_memory;
+
+	if (!data->dirty_end || start < data->dirty_start)
+		data->dirty_start = start;
+	if (start + size > data->dirty_end)
+		data->dirty_end = start + size;
+	data->written = 1;
+	if (!data->writing)
+		odb_start_writes(data);
+}
+
+/** record that all the mapped memory was written */
+static __inline void odb_mark_all_dirty(odb_data_t * data)
+{
+	data->dirty_start = 0;
+	data->dirty_end = data->map_size;
+	data->written = 1;
+	if (!data->writing)
+		odb_start_writes(data);
+}
+
 /** "immpossible" node number to indicate an error from odb_hash_add_node() */
 #define ODB_NODE_NR_INVALID ((odb_node_nr_t)-1)
 
+/* db_pack.c */
+
+/**
+ * odb_pack_open - open a container file
+ * @param path  the container file name
+ * @param rw  ODB_RDWR to create and update the container
+ *
+ * A container is a single file holding many tables, it avoids to use one
+ * file by table when the number of tables is large. Once the container
+ * "dir/samples.pack" is open, odb_open("dir/samples.pack/name") opens the
+ * table "name" stored in the container. odb_open() also opens a container
+ * found in the path of a table but the container stays open only as long
+ * as one of its tables is open.
+ *
+ * Only ODB_FORMAT_HASHED tables are stored in a container.
+ * returns 0 on success, errno on failure
+ */
+int odb_pack_open(char const * path, enum odb_rw rw);
+
+/** close a container opened by odb_pack_open() */
+void odb_pack_close(char const * path);
+
+/**
+ * odb_pack_list - list the tables of a container
+ * @param path  the container file name
+ * @param func  called with the name of each table in the container
+ * @param arg  passed to func
+ *
+ * func must not call any odb function.
+ * returns 0 on success, errno on failure
+ */
+int odb_pack_list(char const * path,
+                  void (*func)(char const * name, void * arg), void * arg);
+
+/**
+ * return the xmalloc()ed file name of the container holding the table
+ * filename, NULL if filename is not stored in a container
+ */
+char * odb_pack_container(char const * filename);
+
+/**
+ * odb_read_header - read the header of a table
+ * @param filename  the table file name
+ * @param header  where to store the header
+ * @param size  header size
+ *
+ * This is cheaper than odb_open() when only the header is needed, filename
+ * can be stored in a container.
+ * returns 0 on success, errno on failure
+ */
+int odb_read_header(char const * filename, void * header, size_t size);
+
 /* db_debug.c */
 /** check that the hash is well built */
 int odb_check_hash(odb_t const * odb);
@@ -196,7 +366,8 @@ int odb_update_node_with_offset(odb_t * odb,
 				odb_key_t key, 
 				unsigned long int offset);
 
-/** Add a new node w/o regarding if a node with the same key already exists
+/** Add a new node w/o regarding if a node with the same key already exists,
+ * for ODB_FORMAT_HASHED value is added to the existing node if any.
  *
  * returns EXIT_SUCCESS on success, EXIT_FAILURE on failure
  */
@@ -210,26 +381,41 @@ int odb_add_node(odb_t * odb, odb_key_t key, odb_value_t value);
  * odb_node_nr_t node_nr, pos;
  * odb_node_t * node = odb_get_iterator(odb, &node_nr);
  *	for ( pos = 0 ; pos < node_nr ; ++pos)
- *		// do something
+ *		if (node[pos].value)
+ *			// do something
  *
  *  note than caller does not need to filter nil key as it's a valid key,
- * The returned range is all valid (i.e. should never contain zero value).
+ * but must skip unused node, they have a zero value.
  */
 odb_node_t * odb_get_iterator(odb_t const * odb, odb_node_nr_t * nr);
 
 static __inline unsigned int
 odb_do_hash(odb_data_t const * data, odb_key_t value)
 {
-	/* FIXME: better hash for eip value, needs to instrument code
-	 * and do a lot of tests ... */
-	/* trying to combine high order bits his a no-op: inside a binary image
-	 * high order bits don't vary a lot, hash table start with 7 bits mask
-	 * so this hash coding use bits 0-7, 8-15. Hash table is stored in
-	 * files avoiding to rebuilding them at profiling re-start so
-	 * on changing do_hash() change the file format!
+	/* Hash table is stored in files avoiding to rebuilding them at
+	 * profiling re-start so on changing do_hash() change the file
+	 * format!
 	 */
-	uint32_t temp = (value >> 32) ^ value;
-	return ((temp << 0) ^ (temp >> 8)) & data->hash_mask;
+	if (data->format == ODB_FORMAT_CHAINED) {
+		/* trying to combine high order bits his a no-op: inside a
+		 * binary image high order bits don't vary a lot, hash table
+		 * start with 7 bits mask so this hash coding use bits 0-7,
+		 * 8-15.
+		 */
+		uint32_t temp = (value >> 32) ^ value;
+		return ((temp << 0) ^ (temp >> 8)) & data->hash_mask;
+	}
+
+	/* ODB_FORMAT_HASHED: all key bits must reach the group index as
+	 * samples are often clustered a few bytes apart, this is the
+	 * 64 bits finalizer of MurmurHash3. Return the first node of the
+	 * group. */
+	value ^= value >> 33;
+	value *= 0xff51afd7ed558ccdULL;
+	value ^= value >> 33;
+	value *= 0xc4ceb9fe1a85ec53ULL;
+	value ^= value >> 33;
+	return (value & data->hash_mask) * ODB_NODES_PER_LINE;
 }
 
 #ifdef __cplusplus
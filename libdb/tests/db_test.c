@@ -15,11 +15,14 @@
 #include <stdio.h>
 #include <string.h>
 #include <fcntl.h>
+#include <unistd.h>
 
 #include "op_sample_file.h"
 #include "odb.h"
 
 #define TEST_FILENAME "test-hash-db.dat"
+#define TEST_PACKNAME "test-hash-db.pack"
+#define NR_PACK_TABLES 16
 
 static int nr_error;
 
@@ -42,8 +45,54 @@ static double used_time(void)
 }
 
 
-/* update nr item */
-static void speed_test(int nr_item, char const * test_name)
+/* libdb create new file in the hashed format, create by hand an empty file
+ * in the old format to check we can still update it */
+static void create_chained_file(char const * filename)
+{
+	size_t const nr_node = 128;
+	odb_descr_t descr;
+	FILE * fp;
+
+	fp = fopen(filename, "w");
+	if (!fp) {
+		perror(filename);
+		exit(EXIT_FAILURE);
+	}
+
+	memset(&descr, '\0', sizeof(descr));
+	descr.size = nr_node;
+	descr.current_size = 1;
+	descr.format = ODB_FORMAT_CHAINED;
+
+	if (fseek(fp, sizeof(struct opd_header), SEEK_SET) ||
+	    fwrite(&descr, sizeof(descr), 1, fp) != 1 ||
+	    ftruncate(fileno(fp), sizeof(struct opd_header) + sizeof(descr) +
+	              nr_node * (sizeof(odb_node_t) + sizeof(odb_index_t)))) {
+		perror(filename);
+		exit(EXIT_FAILURE);
+	}
+
+	fclose(fp);
+}
+
+
+static void create_file(enum odb_format format)
+{
+	remove(TEST_FILENAME);
+	if (format == ODB_FORMAT_CHAINED)
+		create_chained_file(TEST_FILENAME);
+}
+
+
+static char const * format_name(enum odb_format format)
+{
+	return format == ODB_FORMAT_CHAINED ? "chained" : "hashed";
+}
+
+
+/* update nr item, the same random keys are used for each format */
+static void speed_test(int nr_item, char const * test_name,
+                       enum odb_format format, unsigned int seed)
 {
 	int i;
 	double begin, end;
@@ -55,9 +104,13 @@ static void speed_test(int nr_item, char const * test_name)
 		fprintf(stderr, "%s", strerror(rc));
 		exit(EXIT_FAILURE);
 	}
+	srandom(seed);
 	begin = used_time();
 	for (i = 0 ; i < nr_item ; ++i) {
-		rc = odb_update_node(&hash, i);
+		/* text addresses a few bytes apart, the update order differs
+		 * from the insertion order as in a real profile */
+		odb_key_t key = 0x8048000 + (random() % nr_item) * 4;
+		rc = odb_update_node(&hash, key);
 		if (rc != EXIT_SUCCESS) {
 			fprintf(stderr, "%s", strerror(rc));
 			exit(EXIT_FAILURE);
@@ -67,7 +120,7 @@ static void speed_test(int nr_item, char const * test_name)
 	end = used_time();
 	odb_close(&hash);
 
-	verbprintf("%s: nr item: %d, elapsed: %f ns\n",
+	verbprintf("%s %s: nr item: %d, elapsed: %f ns\n", format_name(format),
 		   test_name, nr_item, (end - begin) / nr_item);
 }
 
@@ -75,23 +128,30 @@ static void speed_test(int nr_item, char const * test_name)
 static void do_speed_test(void)
 {
 	int i;
+	int format;
 
 	for (i = 100000; i <= 10000000; i *= 10) {
-		// first test count insertion, second fetch and incr count
-		speed_test(i, "insert");
-		speed_test(i, "update");
-		remove(TEST_FILENAME);
+		for (format = ODB_FORMAT_CHAINED; format <= ODB_FORMAT_HASHED;
+		     ++format) {
+			create_file(format);
+			// first test count insertion, second fetch and incr count
+			speed_test(i, "insert", format, 1);
+			speed_test(i, "update", format, 2);
+			remove(TEST_FILENAME);
+		}
 	}
 }
 
 
-static int test(int nr_item, int nr_unique_item)
+static int test(int nr_item, int nr_unique_item, enum odb_format format)
 {
 	int i;
 	odb_t hash;
 	int ret;
 	int rc;
 
+	create_file(format);
+
 	rc = odb_open(&hash, TEST_FILENAME, ODB_RDWR, sizeof(struct opd_header));
 	if (rc) {
 		fprintf(stderr, "%s", strerror(rc));
@@ -110,6 +170,26 @@ static int test(int nr_item, int nr_unique_item)
 
 	ret = odb_check_hash(&hash);
 
+	if (hash.data->format != format) {
+		fprintf(stderr, "%s format not preserved\n",
+		        format_name(format));
+		ret = 1;
+	}
+
+	if (!ret) {
+		odb_node_nr_t node_nr, pos;
+		odb_node_t * node = odb_get_iterator(&hash, &node_nr);
+		unsigned long total = 0;
+
+		for (pos = 0; pos < node_nr; ++pos)
+			total += node[pos].value;
+		if (total != (unsigned long)nr_item) {
+			fprintf(stderr, "%lu samples found, expected %d\n",
+			        total, nr_item);
+			ret = 1;
+		}
+	}
+
 	odb_close(&hash);
 
 	remove(TEST_FILENAME);
@@ -121,16 +201,392 @@ static int test(int nr_item, int nr_unique_item)
 static void do_test(void)
 {
 	int i, j;
+	int format;
+
+	for (format = ODB_FORMAT_CHAINED; format <= ODB_FORMAT_HASHED;
+	     ++format) {
+		for (i = 1000; i <= 100000; i *= 10) {
+			for (j = 100 ; j <= i / 10 ; j *= 10) {
+				if (test(i, j, format)) {
+					fprintf(stderr,
+					        "%s:%d %s failure for %d %d\n",
+					        __FILE__, __LINE__,
+					        format_name(format), i, j);
+					nr_error++;
+				} else {
+					verbprintf("test() %s ok %d %d\n",
+					           format_name(format), i, j);
+				}
+			}
+		}
+	}
+}
+
+
+static void count_table(char const * name __attribute__((unused)),
+                        void * arg)
+{
+	++*(int *)arg;
+}
+
+
+/* sum of the node values of the table filename, -1 on failure */
+static long pack_total(char const * filename, enum odb_rw rw)
+{
+	odb_node_nr_t node_nr, pos;
+	odb_node_t * node;
+	long total = 0;
+	odb_t hash;
+
+	if (odb_open(&hash, filename, rw, sizeof(struct opd_header)))
+		return -1;
+
+	if (odb_check_hash(&hash)) {
+		odb_close(&hash);
+		return -1;
+	}
+
+	node = odb_get_iterator(&hash, &node_nr);
+	for (pos = 0; pos < node_nr; ++pos)
+		total += node[pos].value;
+
+	odb_close(&hash);
+	return total;
+}
+
+
+/* tables in a container, grown while other tables of the container are
+ * open, then read back without the container being opened explicitly.
+ * nr_item samples are added to each table but the first one */
+static int pack_test(int nr_item)
+{
+	odb_t hash[NR_PACK_TABLES];
+	char name[NR_PACK_TABLES][64];
+	struct opd_header header;
+	int nr_tables = 0;
+	int ret = 0;
+	int i;
+
+	remove(TEST_PACKNAME);
+
+	if (odb_pack_open(TEST_PACKNAME, ODB_RDWR)) {
+		perror(TEST_PACKNAME);
+		return 1;
+	}
+
+	for (i = 0; i < NR_PACK_TABLES; ++i) {
+		sprintf(name[i], TEST_PACKNAME "/{root}/bin/%d/{dep}/%d", i, i);
+		if (odb_open(&hash[i], name[i], ODB_RDWR,
+		             sizeof(struct opd_header))) {
+			fprintf(stderr, "can't open %s\n", name[i]);
+			return 1;
+		}
+		memset(odb_get_data(&hash[i]), '\0', sizeof(header));
+		((struct opd_header *)odb_get_data(&hash[i]))->ctr_event = i;
+	}
+
+	/* tables are grown in turn, table 0 stays empty */
+	for (i = 0; i < nr_item * NR_PACK_TABLES; ++i) {
+		int table = i % NR_PACK_TABLES;
+		if (table && odb_update_node(&hash[table],
+		                             random() % nr_item)) {
+			fprintf(stderr, "can't update %s\n", name[table]);
+			return 1;
+		}
+	}
+
+	for (i = 0; i < NR_PACK_TABLES; ++i)
+		odb_close(&hash[i]);
+	odb_pack_close(TEST_PACKNAME);
+
+	for (i = 0; i < NR_PACK_TABLES; ++i) {
+		long const expect = i ? nr_item : 0;
+		long const total = pack_total(name[i], ODB_RDONLY);
+		if (total != expect) {
+			fprintf(stderr, "%s: %ld samples found, expected %ld\n",
+			        name[i], total, expect);
+			ret = 1;
+		}
+		if (odb_read_header(name[i], &header, sizeof(header)) ||
+		    header.ctr_event != (u32)i) {
+			fprintf(stderr, "%s: bad header\n", name[i]);
+			ret = 1;
+		}
+	}
+
+	if (odb_pack_list(TEST_PACKNAME, count_table, &nr_tables) ||
+	    nr_tables != NR_PACK_TABLES) {
+		fprintf(stderr, "%d tables found, expected %d\n",
+		        nr_tables, NR_PACK_TABLES);
+		ret = 1;
+	}
+
+	remove(TEST_PACKNAME);
+
+	return ret;
+}
+
+
+static void do_pack_test(void)
+{
+	int i;
 
 	for (i = 1000; i <= 100000; i *= 10) {
-		for (j = 100 ; j <= i / 10 ; j *= 10) {
-			if (test(i, j)) {
-				fprintf(stderr, "%s:%d failure for %d %d\n",
-				       __FILE__, __LINE__, i, j);
-				nr_error++;
-			} else {
-				verbprintf("test() ok %d %d\n", i, j);
-			}
+		if (pack_test(i)) {
+			fprintf(stderr, "%s:%d pack failure for %d\n",
+			        __FILE__, __LINE__, i);
+			nr_error++;
+		} else {
+			verbprintf("pack_test() ok %d\n", i);
+		}
+	}
+}
+
+
+struct dirty_ranges {
+	int nr;
+	char * start;
+	size_t size;
+};
+
+
+static void add_dirty(void * start, size_t size, void * arg)
+{
+	struct dirty_ranges * ranges = arg;
+
+	ranges->nr++;
+	ranges->start = start;
+	ranges->size = size;
+}
+
+
+/* the written pages are reported once, and cover the written node */
+static int dirty_test(enum odb_format format)
+{
+	struct dirty_ranges ranges;
+	odb_node_nr_t node_nr, pos;
+	odb_node_t * node;
+	size_t const page_size = getpagesize();
+	odb_t hash;
+	int ret = 0;
+
+	create_file(format);
+	if (odb_open(&hash, TEST_FILENAME, ODB_RDWR,
+	             sizeof(struct opd_header))) {
+		fprintf(stderr, "can't open %s\n", TEST_FILENAME);
+		return 1;
+	}
+
+	/* all of a file opened for writing */
+	memset(&ranges, '\0', sizeof(ranges));
+	odb_collect_dirty(add_dirty, &ranges);
+	if (ranges.nr != 1 || ranges.start != hash.data->map_memory ||
+	    ranges.size != hash.data->map_size) {
+		fprintf(stderr, "open file not dirty\n");
+		ret = 1;
+	}
+
+	memset(&ranges, '\0', sizeof(ranges));
+	odb_collect_dirty(add_dirty, &ranges);
+	if (ranges.nr) {
+		fprintf(stderr, "file still dirty\n");
+		ret = 1;
+	}
+
+	odb_update_node(&hash, 0x1234);
+	odb_update_node(&hash, 0x1234);
+	memset(&ranges, '\0', sizeof(ranges));
+	odb_collect_dirty(add_dirty, &ranges);
+
+	node = odb_get_iterator(&hash, &node_nr);
+	for (pos = 0; pos < node_nr; ++pos) {
+		if (node[pos].value)
+			break;
+	}
+
+	if (ranges.nr != 1 || pos == node_nr ||
+	    (size_t)ranges.start % page_size ||
+	    (char *)&node[pos] < ranges.start ||
+	    (char *)&node[pos + 1] > ranges.start + ranges.size) {
+		fprintf(stderr, "updated node not in dirty range\n");
+		ret = 1;
+	}
+
+	odb_close(&hash);
+	remove(TEST_FILENAME);
+
+	return ret;
+}
+
+
+static void do_dirty_test(void)
+{
+	int format;
+
+	for (format = ODB_FORMAT_CHAINED; format <= ODB_FORMAT_HASHED;
+	     ++format) {
+		if (dirty_test(format)) {
+			fprintf(stderr, "%s:%d %s dirty failure\n",
+			        __FILE__, __LINE__, format_name(format));
+			nr_error++;
+		} else {
+			verbprintf("dirty_test() %s ok\n",
+			           format_name(format));
+		}
+	}
+}
+
+
+/* counts saturate rather than wrap to the zero value of an unused node */
+static int saturate_test(void)
+{
+	odb_value_t const max = (odb_value_t)~0;
+	odb_node_nr_t node_nr, pos;
+	odb_node_t * node;
+	odb_key_t key;
+	size_t size;
+	odb_t hash;
+	int ret = 0;
+
+	create_file(ODB_FORMAT_HASHED);
+	if (odb_open(&hash, TEST_FILENAME, ODB_RDWR,
+	             sizeof(struct opd_header))) {
+		fprintf(stderr, "can't open %s\n", TEST_FILENAME);
+		return 1;
+	}
+
+	/* enough keys for some to share a probe sequence */
+	for (key = 1; key <= 64; ++key)
+		odb_update_node_with_offset(&hash, key, max - 1);
+	size = hash.data->descr->current_size;
+	for (key = 1; key <= 64; ++key) {
+		odb_update_node_with_offset(&hash, key, 1);
+		odb_update_node_with_offset(&hash, key, 2);
+		odb_update_node(&hash, key);
+	}
+	if (sizeof(unsigned long) > sizeof(odb_value_t))
+		odb_update_node_with_offset(&hash, 65, 1UL << 31 << 1);
+	else
+		odb_update_node_with_offset(&hash, 65, max);
+
+	if (hash.data->descr->current_size != size + 1) {
+		fprintf(stderr, "saturated keys inserted again\n");
+		ret = 1;
+	}
+
+	node = odb_get_iterator(&hash, &node_nr);
+	for (pos = 0; pos < node_nr; ++pos) {
+		if (node[pos].value && node[pos].value != max) {
+			fprintf(stderr, "key %llx not saturated: %u\n",
+			        (unsigned long long)node[pos].key,
+			        node[pos].value);
+			ret = 1;
+		}
+	}
+
+	if (odb_check_hash(&hash))
+		ret = 1;
+
+	odb_close(&hash);
+	remove(TEST_FILENAME);
+
+	return ret;
+}
+
+
+static void do_saturate_test(void)
+{
+	if (saturate_test()) {
+		fprintf(stderr, "%s:%d saturate failure\n",
+		        __FILE__, __LINE__);
+		nr_error++;
+	} else {
+		verbprintf("saturate_test() ok\n");
+	}
+}
+
+
+/* write_gen is odd while written and takes a new even value after */
+static int write_gen_test(enum odb_format format)
+{
+	unsigned int gen;
+	odb_t hash;
+	int ret = 0;
+
+	create_file(format);
+	if (odb_open(&hash, TEST_FILENAME, ODB_RDWR,
+	             sizeof(struct opd_header))) {
+		fprintf(stderr, "can't open %s\n", TEST_FILENAME);
+		return 1;
+	}
+
+	/* the hand made chained file is as old files, without write_gen */
+	if (!(hash.data->descr->write_gen & 1)) {
+		fprintf(stderr, "file opened for writing has an even gen\n");
+		ret = 1;
+	}
+
+	odb_commit_writes();
+	gen = hash.data->descr->write_gen;
+	if (!gen || gen & 1) {
+		fprintf(stderr, "bad gen %u after commit\n", gen);
+		ret = 1;
+	}
+
+	odb_commit_writes();
+	if (hash.data->descr->write_gen != gen) {
+		fprintf(stderr, "gen changed without writes\n");
+		ret = 1;
+	}
+
+	odb_update_node(&hash, 0x1234);
+	if (!(hash.data->descr->write_gen & 1)) {
+		fprintf(stderr, "written file has an even gen\n");
+		ret = 1;
+	}
+	odb_update_node(&hash, 0x1235);
+	odb_commit_writes();
+	if (hash.data->descr->write_gen != gen + 2) {
+		fprintf(stderr, "gen %u after writes, expected %u\n",
+		        hash.data->descr->write_gen, gen + 2);
+		ret = 1;
+	}
+	gen += 2;
+
+	/* closing ends the writes */
+	odb_update_node(&hash, 0x1234);
+	odb_close(&hash);
+	if (odb_open(&hash, TEST_FILENAME, ODB_RDONLY,
+	             sizeof(struct opd_header))) {
+		fprintf(stderr, "can't open %s\n", TEST_FILENAME);
+		return 1;
+	}
+	if (hash.data->descr->write_gen != gen + 2) {
+		fprintf(stderr, "gen %u after close, expected %u\n",
+		        hash.data->descr->write_gen, gen + 2);
+		ret = 1;
+	}
+
+	odb_close(&hash);
+	remove(TEST_FILENAME);
+
+	return ret;
+}
+
+
+static void do_write_gen_test(void)
+{
+	int format;
+
+	for (format = ODB_FORMAT_CHAINED; format <= ODB_FORMAT_HASHED;
+	     ++format) {
+		if (write_gen_test(format)) {
+			fprintf(stderr, "%s:%d %s write_gen failure\n",
+			        __FILE__, __LINE__, format_name(format));
+			nr_error++;
+		} else {
+			verbprintf("write_gen_test() %s ok\n",
+			           format_name(format));
 		}
 	}
 }
@@ -178,6 +634,14 @@ speed_test:
 
 	do_test();
 
+	do_pack_test();
+
+	do_dirty_test();
+
+	do_saturate_test();
+
+	do_write_gen_test();
+
 	do_speed_test();
 
 	if (nr_error)
@@ -24,8 +24,12 @@ char op_samples_dir[PATH_MAX];
 char op_samples_current_dir[PATH_MAX];
 char op_lock_file[PATH_MAX];
 char op_log_file[PATH_MAX];
+char op_stats_file[PATH_MAX];
 char op_pipe_file[PATH_MAX];
 char op_dump_status[PATH_MAX];
+char op_control_socket[PATH_MAX];
+char op_bfd_cache_dir[PATH_MAX];
+char op_samples_pack_file[PATH_MAX];
 
 /* paths in op_config_24.h */
 char op_device[PATH_MAX];
@@ -40,7 +44,9 @@ init_op_config_dirs(char const * session_dir)
 	assert(session_dir);	
 	session_dir_len = strlen(session_dir);
 
-	if (session_dir_len + strlen("/samples/oprofiled.log") > PATH_MAX) {
+	/* the longest path below */
+	if (session_dir_len + strlen("/samples//current/" OP_SAMPLES_PACK_NAME)
+	    >= PATH_MAX) {
 		fprintf(stderr, "Session_dir string \"%s\" is too large.\n", 
 			session_dir);
 		exit(EXIT_FAILURE);
@@ -54,6 +60,9 @@ init_op_config_dirs(char const * session_dir)
 	strcpy(op_samples_current_dir, op_samples_dir);
 	strcat(op_samples_current_dir, "/current/");
 
+	strcpy(op_samples_pack_file, op_samples_current_dir);
+	strcat(op_samples_pack_file, OP_SAMPLES_PACK_NAME);
+
 	strcpy(op_lock_file, op_session_dir);
 	strcat(op_lock_file, "/lock");
 
@@ -63,9 +72,18 @@ init_op_config_dirs(char const * session_dir)
 	strcpy(op_log_file, op_samples_dir);
 	strcat(op_log_file, "oprofiled.log");
 
+	strcpy(op_stats_file, op_samples_dir);
+	strcat(op_stats_file, "oprofiled.stats");
+
 	strcpy(op_dump_status, op_session_dir);
 	strcat(op_dump_status, "/complete_dump");
 
+	strcpy(op_control_socket, op_session_dir);
+	strcat(op_control_socket, "/opd_control");
+
+	strcpy(op_bfd_cache_dir, op_session_dir);
+	strcat(op_bfd_cache_dir, "/bfd_cache");
+
 	strcpy(op_device, op_session_dir);
 	strcat(op_device, "/opdev");
 
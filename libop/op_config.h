@@ -36,8 +36,30 @@ extern char op_samples_dir[];
 extern char op_samples_current_dir[];
 extern char op_lock_file[];
 extern char op_log_file[];
+/* daemon statistics, see daemon/opd_stats.h */
+extern char op_stats_file[];
 extern char op_pipe_file[];
 extern char op_dump_status[];
+/* dump requests socket, see daemon/opd_control.h */
+extern char op_control_socket[];
+/* symbol caches of the post-profiling tools, see libutil++/op_bfd_cache.h */
+extern char op_bfd_cache_dir[];
+/* container of the current samples files, see odb_pack_open() */
+extern char op_samples_pack_file[];
+
+/**
+ * requests on op_control_socket, one per connection, terminated by a
+ * newline. Both flush all the kernel buffers, the daemon answers
+ * OP_CONTROL_OK once the samples are written. For OP_CONTROL_DUMP_DIRTY
+ * it is preceded by the sample files written since the last
+ * OP_CONTROL_DUMP_DIRTY request, one per line.
+ */
+#define OP_CONTROL_DUMP "dump"
+#define OP_CONTROL_DUMP_DIRTY "dump dirty"
+#define OP_CONTROL_OK "ok"
+
+/** name of the samples files container in a session directory */
+#define OP_SAMPLES_PACK_NAME "samples.pack"
 
 /* Global directory that stores debug files */
 #ifndef DEBUGDIR
@@ -45,7 +67,9 @@ extern char op_dump_status[];
 #endif
 
 #define OPD_MAGIC "DAE\n"
-#define OPD_VERSION 0x11
+#define OPD_VERSION 0x12
+/** oldest sample file version post-profile tools can read */
+#define OPD_MIN_VERSION 0x11
 
 #define OP_MIN_CPU_BUF_SIZE 2048
 #define OP_MAX_CPU_BUF_SIZE 131072
@@ -35,8 +35,9 @@ struct opd_header {
 	uint64_t embedded_offset;
 	u64 anon_start;
 	u64 cg_to_anon_start;
-	/* binary compatibility reserve */
-	u32 reserved1[1];
+	/* if non zero, the file holds data address samples: the key is
+	 * the data address shifted right by data_shift, not a pc */
+	u32 data_shift;
 };
 
 #endif /* OP_SAMPLE_FILE_H */
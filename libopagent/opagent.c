@@ -51,15 +51,19 @@
  *******************************************************************/
 
 #include <stdio.h>
+#include <stdlib.h>
 #include <errno.h>
 #include <string.h>
 #include <stdint.h>
 #include <limits.h>
 #include <sys/types.h>
 #include <sys/stat.h>
+#include <sys/time.h>
 #include <fcntl.h>
 #include <unistd.h>
 #include <time.h>
+#include <signal.h>
+#include <pthread.h>
 #include <bfd.h>
 
 #include "opagent.h"
@@ -115,12 +119,327 @@ static int define_bfd_vars(void)
  * Define the version of the opagent library.
  */
 #define OP_MAJOR_VERSION 1
-#define OP_MINOR_VERSION 0
+#define OP_MINOR_VERSION 1
 
 #define AGENT_DIR OP_SESSION_DIR_DEFAULT "jitdump"
 
 #define MSG_MAXLEN 20
 
+/* records are buffered per thread and appended to the dump file by a
+ * single write() once a buffer holds FLUSH_SIZE bytes */
+#define BUFFER_SIZE (64 * 1024)
+#define FLUSH_SIZE (48 * 1024)
+/* seconds a record can stay buffered before the flush thread writes it */
+#define FLUSH_PERIOD 1
+
+struct agent;
+
+/**
+ * The records of one thread not written yet. Only the owner thread
+ * appends to it, so the lock is only contended while another thread
+ * flushes it.
+ */
+struct agent_buffer {
+	pthread_mutex_t lock;
+	char * data;
+	size_t size;
+	size_t capacity;
+	struct agent * agent;
+	struct agent_buffer * next;
+};
+
+/** what an op_agent_t points to */
+struct agent {
+	/** the dump file, opened with O_APPEND so each write() appends
+	 * whole records without any locking between threads */
+	int fd;
+	/** the agent_buffer of the calling thread */
+	pthread_key_t key;
+	/** protects buffers and closing, taken before any buffer lock */
+	pthread_mutex_t lock;
+	struct agent_buffer * buffers;
+	/** signalled to stop the flush thread */
+	pthread_cond_t cond;
+	int closing;
+	pthread_t flusher;
+	/** set in a forked child, which has no flush thread, so each
+	 * record is written at once */
+	int forked;
+	/** next open agent, see prepare_fork() */
+	struct agent * next;
+};
+
+/** the open agents, whose buffers are flushed before a fork */
+static pthread_mutex_t agents_lock = PTHREAD_MUTEX_INITIALIZER;
+static struct agent * agents;
+static pthread_once_t atfork_once = PTHREAD_ONCE_INIT;
+
+
+static int write_all(int fd, void const * data, size_t size)
+{
+	while (size) {
+		ssize_t count = write(fd, data, size);
+		if (count < 0 && errno == EINTR)
+			continue;
+		if (count < 0)
+			return -1;
+		data = (char const *)data + count;
+		size -= count;
+	}
+
+	return 0;
+}
+
+
+/** write the records of a locked buffer, they are dropped on failure */
+static int flush_buffer(struct agent_buffer * buf)
+{
+	int rc = 0;
+
+	if (buf->size)
+		rc = write_all(buf->agent->fd, buf->data, buf->size);
+	buf->size = 0;
+	return rc;
+}
+
+
+/** flush the buffers of all threads, agent->lock must be held */
+static int flush_all(struct agent * agent)
+{
+	struct agent_buffer * buf;
+	int rc = 0;
+
+	for (buf = agent->buffers; buf; buf = buf->next) {
+		pthread_mutex_lock(&buf->lock);
+		if (flush_buffer(buf))
+			rc = -1;
+		pthread_mutex_unlock(&buf->lock);
+	}
+
+	return rc;
+}
+
+
+static void free_buffer(struct agent_buffer * buf)
+{
+	pthread_mutex_destroy(&buf->lock);
+	free(buf->data);
+	free(buf);
+}
+
+
+/** called when a thread exits, its records must not be lost */
+static void release_buffer(void * arg)
+{
+	struct agent_buffer * buf = arg;
+	struct agent * agent = buf->agent;
+	struct agent_buffer ** pos;
+
+	pthread_mutex_lock(&agent->lock);
+	for (pos = &agent->buffers; *pos != buf; pos = &(*pos)->next)
+		;
+	*pos = buf->next;
+	pthread_mutex_lock(&buf->lock);
+	flush_buffer(buf);
+	pthread_mutex_unlock(&buf->lock);
+	pthread_mutex_unlock(&agent->lock);
+
+	free_buffer(buf);
+}
+
+
+/**
+ * Return the buffer of the calling thread, locked, with room for size
+ * more bytes. Return NULL on failure.
+ */
+static struct agent_buffer * get_buffer(struct agent * agent, size_t size)
+{
+	struct agent_buffer * buf = pthread_getspecific(agent->key);
+
+	if (!buf) {
+		buf = calloc(1, sizeof(struct agent_buffer));
+		if (!buf) {
+			errno = ENOMEM;
+			return NULL;
+		}
+		pthread_mutex_init(&buf->lock, NULL);
+		buf->agent = agent;
+		pthread_mutex_lock(&agent->lock);
+		buf->next = agent->buffers;
+		agent->buffers = buf;
+		pthread_mutex_unlock(&agent->lock);
+		pthread_setspecific(agent->key, buf);
+	}
+
+	pthread_mutex_lock(&buf->lock);
+
+	if (buf->size + size > buf->capacity) {
+		if (flush_buffer(buf))
+			goto fail;
+		/* a record is never split between two writes */
+		if (size > buf->capacity) {
+			size_t capacity = size > BUFFER_SIZE ? size : BUFFER_SIZE;
+			char * data = realloc(buf->data, capacity);
+			if (!data) {
+				errno = ENOMEM;
+				goto fail;
+			}
+			buf->data = data;
+			buf->capacity = capacity;
+		}
+	}
+
+	return buf;
+
+fail:
+	pthread_mutex_unlock(&buf->lock);
+	return NULL;
+}
+
+
+static void append(struct agent_buffer * buf, void const * data, size_t size)
+{
+	memcpy(buf->data + buf->size, data, size);
+	buf->size += size;
+}
+
+
+/** unlock a buffer returned by get_buffer(), writing it if full enough */
+static int commit_buffer(struct agent_buffer * buf)
+{
+	int rc = 0;
+
+	if (buf->size >= FLUSH_SIZE || buf->agent->forked)
+		rc = flush_buffer(buf);
+	pthread_mutex_unlock(&buf->lock);
+	return rc;
+}
+
+
+/* write the records of idle threads so opjitconv sees them */
+static void * flush_thread(void * arg)
+{
+	struct agent * agent = arg;
+
+	pthread_mutex_lock(&agent->lock);
+	while (!agent->closing) {
+		struct timeval now;
+		struct timespec timeout;
+
+		gettimeofday(&now, NULL);
+		timeout.tv_sec = now.tv_sec + FLUSH_PERIOD;
+		timeout.tv_nsec = now.tv_usec * 1000;
+		pthread_cond_timedwait(&agent->cond, &agent->lock, &timeout);
+		flush_all(agent);
+	}
+	pthread_mutex_unlock(&agent->lock);
+
+	return NULL;
+}
+
+
+/*
+ * A forked child gets a copy of the buffered records and the same dump
+ * file, it must not write them again. Flush them before the fork and
+ * hold every lock, so no thread is appending, until it is done.
+ */
+static void prepare_fork(void)
+{
+	struct agent * agent;
+	struct agent_buffer * buf;
+
+	pthread_mutex_lock(&agents_lock);
+	for (agent = agents; agent; agent = agent->next) {
+		pthread_mutex_lock(&agent->lock);
+		for (buf = agent->buffers; buf; buf = buf->next) {
+			pthread_mutex_lock(&buf->lock);
+			flush_buffer(buf);
+		}
+	}
+}
+
+
+static void parent_fork(void)
+{
+	struct agent * agent;
+	struct agent_buffer * buf;
+
+	for (agent = agents; agent; agent = agent->next) {
+		for (buf = agent->buffers; buf; buf = buf->next)
+			pthread_mutex_unlock(&buf->lock);
+		pthread_mutex_unlock(&agent->lock);
+	}
+	pthread_mutex_unlock(&agents_lock);
+}
+
+
+/* the other threads and the flush thread are gone in the child, and so
+ * are the owners of their buffers, which are empty. The condition still
+ * counts the flush thread as a waiter, it must not be destroyed as is */
+static void child_fork(void)
+{
+	struct agent * agent;
+
+	for (agent = agents; agent; agent = agent->next) {
+		while (agent->buffers) {
+			struct agent_buffer * buf = agent->buffers;
+			agent->buffers = buf->next;
+			pthread_mutex_unlock(&buf->lock);
+			free_buffer(buf);
+		}
+		pthread_setspecific(agent->key, NULL);
+		pthread_cond_init(&agent->cond, NULL);
+		agent->forked = 1;
+		pthread_mutex_unlock(&agent->lock);
+	}
+	pthread_mutex_unlock(&agents_lock);
+}
+
+
+static void register_atfork(void)
+{
+	pthread_atfork(prepare_fork, parent_fork, child_fork);
+}
+
+
+static int start_agent(struct agent * agent)
+{
+	sigset_t all_signals;
+	sigset_t old_signals;
+	int err;
+
+	if (pthread_key_create(&agent->key, release_buffer)) {
+		errno = EAGAIN;
+		return -1;
+	}
+	pthread_mutex_init(&agent->lock, NULL);
+	pthread_cond_init(&agent->cond, NULL);
+	agent->buffers = NULL;
+	agent->closing = 0;
+	agent->forked = 0;
+
+	// the virtual machine handles the signals, not our thread
+	sigfillset(&all_signals);
+	pthread_sigmask(SIG_SETMASK, &all_signals, &old_signals);
+	err = pthread_create(&agent->flusher, NULL, flush_thread, agent);
+	pthread_sigmask(SIG_SETMASK, &old_signals, NULL);
+
+	if (err) {
+		pthread_key_delete(agent->key);
+		errno = err;
+		return -1;
+	}
+
+	pthread_once(&atfork_once, register_atfork);
+	pthread_mutex_lock(&agents_lock);
+	agent->next = agents;
+	agents = agent;
+	pthread_mutex_unlock(&agents_lock);
+
+	return 0;
+}
+
+
 op_agent_t op_open_agent(void)
 {
 	char pad_bytes[7] = {0, 0, 0, 0, 0, 0, 0};
@@ -132,7 +451,7 @@ op_agent_t op_open_agent(void)
 	struct jitheader header;
 	int fd;
 	struct timeval tv;
-	FILE * dumpfile = NULL;
+	struct agent * agent;
 
 	rc = stat(AGENT_DIR, &dirstat);
 	if (rc || !S_ISDIR(dirstat.st_mode)) {
@@ -147,18 +466,14 @@ op_agent_t op_open_agent(void)
 	snprintf(dump_path, PATH_MAX, "%s/%i.dump", AGENT_DIR, getpid());
 	snprintf(err_msg, PATH_MAX + 16, "Error opening %s\n", dump_path);
 	// make the dump file only accessible for the user for security reason.
-	fd = creat(dump_path, S_IRUSR|S_IWUSR);
+	fd = open(dump_path, O_WRONLY | O_CREAT | O_TRUNC | O_APPEND,
+		  S_IRUSR|S_IWUSR);
 	if (fd == -1) {
 		fprintf(stderr, "%s\n", err_msg);
 		return NULL;
 	}
-	dumpfile = fdopen(fd, "w");
-	if (!dumpfile) {
-		fprintf(stderr, "%s\n", err_msg);
-		return NULL;
-	}
 	if (define_bfd_vars())
-		return NULL;
+		goto fail;
 	header.magic = JITHEADER_MAGIC;
 	header.version = JITHEADER_VERSION;
 	header.totalsize = sizeof(header) + strlen(_bfd_target_name) + 1;
@@ -169,27 +484,37 @@ op_agent_t op_open_agent(void)
 	header.bfd_mach = _bfd_mach;
 	if (gettimeofday(&tv, NULL)) {
 		fprintf(stderr, "gettimeofday failed\n");
-		return NULL;
+		goto fail;
 	}
 
 	header.timestamp = tv.tv_sec;
 	snprintf(err_msg, PATH_MAX + 16, "Error writing to %s", dump_path);
-	if (!fwrite(&header, sizeof(header), 1, dumpfile)) {
+	if (write_all(fd, &header, sizeof(header)) ||
+	    write_all(fd, _bfd_target_name, strlen(_bfd_target_name) + 1) ||
+	    /* write padding '\0' if necessary */
+	    (pad_cnt && write_all(fd, pad_bytes, pad_cnt))) {
 		fprintf(stderr, "%s\n", err_msg);
-		return NULL;
+		goto fail;
 	}
-	if (!fwrite(_bfd_target_name, strlen(_bfd_target_name) + 1, 1,
-		    dumpfile)) {
-		fprintf(stderr, "%s\n", err_msg);
-		return NULL;
+
+	agent = malloc(sizeof(struct agent));
+	if (!agent) {
+		errno = ENOMEM;
+		goto fail;
 	}
-	/* write padding '\0' if necessary */
-	if (pad_cnt && !fwrite(pad_bytes, pad_cnt, 1, dumpfile)) {
-		fprintf(stderr, "%s\n", err_msg);
-		return NULL;
+	agent->fd = fd;
+	if (start_agent(agent)) {
+		free(agent);
+		goto fail;
 	}
-	fflush(dumpfile);
-	return (op_agent_t)dumpfile;
+
+	return (op_agent_t)agent;
+
+fail:
+	rc = errno;
+	close(fd);
+	errno = rc;
+	return NULL;
 }
 
 
@@ -197,8 +522,11 @@ int op_close_agent(op_agent_t hdl)
 {
 	struct jr_code_close rec;
 	struct timeval tv;
-	FILE * dumpfile = (FILE *) hdl;
-	if (!dumpfile) {
+	struct agent * agent = hdl;
+	struct agent ** pos;
+	int rc;
+
+	if (!agent) {
 		errno = EINVAL;
 		return -1;
 	}
@@ -210,11 +538,42 @@ int op_close_agent(op_agent_t hdl)
 	}
 	rec.timestamp = tv.tv_sec;
 
-	if (!fwrite(&rec, sizeof(rec), 1, dumpfile))
-		return -1;
-	fclose(dumpfile);
-	dumpfile = NULL;
-	return 0;
+	pthread_mutex_lock(&agents_lock);
+	for (pos = &agents; *pos != agent; pos = &(*pos)->next)
+		;
+	*pos = agent->next;
+	pthread_mutex_unlock(&agents_lock);
+
+	/* stop the flush thread before the buffers go away, a forked child
+	 * has none */
+	if (!agent->forked) {
+		pthread_mutex_lock(&agent->lock);
+		agent->closing = 1;
+		pthread_cond_signal(&agent->cond);
+		pthread_mutex_unlock(&agent->lock);
+		pthread_join(agent->flusher, NULL);
+	}
+
+	/* the buffers of the threads still running are freed below */
+	pthread_key_delete(agent->key);
+
+	/* a thread exiting meanwhile unlinks its buffer under the lock */
+	pthread_mutex_lock(&agent->lock);
+	rc = flush_all(agent);
+	while (agent->buffers) {
+		struct agent_buffer * buf = agent->buffers;
+		agent->buffers = buf->next;
+		free_buffer(buf);
+	}
+	pthread_mutex_unlock(&agent->lock);
+
+	if (write_all(agent->fd, &rec, sizeof(rec)))
+		rc = -1;
+	close(agent->fd);
+	pthread_mutex_destroy(&agent->lock);
+	pthread_cond_destroy(&agent->cond);
+	free(agent);
+	return rc;
 }
 
 
@@ -226,9 +585,10 @@ int op_write_native_code(op_agent_t hdl, char const * symbol_name,
 	size_t sz_symb_name;
 	char pad_bytes[7] = { 0, 0, 0, 0, 0, 0, 0 };
 	size_t padding_count;
-	FILE * dumpfile = (FILE *) hdl;
+	struct agent * agent = hdl;
+	struct agent_buffer * buf;
 
-	if (!dumpfile) {
+	if (!agent) {
 		errno = EINVAL;
 		fprintf(stderr, "Invalid hdl argument\n");
 		return -1;
@@ -251,27 +611,21 @@ int op_write_native_code(op_agent_t hdl, char const * symbol_name,
 
 	rec.timestamp = tv.tv_sec;
 
-	/* locking makes sure that we continuously write this record, if
-	 * we are called within a multi-threaded context */
-	flockfile(dumpfile);
+	/* the whole record goes to the calling thread's buffer, which is
+	 * appended at once to the dump file */
+	buf = get_buffer(agent, rec.total_size);
+	if (!buf)
+		return -1;
 	/* Write record, symbol name, code (optionally), and (if necessary)
 	 * additonal padding \0 bytes.
 	 */
-	if (fwrite_unlocked(&rec, sizeof(rec), 1, dumpfile) &&
-	    fwrite_unlocked(symbol_name, sz_symb_name, 1, dumpfile)) {
-		if (code)
-			fwrite_unlocked(code, size, 1, dumpfile);
-		if (padding_count)
-			fwrite_unlocked(pad_bytes, padding_count, 1, dumpfile);
-		/* Always flush to ensure conversion code to elf will see
-		 * data as soon as possible */
-		fflush_unlocked(dumpfile);
-		funlockfile(dumpfile);
-		return 0;
-	}
-	fflush_unlocked(dumpfile);
-	funlockfile(dumpfile);
-	return -1;
+	append(buf, &rec, sizeof(rec));
+	append(buf, symbol_name, sz_symb_name);
+	if (code)
+		append(buf, code, size);
+	if (padding_count)
+		append(buf, pad_bytes, padding_count);
+	return commit_buffer(buf);
 }
 
 
@@ -280,15 +634,14 @@ int op_write_debug_line_info(op_agent_t hdl, void const * code,
 			     struct debug_line_info const * compile_map)
 {
 	struct jr_code_debug_info rec;
-	long cur_pos, last_pos;
 	struct timeval tv;
 	size_t i;
 	size_t padding_count;
 	char padd_bytes[7] = {0, 0, 0, 0, 0, 0, 0};
-	int rc = -1;
-	FILE * dumpfile = (FILE *) hdl;
+	struct agent * agent = hdl;
+	struct agent_buffer * buf;
 
-	if (!dumpfile) {
+	if (!agent) {
 		errno = EINVAL;
 		fprintf(stderr, "Invalid hdl argument\n");
 		return -1;
@@ -300,8 +653,14 @@ int op_write_debug_line_info(op_agent_t hdl, void const * code,
 
 	rec.id = JIT_CODE_DEBUG_INFO;
 	rec.code_addr = (uint64_t)(uintptr_t)code;
-	/* will be fixed after writing debug line info */
-	rec.total_size = 0;
+	rec.total_size = sizeof(rec);
+	for (i = 0; i < nr_entry; ++i) {
+		rec.total_size += sizeof(compile_map[i].vma) +
+			sizeof(compile_map[i].lineno) +
+			strlen(compile_map[i].filename) + 1;
+	}
+	padding_count = PADDING_8ALIGNED(rec.total_size);
+	rec.total_size += padding_count;
 	rec.nr_entry = nr_entry;
 	if (gettimeofday(&tv, NULL)) {
 		fprintf(stderr, "gettimeofday failed\n");
@@ -310,44 +669,21 @@ int op_write_debug_line_info(op_agent_t hdl, void const * code,
 
 	rec.timestamp = tv.tv_sec;
 
-	flockfile(dumpfile);
+	buf = get_buffer(agent, rec.total_size);
+	if (!buf)
+		return -1;
 
-	if ((cur_pos = ftell(dumpfile)) == -1l)
-		goto error;
-	if (!fwrite_unlocked(&rec, sizeof(rec), 1, dumpfile))
-		goto error;
+	append(buf, &rec, sizeof(rec));
 	for (i = 0; i < nr_entry; ++i) {
-		if (!fwrite_unlocked(&compile_map[i].vma,
-				     sizeof(compile_map[i].vma), 1,
-				     dumpfile) ||
-		    !fwrite_unlocked(&compile_map[i].lineno,
-				     sizeof(compile_map[i].lineno), 1,
-				     dumpfile) ||
-		    !fwrite_unlocked(compile_map[i].filename,
-				     strlen(compile_map[i].filename) + 1, 1,
-				     dumpfile))
-			goto error;
-	}
-
-	if ((last_pos = ftell(dumpfile)) == -1l)
-		goto error;
-	rec.total_size = last_pos - cur_pos;
-	padding_count = PADDING_8ALIGNED(rec.total_size);
-	rec.total_size += padding_count;
-	if (padding_count && !fwrite(padd_bytes, padding_count, 1, dumpfile))
-		goto error;
-	if (fseek(dumpfile, cur_pos, SEEK_SET) == -1l)
-		goto error;
-	if (!fwrite_unlocked(&rec, sizeof(rec), 1, dumpfile))
-		goto error;
-	if (fseek(dumpfile, last_pos + padding_count, SEEK_SET) == -1)
-		goto error;
-
-	rc = 0;
-error:
-	fflush_unlocked(dumpfile);
-	funlockfile(dumpfile);
-	return rc;
+		append(buf, &compile_map[i].vma, sizeof(compile_map[i].vma));
+		append(buf, &compile_map[i].lineno,
+		       sizeof(compile_map[i].lineno));
+		append(buf, compile_map[i].filename,
+		       strlen(compile_map[i].filename) + 1);
+	}
+	if (padding_count)
+		append(buf, padd_bytes, padding_count);
+	return commit_buffer(buf);
 }
 
 
@@ -355,9 +691,10 @@ int op_unload_native_code(op_agent_t hdl, uint64_t vma)
 {
 	struct jr_code_unload rec;
 	struct timeval tv;
-	FILE * dumpfile = (FILE *) hdl;
+	struct agent * agent = hdl;
+	int rc;
 
-	if (!dumpfile) {
+	if (!agent) {
 		errno = EINVAL;
 		fprintf(stderr, "Invalid hdl argument\n");
 		return -1;
@@ -372,10 +709,32 @@ int op_unload_native_code(op_agent_t hdl, uint64_t vma)
 	}
 	rec.timestamp = tv.tv_sec;
 
-	if (!fwrite(&rec, sizeof(rec), 1, dumpfile))
+	/* opjitconv matches an unload with the code load before it in the
+	 * file, which may still be buffered by any thread */
+	pthread_mutex_lock(&agent->lock);
+	rc = flush_all(agent);
+	if (write_all(agent->fd, &rec, sizeof(rec)))
+		rc = -1;
+	pthread_mutex_unlock(&agent->lock);
+	return rc;
+}
+
+
+int op_flush_agent(op_agent_t hdl)
+{
+	struct agent * agent = hdl;
+	int rc;
+
+	if (!agent) {
+		errno = EINVAL;
+		fprintf(stderr, "Invalid hdl argument\n");
 		return -1;
-	fflush(dumpfile);
-	return 0;
+	}
+
+	pthread_mutex_lock(&agent->lock);
+	rc = flush_all(agent);
+	pthread_mutex_unlock(&agent->lock);
+	return rc;
 }
 
 int op_major_version(void)
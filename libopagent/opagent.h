@@ -123,6 +123,20 @@ int op_write_debug_line_info(op_agent_t hdl, void const * code,
  **/
 int op_unload_native_code(op_agent_t hdl, uint64_t vma);
 
+/**
+ * Write the records buffered by all threads to the JIT dump file.
+ * Records are otherwise written once a thread has buffered enough of
+ * them, or about one second after they were reported, and on
+ * op_close_agent(). They are also written before a fork(), the child
+ * then writes each record at once to the same JIT dump file.
+ *
+ * hdl:         Handle returned from an earlier call to op_open_agent()
+ *
+ * Returns 0 on success; -1 otherwise.  If -1 is returned, errno is
+ * set to indicate the nature of the error.
+ **/
+int op_flush_agent(op_agent_t hdl);
+
 /**
  * Returns the major version number of the libopagent library that will be used.
  **/
@@ -0,0 +1,203 @@
+/**
+ * @file aggregate_cache.cpp
+ * On disk cache of the per image results of populate
+ *
+ * @remark Copyright 2010 OProfile authors
+ * @remark Read the file COPYING
+ */
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <cstdio>
+#include <cstring>
+#include <ctime>
+#include <fstream>
+#include <sstream>
+#include <iterator>
+
+#include "aggregate_cache.h"
+#include "odb.h"
+#include "op_sample_file.h"
+#include "op_file.h"
+#include "op_types.h"
+#include "cverb.h"
+
+using namespace std;
+
+namespace {
+
+/// start of an entry file, change it when the entry data layout changes
+char const entry_magic[] = "OPAGGR1\n";
+
+
+/// FNV-1a, only used to name the entry files
+u64 hash_string(string const & str)
+{
+	u64 hash = 0xcbf29ce484222325ULL;
+	for (size_t i = 0; i < str.size(); ++i) {
+		hash ^= (unsigned char)str[i];
+		hash *= 0x100000001b3ULL;
+	}
+	return hash;
+}
+
+
+void put_string(string & out, string const & str)
+{
+	ostringstream os;
+	os << str.size() << '\n';
+	out += os.str();
+	out += str;
+}
+
+
+/// read a string written by put_string() at pos, return false on failure
+bool get_string(string const & in, size_t & pos, string & str)
+{
+	size_t const eol = in.find('\n', pos);
+	if (eol == string::npos)
+		return false;
+
+	istringstream is(in.substr(pos, eol - pos));
+	size_t len;
+	if (!(is >> len) || len > in.size() - eol - 1)
+		return false;
+
+	str = in.substr(eol + 1, len);
+	pos = eol + 1 + len;
+	return true;
+}
+
+}  // anonymous namespace
+
+
+aggregate_cache & aggregate_cache::instance()
+{
+	static aggregate_cache cache;
+	return cache;
+}
+
+
+void aggregate_cache::set_directory(string const & dir)
+{
+	directory = dir;
+	if (!directory.empty() && directory[directory.size() - 1] != '/')
+		directory += '/';
+}
+
+
+string aggregate_cache::entry_filename(string const & id) const
+{
+	char name[32];
+	snprintf(name, sizeof(name), "%016llx",
+	         (unsigned long long)hash_string(id));
+	return directory + name;
+}
+
+
+bool aggregate_cache::get(string const & id, string const & fingerprint,
+                          string & data) const
+{
+	if (!enabled())
+		return false;
+
+	string const filename = entry_filename(id);
+	ifstream in(filename.c_str(), ios::in | ios::binary);
+	if (!in)
+		return false;
+
+	string entry((istreambuf_iterator<char>(in)),
+	             istreambuf_iterator<char>());
+
+	size_t const magic_size = sizeof(entry_magic) - 1;
+	if (entry.compare(0, magic_size, entry_magic))
+		return false;
+
+	size_t pos = magic_size;
+	string entry_id;
+	string entry_fingerprint;
+	if (!get_string(entry, pos, entry_id) || entry_id != id ||
+	    !get_string(entry, pos, entry_fingerprint) ||
+	    entry_fingerprint != fingerprint ||
+	    !get_string(entry, pos, data)) {
+		cverb << vsfile << "aggregate_cache: stale entry "
+		      << filename << endl;
+		return false;
+	}
+
+	cverb << vsfile << "aggregate_cache: using entry " << filename << endl;
+	return true;
+}
+
+
+void aggregate_cache::put(string const & id, string const & fingerprint,
+                          string const & data) const
+{
+	if (!enabled())
+		return;
+
+	string const filename = entry_filename(id);
+	if (create_path(filename.c_str()))
+		return;
+
+	string entry(entry_magic);
+	put_string(entry, id);
+	put_string(entry, fingerprint);
+	put_string(entry, data);
+
+	// a concurrent run must never read a partial entry
+	ostringstream tmp;
+	tmp << filename << ".tmp." << getpid();
+
+	ofstream out(tmp.str().c_str(), ios::out | ios::binary | ios::trunc);
+	out.write(entry.data(), entry.size());
+	out.close();
+
+	if (!out || rename(tmp.str().c_str(), filename.c_str()))
+		unlink(tmp.str().c_str());
+}
+
+
+bool aggregate_cache::add_file_stamp(string & fingerprint,
+                                     string const & filename)
+{
+	struct stat st;
+	if (stat(filename.c_str(), &st))
+		return false;
+
+	// a change made in the same second as the one we see would not
+	// change the stamp
+	if (st.st_mtime >= time(0) - 1)
+		return false;
+
+	ostringstream os;
+	os << filename << ' ' << st.st_dev << ' ' << st.st_ino << ' '
+	   << st.st_size << ' ' << st.st_mtime << '\n';
+	fingerprint += os.str();
+	return true;
+}
+
+
+bool aggregate_cache::add_samples_stamp(string & fingerprint,
+                                        string const & filename)
+{
+	// the odb descr follows the header
+	char head[sizeof(opd_header) + sizeof(odb_descr_t)];
+	if (odb_read_header(filename.c_str(), head, sizeof(head)))
+		return false;
+
+	odb_descr_t descr;
+	memcpy(&descr, head + sizeof(opd_header), sizeof(descr));
+
+	// odd while the daemon writes samples not flushed yet, zero if the
+	// file was written by a daemon without write generations
+	if (!descr.write_gen || descr.write_gen & 1)
+		return false;
+
+	ostringstream os;
+	os << filename << ' ' << descr.write_gen << '\n';
+	fingerprint += os.str();
+	return true;
+}
@@ -0,0 +1,94 @@
+/**
+ * @file aggregate_cache.h
+ * On disk cache of the per image results of populate
+ *
+ * @remark Copyright 2010 OProfile authors
+ * @remark Read the file COPYING
+ *
+ * Tools run repeatedly against a live session read again every sample
+ * file and redo the symbol attribution of every image, even if most
+ * sample files didn't change since the last run. With a cache directory
+ * set, populate_for_image() stores what it computed for an image, and
+ * a later run whose sample files and binary didn't change reuses it.
+ *
+ * An entry is found by an id naming the image and how it was loaded,
+ * and is valid only if its fingerprint, describing the files read, is
+ * the same. Each id has a single entry so the cache doesn't grow as the
+ * sample files change.
+ */
+
+#ifndef AGGREGATE_CACHE_H
+#define AGGREGATE_CACHE_H
+
+#include <string>
+
+#include "utility.h"
+
+class aggregate_cache : noncopyable {
+public:
+	/// return the cache used by the process
+	static aggregate_cache & instance();
+
+	/// set the cache directory, created if needed, empty to disable
+	void set_directory(std::string const & dir);
+
+	/// return true if a cache directory is set
+	bool enabled() const { return !directory.empty(); }
+
+	/**
+	 * get - find a cache entry
+	 * @param id  the entry id
+	 * @param fingerprint  what the entry must have been stored with
+	 * @param data  filled with the entry data
+	 *
+	 * Return false if there is no valid entry.
+	 */
+	bool get(std::string const & id, std::string const & fingerprint,
+	         std::string & data) const;
+
+	/**
+	 * put - store a cache entry, replacing the previous entry of id.
+	 * Failures are silently ignored, the entry will be computed again
+	 * by the next run.
+	 */
+	void put(std::string const & id, std::string const & fingerprint,
+	         std::string const & data) const;
+
+	/**
+	 * add_file_stamp - describe the state of a file
+	 * @param fingerprint  where to append the description
+	 * @param filename  the file
+	 *
+	 * The description changes when the file is modified. Return false
+	 * if the file can't be described reliably, i.e. it can't be found
+	 * or it was modified too recently for its mtime to tell a later
+	 * change.
+	 */
+	static bool add_file_stamp(std::string & fingerprint,
+	                           std::string const & filename);
+
+	/**
+	 * add_samples_stamp - describe the samples of a sample file
+	 * @param fingerprint  where to append the description
+	 * @param filename  the sample file, possibly stored in a container
+	 *
+	 * The daemon writes sample files through a shared mapping, their
+	 * mtime doesn't change on each write, so the description is the
+	 * write generation the daemon keeps in the file, see
+	 * odb_commit_writes(). Only the file header is read. Return false
+	 * if the file can't be read, is being written or was written by a
+	 * daemon without write generations.
+	 */
+	static bool add_samples_stamp(std::string & fingerprint,
+	                              std::string const & filename);
+
+private:
+	aggregate_cache() {}
+
+	/// the file holding the entry of id
+	std::string entry_filename(std::string const & id) const;
+
+	std::string directory;
+};
+
+#endif /* !AGGREGATE_CACHE_H */
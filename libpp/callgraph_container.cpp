@@ -27,6 +27,7 @@
 #include "populate.h"
 #include "string_filter.h"
 #include "op_bfd.h"
+#include "image_cache.h"
 #include "op_sample_file.h"
 #include "locate_images.h"
 
@@ -462,9 +463,11 @@ void callgraph_container::populate(list<string> const & cg_files,
 			report_image_error(caller_file.lib_image,
 					   error, false, extra_found_images);
 
+		// the same images appear in many callgraph files
 		bool caller_bfd_ok = true;
-		op_bfd caller_bfd(caller_file.lib_image,
-			string_filter(), extra_found_images, caller_bfd_ok);
+		op_bfd_ref caller_bfd = image_cache::instance().get(
+			caller_file.lib_image, string_filter(),
+			extra_found_images, caller_bfd_ok);
 		if (!caller_bfd_ok)
 			report_image_error(caller_file.lib_image,
 			                   image_format_failure, false,
@@ -480,8 +483,9 @@ void callgraph_container::populate(list<string> const & cg_files,
 					   error, false, extra_found_images);
 
 		bool callee_bfd_ok = true;
-		op_bfd callee_bfd(callee_file.cg_image,
-			string_filter(), extra_found_images, callee_bfd_ok);
+		op_bfd_ref callee_bfd = image_cache::instance().get(
+			callee_file.cg_image, string_filter(),
+			extra_found_images, callee_bfd_ok);
 		if (!callee_bfd_ok)
 			report_image_error(callee_file.cg_image,
 		                           image_format_failure, false,
@@ -491,7 +495,7 @@ void callgraph_container::populate(list<string> const & cg_files,
 		// We can't use start_offset support in profile_t, give
 		// it a zero offset and we will fix that in add()
 		profile.add_sample_file(*it);
-		add(profile, caller_bfd, caller_bfd_ok, callee_bfd,
+		add(profile, *caller_bfd, caller_bfd_ok, *callee_bfd,
 		    merge_lib ? app_image : app_name, pc,
 		    debug_info, pclass);
 	}
@@ -0,0 +1,79 @@
+/**
+ * @file export_format.h
+ * Binary export format of a profiling session
+ *
+ * @remark Copyright 2010 OProfile authors
+ * @remark Read the file COPYING
+ *
+ * An export file is written by opreport --export and read through
+ * export_reader. It is written one image at a time, so neither the
+ * writer nor the reader need to hold more than one image.
+ *
+ * All integers are unsigned LEB128, signed ones are zigzag encoded
+ * first. A string is its length followed by its bytes. The file is:
+ *
+ *  magic "OPEXPRT\n"
+ *  version
+ *  cpuinfo, event: strings as in opreport --xml
+ *  nr_classes, then name and long name of each profile class
+ *  blocks, each one is a tag byte, the payload size and the payload
+ *
+ * Rows inside a block are stored by column: all values of the first
+ * column, then all values of the second and so on. String columns are
+ * indexes in the block string table. The blocks are:
+ *
+ *  export_block_image, the samples of one image for one class:
+ *   pclass
+ *   nr_strings, then the strings
+ *   image, app, embedding filename: string indexes
+ *   spu_offset
+ *   nr_symbols
+ *   symbol columns: name, sym_index, vma (signed delta to the previous
+ *    symbol vma), size, count, filename, linenr, nr_samples
+ *   nr_samples
+ *   sample columns: vma (signed delta to the previous sample vma),
+ *    count, filename, linenr
+ *  filename is 1 + a string index, 0 if there is no source location.
+ *  The samples of a symbol follow the ones of the previous symbol.
+ *
+ *  export_block_arcs, the call graph arcs of one call graph file:
+ *   pclass
+ *   nr_strings, then the strings
+ *   app: string index
+ *   nr_arcs
+ *   arc columns: caller image, caller symbol, caller vma (signed
+ *    delta), callee image, callee symbol, callee vma (signed delta),
+ *    count
+ *
+ *  export_block_data, the data address samples of one sample file, see
+ *  opd_header::data_shift:
+ *   pclass
+ *   nr_strings, then the strings
+ *   image, app: string indexes
+ *   data_shift
+ *   nr_lines
+ *   line columns: line (signed delta to the previous line), count
+ *  A line is the data address shifted right by data_shift, so the cache
+ *  line or the page accessed. Lines are sorted.
+ *
+ *  export_block_end, the last block:
+ *   nr_classes, then the total count of each class
+ *
+ * Readers must skip blocks with an unknown tag.
+ */
+
+#ifndef EXPORT_FORMAT_H
+#define EXPORT_FORMAT_H
+
+#define OP_EXPORT_MAGIC "OPEXPRT\n"
+#define OP_EXPORT_MAGIC_SIZE 8
+#define OP_EXPORT_VERSION 1
+
+enum export_block_tag {
+	export_block_image = 'I',
+	export_block_arcs = 'A',
+	export_block_data = 'D',
+	export_block_end = 'E'
+};
+
+#endif /* !EXPORT_FORMAT_H */
@@ -0,0 +1,364 @@
+/**
+ * @file export_reader.cpp
+ * Read a profiling session written in the binary export format
+ *
+ * @remark Copyright 2010 OProfile authors
+ * @remark Read the file COPYING
+ */
+
+#include <cstring>
+#include <algorithm>
+
+#include "export_reader.h"
+#include "export_format.h"
+#include "op_exception.h"
+
+using namespace std;
+
+namespace {
+
+/// decode the values of a payload
+class decoder {
+public:
+	decoder(string const & buf, string const & filename_)
+		: pos(buf.data()), end(buf.data() + buf.size()),
+		  filename(filename_) {}
+
+	u64 get_uleb() {
+		u64 value = 0;
+		for (unsigned int shift = 0; ; shift += 7) {
+			if (pos == end || shift >= 64)
+				corrupted();
+			unsigned char const byte = *pos++;
+			value |= u64(byte & 0x7f) << shift;
+			if (!(byte & 0x80))
+				return value;
+		}
+	}
+
+	u64 get_delta(u64 & prev) {
+		u64 const zz = get_uleb();
+		prev += (zz >> 1) ^ -(zz & 1);
+		return prev;
+	}
+
+	string get_string() {
+		u64 const len = get_uleb();
+		if (u64(end - pos) < len)
+			corrupted();
+		string str(pos, len);
+		pos += len;
+		return str;
+	}
+
+	/// read a string index of strings
+	string const & get_string(vector<string> const & strings) {
+		u64 const idx = get_uleb();
+		if (idx >= strings.size())
+			corrupted();
+		return strings[idx];
+	}
+
+	/// read a block string table
+	void get_strings(vector<string> & strings) {
+		strings.resize(get_count());
+		for (size_t i = 0; i < strings.size(); ++i)
+			strings[i] = get_string();
+	}
+
+	/// read a nr of items, each one being at least one byte
+	size_t get_count() {
+		u64 const nr = get_uleb();
+		if (nr > u64(end - pos))
+			corrupted();
+		return nr;
+	}
+
+	void corrupted() const {
+		throw op_runtime_error("export_reader: " + filename +
+		                       " is corrupted");
+	}
+
+private:
+	char const * pos;
+	char const * end;
+	string const & filename;
+};
+
+
+/// read a LEB128 value from a stream, return false at the end of stream
+bool read_uleb(istream & in, u64 & value)
+{
+	value = 0;
+	for (unsigned int shift = 0; shift < 64; shift += 7) {
+		int const byte = in.get();
+		if (byte == EOF)
+			return false;
+		value |= u64(byte & 0x7f) << shift;
+		if (!(byte & 0x80))
+			return true;
+	}
+	return false;
+}
+
+
+/// header strings and nr of classes are smaller than this
+size_t const max_header_size = 1 << 20;
+
+
+/// read a header string from a stream, return false on failure
+bool read_string(istream & in, string & str)
+{
+	u64 len;
+	if (!read_uleb(in, len) || len > max_header_size)
+		return false;
+
+	str.resize(len);
+	if (len)
+		in.read(&str[0], len);
+	return bool(in);
+}
+
+}  // anonymous namespace
+
+
+export_reader::export_reader(string const & filename_)
+	: filename(filename_), pclass_(0), at_end(false)
+{
+	in.open(filename.c_str(), ios::in | ios::binary);
+	if (!in)
+		throw op_runtime_error("export_reader: cannot open " + filename);
+
+	char magic[OP_EXPORT_MAGIC_SIZE];
+	in.read(magic, sizeof(magic));
+	if (!in || memcmp(magic, OP_EXPORT_MAGIC, sizeof(magic))) {
+		throw op_runtime_error("export_reader: " + filename +
+		                       " is not an export file");
+	}
+
+	u64 version;
+	if (!read_uleb(in, version) || version != OP_EXPORT_VERSION) {
+		throw op_runtime_error("export_reader: " + filename +
+		                       " has an unsupported version");
+	}
+
+	u64 nr_classes = 0;
+	bool ok = read_string(in, session_.cpuinfo) &&
+		read_string(in, session_.event) &&
+		read_uleb(in, nr_classes) && nr_classes <= max_header_size;
+
+	session_.classes.resize(ok ? nr_classes : 0);
+	for (size_t i = 0; ok && i < session_.classes.size(); ++i) {
+		ok = read_string(in, session_.classes[i].name) &&
+			read_string(in, session_.classes[i].longname);
+	}
+
+	if (!ok)
+		throw op_runtime_error("export_reader: " + filename +
+		                       " is truncated");
+}
+
+
+export_reader::block_type export_reader::next()
+{
+	while (!at_end) {
+		int const tag = in.get();
+		u64 size;
+		if (tag == EOF || !read_uleb(in, size)) {
+			throw op_runtime_error("export_reader: " + filename +
+			                       " is truncated");
+		}
+
+		string payload;
+		// read by chunk so a corrupted size can't exhaust memory
+		while (payload.size() < size) {
+			char buf[65536];
+			size_t const chunk = min(u64(sizeof(buf)),
+			                         size - payload.size());
+			in.read(buf, chunk);
+			if (!in) {
+				throw op_runtime_error("export_reader: " +
+				        filename + " is truncated");
+			}
+			payload.append(buf, chunk);
+		}
+
+		switch (tag) {
+		case export_block_image:
+			read_image(payload);
+			return image_block;
+		case export_block_arcs:
+			read_arcs(payload);
+			return arcs_block;
+		case export_block_data:
+			read_data(payload);
+			return data_block;
+		case export_block_end:
+			read_end(payload);
+			at_end = true;
+			break;
+		default:
+			// written by a later version, skip it
+			break;
+		}
+	}
+
+	return end_block;
+}
+
+
+void export_reader::read_image(string const & payload)
+{
+	typedef profile_container::add_record::symbol symbol;
+	typedef profile_container::add_record::sample sample;
+
+	decoder in(payload, filename);
+	profile_container::add_record & record = image_;
+
+	pclass_ = in.get_uleb();
+	if (pclass_ >= session_.classes.size())
+		in.corrupted();
+	record.pclass = pclass_;
+
+	vector<string> strings;
+	in.get_strings(strings);
+
+	record.image_name = in.get_string(strings);
+	record.app_name = in.get_string(strings);
+	record.embedding_filename = in.get_string(strings);
+	record.spu_offset = in.get_uleb();
+
+	// source filenames are renumbered in their order of use
+	record.filenames.clear();
+	vector<size_t> file_map(strings.size() + 1, 0);
+
+	vector<symbol> & symbols = record.symbols;
+	vector<sample> & samples = record.samples;
+	u64 prev;
+
+	symbols.resize(in.get_count());
+	for (size_t i = 0; i < symbols.size(); ++i)
+		symbols[i].name = in.get_string(strings);
+	for (size_t i = 0; i < symbols.size(); ++i)
+		symbols[i].sym_index = in.get_uleb();
+	prev = 0;
+	for (size_t i = 0; i < symbols.size(); ++i)
+		symbols[i].vma = in.get_delta(prev);
+	for (size_t i = 0; i < symbols.size(); ++i)
+		symbols[i].size = in.get_uleb();
+	for (size_t i = 0; i < symbols.size(); ++i)
+		symbols[i].count = in.get_uleb();
+	for (size_t i = 0; i < symbols.size(); ++i)
+		symbols[i].filename = in.get_uleb();
+	for (size_t i = 0; i < symbols.size(); ++i)
+		symbols[i].linenr = in.get_uleb();
+	size_t total_samples = 0;
+	for (size_t i = 0; i < symbols.size(); ++i) {
+		symbols[i].nr_samples = in.get_uleb();
+		total_samples += symbols[i].nr_samples;
+	}
+
+	samples.resize(in.get_count());
+	if (samples.size() != total_samples)
+		in.corrupted();
+	prev = 0;
+	for (size_t i = 0; i < samples.size(); ++i)
+		samples[i].vma = in.get_delta(prev);
+	for (size_t i = 0; i < samples.size(); ++i)
+		samples[i].count = in.get_uleb();
+	for (size_t i = 0; i < samples.size(); ++i)
+		samples[i].filename = in.get_uleb();
+	for (size_t i = 0; i < samples.size(); ++i)
+		samples[i].linenr = in.get_uleb();
+
+	// map 1 + string index to 1 + index in record.filenames
+	for (size_t i = 0; i < symbols.size() + samples.size(); ++i) {
+		size_t & filename = i < symbols.size()
+			? symbols[i].filename
+			: samples[i - symbols.size()].filename;
+		if (filename >= file_map.size())
+			in.corrupted();
+		if (filename && !file_map[filename]) {
+			record.filenames.push_back(strings[filename - 1]);
+			file_map[filename] = record.filenames.size();
+		}
+		filename = file_map[filename];
+	}
+}
+
+
+void export_reader::read_arcs(string const & payload)
+{
+	decoder in(payload, filename);
+
+	pclass_ = in.get_uleb();
+	if (pclass_ >= session_.classes.size())
+		in.corrupted();
+
+	vector<string> strings;
+	in.get_strings(strings);
+
+	arcs_app_ = in.get_string(strings);
+
+	u64 prev;
+
+	arcs_.resize(in.get_count());
+	for (size_t i = 0; i < arcs_.size(); ++i)
+		arcs_[i].caller_image = in.get_string(strings);
+	for (size_t i = 0; i < arcs_.size(); ++i)
+		arcs_[i].caller_symbol = in.get_string(strings);
+	prev = 0;
+	for (size_t i = 0; i < arcs_.size(); ++i)
+		arcs_[i].caller_vma = in.get_delta(prev);
+	for (size_t i = 0; i < arcs_.size(); ++i)
+		arcs_[i].callee_image = in.get_string(strings);
+	for (size_t i = 0; i < arcs_.size(); ++i)
+		arcs_[i].callee_symbol = in.get_string(strings);
+	prev = 0;
+	for (size_t i = 0; i < arcs_.size(); ++i)
+		arcs_[i].callee_vma = in.get_delta(prev);
+	for (size_t i = 0; i < arcs_.size(); ++i)
+		arcs_[i].count = in.get_uleb();
+}
+
+
+void export_reader::read_data(string const & payload)
+{
+	decoder in(payload, filename);
+
+	pclass_ = in.get_uleb();
+	if (pclass_ >= session_.classes.size())
+		in.corrupted();
+
+	vector<string> strings;
+	in.get_strings(strings);
+
+	data_.image = in.get_string(strings);
+	data_.app = in.get_string(strings);
+	u64 const data_shift = in.get_uleb();
+	if (!data_shift || data_shift >= 64)
+		in.corrupted();
+	data_.data_shift = data_shift;
+
+	vector<pair<u64, count_type> > & lines = data_.lines;
+	u64 prev;
+
+	lines.resize(in.get_count());
+	prev = 0;
+	for (size_t i = 0; i < lines.size(); ++i)
+		lines[i].first = in.get_delta(prev);
+	for (size_t i = 0; i < lines.size(); ++i)
+		lines[i].second = in.get_uleb();
+}
+
+
+void export_reader::read_end(string const & payload)
+{
+	decoder in(payload, filename);
+
+	totals_.resize(in.get_count());
+	if (totals_.size() != session_.classes.size())
+		in.corrupted();
+	for (size_t i = 0; i < totals_.size(); ++i)
+		totals_[i] = in.get_uleb();
+}
@@ -0,0 +1,108 @@
+/**
+ * @file export_reader.h
+ * Read a profiling session written in the binary export format
+ *
+ * @remark Copyright 2010 OProfile authors
+ * @remark Read the file COPYING
+ *
+ * Tools reading an export file don't need anything else from libpp,
+ * an image block is returned as the profile_container::add_record it
+ * was written from, so it can also be added to a profile_container.
+ */
+
+#ifndef EXPORT_READER_H
+#define EXPORT_READER_H
+
+#include <string>
+#include <vector>
+#include <fstream>
+#include <utility>
+
+#include "export_writer.h"
+#include "profile_container.h"
+#include "utility.h"
+#include "op_types.h"
+
+/// the data address samples of one sample file, see opd_header::data_shift
+struct export_data {
+	std::string image;
+	std::string app;
+	/// a line is a data address shifted right by data_shift
+	unsigned int data_shift;
+	/// the count of each line, sorted by line
+	std::vector<std::pair<u64, count_type> > lines;
+};
+
+
+/// a call graph arc between two symbols
+struct export_arc {
+	std::string caller_image;
+	std::string caller_symbol;
+	bfd_vma caller_vma;
+	std::string callee_image;
+	std::string callee_symbol;
+	bfd_vma callee_vma;
+	count_type count;
+};
+
+
+class export_reader : noncopyable {
+public:
+	/// open filename and read its header, throw op_runtime_error on
+	/// failure
+	explicit export_reader(std::string const & filename);
+
+	/// the session description
+	export_session const & session() const { return session_; }
+
+	enum block_type {
+		image_block,
+		arcs_block,
+		data_block,
+		/// the end of the file, the totals are available
+		end_block
+	};
+
+	/**
+	 * Read the next block, return its type. Throw op_runtime_error
+	 * if the file is truncated or corrupted.
+	 */
+	block_type next();
+
+	/// the samples read by the last next() returning image_block
+	profile_container::add_record const & image() const { return image_; }
+
+	/// the arcs read by the last next() returning arcs_block
+	std::vector<export_arc> const & arcs() const { return arcs_; }
+
+	/// the samples read by the last next() returning data_block
+	export_data const & data() const { return data_; }
+
+	/// the class of the last block read
+	size_t pclass() const { return pclass_; }
+
+	/// the owning application of the last arcs block read
+	std::string const & arcs_app() const { return arcs_app_; }
+
+	/// the total count of each class, once next() returned end_block
+	std::vector<u64> const & totals() const { return totals_; }
+
+private:
+	void read_image(std::string const & payload);
+	void read_arcs(std::string const & payload);
+	void read_data(std::string const & payload);
+	void read_end(std::string const & payload);
+
+	std::string filename;
+	std::ifstream in;
+	export_session session_;
+	profile_container::add_record image_;
+	std::vector<export_arc> arcs_;
+	export_data data_;
+	size_t pclass_;
+	std::string arcs_app_;
+	std::vector<u64> totals_;
+	bool at_end;
+};
+
+#endif /* !EXPORT_READER_H */
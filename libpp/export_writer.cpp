@@ -0,0 +1,396 @@
+/**
+ * @file export_writer.cpp
+ * Write a profiling session in the binary export format
+ *
+ * @remark Copyright 2010 OProfile authors
+ * @remark Read the file COPYING
+ */
+
+#include <algorithm>
+#include <map>
+
+#include "export_writer.h"
+#include "export_format.h"
+#include "op_exception.h"
+#include "op_bfd.h"
+#include "image_cache.h"
+#include "image_errors.h"
+#include "parse_filename.h"
+#include "locate_images.h"
+#include "string_filter.h"
+#include "profile.h"
+#include "op_sample_file.h"
+
+using namespace std;
+
+namespace {
+
+void put_uleb(string & out, u64 value)
+{
+	do {
+		unsigned char byte = value & 0x7f;
+		value >>= 7;
+		if (value)
+			byte |= 0x80;
+		out += byte;
+	} while (value);
+}
+
+
+/// zigzag encode the difference to the previous value of a column
+void put_delta(string & out, u64 value, u64 & prev)
+{
+	long long const delta = (long long)(value - prev);
+	put_uleb(out, (u64(delta) << 1) ^ u64(delta >> 63));
+	prev = value;
+}
+
+
+void put_string(string & out, string const & str)
+{
+	put_uleb(out, str.size());
+	out += str;
+}
+
+
+/// the string table of a block
+class block_strings {
+public:
+	/// return the index of str, adding it if needed
+	u64 get(string const & str) {
+		map<string, u64>::const_iterator it = index.find(str);
+		if (it != index.end())
+			return it->second;
+		u64 const idx = strings.size();
+		strings.push_back(str);
+		index[str] = idx;
+		return idx;
+	}
+
+	void write(string & out) const {
+		put_uleb(out, strings.size());
+		for (size_t i = 0; i < strings.size(); ++i)
+			put_string(out, strings[i]);
+	}
+
+private:
+	vector<string> strings;
+	map<string, u64> index;
+};
+
+
+// we store {caller,callee} inside a single u64, see callgraph_container
+odb_key_t caller_to_key(u32 value)
+{
+	return odb_key_t(value) << 32;
+}
+
+
+/// find the symbol containing a file offset, return false if none
+bool find_symbol_by_filepos(op_bfd const & bfd, vma_t offset,
+                            symbol_index_t & i)
+{
+	op_bfd_symbol tmpsym(offset, 0, string());
+
+	// sorted by filepos so this will find the nearest
+	vector<op_bfd_symbol>::const_iterator it =
+		upper_bound(bfd.syms.begin(), bfd.syms.end(), tmpsym);
+
+	if (it == bfd.syms.begin())
+		return false;
+	--it;
+
+	if (offset >= it->filepos() + it->size())
+		return false;
+
+	i = distance(bfd.syms.begin(), it);
+	return true;
+}
+
+
+/// return an op_bfd for an image of a call graph file
+op_bfd_ref get_cg_bfd(string const & image, extra_images const & extra,
+                      bool & ok)
+{
+	image_error error;
+	extra.find_image_path(image, error, false);
+	if (error != image_ok)
+		report_image_error(image, error, false, extra);
+
+	ok = true;
+	op_bfd_ref bfd = image_cache::instance().get(image, string_filter(),
+	                                             extra, ok);
+	if (!ok)
+		report_image_error(image, image_format_failure, false, extra);
+
+	return bfd;
+}
+
+
+/// an arc between two symbols
+struct arc {
+	symbol_index_t caller;
+	symbol_index_t callee;
+	count_type count;
+};
+
+}  // anonymous namespace
+
+
+export_writer::export_writer(string const & filename_,
+                             export_session const & session)
+	: filename(filename_), totals(session.classes.size())
+{
+	out.open(filename.c_str(), ios::out | ios::binary | ios::trunc);
+	if (!out) {
+		throw op_runtime_error("export_writer: cannot create "
+		                       + filename);
+	}
+
+	string header(OP_EXPORT_MAGIC, OP_EXPORT_MAGIC_SIZE);
+	put_uleb(header, OP_EXPORT_VERSION);
+	put_string(header, session.cpuinfo);
+	put_string(header, session.event);
+	put_uleb(header, session.classes.size());
+	for (size_t i = 0; i < session.classes.size(); ++i) {
+		put_string(header, session.classes[i].name);
+		put_string(header, session.classes[i].longname);
+	}
+
+	out.write(header.data(), header.size());
+}
+
+
+void export_writer::add(profile_container::add_record const & record)
+{
+	typedef profile_container::add_record::symbol symbol;
+	typedef profile_container::add_record::sample sample;
+
+	vector<symbol> const & symbols = record.symbols;
+	vector<sample> const & samples = record.samples;
+
+	block_strings strings;
+	u64 const image = strings.get(record.image_name);
+	u64 const app = strings.get(record.app_name);
+	u64 const embedding = strings.get(record.embedding_filename);
+
+	// a source filename is 1 + its index in record.filenames
+	vector<u64> filenames(1, 0);
+	for (size_t i = 0; i < record.filenames.size(); ++i)
+		filenames.push_back(1 + strings.get(record.filenames[i]));
+
+	string rows;
+	u64 prev;
+
+	put_uleb(rows, symbols.size());
+	for (size_t i = 0; i < symbols.size(); ++i)
+		put_uleb(rows, strings.get(symbols[i].name));
+	for (size_t i = 0; i < symbols.size(); ++i)
+		put_uleb(rows, symbols[i].sym_index);
+	prev = 0;
+	for (size_t i = 0; i < symbols.size(); ++i)
+		put_delta(rows, symbols[i].vma, prev);
+	for (size_t i = 0; i < symbols.size(); ++i)
+		put_uleb(rows, symbols[i].size);
+	for (size_t i = 0; i < symbols.size(); ++i)
+		put_uleb(rows, symbols[i].count);
+	for (size_t i = 0; i < symbols.size(); ++i)
+		put_uleb(rows, filenames[symbols[i].filename]);
+	for (size_t i = 0; i < symbols.size(); ++i)
+		put_uleb(rows, symbols[i].linenr);
+	for (size_t i = 0; i < symbols.size(); ++i)
+		put_uleb(rows, symbols[i].nr_samples);
+
+	put_uleb(rows, samples.size());
+	prev = 0;
+	for (size_t i = 0; i < samples.size(); ++i)
+		put_delta(rows, samples[i].vma, prev);
+	for (size_t i = 0; i < samples.size(); ++i)
+		put_uleb(rows, samples[i].count);
+	for (size_t i = 0; i < samples.size(); ++i)
+		put_uleb(rows, filenames[samples[i].filename]);
+	for (size_t i = 0; i < samples.size(); ++i)
+		put_uleb(rows, samples[i].linenr);
+
+	string payload;
+	put_uleb(payload, record.pclass);
+	strings.write(payload);
+	put_uleb(payload, image);
+	put_uleb(payload, app);
+	put_uleb(payload, embedding);
+	put_uleb(payload, record.spu_offset);
+	payload += rows;
+
+	write_block(export_block_image, payload);
+
+	for (size_t i = 0; i < symbols.size(); ++i)
+		totals[record.pclass] += symbols[i].count;
+}
+
+
+void export_writer::add_arcs(string const & cg_file, string const & app_name,
+                             size_t pclass, extra_images const & extra)
+{
+	parsed_filename const file = parse_filename(cg_file, extra);
+
+	bool caller_ok;
+	op_bfd_ref caller_bfd = get_cg_bfd(file.lib_image, extra, caller_ok);
+	bool callee_ok;
+	op_bfd_ref callee_bfd = get_cg_bfd(file.cg_image, extra, callee_ok);
+
+	profile_t profile;
+	// the start offset is handled below, see callgraph_container::add()
+	profile.add_sample_file(cg_file);
+
+	opd_header const & header = profile.get_header();
+
+	// arcs from a kernel image can't be resolved without the binary
+	if (header.is_kernel && !caller_ok)
+		return;
+
+	u32 caller_offset;
+	if (header.is_kernel)
+		caller_offset = caller_bfd->get_start_offset(0);
+	else
+		caller_offset = header.anon_start;
+
+	u32 callee_offset;
+	if (header.cg_to_is_kernel)
+		callee_offset = callee_bfd->get_start_offset(0);
+	else
+		callee_offset = header.cg_to_anon_start;
+
+	vector<arc> arcs;
+
+	for (symbol_index_t i = 0; i < caller_bfd->syms.size(); ++i) {
+		unsigned long long start;
+		unsigned long long end;
+		caller_bfd->get_symbol_range(i, start, end);
+
+		// see profile_t::samples_range() for why we need this check
+		if (start <= caller_offset)
+			continue;
+
+		profile_t::iterator_pair p_it = profile.samples_range(
+			caller_to_key(start - caller_offset),
+			caller_to_key(end - caller_offset));
+
+		// callees of one caller are few, a map is cheap enough
+		map<symbol_index_t, count_type> callees;
+		for (; p_it.first != p_it.second; ++p_it.first) {
+			symbol_index_t callee;
+			vma_t const to = p_it.first.vma() & 0xffffffff;
+			if (find_symbol_by_filepos(*callee_bfd,
+			                           to + callee_offset, callee))
+				callees[callee] += p_it.first.count();
+		}
+
+		map<symbol_index_t, count_type>::const_iterator it;
+		for (it = callees.begin(); it != callees.end(); ++it) {
+			arc const a = { i, it->first, it->second };
+			arcs.push_back(a);
+		}
+	}
+
+	if (arcs.empty())
+		return;
+
+	block_strings strings;
+	u64 const app = strings.get(app_name);
+	u64 const caller_image = strings.get(caller_bfd->get_filename());
+	u64 const callee_image = strings.get(callee_bfd->get_filename());
+
+	string rows;
+	u64 prev;
+
+	put_uleb(rows, arcs.size());
+	for (size_t i = 0; i < arcs.size(); ++i)
+		put_uleb(rows, caller_image);
+	for (size_t i = 0; i < arcs.size(); ++i)
+		put_uleb(rows, strings.get(caller_bfd->syms[arcs[i].caller].name()));
+	prev = 0;
+	for (size_t i = 0; i < arcs.size(); ++i)
+		put_delta(rows, caller_bfd->syms[arcs[i].caller].vma(), prev);
+	for (size_t i = 0; i < arcs.size(); ++i)
+		put_uleb(rows, callee_image);
+	for (size_t i = 0; i < arcs.size(); ++i)
+		put_uleb(rows, strings.get(callee_bfd->syms[arcs[i].callee].name()));
+	prev = 0;
+	for (size_t i = 0; i < arcs.size(); ++i)
+		put_delta(rows, callee_bfd->syms[arcs[i].callee].vma(), prev);
+	for (size_t i = 0; i < arcs.size(); ++i)
+		put_uleb(rows, arcs[i].count);
+
+	string payload;
+	put_uleb(payload, pclass);
+	strings.write(payload);
+	put_uleb(payload, app);
+	payload += rows;
+
+	write_block(export_block_arcs, payload);
+}
+
+
+void export_writer::add_data(string const & sample_file,
+                             string const & image_name,
+                             string const & app_name, size_t pclass)
+{
+	vector<profile_t::sample_entry> lines;
+	unsigned int const data_shift =
+		profile_t::data_samples(sample_file, lines);
+	if (lines.empty())
+		return;
+
+	block_strings strings;
+	u64 const image = strings.get(image_name);
+	u64 const app = strings.get(app_name);
+
+	string rows;
+	u64 prev;
+
+	put_uleb(rows, lines.size());
+	prev = 0;
+	for (size_t i = 0; i < lines.size(); ++i)
+		put_delta(rows, lines[i].first, prev);
+	for (size_t i = 0; i < lines.size(); ++i) {
+		put_uleb(rows, lines[i].second);
+		totals[pclass] += lines[i].second;
+	}
+
+	string payload;
+	put_uleb(payload, pclass);
+	strings.write(payload);
+	put_uleb(payload, image);
+	put_uleb(payload, app);
+	put_uleb(payload, data_shift);
+	payload += rows;
+
+	write_block(export_block_data, payload);
+}
+
+
+void export_writer::close()
+{
+	string payload;
+	put_uleb(payload, totals.size());
+	for (size_t i = 0; i < totals.size(); ++i)
+		put_uleb(payload, totals[i]);
+
+	write_block(export_block_end, payload);
+
+	out.close();
+	if (!out)
+		throw op_runtime_error("export_writer: cannot write " + filename);
+}
+
+
+void export_writer::write_block(char tag, string const & payload)
+{
+	string header(1, tag);
+	put_uleb(header, payload.size());
+
+	out.write(header.data(), header.size());
+	out.write(payload.data(), payload.size());
+	if (!out)
+		throw op_runtime_error("export_writer: cannot write " + filename);
+}
@@ -0,0 +1,88 @@
+/**
+ * @file export_writer.h
+ * Write a profiling session in the binary export format
+ *
+ * @remark Copyright 2010 OProfile authors
+ * @remark Read the file COPYING
+ */
+
+#ifndef EXPORT_WRITER_H
+#define EXPORT_WRITER_H
+
+#include <string>
+#include <vector>
+#include <fstream>
+
+#include "profile_container.h"
+#include "utility.h"
+#include "op_types.h"
+
+class extra_images;
+
+/// what describes a session in an export file
+struct export_session {
+	struct profile_class {
+		std::string name;
+		std::string longname;
+	};
+
+	std::string cpuinfo;
+	std::string event;
+	std::vector<profile_class> classes;
+};
+
+
+/**
+ * Blocks are written as soon as they are added, see export_format.h
+ * for the file layout.
+ */
+class export_writer : noncopyable {
+public:
+	/// create filename, throw op_runtime_error on failure
+	export_writer(std::string const & filename,
+	              export_session const & session);
+
+	/// write the samples of one image for one class
+	void add(profile_container::add_record const & record);
+
+	/**
+	 * add_arcs - write the arcs of a call graph sample file
+	 * @param cg_file  the call graph sample file
+	 * @param app_name  the owning application name of the arcs
+	 * @param pclass  the profile class of cg_file
+	 * @param extra  extra images location
+	 *
+	 * Arcs are resolved to their caller and callee symbols as
+	 * opreport --callgraph does.
+	 */
+	void add_arcs(std::string const & cg_file, std::string const & app_name,
+	              size_t pclass, extra_images const & extra);
+
+	/**
+	 * add_data - write the samples of a data address sample file
+	 * @param sample_file  the sample file
+	 * @param image_name  the image of the sampled instructions
+	 * @param app_name  the owning application name
+	 * @param pclass  the profile class of sample_file
+	 *
+	 * Nothing is written if sample_file doesn't hold data address
+	 * samples, see opd_header::data_shift.
+	 */
+	void add_data(std::string const & sample_file,
+	              std::string const & image_name,
+	              std::string const & app_name, size_t pclass);
+
+	/// write the end block and close the file
+	void close();
+
+private:
+	/// write a block and check the stream state
+	void write_block(char tag, std::string const & payload);
+
+	std::string filename;
+	std::ofstream out;
+	/// total count of each class
+	std::vector<u64> totals;
+};
+
+#endif /* !EXPORT_WRITER_H */
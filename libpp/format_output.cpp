@@ -27,9 +27,12 @@
 #include "profile_container.h"
 #include "callgraph_container.h"
 #include "diff_container.h"
+#include "sample_spill.h"
 #include "arrange_profiles.h"
 #include "xml_output.h"
 #include "xml_utils.h"
+#include "image_cache.h"
+#include "op_bfd.h"
 #include "cverb.h"
 
 using namespace std;
@@ -435,7 +438,8 @@ opreport_formatter::opreport_formatter(profile_container const & p)
 	:
 	formatter(p.extra_found_images),
 	profile(p),
-	need_details(false)
+	need_details(false),
+	spill(0)
 {
 	counts.total = profile.samples_count();
 }
@@ -447,6 +451,12 @@ void opreport_formatter::show_details(bool on_off)
 }
 
 
+void opreport_formatter::set_sample_spill(sample_spill const * s)
+{
+	spill = s;
+}
+
+
 void opreport_formatter::output(ostream & out, symbol_entry const * symb)
 {
 	do_output(out, *symb, symb->sample, counts);
@@ -480,6 +490,16 @@ output_details(ostream & out, symbol_entry const * symb)
 	c.cumulated_samples = count_array_t();
 	c.cumulated_percent = count_array_t();
 
+	vector<sample_entry> samples;
+	if (spill && spill->get(*symb, samples)) {
+		for (size_t i = 0; i < samples.size(); ++i) {
+			out << "  ";
+			do_output(out, *symb, samples[i], c, diff_array_t(),
+			          true);
+		}
+		return;
+	}
+
 	sample_container::samples_iterator it = profile.begin(symb);
 	sample_container::samples_iterator end = profile.end(symb);
 	for (; it != end; ++it) {
@@ -655,7 +675,7 @@ void xml_formatter::output(ostream & out)
 }
 
 bool
-xml_formatter::get_bfd_object(symbol_entry const * symb, op_bfd * & abfd) const
+xml_formatter::get_bfd_object(symbol_entry const * symb, op_bfd_ref & abfd) const
 {
 	bool ok = true;
 
@@ -667,16 +687,14 @@ xml_formatter::get_bfd_object(symbol_entry const * symb, op_bfd * & abfd) const
 		// in future it would work ?
 		string tmp = get_image_name(symb->embedding_filename, 
 			image_name_storage::int_filename, extra_found_images);
-		if (abfd && abfd->get_filename() == tmp)
+		if (abfd.valid() && abfd->get_filename() == tmp)
 			return true;
-		delete abfd;
-		abfd = new op_bfd(symb->spu_offset, tmp,
+		abfd = image_cache::instance().get(symb->spu_offset, tmp,
 				  symbol_filter, extra_found_images, ok);
 	} else {
-		if (abfd && abfd->get_filename() == image_name)
+		if (abfd.valid() && abfd->get_filename() == image_name)
 			return true;
-		delete abfd;
-		abfd = new op_bfd(image_name, symbol_filter,
+		abfd = image_cache::instance().get(image_name, symbol_filter,
 				  extra_found_images, ok);
 
 	}
@@ -684,8 +702,7 @@ xml_formatter::get_bfd_object(symbol_entry const * symb, op_bfd * & abfd) const
 	if (!ok) {
 		report_image_error(image_name, image_format_failure,
 				   false, extra_found_images);
-		delete abfd;
-		abfd = 0;
+		abfd = op_bfd_ref();
 		return false;
 	}
 
@@ -693,7 +710,7 @@ xml_formatter::get_bfd_object(symbol_entry const * symb, op_bfd * & abfd) const
 }
 
 void xml_formatter::
-output_the_symbol_data(ostream & out, symbol_entry const * symb, op_bfd * & abfd)
+output_the_symbol_data(ostream & out, symbol_entry const * symb, op_bfd_ref & abfd)
 {
 	string const name = symbol_names.name(symb->name);
 	assert(name.size() > 0);
@@ -723,7 +740,7 @@ output_the_symbol_data(ostream & out, symbol_entry const * symb, op_bfd * & abfd
 
 			if (need_details) {
 				get_bfd_object(symb, abfd);
-				if (abfd && abfd->symbol_has_contents(symb->sym_index))
+				if (abfd.valid() && abfd->symbol_has_contents(symb->sym_index))
 					xml_support->output_symbol_bytes(bytes_out, symb, sd_it->second, *abfd);
 			}
 		}
@@ -735,7 +752,7 @@ output_the_symbol_data(ostream & out, symbol_entry const * symb, op_bfd * & abfd
 }
 
 void xml_formatter::output_cg_children(ostream & out, 
-	cg_symbol::children const cg_symb, op_bfd * & abfd)
+	cg_symbol::children const cg_symb, op_bfd_ref & abfd)
 {
 	cg_symbol::children::const_iterator cit;
 	cg_symbol::children::const_iterator cend = cg_symb.end();
@@ -756,7 +773,7 @@ void xml_formatter::output_cg_children(ostream & out,
 
 void xml_formatter::output_symbol_data(ostream & out)
 {
-	op_bfd * abfd = NULL;
+	op_bfd_ref abfd;
 	sym_iterator it = symbols.begin();
 	sym_iterator end = symbols.end();
 
@@ -772,8 +789,6 @@ void xml_formatter::output_symbol_data(ostream & out)
 		}
 	}
 	out << close_element(SYMBOL_TABLE);
-
-	delete abfd;
 }
 
 string  xml_formatter::
@@ -29,7 +29,8 @@ class callgraph_container;
 class profile_container;
 class diff_container;
 class extra_images;
-class op_bfd;
+class op_bfd_ref;
+class sample_spill;
 
 struct profile_classes;
 // FIXME: should be passed to the derived class formatter ctor
@@ -186,6 +187,9 @@ public:
 	/// set the output_details boolean
 	void show_details(bool);
 
+	/// take details from spill rather than from the profile container
+	void set_sample_spill(sample_spill const * spill);
+
 private:
  
 	/** output one symbol symb to out according to the output format
@@ -200,6 +204,9 @@ private:
  
 	/// true if we need to show details for each symbols
 	bool need_details;
+
+	/// where details come from if non-NULL
+	sample_spill const * spill;
 };
 
 
@@ -287,13 +294,13 @@ private:
 
 	/// Retrieve a bfd object for this symbol, reopening a new bfd object
 	/// only if necessary
-	bool get_bfd_object(symbol_entry const * symb, op_bfd * & abfd) const;
+	bool get_bfd_object(symbol_entry const * symb, op_bfd_ref & abfd) const;
 
 	void output_the_symbol_data(std::ostream & out,
-		symbol_entry const * symb, op_bfd * & abfd);
+		symbol_entry const * symb, op_bfd_ref & abfd);
 
 	void output_cg_children(std::ostream & out,
-		cg_symbol::children const cg_symb, op_bfd * & abfd);
+		cg_symbol::children const cg_symb, op_bfd_ref & abfd);
 };
 
 // callgraph XML output version
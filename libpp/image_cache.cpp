@@ -0,0 +1,230 @@
+/**
+ * @file image_cache.cpp
+ * Process wide cache of op_bfd objects
+ *
+ * @remark Copyright 2010 OProfile authors
+ * @remark Read the file COPYING
+ */
+
+#include <iostream>
+
+#include "image_cache.h"
+#include "op_bfd.h"
+#include "string_filter.h"
+#include "locate_images.h"
+#include "cverb.h"
+
+using namespace std;
+
+extern verbose vbfd;
+
+struct image_cache_entry {
+	image_cache_entry() : bfd(0), ok(false), refcount(0), size(0) {}
+
+	op_bfd * bfd;
+	/// ok as returned by the op_bfd ctor
+	bool ok;
+	size_t refcount;
+	/// memory_size() of bfd when created
+	size_t size;
+	/// position in image_cache::entries
+	image_cache::entries_t::iterator pos;
+	/// position in image_cache::unused, valid if refcount is zero
+	list<image_cache_entry *>::iterator unused_pos;
+};
+
+
+namespace {
+
+/// default memory limit, in bytes
+size_t const default_memory_limit = 256 * 1024 * 1024;
+
+}  // anonymous namespace
+
+
+op_bfd_ref::op_bfd_ref(image_cache_entry * e)
+	: entry(e)
+{
+	++entry->refcount;
+}
+
+
+op_bfd_ref::op_bfd_ref(op_bfd_ref const & rhs)
+	: entry(rhs.entry)
+{
+	if (entry)
+		++entry->refcount;
+}
+
+
+op_bfd_ref::~op_bfd_ref()
+{
+	if (entry && --entry->refcount == 0)
+		image_cache::instance().release(entry);
+}
+
+
+op_bfd_ref & op_bfd_ref::operator=(op_bfd_ref const & rhs)
+{
+	// rhs first in case of self assignment
+	if (rhs.entry)
+		++rhs.entry->refcount;
+	if (entry && --entry->refcount == 0)
+		image_cache::instance().release(entry);
+	entry = rhs.entry;
+	return *this;
+}
+
+
+op_bfd & op_bfd_ref::operator*() const
+{
+	return *entry->bfd;
+}
+
+
+op_bfd * op_bfd_ref::operator->() const
+{
+	return entry->bfd;
+}
+
+
+bool image_cache::key_t::operator<(key_t const & rhs) const
+{
+	if (filename != rhs.filename)
+		return filename < rhs.filename;
+	if (spu_offset != rhs.spu_offset)
+		return spu_offset < rhs.spu_offset;
+	if (extra_uid != rhs.extra_uid)
+		return extra_uid < rhs.extra_uid;
+	if (ok != rhs.ok)
+		return ok < rhs.ok;
+	return filter < rhs.filter;
+}
+
+
+image_cache::image_cache()
+	: memory_used(0), memory_limit(default_memory_limit)
+{
+}
+
+
+image_cache::~image_cache()
+{
+	// handles still alive at exit are dangling from now on
+	entries_t::iterator it = entries.begin();
+	for (; it != entries.end(); ++it) {
+		delete it->second->bfd;
+		delete it->second;
+	}
+}
+
+
+image_cache & image_cache::instance()
+{
+	// built on first use, so it is destroyed before the globals
+	// used by op_bfd
+	static image_cache cache;
+	return cache;
+}
+
+
+op_bfd_ref image_cache::get(string const & filename,
+                            string_filter const & symbol_filter,
+                            extra_images const & extra, bool & ok)
+{
+	key_t key;
+	key.filename = filename;
+	key.spu_offset = 0;
+	return get(key, symbol_filter, extra, ok);
+}
+
+
+op_bfd_ref image_cache::get(uint64_t spu_offset, string const & filename,
+                            string_filter const & symbol_filter,
+                            extra_images const & extra, bool & ok)
+{
+	key_t key;
+	key.filename = filename;
+	key.spu_offset = spu_offset;
+	return get(key, symbol_filter, extra, ok);
+}
+
+
+op_bfd_ref image_cache::get(key_t const & key_in,
+                            string_filter const & symbol_filter,
+                            extra_images const & extra, bool & ok)
+{
+	key_t key(key_in);
+	key.filter = symbol_filter.id();
+	key.extra_uid = extra.get_uid();
+	key.ok = ok;
+
+	entries_t::iterator it = entries.find(key);
+	if (it != entries.end()) {
+		image_cache_entry * entry = it->second;
+		if (entry->refcount == 0)
+			unused.erase(entry->unused_pos);
+		cverb << vbfd << "image_cache: reusing " << key.filename
+		      << endl;
+		ok = entry->ok;
+		return op_bfd_ref(entry);
+	}
+
+	image_cache_entry * entry = new image_cache_entry;
+	try {
+		if (key.spu_offset) {
+			entry->bfd = new op_bfd(key.spu_offset, key.filename,
+			                        symbol_filter, extra, ok);
+		} else {
+			entry->bfd = new op_bfd(key.filename, symbol_filter,
+			                        extra, ok);
+		}
+	} catch (...) {
+		delete entry;
+		throw;
+	}
+
+	entry->ok = ok;
+	entry->size = entry->bfd->memory_size();
+	entry->pos = entries.insert(make_pair(key, entry)).first;
+	memory_used += entry->size;
+
+	return op_bfd_ref(entry);
+}
+
+
+void image_cache::release(image_cache_entry * entry)
+{
+	entry->unused_pos = unused.insert(unused.end(), entry);
+	shrink(memory_limit);
+}
+
+
+void image_cache::shrink(size_t limit)
+{
+	while (memory_used > limit && !unused.empty()) {
+		image_cache_entry * entry = unused.front();
+		unused.pop_front();
+
+		cverb << vbfd << "image_cache: deleting "
+		      << entry->pos->first.filename << endl;
+
+		memory_used -= entry->size;
+		entries.erase(entry->pos);
+		delete entry->bfd;
+		delete entry;
+	}
+}
+
+
+void image_cache::set_memory_limit(size_t limit)
+{
+	memory_limit = limit;
+	shrink(memory_limit);
+}
+
+
+void image_cache::clear()
+{
+	shrink(0);
+}
@@ -0,0 +1,130 @@
+/**
+ * @file image_cache.h
+ * Process wide cache of op_bfd objects
+ *
+ * @remark Copyright 2010 OProfile authors
+ * @remark Read the file COPYING
+ *
+ * Opening an image and reading its symbols is the costliest part of the
+ * post-profiling tools. The same image is used by populate, by each
+ * callgraph sample file it appears in, and by the XML output, so all of
+ * them get their op_bfd from image_cache instead of building their own.
+ *
+ * An op_bfd is shared by all users asking for the same image with the
+ * same symbol filter. Unused op_bfd are kept, least recently used ones
+ * being deleted when the estimated memory used by all of them exceeds
+ * the memory limit.
+ */
+
+#ifndef IMAGE_CACHE_H
+#define IMAGE_CACHE_H
+
+#include <string>
+#include <list>
+#include <map>
+
+#include <stdint.h>
+
+#include "utility.h"
+
+class op_bfd;
+class string_filter;
+class extra_images;
+struct image_cache_entry;
+
+/// a reference counted handle on an op_bfd owned by image_cache
+class op_bfd_ref {
+public:
+	op_bfd_ref() : entry(0) {}
+	op_bfd_ref(op_bfd_ref const & rhs);
+	~op_bfd_ref();
+	op_bfd_ref & operator=(op_bfd_ref const & rhs);
+
+	/// the op_bfd must not be used once all handles are destroyed
+	op_bfd & operator*() const;
+	op_bfd * operator->() const;
+
+	/// return false if this handle refers to no op_bfd
+	bool valid() const { return entry != 0; }
+
+private:
+	friend class image_cache;
+
+	explicit op_bfd_ref(image_cache_entry * e);
+
+	image_cache_entry * entry;
+};
+
+
+class image_cache : noncopyable {
+public:
+	/// return the cache used by the process
+	static image_cache & instance();
+
+	~image_cache();
+
+	/**
+	 * get - return an op_bfd for an image
+	 * @param filename  the name of the image file
+	 * @param symbol_filter  filter to apply to symbols
+	 * @param extra  extra_images used to locate the image
+	 * @param ok  as for op_bfd ctor
+	 *
+	 * extra must be alive as long as the cache holds the op_bfd, i.e.
+	 * until clear() is called.
+	 */
+	op_bfd_ref get(std::string const & filename,
+	               string_filter const & symbol_filter,
+	               extra_images const & extra, bool & ok);
+
+	/// same as above for an SPU image embedded at spu_offset in filename
+	op_bfd_ref get(uint64_t spu_offset, std::string const & filename,
+	               string_filter const & symbol_filter,
+	               extra_images const & extra, bool & ok);
+
+	/**
+	 * Set the memory used by all op_bfd above which unused ones are
+	 * deleted, in bytes. op_bfd in use are never deleted, so the limit
+	 * can be exceeded.
+	 */
+	void set_memory_limit(size_t limit);
+
+	/// delete all unused op_bfd
+	void clear();
+
+private:
+	image_cache();
+
+	struct key_t {
+		std::string filename;
+		uint64_t spu_offset;
+		std::string filter;
+		int extra_uid;
+		/// ok as given to the op_bfd ctor
+		bool ok;
+		bool operator<(key_t const & rhs) const;
+	};
+
+	typedef std::map<key_t, image_cache_entry *> entries_t;
+
+	friend class op_bfd_ref;
+	friend struct image_cache_entry;
+
+	/// called when the last handle on an entry is destroyed
+	void release(image_cache_entry * entry);
+
+	/// delete unused entries until the memory limit is honoured
+	void shrink(size_t limit);
+
+	op_bfd_ref get(key_t const & key, string_filter const & symbol_filter,
+	               extra_images const & extra, bool & ok);
+
+	entries_t entries;
+	/// unused entries, least recently used first
+	std::list<image_cache_entry *> unused;
+	/// estimated memory used by all entries
+	size_t memory_used;
+	size_t memory_limit;
+};
+
+#endif /* !IMAGE_CACHE_H */
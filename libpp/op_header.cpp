@@ -11,6 +11,7 @@
  */
 
 #include <cstring>
+#include <cerrno>
 #include <iostream>
 #include <cstdlib>
 #include <iomanip>
@@ -129,27 +130,24 @@ void check_mtime(string const & file, opd_header const & header)
 
 opd_header const read_header(string const & sample_filename)
 {
-	int fd = open(sample_filename.c_str(), O_RDONLY);
-	if (fd < 0)
-		throw op_fatal_error("Can't open sample file:" +
-				     sample_filename);
-
 	opd_header header;
-	if (read(fd, &header, sizeof(header)) != sizeof(header)) {
-		close(fd);
+
+	// the sample file can be stored in a container
+	int err = odb_read_header(sample_filename.c_str(), &header,
+	                          sizeof(header));
+	if (err == EIO)
 		throw op_fatal_error("Can't read sample file header:" +
 				     sample_filename);
-	}
+	if (err)
+		throw op_fatal_error("Can't open sample file:" +
+				     sample_filename);
 
 	if (memcmp(header.magic, OPD_MAGIC, sizeof(header.magic))) {
 		throw op_fatal_error("Invalid sample file, "
 				     "bad magic number: " +
 				     sample_filename);
-		close(fd);
 	}
 
-	close(fd);
-
 	return header;
 }
 
@@ -16,13 +16,32 @@
 #include "profile_container.h"
 #include "arrange_profiles.h"
 #include "op_bfd.h"
+#include "image_cache.h"
+#include "aggregate_cache.h"
+#include "string_filter.h"
 #include "op_header.h"
 #include "populate.h"
 #include "populate_for_spu.h"
 
 #include "image_errors.h"
+#include "op_exception.h"
+#include "op_types.h"
+#include "utility.h"
 
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <poll.h>
+#include <unistd.h>
+#include <errno.h>
+
+#include <cstdlib>
+#include <cstring>
+#include <algorithm>
 #include <iostream>
+#include <sstream>
+#include <vector>
+#include <map>
 
 using namespace std;
 
@@ -36,38 +55,35 @@ populate_from_files(profile_t & profile, op_bfd const & abfd,
 	list<profile_sample_files>::const_iterator it = files.begin();
 	list<profile_sample_files>::const_iterator const end = files.end();
 
-	bool found = false;
+	list<string> filenames;
 	// we can't handle cg files here obviously
 	for (; it != end; ++it) {
 		// A bit ugly but we must accept silently empty sample filename
 		// since we can create a profile_sample_files for cg file only
 		// (i.e no sample to the binary)
-		if (!it->sample_filename.empty()) {
-			profile.add_sample_file(it->sample_filename);
-			profile.set_offset(abfd);
-			found = true;
-		}
+		if (!it->sample_filename.empty())
+			filenames.push_back(it->sample_filename);
 	}
 
-	return found;
-}
+	if (filenames.empty())
+		return false;
 
-}  // anon namespace
+	// with --merge there can be one file per cpu or per thread, they
+	// are merged at once
+	profile.add_sample_files(filenames);
+	profile.set_offset(abfd);
+	return true;
+}
 
 
-void
-populate_for_image(profile_container & samples, inverted_profile const & ip,
-	string_filter const & symbol_filter, bool * has_debug_info)
+/// load one image into samples, or into records if non-NULL
+void populate_image(profile_container & samples, inverted_profile const & ip,
+                    string_filter const & symbol_filter, bool * has_debug_info,
+                    vector<profile_container::add_record> * records)
 {
-	if (is_spu_profile(ip)) {
-		populate_for_spu_image(samples, ip, symbol_filter,
-				       has_debug_info);
-		return;
-	}
-
 	bool ok = ip.error == image_ok;
-	op_bfd abfd(ip.image, symbol_filter,
-		    samples.extra_found_images, ok);
+	op_bfd_ref abfd = image_cache::instance().get(ip.image, symbol_filter,
+		samples.extra_found_images, ok);
 	if (!ok && ip.error == image_ok)
 		ip.error = image_format_failure;
 
@@ -89,9 +105,17 @@ populate_for_image(profile_container & samples, inverted_profile const & ip,
 		// to the wrong app_image otherwise
 		for (; it != end; ++it) {
 			profile_t profile;
-			if (populate_from_files(profile, abfd, it->files)) {
+			if (populate_from_files(profile, *abfd, it->files)) {
 				header = profile.get_header();
-				samples.add(profile, abfd, it->app_image, i);
+				if (records) {
+					records->push_back(
+						profile_container::add_record());
+					samples.collect(records->back(), profile,
+						*abfd, it->app_image, i);
+				} else {
+					samples.add(profile, *abfd,
+						it->app_image, i);
+				}
 				found = true;
 			}
 		}
@@ -106,5 +130,618 @@ populate_for_image(profile_container & samples, inverted_profile const & ip,
 	}
 
 	if (has_debug_info)
-		*has_debug_info = abfd.has_debug_info();
+		*has_debug_info = abfd->has_debug_info();
+}
+
+
+/*
+ * Messages between populate_for_images() and its workers. Both ends
+ * are the same binary on the same host so values are sent as they are
+ * in memory.
+ */
+class packer {
+public:
+	packer(string & buf_) : buf(buf_) {}
+
+	template <typename T> void put(T const & value) {
+		buf.append(reinterpret_cast<char const *>(&value),
+		           sizeof(value));
+	}
+
+	void put_string(string const & str) {
+		put<u64>(str.size());
+		buf.append(str);
+	}
+
+private:
+	string & buf;
+};
+
+
+class unpacker {
+public:
+	unpacker(string const & buf)
+		: pos(buf.data()), end(buf.data() + buf.size()) {}
+
+	template <typename T> T get() {
+		T value;
+		memcpy(&value, take(sizeof(value)), sizeof(value));
+		return value;
+	}
+
+	string get_string() {
+		size_t const len = get<u64>();
+		return string(take(len), len);
+	}
+
+private:
+	char const * take(size_t len) {
+		if (size_t(end - pos) < len) {
+			throw op_runtime_error("populate_for_images(): "
+			                       "truncated worker message");
+		}
+		char const * cur = pos;
+		pos += len;
+		return cur;
+	}
+
+	char const * pos;
+	char const * end;
+};
+
+
+void pack_record(packer & out, profile_container::add_record const & record)
+{
+	out.put<u64>(record.pclass);
+	out.put_string(record.image_name);
+	out.put_string(record.app_name);
+	out.put<u64>(record.spu_offset);
+	out.put_string(record.embedding_filename);
+
+	out.put<u64>(record.filenames.size());
+	for (size_t i = 0; i < record.filenames.size(); ++i)
+		out.put_string(record.filenames[i]);
+
+	out.put<u64>(record.symbols.size());
+	for (size_t i = 0; i < record.symbols.size(); ++i) {
+		profile_container::add_record::symbol const & symbol =
+			record.symbols[i];
+		out.put_string(symbol.name);
+		out.put<u64>(symbol.sym_index);
+		out.put<u64>(symbol.size);
+		out.put<count_type>(symbol.count);
+		out.put<u32>(symbol.linenr);
+		out.put<u64>(symbol.filename);
+		out.put<u64>(symbol.vma);
+		out.put<u64>(symbol.nr_samples);
+	}
+
+	out.put<u64>(record.samples.size());
+	for (size_t i = 0; i < record.samples.size(); ++i)
+		out.put(record.samples[i]);
+}
+
+
+void unpack_record(unpacker & in, profile_container::add_record & record)
+{
+	record.pclass = in.get<u64>();
+	record.image_name = in.get_string();
+	record.app_name = in.get_string();
+	record.spu_offset = in.get<u64>();
+	record.embedding_filename = in.get_string();
+
+	record.filenames.resize(in.get<u64>());
+	for (size_t i = 0; i < record.filenames.size(); ++i)
+		record.filenames[i] = in.get_string();
+
+	record.symbols.resize(in.get<u64>());
+	for (size_t i = 0; i < record.symbols.size(); ++i) {
+		profile_container::add_record::symbol & symbol =
+			record.symbols[i];
+		symbol.name = in.get_string();
+		symbol.sym_index = in.get<u64>();
+		symbol.size = in.get<u64>();
+		symbol.count = in.get<count_type>();
+		symbol.linenr = in.get<u32>();
+		symbol.filename = in.get<u64>();
+		symbol.vma = in.get<u64>();
+		symbol.nr_samples = in.get<u64>();
+	}
+
+	record.samples.resize(in.get<u64>());
+	for (size_t i = 0; i < record.samples.size(); ++i)
+		record.samples[i] =
+			in.get<profile_container::add_record::sample>();
+}
+
+
+/// load one image in a worker, result is what add_image_result() expects
+void load_image(string & result, profile_container & samples,
+                inverted_profile const & ip,
+                string_filter const & symbol_filter)
+{
+	vector<profile_container::add_record> records;
+	bool has_debug_info = false;
+	bool failed = false;
+	string failure;
+
+	// warnings are given back to the parent, to be output when
+	// the image is added
+	ostringstream messages;
+	streambuf * cerr_buf = cerr.rdbuf(messages.rdbuf());
+
+	try {
+		populate_image(samples, ip, symbol_filter, &has_debug_info,
+		               &records);
+	} catch (exception const & e) {
+		failed = true;
+		failure = e.what();
+	} catch (...) {
+		failed = true;
+		failure = "unknown exception";
+	}
+
+	cerr.rdbuf(cerr_buf);
+
+	packer out(result);
+	out.put<u32>(ip.error);
+	out.put<u8>(has_debug_info);
+	out.put_string(messages.str());
+	out.put<u8>(failed);
+	out.put_string(failure);
+	if (failed)
+		records.clear();
+	out.put<u64>(records.size());
+	for (size_t i = 0; i < records.size(); ++i)
+		pack_record(out, records[i]);
+}
+
+
+/// add an image loaded by load_image() to samples
+void add_image_result(profile_container & samples, inverted_profile const & ip,
+                      string const & result, bool & has_debug_info)
+{
+	unpacker in(result);
+
+	ip.error = image_error(in.get<u32>());
+	has_debug_info = in.get<u8>();
+	cerr << in.get_string();
+	bool const failed = in.get<u8>();
+	string const failure = in.get_string();
+	if (failed)
+		throw op_runtime_error(failure);
+
+	size_t const nr_records = in.get<u64>();
+	for (size_t i = 0; i < nr_records; ++i) {
+		profile_container::add_record record;
+		unpack_record(in, record);
+		samples.add(record);
+	}
+}
+
+
+/// what identifies an image in aggregate_cache
+struct cache_key {
+	cache_key() : valid(false) {}
+
+	/// false if the image can't be cached
+	bool valid;
+	std::string id;
+	std::string fingerprint;
+};
+
+
+/// build the aggregate_cache key of an image
+void get_cache_key(cache_key & key, profile_container const & samples,
+                   inverted_profile const & ip,
+                   string_filter const & symbol_filter)
+{
+	key.valid = false;
+	if (!aggregate_cache::instance().enabled() || is_spu_profile(ip) ||
+	    ip.error != image_ok)
+		return;
+
+	ostringstream id;
+	id << ip.image << '\n' << symbol_filter.id() << '\n'
+	   << samples.get_debug_info() << samples.get_need_details() << '\n';
+	key.id = id.str();
+
+	image_error error;
+	string const filename = samples.extra_found_images.find_image_path(
+		ip.image, error, true);
+	key.fingerprint.clear();
+	if (error != image_ok ||
+	    !aggregate_cache::add_file_stamp(key.fingerprint, filename))
+		return;
+
+	// the result depends on how the sample files are grouped too
+	for (size_t i = 0; i < ip.groups.size(); ++i) {
+		key.fingerprint += "group\n";
+		list<image_set>::const_iterator it = ip.groups[i].begin();
+		for (; it != ip.groups[i].end(); ++it) {
+			key.fingerprint += it->app_image + '\n';
+			list<profile_sample_files>::const_iterator fit;
+			for (fit = it->files.begin(); fit != it->files.end();
+			     ++fit) {
+				if (fit->sample_filename.empty())
+					continue;
+				if (!aggregate_cache::add_samples_stamp(
+					key.fingerprint, fit->sample_filename))
+					return;
+			}
+		}
+	}
+
+	key.valid = true;
+}
+
+
+/// store a load_image() result in aggregate_cache if it can be reused
+void cache_image_result(cache_key const & key, inverted_profile const & ip,
+                        string const & result)
+{
+	// images which failed to load are not cached, so the next run
+	// gives the same error
+	if (key.valid && ip.error == image_ok)
+		aggregate_cache::instance().put(key.id, key.fingerprint, result);
+}
+
+
+bool read_all(int fd, void * buf, size_t size)
+{
+	char * pos = static_cast<char *>(buf);
+	while (size) {
+		ssize_t count = read(fd, pos, size);
+		if (count < 0 && errno == EINTR)
+			continue;
+		if (count <= 0)
+			return false;
+		pos += count;
+		size -= count;
+	}
+	return true;
+}
+
+
+bool write_all(int fd, void const * buf, size_t size)
+{
+	char const * pos = static_cast<char const *>(buf);
+	while (size) {
+		// a dead peer must not kill us with SIGPIPE
+		ssize_t count = send(fd, pos, size, MSG_NOSIGNAL);
+		if (count < 0 && errno == EINTR)
+			continue;
+		if (count <= 0)
+			return false;
+		pos += count;
+		size -= count;
+	}
+	return true;
+}
+
+
+/**
+ * Child processes loading images for populate_for_images(). Each worker
+ * is given the index of the image to load, and sends back the index
+ * followed by the size and the content of the load_image() result.
+ */
+class worker_pool : noncopyable {
+public:
+	worker_pool(size_t nr_workers, profile_container & samples,
+	            vector<inverted_profile const *> const & images,
+	            string_filter const & symbol_filter);
+
+	/// stop all workers and wait for them
+	~worker_pool();
+
+	/// return true if a worker is waiting for an image to load
+	bool idle() const { return !idle_workers.empty(); }
+
+	/// give images[index] to an idle worker
+	void start(size_t index);
+
+	/// wait for the next loaded image, return its index
+	size_t receive(string & result);
+
+private:
+	/// the loop of a worker, it returns when fd is closed
+	static void run(int fd, profile_container & samples,
+	                vector<inverted_profile const *> const & images,
+	                string_filter const & symbol_filter);
+
+	struct worker {
+		pid_t pid;
+		/// socket to the worker
+		int fd;
+	};
+
+	vector<worker> workers;
+	/// indexes in workers of the workers waiting for an image
+	vector<size_t> idle_workers;
+};
+
+
+worker_pool::worker_pool(size_t nr_workers, profile_container & samples,
+                         vector<inverted_profile const *> const & images,
+                         string_filter const & symbol_filter)
+{
+	for (size_t i = 0; i < nr_workers; ++i) {
+		int fds[2];
+		if (socketpair(AF_UNIX, SOCK_STREAM, 0, fds)) {
+			throw op_runtime_error("populate_for_images(): "
+			                       "socketpair() failed", errno);
+		}
+
+		worker w;
+		w.pid = fork();
+		if (w.pid < 0) {
+			int const err = errno;
+			close(fds[0]);
+			close(fds[1]);
+			throw op_runtime_error("populate_for_images(): "
+			                       "fork() failed", err);
+		}
+
+		if (w.pid == 0) {
+			// the other workers must see their socket closed
+			// when the parent closes it
+			for (size_t j = 0; j < workers.size(); ++j)
+				close(workers[j].fd);
+			close(fds[0]);
+
+			// never go back to the caller in the child
+			int status = EXIT_SUCCESS;
+			try {
+				run(fds[1], samples, images, symbol_filter);
+			} catch (...) {
+				status = EXIT_FAILURE;
+			}
+
+			// _exit() doesn't run the static dtors, delete the
+			// op_bfd now so their on-disk caches get written
+			try {
+				image_cache::instance().clear();
+			} catch (...) {
+				status = EXIT_FAILURE;
+			}
+			_exit(status);
+		}
+
+		close(fds[1]);
+		w.fd = fds[0];
+		workers.push_back(w);
+		idle_workers.push_back(i);
+	}
+}
+
+
+worker_pool::~worker_pool()
+{
+	for (size_t i = 0; i < workers.size(); ++i)
+		close(workers[i].fd);
+
+	for (size_t i = 0; i < workers.size(); ++i) {
+		while (waitpid(workers[i].pid, 0, 0) < 0 && errno == EINTR)
+			;
+	}
+}
+
+
+void worker_pool::run(int fd, profile_container & samples,
+                      vector<inverted_profile const *> const & images,
+                      string_filter const & symbol_filter)
+{
+	u64 index;
+	while (read_all(fd, &index, sizeof(index))) {
+		string result;
+		load_image(result, samples, *images[index], symbol_filter);
+
+		u64 const header[2] = { index, result.size() };
+		if (!write_all(fd, header, sizeof(header)) ||
+		    !write_all(fd, result.data(), result.size()))
+			return;
+	}
+}
+
+
+void worker_pool::start(size_t index)
+{
+	worker const & w = workers[idle_workers.back()];
+	idle_workers.pop_back();
+
+	u64 const task = index;
+	if (!write_all(w.fd, &task, sizeof(task))) {
+		throw op_runtime_error("populate_for_images(): worker "
+		                       "process exited");
+	}
+}
+
+
+size_t worker_pool::receive(string & result)
+{
+	vector<pollfd> fds;
+	vector<size_t> busy;
+	for (size_t i = 0; i < workers.size(); ++i) {
+		if (find(idle_workers.begin(), idle_workers.end(), i)
+		    != idle_workers.end())
+			continue;
+		pollfd pfd = { workers[i].fd, POLLIN, 0 };
+		fds.push_back(pfd);
+		busy.push_back(i);
+	}
+
+	while (poll(&fds[0], fds.size(), -1) < 0) {
+		if (errno != EINTR) {
+			throw op_runtime_error("populate_for_images(): "
+			                       "poll() failed", errno);
+		}
+	}
+
+	size_t i = 0;
+	while (!fds[i].revents)
+		++i;
+
+	u64 header[2];
+	result.resize(0);
+	if (read_all(fds[i].fd, header, sizeof(header))) {
+		result.resize(header[1]);
+		if (header[1] == 0 ||
+		    read_all(fds[i].fd, &result[0], header[1])) {
+			idle_workers.push_back(busy[i]);
+			return header[0];
+		}
+	}
+
+	throw op_runtime_error("populate_for_images(): worker process "
+	                       "exited");
+}
+
+
+/**
+ * Start the next images while workers are available. Images found in
+ * aggregate_cache don't need a worker, their result is directly put
+ * in results.
+ */
+void start_images(worker_pool & pool,
+                  vector<inverted_profile const *> const & images,
+                  vector<cache_key> const & keys,
+                  map<size_t, string> & results,
+                  size_t & next, size_t end)
+{
+	for (; next < end && pool.idle(); ++next) {
+		// SPU images are loaded in the parent, see populate_for_images()
+		if (is_spu_profile(*images[next]))
+			continue;
+
+		string cached;
+		if (keys[next].valid && aggregate_cache::instance().get(
+			keys[next].id, keys[next].fingerprint, cached)) {
+			results[next].swap(cached);
+			continue;
+		}
+
+		pool.start(next);
+	}
+}
+
+}  // anon namespace
+
+
+void
+populate_for_image(profile_container & samples, inverted_profile const & ip,
+	string_filter const & symbol_filter, bool * has_debug_info)
+{
+	if (is_spu_profile(ip)) {
+		populate_for_spu_image(samples, ip, symbol_filter,
+				       has_debug_info);
+		return;
+	}
+
+	cache_key key;
+	get_cache_key(key, samples, ip, symbol_filter);
+	if (!key.valid) {
+		populate_image(samples, ip, symbol_filter, has_debug_info, 0);
+		return;
+	}
+
+	// go through load_image() so the result can be stored as it is,
+	// with the warnings given while loading the image
+	string result;
+	bool const cached = aggregate_cache::instance().get(key.id,
+		key.fingerprint, result);
+	if (!cached)
+		load_image(result, samples, ip, symbol_filter);
+
+	bool debug_info = false;
+	add_image_result(samples, ip, result, debug_info);
+	if (has_debug_info)
+		*has_debug_info = debug_info;
+
+	if (!cached)
+		cache_image_result(key, ip, result);
+}
+
+
+void collect_for_image(vector<profile_container::add_record> & records,
+	profile_container & samples, inverted_profile const & ip,
+	string_filter const & symbol_filter)
+{
+	populate_image(samples, ip, symbol_filter, 0, &records);
+}
+
+
+void populate_for_images(profile_container & samples,
+	list<inverted_profile> const & iprofiles,
+	string_filter const & symbol_filter, size_t nr_jobs,
+	bool * has_debug_info)
+{
+	vector<inverted_profile const *> images;
+	size_t nr_workers = 0;
+
+	list<inverted_profile>::const_iterator it = iprofiles.begin();
+	list<inverted_profile>::const_iterator const end = iprofiles.end();
+	for (; it != end; ++it) {
+		images.push_back(&*it);
+		if (!is_spu_profile(*it))
+			++nr_workers;
+	}
+
+	nr_workers = min(nr_workers, nr_jobs);
+	if (nr_workers < 2)
+		nr_workers = 0;
+
+	if (has_debug_info)
+		*has_debug_info = false;
+
+	scoped_ptr<worker_pool> pool;
+	if (nr_workers) {
+		pool.reset(new worker_pool(nr_workers, samples, images,
+		                           symbol_filter));
+	}
+
+	// images found in aggregate_cache are not given to workers
+	vector<cache_key> keys(pool.get() ? images.size() : 0);
+	for (size_t i = 0; i < keys.size(); ++i)
+		get_cache_key(keys[i], samples, *images[i], symbol_filter);
+
+	// loaded images not yet added, a worker is never given an image
+	// too far ahead of the next one to add to bound their memory use
+	map<size_t, string> results;
+	// images whose result comes from aggregate_cache
+	vector<bool> cached(keys.size());
+	size_t const max_ahead = 4 * nr_workers;
+	size_t next_start = 0;
+
+	for (size_t i = 0; i < images.size(); ++i) {
+		bool debug_info = false;
+
+		if (!pool.get() || is_spu_profile(*images[i])) {
+			populate_for_image(samples, *images[i], symbol_filter,
+			                   &debug_info);
+		} else {
+			map<size_t, string>::iterator result;
+			while ((result = results.find(i)) == results.end()) {
+				size_t const first = next_start;
+				start_images(*pool, images, keys, results,
+				     next_start, min(images.size(), i + max_ahead));
+				for (size_t j = first; j < next_start; ++j)
+					cached[j] = results.count(j);
+				if (results.count(i))
+					continue;
+				string loaded;
+				size_t const index = pool->receive(loaded);
+				results[index].swap(loaded);
+			}
+
+			add_image_result(samples, *images[i], result->second,
+			                 debug_info);
+			if (!cached[i])
+				cache_image_result(keys[i], *images[i],
+				                   result->second);
+			results.erase(result);
+		}
+
+		if (debug_info && has_debug_info)
+			*has_debug_info = true;
+	}
 }
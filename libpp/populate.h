@@ -12,7 +12,12 @@
 #ifndef POPULATE_H
 #define POPULATE_H
 
-class profile_container;
+#include <list>
+#include <vector>
+#include <cstddef>
+
+#include "profile_container.h"
+
 class inverted_profile;
 class string_filter;
 
@@ -22,4 +27,40 @@ void
 populate_for_image(profile_container & samples, inverted_profile const & ip,
    string_filter const & symbol_filter, bool * has_debug_info);
 
+/**
+ * populate_for_images - load all sample file information for a list
+ * of binary images
+ * @param samples  the container to fill
+ * @param iprofiles  the images to load, in order
+ * @param symbol_filter  the symbols to load
+ * @param nr_jobs  the max nr of images loaded at once
+ * @param has_debug_info  if non-NULL, set to true if any image has
+ *  debug information
+ *
+ * The result is the same as calling populate_for_image() on each image
+ * in order. If nr_jobs > 1 the images are loaded by as many child
+ * processes and their results are added to samples in the images
+ * order, so the content of samples doesn't depend on nr_jobs. This is
+ * done through separate processes since neither libbfd nor the name
+ * storage can be used by several threads.
+ */
+void populate_for_images(profile_container & samples,
+   std::list<inverted_profile> const & iprofiles,
+   string_filter const & symbol_filter, size_t nr_jobs,
+   bool * has_debug_info);
+
+/**
+ * collect_for_image - load all sample file information for one binary
+ * image without adding it to a container
+ * @param records  filled with what populate_for_image() would add
+ * @param samples  the container records are built for
+ * @param ip  the image to load
+ * @param symbol_filter  the symbols to load
+ *
+ * Cell SPU profiles are not supported.
+ */
+void collect_for_image(std::vector<profile_container::add_record> & records,
+   profile_container & samples, inverted_profile const & ip,
+   string_filter const & symbol_filter);
+
 #endif /* POPULATE_H */
@@ -14,6 +14,7 @@
 #include "profile_container.h"
 #include "arrange_profiles.h"
 #include "op_bfd.h"
+#include "image_cache.h"
 #include "op_header.h"
 #include "populate.h"
 #include "populate_for_spu.h"
@@ -53,7 +54,6 @@ populate_spu_profile_from_files(list<profile_sample_files> const & files,
 {
 	string archive_path = samples.extra_found_images.get_archive_path();
 	bool ok = ip.error == image_ok;
-	op_bfd * abfd = NULL;
 	string fname_to_check;
 	list<profile_sample_files>::const_iterator it = files.begin();
 	list<profile_sample_files>::const_iterator const end = files.end();
@@ -64,15 +64,17 @@ populate_spu_profile_from_files(list<profile_sample_files> const & files,
 
 		profile.add_sample_file(it->sample_filename);
 		opd_header header = profile.get_header();
+		op_bfd_ref abfd;
 		if (header.embedded_offset) {
-			abfd = new op_bfd(header.embedded_offset,
+			abfd = image_cache::instance().get(
+					  header.embedded_offset,
 					  ip.image,
 					  symbol_filter,
 					  samples.extra_found_images,
 					  ok);
 			fname_to_check = ip.image;
 		} else {
-			abfd = new op_bfd(ip.image,
+			abfd = image_cache::instance().get(ip.image,
 					  symbol_filter,
 					  samples.extra_found_images,
 					  ok);
@@ -97,7 +99,6 @@ populate_spu_profile_from_files(list<profile_sample_files> const & files,
 
 		if (has_debug_info && !*has_debug_info)
 			*has_debug_info = abfd->has_debug_info();
-		delete abfd;
 	}
 }
 }  // anon namespace
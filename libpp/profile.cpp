@@ -17,6 +17,8 @@
 #include <string>
 #include <sstream>
 #include <cstring>
+#include <algorithm>
+#include <list>
 
 #include <cerrno>
 
@@ -31,6 +33,104 @@
 
 using namespace std;
 
+namespace {
+
+/// order sample entries on eip, for lower_bound()
+struct less_sample_key {
+	bool operator()(pair<odb_key_t, count_type> const & lhs,
+	                odb_key_t rhs) const {
+		return lhs.first < rhs;
+	}
+};
+
+
+/// order sample entries on eip only, for sort()
+struct less_sample_entry {
+	bool operator()(pair<odb_key_t, count_type> const & lhs,
+	                pair<odb_key_t, count_type> const & rhs) const {
+		return lhs.first < rhs.first;
+	}
+};
+
+
+/**
+ * Sort samples on eip with a LSD radix sort on bytes. The histograms of
+ * all bytes are built in a single pass and bytes with the same value
+ * for all keys are skipped, which is most of them since keys are
+ * offsets inside one image.
+ */
+template <typename Samples>
+void radix_sort(Samples & samples)
+{
+	size_t const nr_bytes = sizeof(odb_key_t);
+	size_t const size = samples.size();
+
+	// below this std::sort is faster than clearing the histograms
+	if (size < 256) {
+		sort(samples.begin(), samples.end(), less_sample_entry());
+		return;
+	}
+
+	vector<size_t> count(nr_bytes * 256, 0);
+	for (size_t i = 0; i < size; ++i) {
+		odb_key_t key = samples[i].first;
+		for (size_t byte = 0; byte < nr_bytes; ++byte, key >>= 8)
+			++count[byte * 256 + (key & 0xff)];
+	}
+
+	Samples tmp(size);
+	for (size_t byte = 0; byte < nr_bytes; ++byte) {
+		size_t * bucket = &count[byte * 256];
+		unsigned int const first = samples[0].first >> (byte * 8) & 0xff;
+		if (bucket[first] == size)
+			continue;
+
+		size_t pos = 0;
+		for (size_t i = 0; i < 256; ++i) {
+			size_t const nr = bucket[i];
+			bucket[i] = pos;
+			pos += nr;
+		}
+
+		for (size_t i = 0; i < size; ++i) {
+			unsigned int const digit =
+				samples[i].first >> (byte * 8) & 0xff;
+			tmp[bucket[digit]++] = samples[i];
+		}
+
+		samples.swap(tmp);
+	}
+}
+
+
+/// merge two sorted runs into out, summing the counts of equal keys
+template <typename Samples>
+void merge_run_pair(Samples const & lhs, Samples const & rhs, Samples & out)
+{
+	out.resize(lhs.size() + rhs.size());
+
+	size_t i = 0, j = 0, k = 0;
+	while (i < lhs.size() && j < rhs.size()) {
+		if (lhs[i].first < rhs[j].first) {
+			out[k++] = lhs[i++];
+		} else if (rhs[j].first < lhs[i].first) {
+			out[k++] = rhs[j++];
+		} else {
+			out[k] = lhs[i++];
+			out[k++].second += rhs[j++].second;
+		}
+	}
+	for (; i < lhs.size(); ++i)
+		out[k++] = lhs[i];
+	for (; j < rhs.size(); ++j)
+		out[k++] = rhs[j];
+
+	out.resize(k);
+}
+
+}  // anonymous namespace
+
+
 profile_t::profile_t()
 	: start_offset(0)
 {
@@ -48,6 +148,7 @@ count_type profile_t::sample_count(string const & filename)
 
 	odb_node_nr_t node_nr, pos;
 	odb_node_t * node = odb_get_iterator(&samples_db, &node_nr);
+	// unused node have a zero value
 	for (pos = 0; pos < node_nr; ++pos)
 		count += node[pos].value;
 
@@ -69,6 +170,38 @@ enum profile_type profile_t::is_spu_sample_file(string const & filename)
 	return retval;
 }
 
+//static member
+unsigned int profile_t::data_samples(string const & filename,
+                                     vector<sample_entry> & samples)
+{
+	odb_t samples_db;
+	open_sample_file(filename, samples_db);
+
+	opd_header const & head =
+		*static_cast<opd_header *>(odb_get_data(&samples_db));
+	unsigned int const data_shift = head.data_shift;
+
+	odb_node_nr_t node_nr, pos;
+	odb_node_t * node = odb_get_iterator(&samples_db, &node_nr);
+
+	samples.clear();
+	if (data_shift) {
+		samples.reserve(node_nr);
+		for (pos = 0; pos < node_nr; ++pos) {
+			if (node[pos].value) {
+				samples.push_back(sample_entry(node[pos].key,
+				                               node[pos].value));
+			}
+		}
+	}
+
+	odb_close(&samples_db);
+
+	radix_sort(samples);
+
+	return data_shift;
+}
+
 //static member
 void profile_t::open_sample_file(string const & filename, odb_t & db)
 {
@@ -76,7 +209,7 @@ void profile_t::open_sample_file(string const & filename, odb_t & db)
 	// fail and the error message will be obscure.
 	opd_header head = read_header(filename);
 
-	if (head.version != OPD_VERSION) {
+	if (head.version < OPD_MIN_VERSION || head.version > OPD_VERSION) {
 		ostringstream os;
 		os << "oprofpp: samples files version mismatch, are you "
 		   << "running a daemon and post-profile tools with version "
@@ -92,6 +225,27 @@ void profile_t::open_sample_file(string const & filename, odb_t & db)
 }
 
 void profile_t::add_sample_file(string const & filename)
+{
+	add_sample_files(list<string>(1, filename));
+}
+
+
+void profile_t::add_sample_files(list<string> const & filenames)
+{
+	vector<ordered_samples_t> runs(1 + filenames.size());
+	runs[0].swap(ordered_samples);
+
+	list<string>::const_iterator it = filenames.begin();
+	for (size_t i = 1; it != filenames.end(); ++it, ++i)
+		read_sample_file(*it, runs[i]);
+
+	merge_runs(runs);
+	ordered_samples.swap(runs[0]);
+}
+
+
+void profile_t::read_sample_file(string const & filename,
+                                 ordered_samples_t & run)
 {
 	odb_t samples_db;
 
@@ -109,19 +263,40 @@ void profile_t::add_sample_file(string const & filename)
 	odb_node_nr_t node_nr, pos;
 	odb_node_t * node = odb_get_iterator(&samples_db, &node_nr);
 
+	// data address samples are keyed by the data line or page, not by
+	// a pc, so they can't be attributed to symbols. opreport --export
+	// writes them, see data_samples()
+	if (head.data_shift)
+		node_nr = 0;
+
+	run.reserve(node_nr);
+
 	for (pos = 0; pos < node_nr; ++pos) {
-		ordered_samples_t::iterator it = 
-		    ordered_samples.find(node[pos].key);
-		if (it != ordered_samples.end()) {
-			it->second += node[pos].value;
-		} else {
-			ordered_samples_t::value_type
-				val(node[pos].key, node[pos].value);
-			ordered_samples.insert(val);
-		}
+		if (node[pos].value)
+			run.push_back(sample_entry(node[pos].key, node[pos].value));
 	}
 
 	odb_close(&samples_db);
+
+	radix_sort(run);
+}
+
+
+void profile_t::merge_runs(vector<ordered_samples_t> & runs)
+{
+	// merge runs two by two: each round is a sequential pass, and the
+	// runs of a session share most of their eips so they shrink fast
+	while (runs.size() > 1) {
+		vector<ordered_samples_t> merged((runs.size() + 1) / 2);
+		for (size_t i = 0; i + 1 < runs.size(); i += 2) {
+			merge_run_pair(runs[i], runs[i + 1], merged[i / 2]);
+			ordered_samples_t().swap(runs[i]);
+			ordered_samples_t().swap(runs[i + 1]);
+		}
+		if (runs.size() % 2)
+			merged.back().swap(runs.back());
+		runs.swap(merged);
+	}
 }
 
 
@@ -167,10 +342,12 @@ profile_t::samples_range(odb_key_t start, odb_key_t end) const
 			"oprofile-list@lists.sourceforge.net");
 	}
 
-	ordered_samples_t::const_iterator first = 
-		ordered_samples.lower_bound(start);
+	ordered_samples_t::const_iterator first =
+		lower_bound(ordered_samples.begin(), ordered_samples.end(),
+		            start, less_sample_key());
 	ordered_samples_t::const_iterator last =
-		ordered_samples.lower_bound(end);
+		lower_bound(first, ordered_samples.end(), end,
+		            less_sample_key());
 
 	return make_pair(const_iterator(first, start_offset),
 		const_iterator(last, start_offset));
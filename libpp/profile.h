@@ -14,7 +14,9 @@
 #define PROFILE_H
 
 #include <string>
-#include <map>
+#include <list>
+#include <vector>
+#include <utility>
 #include <iterator>
 
 #include "odb.h"
@@ -65,6 +67,23 @@ public:
 	 */
 	static enum profile_type is_spu_sample_file(std::string const & filename);
 
+	/// a sample count at a given key
+	typedef std::pair<odb_key_t, count_type> sample_entry;
+
+	/**
+	 * read the samples of a data address sample file
+	 * @param filename  sample filename
+	 * @param samples  filled with the samples sorted by key, a key is
+	 *  a data address shifted right by the returned data_shift
+	 *
+	 * Return the data_shift of the file header, if it is zero the file
+	 * doesn't hold data address samples and samples is left empty.
+	 * See opd_header::data_shift.
+	 */
+	static unsigned int
+	data_samples(std::string const & filename,
+	             std::vector<sample_entry> & samples);
+
 	/**
 	 * cumulate sample file to our container of samples
 	 * @param filename  sample file name
@@ -75,6 +94,16 @@ public:
 	 */
 	void add_sample_file(std::string const & filename);
 
+	/**
+	 * cumulate sample files to our container of samples
+	 * @param filenames  sample file names
+	 *
+	 * Same as calling add_sample_file() on each file but the samples
+	 * of all files are merged at once, which is much faster for many
+	 * files.
+	 */
+	void add_sample_files(std::list<std::string> const & filenames);
+
 	/// Set an appropriate start offset, see comments below.
 	void set_offset(op_bfd const & abfd);
 
@@ -103,16 +132,24 @@ private:
 	scoped_ptr<opd_header> file_header;
 
 	/// storage type for samples sorted by eip
-	typedef std::map<odb_key_t, count_type> ordered_samples_t;
+	typedef std::vector<sample_entry> ordered_samples_t;
 
 	/**
 	 * Samples are stored in hash table, iterating over hash table don't
 	 * provide any ordering, the above count() interface rely on samples
-	 * ordered by eip. This map is only a temporary storage where samples
-	 * are ordered by eip.
+	 * ordered by eip. This vector is only a temporary storage where
+	 * samples are ordered by eip, with one entry per eip. Each sample
+	 * file is read in a sorted run, runs are then merged.
 	 */
 	ordered_samples_t ordered_samples;
 
+	/// read the samples of a sample file in a run sorted by eip
+	void read_sample_file(std::string const & filename,
+	                      ordered_samples_t & run);
+
+	/// merge sorted runs into runs[0], summing equal keys
+	static void merge_runs(std::vector<ordered_samples_t> & runs);
+
 	/**
 	 * For certain profiles, such as kernel/modules, and anon
 	 * regions with a matching binary, this value is non-zero,
@@ -66,21 +66,56 @@ profile_container::~profile_container()
 }
  
 
-// Post condition:
-//  the symbols/samples are sorted by increasing vma.
-//  the range of sample_entry inside each symbol entry are valid
-//  the samples_by_file_loc member var is correctly setup.
+size_t profile_container::filename_index::get(string const & filename)
+{
+	if (last && filenames[last - 1] == filename)
+		return last;
+
+	map<string, size_t>::const_iterator it = index.find(filename);
+	if (it != index.end()) {
+		last = it->second;
+	} else {
+		filenames.push_back(filename);
+		last = filenames.size();
+		index[filename] = last;
+	}
+
+	return last;
+}
+
+
 void profile_container::add(profile_t const & profile,
                             op_bfd const & abfd, string const & app_name,
                             size_t pclass)
 {
-	string const image_name = abfd.get_filename();
+	add_record record;
+	collect(record, profile, abfd, app_name, pclass);
+	add(record);
+}
+
+
+void profile_container::collect(add_record & record,
+                                profile_t const & profile,
+                                op_bfd const & abfd, string const & app_name,
+                                size_t pclass) const
+{
 	opd_header header = profile.get_header();
 
+	record.pclass = pclass;
+	record.image_name = abfd.get_filename();
+	record.app_name = app_name;
+	record.spu_offset = 0;
+	if ((header.spu_profile == cell_spu_profile) &&
+	    header.embedded_offset) {
+		record.spu_offset = header.embedded_offset;
+		record.embedding_filename = abfd.get_embedding_filename();
+	}
+
+	filename_index filenames(record.filenames);
+
 	for (symbol_index_t i = 0; i < abfd.syms.size(); ++i) {
 
 		unsigned long long start = 0, end = 0;
-		symbol_entry symb_entry;
 
 		abfd.get_symbol_range(i, start, end);
 
@@ -92,71 +127,131 @@ void profile_container::add(profile_t const & profile,
 		if (count == 0)
 			continue;
 
-		symb_entry.sample.counts[pclass] = count;
-		total_count[pclass] += count;
-
-		symb_entry.size = end - start;
-
-		symb_entry.name = symbol_names.create(abfd.syms[i].name());
-		symb_entry.sym_index = i;
-
-		symb_entry.sample.file_loc.linenr = 0;
+		add_record::symbol symbol;
+		symbol.name = abfd.syms[i].name();
+		symbol.sym_index = i;
+		symbol.size = end - start;
+		symbol.count = count;
+		symbol.linenr = 0;
+		symbol.filename = 0;
 		if (debug_info) {
 			string filename;
-			if (abfd.get_linenr(i, start, filename,
-				symb_entry.sample.file_loc.linenr)) {
-				symb_entry.sample.file_loc.filename =
-					debug_names.create(filename);
-			}
+			if (abfd.get_linenr(i, start, filename, symbol.linenr))
+				symbol.filename = filenames.get(filename);
 		}
+		symbol.vma = abfd.syms[i].vma();
+		symbol.nr_samples = 0;
 
-		symb_entry.image_name = image_names.create(image_name);
-		symb_entry.app_name = image_names.create(app_name);
-
-		symb_entry.sample.vma = abfd.syms[i].vma();
-		if ((header.spu_profile == cell_spu_profile) &&
-		    header.embedded_offset) {
-			symb_entry.spu_offset = header.embedded_offset;
-			symb_entry.embedding_filename =
-				image_names.create(abfd.get_embedding_filename());
-		} else {
-			symb_entry.spu_offset = 0;
+		if (need_details) {
+			symbol.nr_samples = collect_samples(record, filenames,
+			                                    abfd, i, p_it, start);
 		}
-		symbol_entry const * symbol = symbols->insert(symb_entry);
 
-		if (need_details)
-			add_samples(abfd, i, p_it, symbol, pclass, start);
+		record.symbols.push_back(symbol);
 	}
 }
 
 
-void
-profile_container::add_samples(op_bfd const & abfd, symbol_index_t sym_index,
-                               profile_t::iterator_pair const & p_it,
-                               symbol_entry const * symbol, size_t pclass,
-			       unsigned long start)
+size_t profile_container::collect_samples(add_record & record,
+                                          filename_index & filenames,
+                                          op_bfd const & abfd,
+                                          symbol_index_t sym_index,
+                                          profile_t::iterator_pair const & p_it,
+                                          unsigned long start) const
 {
 	bfd_vma base_vma = abfd.syms[sym_index].vma();
+	size_t nr_samples = 0;
 
 	profile_t::const_iterator it;
 	for (it = p_it.first; it != p_it.second ; ++it) {
-		sample_entry sample;
+		add_record::sample sample;
 
-		sample.counts[pclass] = it.count();
+		sample.count = it.count();
 
-		sample.file_loc.linenr = 0;
+		sample.linenr = 0;
+		sample.filename = 0;
 		if (debug_info) {
 			string filename;
 			if (abfd.get_linenr(sym_index, it.vma(), filename,
-					sample.file_loc.linenr)) {
-				sample.file_loc.filename =
-					debug_names.create(filename);
+					sample.linenr)) {
+				sample.filename = filenames.get(filename);
 			}
 		}
 
 		sample.vma = (it.vma() - start) + base_vma;
 
-		samples->insert(symbol, sample);
+		record.samples.push_back(sample);
+		++nr_samples;
+	}
+
+	return nr_samples;
+}
+
+
+// Post condition:
+//  the symbols/samples are sorted by increasing vma.
+//  the range of sample_entry inside each symbol entry are valid
+//  the samples_by_file_loc member var is correctly setup.
+void profile_container::add(add_record const & record)
+{
+	vector<symbol_entry const *> entries;
+	add(record, entries);
+}
+
+
+void profile_container::add(add_record const & record,
+                            vector<symbol_entry const *> & entries)
+{
+	size_t const pclass = record.pclass;
+
+	entries.resize(record.symbols.size());
+
+	vector<add_record::sample>::const_iterator sample_it =
+		record.samples.begin();
+
+	for (size_t i = 0; i < record.symbols.size(); ++i) {
+		add_record::symbol const & symbol = record.symbols[i];
+		symbol_entry symb_entry;
+
+		symb_entry.sample.counts[pclass] = symbol.count;
+		total_count[pclass] += symbol.count;
+
+		symb_entry.size = symbol.size;
+
+		symb_entry.name = symbol_names.create(symbol.name);
+		symb_entry.sym_index = symbol.sym_index;
+
+		symb_entry.sample.file_loc.linenr = symbol.linenr;
+		if (symbol.filename) {
+			symb_entry.sample.file_loc.filename = debug_names.create(
+				record.filenames[symbol.filename - 1]);
+		}
+
+		symb_entry.image_name = image_names.create(record.image_name);
+		symb_entry.app_name = image_names.create(record.app_name);
+
+		symb_entry.sample.vma = symbol.vma;
+		symb_entry.spu_offset = record.spu_offset;
+		if (record.spu_offset) {
+			symb_entry.embedding_filename =
+				image_names.create(record.embedding_filename);
+		}
+		symbol_entry const * entry = symbols->insert(symb_entry);
+		entries[i] = entry;
+
+		for (size_t j = 0; j < symbol.nr_samples; ++j, ++sample_it) {
+			sample_entry sample;
+
+			sample.counts[pclass] = sample_it->count;
+			sample.file_loc.linenr = sample_it->linenr;
+			if (sample_it->filename) {
+				sample.file_loc.filename = debug_names.create(
+					record.filenames[sample_it->filename - 1]);
+			}
+			sample.vma = sample_it->vma;
+
+			samples->insert(entry, sample);
+		}
 	}
 }
 
@@ -14,6 +14,7 @@
 
 #include <string>
 #include <vector>
+#include <map>
 
 #include "profile.h"
 #include "utility.h"
@@ -49,6 +50,12 @@ public:
 			  extra_images const & extra);
 
 	~profile_container();
+
+	/// the hints given to the ctor
+	//@{
+	bool get_debug_info() const { return debug_info; }
+	bool get_need_details() const { return need_details; }
+	//@}
  
 	/**
 	 * add() - record symbols/samples in the underlying container
@@ -66,6 +73,65 @@ public:
 	void add(profile_t const & profile, op_bfd const & abfd,
 		 std::string const & app_name, size_t pclass);
 
+	/**
+	 * What add() records for one profile class. Names are kept as
+	 * strings rather than created in the global name storage, so a
+	 * record can be built in another process, see populate_for_images().
+	 */
+	struct add_record {
+		/// a sample belonging to a symbol
+		struct sample {
+			count_type count;
+			unsigned int linenr;
+			/// 1 + index in filenames, 0 if no source location
+			size_t filename;
+			bfd_vma vma;
+		};
+
+		struct symbol {
+			std::string name;
+			size_t sym_index;
+			size_t size;
+			count_type count;
+			unsigned int linenr;
+			/// 1 + index in filenames, 0 if no source location
+			size_t filename;
+			bfd_vma vma;
+			/// nr of samples of this symbol, they follow the
+			/// samples of the previous symbol in samples
+			size_t nr_samples;
+		};
+
+		size_t pclass;
+		std::string image_name;
+		std::string app_name;
+		/// non zero for a SPU profile embedded in another file
+		uint64_t spu_offset;
+		std::string embedding_filename;
+		/// source filenames, each stored only once
+		std::vector<std::string> filenames;
+		std::vector<symbol> symbols;
+		std::vector<sample> samples;
+	};
+
+	/// collect() - build the record add() would use, see add() params
+	void collect(add_record & record, profile_t const & profile,
+		     op_bfd const & abfd, std::string const & app_name,
+		     size_t pclass) const;
+
+	/**
+	 * add() - record a collect() result in the underlying container
+	 *
+	 * Names are created in the same order as add(profile, ...) would
+	 * so the container doesn't depend on where record was built.
+	 */
+	void add(add_record const & record);
+
+	/// same as above, entries is filled with the symbol_entry of each
+	/// symbol of record
+	void add(add_record const & record,
+	         std::vector<symbol_entry const *> & entries);
+
 	/// Find a symbol from its image_name, vma, return zero if no symbol
 	/// for this image at this vma
 	symbol_entry const * find_symbol(std::string const & image_name,
@@ -141,11 +207,27 @@ public:
 	sample_container::samples_iterator end(symbol_entry const *) const;
 
 private:
-	/// helper for add()
-	void add_samples(op_bfd const & abfd, symbol_index_t sym_index,
-	                 profile_t::iterator_pair const &,
-	                 symbol_entry const * symbol, size_t pclass,
-			 unsigned long start);
+	/// source filenames of an add_record, see filename_index::get()
+	class filename_index {
+	public:
+		filename_index(std::vector<std::string> & filenames_)
+			: filenames(filenames_), last(0) {}
+
+		/// return 1 + index of filename, adding it if needed
+		size_t get(std::string const & filename);
+
+	private:
+		std::vector<std::string> & filenames;
+		std::map<std::string, size_t> index;
+		/// consecutive samples are most often in the same file
+		size_t last;
+	};
+
+	/// helper for collect(), return the nr of samples added to record
+	size_t collect_samples(add_record & record, filename_index & filenames,
+	                       op_bfd const & abfd, symbol_index_t sym_index,
+	                       profile_t::iterator_pair const &,
+	                       unsigned long start) const;
 
 	/**
 	 * create an unique artificial symbol for an offset range. The range
@@ -24,6 +24,7 @@
 #include "op_exception.h"
 #include "op_header.h"
 #include "op_fileio.h"
+#include "odb.h"
 
 using namespace std;
 
@@ -495,6 +496,34 @@ void warn_if_kern_buffs_overflow(string const & session_samples_dir)
 }
 
 
+struct packed_files {
+	string pack;
+	list<string> * files;
+};
+
+
+void add_packed_file(char const * name, void * arg)
+{
+	packed_files * packed = static_cast<packed_files *>(arg);
+	packed->files->push_back(packed->pack + '/' + name);
+}
+
+
+/**
+ * Add to files the sample files stored in the container pack if it
+ * exists. The container is left open as the files will be opened later.
+ */
+void list_packed_files(list<string> & files, string const & pack)
+{
+	if (odb_pack_open(pack.c_str(), ODB_RDONLY))
+		return;
+
+	packed_files packed;
+	packed.pack = pack;
+	packed.files = &files;
+	odb_pack_list(pack.c_str(), add_packed_file, &packed);
+}
+
 }  // anonymous namespace
 
 
@@ -538,7 +567,11 @@ list<string> profile_spec::generate_file_list(bool exclude_dependent,
 		list<string> files;
 		create_file_list(files, base_dir, "*", true);
 
-		if (!files.empty()) {
+		string const pack = base_dir + "/" OP_SAMPLES_PACK_NAME;
+		list<string> packed;
+		list_packed_files(packed, pack);
+
+		if (!files.empty() || !packed.empty()) {
 			found_file = true;
 			warn_if_kern_buffs_overflow(base_dir + "/");
 		}
@@ -551,6 +584,12 @@ list<string> profile_spec::generate_file_list(bool exclude_dependent,
 				unique_files.insert(*it);
 			}
 		}
+		for (it = packed.begin(); it != packed.end(); ++it) {
+			if (valid_candidate(pack, *it, *this,
+			    exclude_dependent, exclude_cg)) {
+				unique_files.insert(*it);
+			}
+		}
 		if (invalid_sample_file) {
 			cerr << "Warning: Invalid sample files found in "
 			     << base_dir << endl;
@@ -0,0 +1,277 @@
+/**
+ * @file sample_spill.cpp
+ * Per symbol detail samples kept out of profile_container
+ *
+ * @remark Copyright 2010 OProfile authors
+ * @remark Read the file COPYING
+ */
+
+#include <unistd.h>
+#include <errno.h>
+
+#include <cstdlib>
+#include <algorithm>
+#include <iostream>
+#include <queue>
+
+#include "sample_spill.h"
+#include "op_exception.h"
+#include "cverb.h"
+
+using namespace std;
+
+namespace {
+
+size_t const npos = size_t(-1);
+
+
+/// create an unnamed temporary file
+int create_temp()
+{
+	char const * dir = getenv("TMPDIR");
+	string temp = string(dir && *dir ? dir : "/tmp") + "/opreport.XXXXXX";
+	int fd = mkstemp(&temp[0]);
+	if (fd == -1)
+		throw op_runtime_error("sample_spill: can't create " + temp, errno);
+	// nobody else needs it, it is removed on close
+	unlink(temp.c_str());
+	return fd;
+}
+
+
+void write_at(int fd, void const * data, size_t size, off_t offset)
+{
+	char const * pos = static_cast<char const *>(data);
+	while (size) {
+		ssize_t count = pwrite(fd, pos, size, offset);
+		if (count < 0 && errno == EINTR)
+			continue;
+		if (count <= 0) {
+			throw op_runtime_error("sample_spill: can't write the "
+			                       "temporary file", errno);
+		}
+		pos += count;
+		offset += count;
+		size -= count;
+	}
+}
+
+
+void read_at(int fd, void * data, size_t size, off_t offset)
+{
+	char * pos = static_cast<char *>(data);
+	while (size) {
+		ssize_t count = pread(fd, pos, size, offset);
+		if (count < 0 && errno == EINTR)
+			continue;
+		if (count <= 0) {
+			throw op_runtime_error("sample_spill: can't read the "
+			                       "temporary file", errno);
+		}
+		pos += count;
+		offset += count;
+		size -= count;
+	}
+}
+
+
+/// the next sample of a run in the merge of get(), the smallest first
+struct merge_pos {
+	bfd_vma vma;
+	/// the run order breaks ties, as the first class comes first
+	size_t run;
+	size_t pos;
+
+	bool operator<(merge_pos const & rhs) const {
+		if (vma != rhs.vma)
+			return vma > rhs.vma;
+		return run > rhs.run;
+	}
+};
+
+}  // anonymous namespace
+
+
+sample_spill::sample_spill(size_t memory_limit_)
+	: memory_limit(memory_limit_), file_samples(0), file_runs(0),
+	  fd(-1), runs_fd(-1)
+{
+}
+
+
+sample_spill::~sample_spill()
+{
+	if (fd != -1)
+		close(fd);
+	if (runs_fd != -1)
+		close(runs_fd);
+}
+
+
+void sample_spill::add(profile_container & container,
+                       profile_container::add_record & record)
+{
+	typedef profile_container::add_record::sample sample;
+
+	// only the symbols go to the container
+	vector<size_t> nr_samples(record.symbols.size());
+	for (size_t i = 0; i < record.symbols.size(); ++i) {
+		nr_samples[i] = record.symbols[i].nr_samples;
+		record.symbols[i].nr_samples = 0;
+	}
+
+	vector<symbol_entry const *> entries;
+	container.add(record, entries);
+
+	vector<sample>::const_iterator sample_it = record.samples.begin();
+
+	for (size_t i = 0; i < record.symbols.size(); ++i) {
+		if (!nr_samples[i])
+			continue;
+
+		pair<last_runs_t::iterator, bool> last =
+			last_runs.insert(make_pair(entries[i], npos));
+
+		run r;
+		r.first = file_samples + buffer.size();
+		r.nr = nr_samples[i];
+		r.pclass = record.pclass;
+		r.prev = last.first->second;
+		last.first->second = file_runs + run_buffer.size();
+		run_buffer.push_back(r);
+
+		for (size_t j = 0; j < nr_samples[i]; ++j, ++sample_it) {
+			stored_sample s;
+			s.vma = sample_it->vma;
+			s.count = sample_it->count;
+			s.linenr = sample_it->linenr;
+			if (sample_it->filename) {
+				s.filename = debug_names.create(
+					record.filenames[sample_it->filename - 1]);
+			}
+			buffer.push_back(s);
+		}
+	}
+
+	record.samples.clear();
+
+	if (buffer.size() * sizeof(stored_sample) +
+	    run_buffer.size() * sizeof(run) > memory_limit)
+		flush();
+}
+
+
+void sample_spill::flush()
+{
+	if (fd == -1)
+		fd = create_temp();
+	if (runs_fd == -1)
+		runs_fd = create_temp();
+
+	if (!buffer.empty()) {
+		write_at(fd, &buffer[0], buffer.size() * sizeof(stored_sample),
+		         off_t(file_samples) * sizeof(stored_sample));
+	}
+	if (!run_buffer.empty()) {
+		write_at(runs_fd, &run_buffer[0], run_buffer.size() * sizeof(run),
+		         off_t(file_runs) * sizeof(run));
+	}
+
+	cverb << vdebug << "sample_spill: " << buffer.size() << " samples and "
+	      << run_buffer.size() << " runs written" << endl;
+
+	file_samples += buffer.size();
+	file_runs += run_buffer.size();
+	// release the memory, not only the content
+	vector<stored_sample>().swap(buffer);
+	vector<run>().swap(run_buffer);
+}
+
+
+void sample_spill::read(size_t first, size_t nr,
+                        vector<stored_sample> & out) const
+{
+	out.resize(nr);
+	if (!nr)
+		return;
+
+	if (first >= file_samples) {
+		copy(buffer.begin() + (first - file_samples),
+		     buffer.begin() + (first - file_samples) + nr, out.begin());
+		return;
+	}
+
+	// a run is added at once so it is never split by flush()
+	read_at(fd, &out[0], nr * sizeof(stored_sample),
+	        off_t(first) * sizeof(stored_sample));
+}
+
+
+sample_spill::run sample_spill::read_run(size_t index) const
+{
+	if (index >= file_runs)
+		return run_buffer[index - file_runs];
+
+	run r;
+	read_at(runs_fd, &r, sizeof(r), off_t(index) * sizeof(run));
+	return r;
+}
+
+
+bool sample_spill::get(symbol_entry const & symbol,
+                       vector<sample_entry> & samples) const
+{
+	samples.clear();
+
+	last_runs_t::const_iterator it = last_runs.find(&symbol);
+	if (it == last_runs.end())
+		return false;
+
+	// the chain goes from the last run to the first one
+	vector<run> symbol_runs;
+	for (size_t index = it->second; index != npos; ) {
+		symbol_runs.push_back(read_run(index));
+		index = symbol_runs.back().prev;
+	}
+	reverse(symbol_runs.begin(), symbol_runs.end());
+
+	vector<vector<stored_sample> > stored(symbol_runs.size());
+	priority_queue<merge_pos> heap;
+	for (size_t i = 0; i < symbol_runs.size(); ++i) {
+		read(symbol_runs[i].first, symbol_runs[i].nr, stored[i]);
+		if (!stored[i].empty()) {
+			merge_pos pos = { stored[i][0].vma, i, 0 };
+			heap.push(pos);
+		}
+	}
+
+	// each run is sorted, merge them, adding the samples of all
+	// classes at the same vma
+	while (!heap.empty()) {
+		merge_pos pos = heap.top();
+		heap.pop();
+
+		stored_sample const & s = stored[pos.run][pos.pos];
+		if (samples.empty() || samples.back().vma != s.vma) {
+			sample_entry sample;
+			sample.vma = s.vma;
+			sample.file_loc.filename = s.filename;
+			sample.file_loc.linenr = s.linenr;
+			samples.push_back(sample);
+		}
+		samples.back().counts[symbol_runs[pos.run].pclass] += s.count;
+
+		if (++pos.pos < stored[pos.run].size()) {
+			pos.vma = stored[pos.run][pos.pos].vma;
+			heap.push(pos);
+		}
+	}
+
+	return true;
+}
+
+
+size_t sample_spill::spilled_size() const
+{
+	return file_samples * sizeof(stored_sample) + file_runs * sizeof(run);
+}
@@ -0,0 +1,106 @@
+/**
+ * @file sample_spill.h
+ * Per symbol detail samples kept out of profile_container
+ *
+ * @remark Copyright 2010 OProfile authors
+ * @remark Read the file COPYING
+ *
+ * The detail samples of a large session don't fit in memory when held
+ * by a profile_container. sample_spill holds them in a compact form,
+ * and moves them to a temporary file once they use more memory than a
+ * given limit. The samples of each symbol are stored as one sorted run
+ * per profile class, merged back when the symbol is output. The runs
+ * are spilled along with the samples, only the last run of each symbol
+ * stays in memory.
+ */
+
+#ifndef SAMPLE_SPILL_H
+#define SAMPLE_SPILL_H
+
+#include <vector>
+#include <map>
+
+#include "profile_container.h"
+#include "symbol.h"
+#include "utility.h"
+
+class sample_spill : noncopyable {
+public:
+	/**
+	 * @param memory_limit  the memory used by samples and runs not yet
+	 *  written to the temporary files, in bytes
+	 */
+	explicit sample_spill(size_t memory_limit);
+
+	/// remove the temporary files
+	~sample_spill();
+
+	/**
+	 * add - add a profile_container::add_record
+	 * @param container  where the symbols of record are added
+	 * @param record  the record, its samples are moved to the spill
+	 *
+	 * Throw op_runtime_error if the temporary file can't be written.
+	 */
+	void add(profile_container & container,
+	         profile_container::add_record & record);
+
+	/**
+	 * get - return the samples of a symbol for all classes, sorted by
+	 * vma, as a profile_container would give them. Return false if
+	 * the symbol samples were not added through add().
+	 */
+	bool get(symbol_entry const & symbol,
+	         std::vector<sample_entry> & samples) const;
+
+	/// the nr of bytes written to the temporary files
+	size_t spilled_size() const;
+
+private:
+	/// a sample as stored, for one profile class
+	struct stored_sample {
+		bfd_vma vma;
+		count_type count;
+		debug_name_id filename;
+		unsigned int linenr;
+	};
+
+	/// the samples of a symbol for one class
+	struct run {
+		/// index of the first sample, see file_samples
+		size_t first;
+		size_t nr;
+		size_t pclass;
+		/// index of the previous run of the symbol, or npos
+		size_t prev;
+	};
+
+	/// the index of the last run of each symbol
+	typedef std::map<symbol_entry const *, size_t> last_runs_t;
+
+	/// write the buffered samples and runs to the temporary files
+	void flush();
+
+	/// read nr samples from index first
+	void read(size_t first, size_t nr,
+	          std::vector<stored_sample> & out) const;
+
+	/// read the run at index
+	run read_run(size_t index) const;
+
+	size_t memory_limit;
+	last_runs_t last_runs;
+	/// samples not yet written, they follow the ones of the file
+	std::vector<stored_sample> buffer;
+	/// runs not yet written, they follow the ones of the file
+	std::vector<run> run_buffer;
+	/// nr of samples written to the file
+	size_t file_samples;
+	/// nr of runs written to the runs file
+	size_t file_runs;
+	/// temporary files, -1 until needed
+	int fd;
+	int runs_fd;
+};
+
+#endif /* !SAMPLE_SPILL_H */
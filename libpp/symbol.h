@@ -14,7 +14,7 @@
 
 #include "name_storage.h"
 #include "growable_vector.h"
-#include "sparse_array.h"
+#include "small_array.h"
 #include "format_flags.h"
 #include "op_types.h"
 
@@ -26,8 +26,8 @@
 class extra_images;
 
 
-/// for storing sample counts
-typedef sparse_array<u32, count_type> count_array_t;
+/// for storing sample counts, indexed by profile class
+typedef small_array<count_type, 4> count_array_t;
 
 
 /// A simple container for a fileno:linenr location.
@@ -0,0 +1,430 @@
+/**
+ * @file export_tests.cpp
+ * tests export_writer and export_reader
+ *
+ * @remark Copyright 2010 OProfile authors
+ * @remark Read the file COPYING
+ */
+
+#include <unistd.h>
+#include <string.h>
+
+#include <cstdlib>
+#include <cstdio>
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "export_writer.h"
+#include "export_reader.h"
+#include "export_format.h"
+#include "op_exception.h"
+#include "op_sample_file.h"
+#include "op_config.h"
+#include "odb.h"
+
+using namespace std;
+
+namespace {
+
+typedef profile_container::add_record::symbol symbol;
+typedef profile_container::add_record::sample sample;
+
+int nr_error;
+
+
+void check(bool cond, string const & what)
+{
+	if (!cond) {
+		cerr << "export: " << what << endl;
+		++nr_error;
+	}
+}
+
+
+export_session make_session()
+{
+	export_session session;
+	session.cpuinfo = "cpu";
+	session.event = "CPU_CLK_UNHALTED";
+	session.classes.resize(2);
+	session.classes[0].name = "c0";
+	session.classes[0].longname = "class 0";
+	session.classes[1].name = "c1";
+	session.classes[1].longname = "class 1";
+	return session;
+}
+
+
+symbol make_symbol(string const & name, bfd_vma vma, count_type count,
+                   size_t filename, size_t nr_samples)
+{
+	symbol sym;
+	sym.name = name;
+	sym.sym_index = vma & 0xff;
+	sym.size = 0x40;
+	sym.count = count;
+	sym.linenr = filename ? 10 : 0;
+	sym.filename = filename;
+	sym.vma = vma;
+	sym.nr_samples = nr_samples;
+	return sym;
+}
+
+
+sample make_sample(bfd_vma vma, count_type count, size_t filename)
+{
+	sample s;
+	s.count = count;
+	s.linenr = filename ? 12 : 0;
+	s.filename = filename;
+	s.vma = vma;
+	return s;
+}
+
+
+/// the vmas aren't sorted so negative deltas are written
+profile_container::add_record make_record()
+{
+	profile_container::add_record record;
+	record.pclass = 1;
+	record.image_name = "/bin/image";
+	record.app_name = "/bin/app";
+	record.spu_offset = 0;
+	// numbered in order of use, as the reader does
+	record.filenames.push_back("a.c");
+	record.filenames.push_back("b.c");
+
+	record.symbols.push_back(make_symbol("f", 0x8000, 5, 1, 2));
+	record.symbols.push_back(make_symbol("g", 0x1000, 300, 0, 1));
+	record.symbols.push_back(make_symbol("h", 0xfffff000, 1, 2, 0));
+
+	record.samples.push_back(make_sample(0x8010, 2, 1));
+	record.samples.push_back(make_sample(0x8004, 3, 0));
+	record.samples.push_back(make_sample(0x1000, 300, 2));
+
+	return record;
+}
+
+
+bool operator==(symbol const & lhs, symbol const & rhs)
+{
+	return lhs.name == rhs.name && lhs.sym_index == rhs.sym_index &&
+		lhs.size == rhs.size && lhs.count == rhs.count &&
+		lhs.linenr == rhs.linenr && lhs.filename == rhs.filename &&
+		lhs.vma == rhs.vma && lhs.nr_samples == rhs.nr_samples;
+}
+
+
+bool operator==(sample const & lhs, sample const & rhs)
+{
+	return lhs.count == rhs.count && lhs.linenr == rhs.linenr &&
+		lhs.filename == rhs.filename && lhs.vma == rhs.vma;
+}
+
+
+string read_file(string const & filename)
+{
+	ifstream in(filename.c_str(), ios::binary);
+	ostringstream out;
+	out << in.rdbuf();
+	return out.str();
+}
+
+
+void write_file(string const & filename, string const & content)
+{
+	ofstream out(filename.c_str(), ios::binary | ios::trunc);
+	out.write(content.data(), content.size());
+}
+
+
+/// return true if reading filename up to its end block throws
+bool rejected(string const & filename)
+{
+	try {
+		export_reader reader(filename);
+		while (reader.next() != export_reader::end_block)
+			;
+	} catch (op_runtime_error const &) {
+		return true;
+	}
+	return false;
+}
+
+
+void put_uleb(string & out, u64 value)
+{
+	do {
+		unsigned char byte = value & 0x7f;
+		value >>= 7;
+		if (value)
+			byte |= 0x80;
+		out += byte;
+	} while (value);
+}
+
+
+void put_string(string & out, string const & str)
+{
+	put_uleb(out, str.size());
+	out += str;
+}
+
+
+/// a header of a session with a single class
+string make_header()
+{
+	string header(OP_EXPORT_MAGIC, OP_EXPORT_MAGIC_SIZE);
+	put_uleb(header, OP_EXPORT_VERSION);
+	put_string(header, "cpu");
+	put_string(header, "event");
+	put_uleb(header, 1);
+	put_string(header, "c0");
+	put_string(header, "class 0");
+	return header;
+}
+
+
+string make_block(char tag, string const & payload)
+{
+	string block(1, tag);
+	put_uleb(block, payload.size());
+	return block + payload;
+}
+
+
+/// an image block of one symbol without samples, whose payload values
+/// can be replaced
+string image_payload(u64 pclass, u64 image, u64 sym_filename)
+{
+	string payload;
+	put_uleb(payload, pclass);
+	put_uleb(payload, 2);
+	put_string(payload, "/bin/image");
+	put_string(payload, "f");
+	put_uleb(payload, image);
+	put_uleb(payload, 0);
+	put_uleb(payload, 0);
+	put_uleb(payload, 0);
+	put_uleb(payload, 1);
+	put_uleb(payload, 1);		// name
+	put_uleb(payload, 0);		// sym_index
+	put_uleb(payload, 0);		// vma
+	put_uleb(payload, 0);		// size
+	put_uleb(payload, 1);		// count
+	put_uleb(payload, sym_filename);
+	put_uleb(payload, 0);		// linenr
+	put_uleb(payload, 0);		// nr_samples
+	put_uleb(payload, 0);
+	return payload;
+}
+
+
+string end_block()
+{
+	string payload;
+	put_uleb(payload, 1);
+	put_uleb(payload, 1);
+	return make_block(export_block_end, payload);
+}
+
+
+void round_trip_tests(string const & filename)
+{
+	export_session const session = make_session();
+	profile_container::add_record const record = make_record();
+
+	export_writer writer(filename, session);
+	writer.add(record);
+	writer.close();
+
+	export_reader reader(filename);
+	check(reader.session().cpuinfo == session.cpuinfo, "cpuinfo");
+	check(reader.session().event == session.event, "event");
+	check(reader.session().classes.size() == 2, "nr classes");
+	check(reader.session().classes[1].longname == "class 1",
+	      "class longname");
+
+	check(reader.next() == export_reader::image_block, "no image block");
+	profile_container::add_record const & read = reader.image();
+	check(reader.pclass() == 1 && read.pclass == 1, "pclass");
+	check(read.image_name == record.image_name, "image name");
+	check(read.app_name == record.app_name, "app name");
+	check(read.filenames == record.filenames, "source filenames");
+	check(read.symbols.size() == record.symbols.size(), "nr symbols");
+	for (size_t i = 0; i < read.symbols.size(); ++i)
+		check(read.symbols[i] == record.symbols[i], "symbol");
+	check(read.samples.size() == record.samples.size(), "nr samples");
+	for (size_t i = 0; i < read.samples.size(); ++i)
+		check(read.samples[i] == record.samples[i], "sample");
+
+	check(reader.next() == export_reader::end_block, "no end block");
+	check(reader.totals().size() == 2, "nr totals");
+	check(reader.totals()[0] == 0 && reader.totals()[1] == 306, "totals");
+	check(reader.next() == export_reader::end_block, "read past the end");
+}
+
+
+/// the lines of the data address sample file, not all fit in 32 bits
+u64 const data_lines[] = { 0x7fff12345678ULL, 0x10, 0x7fff12345677ULL };
+size_t const nr_data_lines = sizeof(data_lines) / sizeof(data_lines[0]);
+
+
+/// write a data address sample file, line i has i + 1 samples
+void write_data_file(string const & filename, u32 data_shift)
+{
+	odb_t db;
+	odb_init(&db);
+	int rc = odb_open(&db, filename.c_str(), ODB_RDWR,
+	                  sizeof(struct opd_header));
+	if (rc)
+		throw op_runtime_error(filename + ": " + strerror(rc));
+
+	opd_header & head = *static_cast<opd_header *>(odb_get_data(&db));
+	memcpy(head.magic, OPD_MAGIC, sizeof(head.magic));
+	head.version = OPD_VERSION;
+	head.data_shift = data_shift;
+
+	for (size_t i = 0; i < nr_data_lines; ++i)
+		odb_update_node_with_offset(&db, data_lines[i], i + 1);
+
+	odb_close(&db);
+}
+
+
+void data_tests(string const & filename, string const & sample_file)
+{
+	write_data_file(sample_file, 6);
+
+	export_writer writer(filename, make_session());
+	writer.add_data(sample_file, "/bin/image", "/bin/app", 1);
+	writer.close();
+
+	export_reader reader(filename);
+	check(reader.next() == export_reader::data_block, "no data block");
+	export_data const & data = reader.data();
+	check(reader.pclass() == 1, "data pclass");
+	check(data.image == "/bin/image", "data image name");
+	check(data.app == "/bin/app", "data app name");
+	check(data.data_shift == 6, "data_shift");
+	check(data.lines.size() == nr_data_lines, "nr data lines");
+	if (data.lines.size() == nr_data_lines) {
+		// sorted by line
+		check(data.lines[0] == make_pair(data_lines[1], count_type(2)) &&
+		      data.lines[1] == make_pair(data_lines[2], count_type(3)) &&
+		      data.lines[2] == make_pair(data_lines[0], count_type(1)),
+		      "data lines");
+	}
+
+	check(reader.next() == export_reader::end_block, "no end block");
+	check(reader.totals()[1] == 6, "data totals");
+
+	// the samples of other sample files aren't data lines
+	write_data_file(sample_file, 0);
+	export_writer no_data(filename, make_session());
+	no_data.add_data(sample_file, "/bin/image", "/bin/app", 1);
+	no_data.close();
+
+	export_reader no_data_reader(filename);
+	check(no_data_reader.next() == export_reader::end_block,
+	      "data block of a pc sample file");
+}
+
+
+void truncated_tests(string const & filename, string const & truncated)
+{
+	string const content = read_file(filename);
+	check(!rejected(filename), "valid file rejected");
+
+	for (size_t size = 0; size < content.size(); ++size) {
+		write_file(truncated, content.substr(0, size));
+		ostringstream what;
+		what << "file truncated to " << size << " bytes accepted";
+		check(rejected(truncated), what.str());
+	}
+}
+
+
+void index_tests(string const & filename)
+{
+	string const header = make_header();
+
+	write_file(filename, header +
+		make_block(export_block_image, image_payload(0, 0, 0)) +
+		end_block());
+	check(!rejected(filename), "valid image block rejected");
+
+	// an unknown block is skipped
+	write_file(filename, header + make_block('Z', "junk") + end_block());
+	check(!rejected(filename), "unknown block not skipped");
+
+	write_file(filename, header +
+		make_block(export_block_image, image_payload(1, 0, 0)) +
+		end_block());
+	check(rejected(filename), "out of range pclass accepted");
+
+	write_file(filename, header +
+		make_block(export_block_image, image_payload(0, 2, 0)) +
+		end_block());
+	check(rejected(filename), "out of range string index accepted");
+
+	write_file(filename, header +
+		make_block(export_block_image, image_payload(0, 0, 3)) +
+		end_block());
+	check(rejected(filename), "out of range source filename accepted");
+
+	string totals;
+	put_uleb(totals, 2);
+	put_uleb(totals, 1);
+	put_uleb(totals, 1);
+	write_file(filename, header + make_block(export_block_end, totals));
+	check(rejected(filename), "wrong nr of totals accepted");
+
+	string data;
+	put_uleb(data, 0);		// pclass
+	put_uleb(data, 1);
+	put_string(data, "/bin/image");
+	put_uleb(data, 0);		// image
+	put_uleb(data, 0);		// app
+	put_uleb(data, 64);		// data_shift
+	put_uleb(data, 0);		// nr_lines
+	write_file(filename, header +
+		make_block(export_block_data, data) + end_block());
+	check(rejected(filename), "out of range data_shift accepted");
+}
+
+}  // anonymous namespace
+
+
+int main()
+{
+	char dir[] = "/tmp/export_tests.XXXXXX";
+	if (!mkdtemp(dir)) {
+		perror(dir);
+		return EXIT_FAILURE;
+	}
+
+	string const filename = string(dir) + "/session";
+	string const truncated = string(dir) + "/truncated";
+	string const sample_file = string(dir) + "/samples";
+
+	try {
+		round_trip_tests(filename);
+		truncated_tests(filename, truncated);
+		index_tests(filename);
+		data_tests(filename, sample_file);
+	} catch (op_runtime_error const & e) {
+		cerr << "export: " << e.what() << endl;
+		++nr_error;
+	}
+
+	remove(filename.c_str());
+	remove(truncated.c_str());
+	remove(sample_file.c_str());
+	rmdir(dir);
+
+	return nr_error ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -0,0 +1,127 @@
+/**
+ * @file populate_tests.cpp
+ * tests populate_for_images()
+ *
+ * @remark Copyright 2010 OProfile authors
+ * @remark Read the file COPYING
+ */
+
+#include <sys/types.h>
+#include <dirent.h>
+#include <unistd.h>
+#include <limits.h>
+
+#include <cstdlib>
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+#include <fstream>
+#include <string>
+#include <list>
+
+#include "op_config.h"
+#include "arrange_profiles.h"
+#include "profile_container.h"
+#include "locate_images.h"
+#include "string_filter.h"
+#include "populate.h"
+
+using namespace std;
+
+namespace {
+
+int nr_error;
+
+
+void check(bool cond, char const * what)
+{
+	if (!cond) {
+		cerr << "populate_for_images: " << what << endl;
+		++nr_error;
+	}
+}
+
+
+/// return the nr of entries in dir
+size_t count_files(string const & dir)
+{
+	DIR * d = opendir(dir.c_str());
+	if (!d)
+		return 0;
+	size_t nr = 0;
+	struct dirent * entry;
+	while ((entry = readdir(d)) != 0) {
+		if (strcmp(entry->d_name, ".") && strcmp(entry->d_name, ".."))
+			++nr;
+	}
+	closedir(d);
+	return nr;
+}
+
+
+void remove_dir(string const & dir)
+{
+	DIR * d = opendir(dir.c_str());
+	if (!d)
+		return;
+	struct dirent * entry;
+	while ((entry = readdir(d)) != 0) {
+		string const name = entry->d_name;
+		if (name != "." && name != "..")
+			remove((dir + '/' + name).c_str());
+	}
+	closedir(d);
+	rmdir(dir.c_str());
+}
+
+}  // anonymous namespace
+
+
+int main()
+{
+	char dir[] = "/tmp/populate_tests.XXXXXX";
+	if (!mkdtemp(dir)) {
+		perror(dir);
+		return EXIT_FAILURE;
+	}
+
+	char self[PATH_MAX];
+	ssize_t const len = readlink("/proc/self/exe", self, sizeof(self) - 1);
+	if (len <= 0) {
+		perror("/proc/self/exe");
+		return EXIT_FAILURE;
+	}
+	self[len] = '\0';
+
+	string const test_dir = dir;
+	string const cache_dir = test_dir + "/bfd_cache";
+	string const copy = test_dir + "/image";
+
+	// two different images, so each worker loads one
+	{
+		ifstream in(self, ios::binary);
+		ofstream out(copy.c_str(), ios::binary);
+		out << in.rdbuf();
+	}
+
+	strcpy(op_bfd_cache_dir, cache_dir.c_str());
+
+	// images without sample files are loaded all the same
+	list<inverted_profile> iprofiles(2);
+	iprofiles.front().image = self;
+	iprofiles.back().image = copy;
+
+	extra_images extra;
+	profile_container samples(false, false, extra);
+	populate_for_images(samples, iprofiles, string_filter(), 2, 0);
+
+	// the workers exit with _exit(), their op_bfd caches must have
+	// been written before
+	check(count_files(cache_dir) == 2, "bfd_cache not written by workers");
+
+	remove_dir(cache_dir);
+	remove(copy.c_str());
+	rmdir(test_dir.c_str());
+
+	return nr_error ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -11,6 +11,7 @@
 #include "bfd_support.h"
 
 #include "op_bfd.h"
+#include "dwarf_line_table.h"
 #include "op_fileio.h"
 #include "op_config.h"
 #include "string_manip.h"
@@ -294,7 +295,8 @@ bfd * fdopen_bfd(string const & file, int fd)
 
 
 bool find_separate_debug_file(bfd * ibfd, string const & filepath_in, 
-                              string & debug_filename, extra_images const & extra)
+                              string & debug_filename, extra_images const & extra,
+                              vector<string> * candidates)
 {
 	string filepath(filepath_in);
 	string basename;
@@ -316,6 +318,12 @@ bool find_separate_debug_file(bfd * ibfd, string const & filepath_in,
 	cverb << vbfd << "looking for debugging file " << basename 
 	      << " with crc32 = " << hex << crc32 << endl;
 
+	if (candidates) {
+		candidates->push_back(first_try);
+		candidates->push_back(second_try);
+		candidates->push_back(third_try);
+	}
+
 	if (separate_debug_file_exists(first_try, crc32, extra)) 
 		debug_filename = first_try; 
 	else if (separate_debug_file_exists(second_try, crc32, extra))
@@ -673,3 +681,82 @@ fail:
 	info.line = 0;
 	return info;
 }
+
+
+namespace {
+
+/// read a debug section, leaving content empty if there is none
+bool read_debug_section(bfd * abfd, char const * name, string & content)
+{
+	asection * sect = bfd_get_section_by_name(abfd, name);
+	if (!sect)
+		return true;
+
+	bfd_size_type const size = bfd_section_size(abfd, sect);
+	content.resize(size);
+	if (!size)
+		return true;
+
+	return bfd_get_section_contents(abfd, sect, &content[0],
+	                                static_cast<file_ptr>(0), size);
+}
+
+}  // namespace anon
+
+
+bool read_line_table(bfd_info const & b, dwarf_line_table & table)
+{
+	if (!b.valid())
+		return false;
+
+	// the line programs of a relocatable object need relocation, and
+	// all their code sections start at address zero
+	if (bfd_get_file_flags(b.abfd) & HAS_RELOC)
+		return false;
+
+	dwarf_line_table::sections secs;
+	if (!read_debug_section(b.abfd, ".debug_info", secs.info) ||
+	    !read_debug_section(b.abfd, ".debug_abbrev", secs.abbrev) ||
+	    !read_debug_section(b.abfd, ".debug_line", secs.line) ||
+	    !read_debug_section(b.abfd, ".debug_str", secs.str) ||
+	    !read_debug_section(b.abfd, ".debug_line_str", secs.line_str))
+		return false;
+
+	if (secs.line.empty())
+		return false;
+
+	bool const ok = table.read(secs, bfd_big_endian(b.abfd),
+	                   ::bfd_arch_bits_per_address(b.abfd) / 8);
+
+	cverb << vbfd << "DWARF line table "
+	      << (ok ? "read for " : "not usable for ")
+	      << bfd_get_filename(b.abfd) << endl;
+
+	return ok && !table.empty();
+}
+
+
+linenr_info const
+find_line_in_table(dwarf_line_table const & table, bfd_info const & b,
+                   op_bfd_symbol const & sym, bfd_vma offset)
+{
+	linenr_info info;
+	info.found = false;
+	info.line = 0;
+
+	// take care about artificial symbol
+	if (!b.valid() || !sym.symbol())
+		return info;
+
+	asection const * section = sym.symbol()->section;
+	bfd_vma const pc = (sym.value() + offset) - sym.filepos();
+
+	if ((bfd_get_section_flags(b.abfd, section) & SEC_ALLOC) == 0)
+		return info;
+
+	if (pc >= bfd_section_size(b.abfd, section))
+		return info;
+
+	info.found = table.find(section->vma + pc, info.filename, info.line);
+	return info;
+}
@@ -19,8 +19,10 @@
 #include <stdint.h>
 
 #include <string>
+#include <vector>
 
 class op_bfd_symbol;
+class dwarf_line_table;
 
 /// holder for BFD state we must keep
 struct bfd_info {
@@ -104,12 +106,16 @@ private:
  * this separate file, and a link to the new file is placed in the
  * binary. The debug files hold the information needed by the debugger
  * (and OProfile) to map machine instructions back to source code.
+ *
+ * If candidates is non-NULL, the file names looked for are appended to it
+ * before being resolved through extra.
  */
 extern bool
 find_separate_debug_file(bfd * ibfd, 
                          std::string const & filepath_in,
                          std::string & debug_filename,
-                         extra_images const & extra);
+                         extra_images const & extra,
+                         std::vector<std::string> * candidates = 0);
 
 /// open the given BFD
 bfd * open_bfd(std::string const & file);
@@ -153,4 +159,23 @@ linenr_info const
 find_nearest_line(bfd_info const & ibfd, op_bfd_symbol const & sym,
                   bfd_vma offset, bool anon_obj);
 
+/**
+ * read_line_table - decode the DWARF line programs of a bfd
+ * @param b  the bfd holding the debug info
+ * @param table  the table to fill
+ *
+ * Return false if the line table can't be used, find_nearest_line()
+ * must then be used for all lookups. Relocatable objects are not handled.
+ */
+bool read_line_table(bfd_info const & b, dwarf_line_table & table);
+
+/**
+ * Same as find_nearest_line() for a non anonymous object, using a table
+ * read by read_line_table(). A lookup that fails must be done again through
+ * find_nearest_line(), which has other ways to find a line.
+ */
+linenr_info const
+find_line_in_table(dwarf_line_table const & table, bfd_info const & b,
+                   op_bfd_symbol const & sym, bfd_vma offset);
+
 #endif /* !BFD_SUPPORT_H */
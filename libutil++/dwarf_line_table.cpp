@@ -0,0 +1,869 @@
+/**
+ * @file dwarf_line_table.cpp
+ * Decoding of the DWARF line number programs of an image
+ *
+ * @remark Copyright 2010 OProfile authors
+ * @remark Read the file COPYING
+ */
+
+#include "dwarf_line_table.h"
+
+#include <algorithm>
+#include <cstring>
+
+using namespace std;
+
+namespace {
+
+// the few DWARF constants we need, see the DWARF 5 standard section 7
+enum {
+	DW_TAG_compile_unit = 0x11,
+	DW_TAG_partial_unit = 0x3c,
+	DW_TAG_skeleton_unit = 0x4a,
+
+	DW_AT_stmt_list = 0x10,
+	DW_AT_comp_dir = 0x1b,
+
+	DW_UT_compile = 0x01,
+	DW_UT_partial = 0x03,
+
+	DW_FORM_addr = 0x01,
+	DW_FORM_block2 = 0x03,
+	DW_FORM_block4 = 0x04,
+	DW_FORM_data2 = 0x05,
+	DW_FORM_data4 = 0x06,
+	DW_FORM_data8 = 0x07,
+	DW_FORM_string = 0x08,
+	DW_FORM_block = 0x09,
+	DW_FORM_block1 = 0x0a,
+	DW_FORM_data1 = 0x0b,
+	DW_FORM_flag = 0x0c,
+	DW_FORM_sdata = 0x0d,
+	DW_FORM_strp = 0x0e,
+	DW_FORM_udata = 0x0f,
+	DW_FORM_ref_addr = 0x10,
+	DW_FORM_ref1 = 0x11,
+	DW_FORM_ref2 = 0x12,
+	DW_FORM_ref4 = 0x13,
+	DW_FORM_ref8 = 0x14,
+	DW_FORM_ref_udata = 0x15,
+	DW_FORM_indirect = 0x16,
+	DW_FORM_sec_offset = 0x17,
+	DW_FORM_exprloc = 0x18,
+	DW_FORM_flag_present = 0x19,
+	DW_FORM_strx = 0x1a,
+	DW_FORM_addrx = 0x1b,
+	DW_FORM_ref_sup4 = 0x1c,
+	DW_FORM_strp_sup = 0x1d,
+	DW_FORM_data16 = 0x1e,
+	DW_FORM_line_strp = 0x1f,
+	DW_FORM_ref_sig8 = 0x20,
+	DW_FORM_implicit_const = 0x21,
+	DW_FORM_loclistx = 0x22,
+	DW_FORM_rnglistx = 0x23,
+	DW_FORM_ref_sup8 = 0x24,
+	DW_FORM_strx1 = 0x25,
+	DW_FORM_strx2 = 0x26,
+	DW_FORM_strx3 = 0x27,
+	DW_FORM_strx4 = 0x28,
+	DW_FORM_addrx1 = 0x29,
+	DW_FORM_addrx2 = 0x2a,
+	DW_FORM_addrx3 = 0x2b,
+	DW_FORM_addrx4 = 0x2c,
+	DW_FORM_GNU_addr_index = 0x1f01,
+	DW_FORM_GNU_str_index = 0x1f02,
+	DW_FORM_GNU_ref_alt = 0x1f20,
+	DW_FORM_GNU_strp_alt = 0x1f21,
+
+	DW_LNS_copy = 1,
+	DW_LNS_advance_pc = 2,
+	DW_LNS_advance_line = 3,
+	DW_LNS_set_file = 4,
+	DW_LNS_const_add_pc = 8,
+	DW_LNS_fixed_advance_pc = 9,
+
+	DW_LNE_end_sequence = 1,
+	DW_LNE_set_address = 2,
+	DW_LNE_define_file = 3,
+
+	DW_LNCT_path = 1,
+	DW_LNCT_directory_index = 2
+};
+
+
+bool is_absolute(string const & path)
+{
+	return !path.empty() && path[0] == '/';
+}
+
+}  // anon namespace
+
+
+/// bounds checked reading of DWARF data, errors are sticky
+class dwarf_line_table::reader {
+public:
+	reader(string const & data, bool big_endian_)
+		: begin(data.data()), pos(begin), end(begin + data.size()),
+		  big_endian(big_endian_), error(false), dwarf64(false),
+		  address_size(0) {}
+
+	bool ok() const { return !error; }
+	bool at_end() const { return pos >= end; }
+	size_t offset() const { return pos - begin; }
+
+	/// a reader of the size next bytes, which are skipped
+	reader sub(u64 size) {
+		reader r(*this);
+		r.begin = pos;
+		if (size > u64(end - pos)) {
+			error = r.error = true;
+			size = 0;
+		}
+		r.end = pos + size;
+		pos += size;
+		return r;
+	}
+
+	/// a reader of the whole data from offset
+	reader at(u64 offset) const {
+		reader r(*this);
+		r.pos = r.begin + offset;
+		if (offset > u64(end - begin)) {
+			r.error = true;
+			r.pos = r.end;
+		}
+		return r;
+	}
+
+	void skip(u64 size) {
+		if (size > u64(end - pos)) {
+			error = true;
+			pos = end;
+		} else {
+			pos += size;
+		}
+	}
+
+	u64 fixed(size_t size) {
+		if (size > size_t(end - pos)) {
+			error = true;
+			pos = end;
+			return 0;
+		}
+		u64 value = 0;
+		for (size_t i = 0; i < size; ++i) {
+			unsigned char const byte =
+				pos[big_endian ? i : size - 1 - i];
+			value = (value << 8) | byte;
+		}
+		pos += size;
+		return value;
+	}
+
+	u64 u8() { return fixed(1); }
+	u64 u16() { return fixed(2); }
+	u64 u32() { return fixed(4); }
+	u64 u64_() { return fixed(8); }
+	u64 offset_value() { return fixed(dwarf64 ? 8 : 4); }
+	u64 address() { return fixed(address_size); }
+
+	u64 uleb() {
+		u64 value = 0;
+		unsigned int shift = 0;
+		while (pos < end) {
+			unsigned char const byte = *pos++;
+			if (shift < 64)
+				value |= u64(byte & 0x7f) << shift;
+			shift += 7;
+			if (!(byte & 0x80))
+				return value;
+		}
+		error = true;
+		return 0;
+	}
+
+	long long sleb() {
+		u64 value = 0;
+		unsigned int shift = 0;
+		while (pos < end) {
+			unsigned char const byte = *pos++;
+			if (shift < 64)
+				value |= u64(byte & 0x7f) << shift;
+			shift += 7;
+			if (!(byte & 0x80)) {
+				if (shift < 64 && (byte & 0x40))
+					value |= ~u64(0) << shift;
+				return value;
+			}
+		}
+		error = true;
+		return 0;
+	}
+
+	string cstr() {
+		char const * str_end = static_cast<char const *>(
+			memchr(pos, '\0', end - pos));
+		if (!str_end) {
+			error = true;
+			pos = end;
+			return string();
+		}
+		string const str(pos, str_end);
+		pos = str_end + 1;
+		return str;
+	}
+
+	/// read an initial length, setting dwarf64, and return a reader
+	/// for the unit content
+	reader unit() {
+		u64 length = u32();
+		dwarf64 = false;
+		if (length == 0xffffffff) {
+			dwarf64 = true;
+			length = u64_();
+		} else if (length >= 0xfffffff0) {
+			error = true;
+			length = 0;
+		}
+		return sub(length);
+	}
+
+	/// skip an attribute value of the given form, false if unknown
+	bool skip_form(u64 form, unsigned int version) {
+		switch (form) {
+		case DW_FORM_flag_present:
+		case DW_FORM_implicit_const:
+			break;
+		case DW_FORM_data1:
+		case DW_FORM_ref1:
+		case DW_FORM_flag:
+		case DW_FORM_strx1:
+		case DW_FORM_addrx1:
+			skip(1);
+			break;
+		case DW_FORM_data2:
+		case DW_FORM_ref2:
+		case DW_FORM_strx2:
+		case DW_FORM_addrx2:
+			skip(2);
+			break;
+		case DW_FORM_strx3:
+		case DW_FORM_addrx3:
+			skip(3);
+			break;
+		case DW_FORM_data4:
+		case DW_FORM_ref4:
+		case DW_FORM_ref_sup4:
+		case DW_FORM_strx4:
+		case DW_FORM_addrx4:
+			skip(4);
+			break;
+		case DW_FORM_data8:
+		case DW_FORM_ref8:
+		case DW_FORM_ref_sig8:
+		case DW_FORM_ref_sup8:
+			skip(8);
+			break;
+		case DW_FORM_data16:
+			skip(16);
+			break;
+		case DW_FORM_addr:
+			skip(address_size);
+			break;
+		case DW_FORM_ref_addr:
+			skip(version == 2 ? address_size : (dwarf64 ? 8 : 4));
+			break;
+		case DW_FORM_strp:
+		case DW_FORM_sec_offset:
+		case DW_FORM_line_strp:
+		case DW_FORM_strp_sup:
+		case DW_FORM_GNU_ref_alt:
+		case DW_FORM_GNU_strp_alt:
+			offset_value();
+			break;
+		case DW_FORM_sdata:
+			sleb();
+			break;
+		case DW_FORM_udata:
+		case DW_FORM_ref_udata:
+		case DW_FORM_strx:
+		case DW_FORM_addrx:
+		case DW_FORM_loclistx:
+		case DW_FORM_rnglistx:
+		case DW_FORM_GNU_addr_index:
+		case DW_FORM_GNU_str_index:
+			uleb();
+			break;
+		case DW_FORM_string:
+			cstr();
+			break;
+		case DW_FORM_block1:
+			skip(u8());
+			break;
+		case DW_FORM_block2:
+			skip(u16());
+			break;
+		case DW_FORM_block4:
+			skip(u32());
+			break;
+		case DW_FORM_block:
+		case DW_FORM_exprloc:
+			skip(uleb());
+			break;
+		case DW_FORM_indirect:
+			return skip_form(uleb(), version);
+		default:
+			return false;
+		}
+		return ok();
+	}
+
+	/**
+	 * read an attribute value of string form, false if the form isn't
+	 * a string form we can read
+	 */
+	bool read_string(u64 form, sections const & secs, string & str) {
+		u64 offset;
+		switch (form) {
+		case DW_FORM_string:
+			str = cstr();
+			return ok();
+		case DW_FORM_strp:
+			offset = offset_value();
+			return ok() && string_at(secs.str, offset, str);
+		case DW_FORM_line_strp:
+			offset = offset_value();
+			return ok() && string_at(secs.line_str, offset, str);
+		}
+		return false;
+	}
+
+	/// read an attribute value of constant form
+	bool read_constant(u64 form, u64 & value) {
+		switch (form) {
+		case DW_FORM_data1:
+			value = u8();
+			break;
+		case DW_FORM_data2:
+			value = u16();
+			break;
+		case DW_FORM_data4:
+			value = u32();
+			break;
+		case DW_FORM_data8:
+			value = u64_();
+			break;
+		case DW_FORM_udata:
+			value = uleb();
+			break;
+		case DW_FORM_sec_offset:
+			value = offset_value();
+			break;
+		default:
+			return false;
+		}
+		return ok();
+	}
+
+	char const * begin;
+	char const * pos;
+	char const * end;
+	bool big_endian;
+	bool error;
+	bool dwarf64;
+	unsigned int address_size;
+
+private:
+	static bool string_at(string const & sec, u64 offset, string & str) {
+		if (offset >= sec.size())
+			return false;
+		char const * start = sec.data() + offset;
+		char const * str_end = static_cast<char const *>(
+			memchr(start, '\0', sec.size() - offset));
+		if (!str_end)
+			return false;
+		str.assign(start, str_end);
+		return true;
+	}
+};
+
+
+/// what we need from the compilation unit owning a line program
+struct dwarf_line_table::unit_info {
+	unit_info() : has_comp_dir(false) {}
+	bool has_comp_dir;
+	string comp_dir;
+};
+
+
+dwarf_line_table::dwarf_line_table()
+	: last_sequence(0), last_row(0)
+{
+}
+
+
+bool dwarf_line_table::read(sections const & secs, bool big_endian,
+                            unsigned int address_size)
+{
+	reader base(secs.line, big_endian);
+	base.address_size = address_size;
+
+	map<u64, unit_info> units;
+	bool ok = read_units(secs, base, units);
+
+	map<u64, unit_info>::const_iterator it = units.begin();
+	for (; ok && it != units.end(); ++it)
+		ok = read_program(secs, base, it->first, it->second);
+
+	if (!ok) {
+		rows.clear();
+		sequences.clear();
+		filenames.clear();
+		filename_index.clear();
+		return false;
+	}
+
+	sort(sequences.begin(), sequences.end());
+	last_sequence = 0;
+	last_row = sequences.empty() ? 0 : sequences[0].first_row;
+	return true;
+}
+
+
+bool dwarf_line_table::read_units(sections const & secs, reader const & base,
+                                  map<u64, unit_info> & units)
+{
+	reader info(secs.info, base.big_endian);
+
+	if (info.at_end())
+		return false;
+
+	while (!info.at_end()) {
+		reader unit = info.unit();
+		if (!unit.ok())
+			return false;
+
+		unsigned int const version = unit.u16();
+		if (version < 2 || version > 5)
+			return false;
+
+		u64 abbrev_offset;
+		unsigned int unit_type = DW_UT_compile;
+		if (version == 5) {
+			unit_type = unit.u8();
+			unit.address_size = unit.u8();
+			abbrev_offset = unit.offset_value();
+			// skeleton and split units have a dwo id, they don't
+			// own a line program we can use
+			if (unit_type != DW_UT_compile &&
+			    unit_type != DW_UT_partial)
+				continue;
+		} else {
+			abbrev_offset = unit.offset_value();
+			unit.address_size = unit.u8();
+		}
+
+		if (!unit.ok())
+			return false;
+
+		u64 const code = unit.uleb();
+		if (!code)
+			continue;
+
+		// look for the abbreviation of the unit DIE
+		reader abbrev =
+			reader(secs.abbrev, base.big_endian).at(abbrev_offset);
+		u64 tag = 0;
+		while (abbrev.ok()) {
+			u64 const abbrev_code = abbrev.uleb();
+			if (!abbrev_code)
+				return false;
+			tag = abbrev.uleb();
+			abbrev.u8();
+			if (abbrev_code == code)
+				break;
+			for (;;) {
+				u64 const name = abbrev.uleb();
+				u64 const form = abbrev.uleb();
+				if (form == DW_FORM_implicit_const)
+					abbrev.sleb();
+				if (!abbrev.ok())
+					return false;
+				if (!name && !form)
+					break;
+			}
+		}
+
+		if (tag != DW_TAG_compile_unit && tag != DW_TAG_partial_unit &&
+		    tag != DW_TAG_skeleton_unit)
+			continue;
+
+		bool has_stmt_list = false;
+		u64 stmt_list = 0;
+		unit_info info_unit;
+
+		for (;;) {
+			u64 const name = abbrev.uleb();
+			u64 form = abbrev.uleb();
+			if (form == DW_FORM_implicit_const)
+				abbrev.sleb();
+			if (!abbrev.ok())
+				return false;
+			if (!name && !form)
+				break;
+
+			if (form == DW_FORM_indirect)
+				form = unit.uleb();
+
+			if (name == DW_AT_stmt_list) {
+				if (!unit.read_constant(form, stmt_list))
+					return false;
+				has_stmt_list = true;
+			} else if (name == DW_AT_comp_dir) {
+				if (!unit.read_string(form, secs,
+				                      info_unit.comp_dir))
+					return false;
+				info_unit.has_comp_dir = true;
+			} else if (!unit.skip_form(form, version)) {
+				return false;
+			}
+		}
+
+		if (!has_stmt_list)
+			continue;
+
+		// Irix 6.2 native cc prepends <machine>.: to the compilation
+		// directory, bfd strips it
+		string & dir = info_unit.comp_dir;
+		string::size_type const pos = dir.find(':');
+		if (pos != string::npos && pos != 0 && dir[pos - 1] == '.' &&
+		    pos + 1 < dir.size() && dir[pos + 1] == '/')
+			dir.erase(0, pos + 1);
+
+		units[stmt_list] = info_unit;
+	}
+
+	return info.ok();
+}
+
+
+bool dwarf_line_table::read_program(sections const & secs,
+                                    reader const & base, u64 offset,
+                                    unit_info const & unit)
+{
+	reader data = base.at(offset);
+	reader program = data.unit();
+	if (!program.ok())
+		return false;
+
+	unsigned int const version = program.u16();
+	if (version < 2 || version > 5)
+		return false;
+
+	if (version == 5) {
+		program.address_size = program.u8();
+		// segment selector size
+		program.u8();
+	}
+
+	u64 const header_length = program.offset_value();
+	reader header = program.sub(header_length);
+
+	unsigned int const min_inst_length = header.u8();
+	unsigned int max_ops_per_inst = 1;
+	if (version >= 4)
+		max_ops_per_inst = header.u8();
+	// default_is_stmt
+	header.u8();
+	int const line_base = (signed char)header.u8();
+	unsigned int const line_range = header.u8();
+	unsigned int const opcode_base = header.u8();
+
+	// VLIW op indexes are not handled
+	if (!header.ok() || !line_range || !opcode_base ||
+	    max_ops_per_inst != 1)
+		return false;
+
+	vector<unsigned int> opcode_lengths(opcode_base);
+	for (size_t i = 1; i < opcode_base; ++i)
+		opcode_lengths[i] = header.u8();
+
+	vector<string> dirs;
+	vector<pair<string, u64> > files;
+
+	if (version < 5) {
+		for (;;) {
+			string const dir = header.cstr();
+			if (!header.ok())
+				return false;
+			if (dir.empty())
+				break;
+			dirs.push_back(dir);
+		}
+		for (;;) {
+			string const name = header.cstr();
+			if (!header.ok())
+				return false;
+			if (name.empty())
+				break;
+			u64 const dir = header.uleb();
+			// mtime and length
+			header.uleb();
+			header.uleb();
+			files.push_back(make_pair(name, dir));
+		}
+	} else {
+		for (int pass = 0; pass < 2; ++pass) {
+			vector<pair<u64, u64> > format(header.u8());
+			for (size_t i = 0; i < format.size(); ++i) {
+				format[i].first = header.uleb();
+				format[i].second = header.uleb();
+			}
+			u64 const count = header.uleb();
+			for (u64 i = 0; header.ok() && i < count; ++i) {
+				string path;
+				u64 dir = 0;
+				for (size_t j = 0; j < format.size(); ++j) {
+					u64 const type = format[j].first;
+					u64 const form = format[j].second;
+					bool ok;
+					if (type == DW_LNCT_path)
+						ok = header.read_string(form,
+							secs, path);
+					else if (type == DW_LNCT_directory_index)
+						ok = header.read_constant(form,
+							dir);
+					else
+						ok = header.skip_form(form,
+							version);
+					if (!ok)
+						return false;
+				}
+				if (pass == 0)
+					dirs.push_back(path);
+				else
+					files.push_back(make_pair(path, dir));
+			}
+		}
+	}
+
+	if (!header.ok())
+		return false;
+
+	// run the line program
+	size_t const first_row = rows.size();
+	u64 address = 0;
+	u64 file = 1;
+	long long line = 1;
+	size_t seq_first = rows.size();
+
+	while (program.ok() && !program.at_end()) {
+		unsigned int const opcode = program.u8();
+		bool emit = false;
+		bool end_sequence = false;
+
+		if (opcode >= opcode_base) {
+			unsigned int const adj = opcode - opcode_base;
+			address += (adj / line_range) * min_inst_length;
+			line += line_base + int(adj % line_range);
+			emit = true;
+		} else if (opcode == 0) {
+			u64 const len = program.uleb();
+			reader ext = program.sub(len);
+			unsigned int const sub_opcode = ext.u8();
+			if (sub_opcode == DW_LNE_end_sequence) {
+				emit = end_sequence = true;
+			} else if (sub_opcode == DW_LNE_set_address) {
+				if (len < 2 || len > 9)
+					return false;
+				ext.address_size = len - 1;
+				address = ext.address();
+			} else if (sub_opcode == DW_LNE_define_file) {
+				string const name = ext.cstr();
+				u64 const dir = ext.uleb();
+				files.push_back(make_pair(name, dir));
+			}
+			if (!ext.ok())
+				return false;
+		} else if (opcode == DW_LNS_copy) {
+			emit = true;
+		} else if (opcode == DW_LNS_advance_pc) {
+			address += program.uleb() * min_inst_length;
+		} else if (opcode == DW_LNS_advance_line) {
+			line += program.sleb();
+		} else if (opcode == DW_LNS_set_file) {
+			file = program.uleb();
+		} else if (opcode == DW_LNS_const_add_pc) {
+			address += ((255 - opcode_base) / line_range) *
+				min_inst_length;
+		} else if (opcode == DW_LNS_fixed_advance_pc) {
+			address += program.u16();
+		} else {
+			for (unsigned int i = 0; i < opcode_lengths[opcode]; ++i)
+				program.uleb();
+		}
+
+		if (!emit)
+			continue;
+
+		bool const in_sequence = rows.size() > seq_first;
+
+		if (end_sequence) {
+			if (in_sequence && address > rows[seq_first].address) {
+				sequence seq;
+				seq.low = rows[seq_first].address;
+				seq.high = address;
+				seq.first_row = seq_first;
+				seq.last_row = rows.size();
+				sequences.push_back(seq);
+			} else {
+				rows.resize(seq_first);
+			}
+			address = 0;
+			file = 1;
+			line = 1;
+			seq_first = rows.size();
+			continue;
+		}
+
+		row r;
+		r.address = address;
+		// a file number for now, it is mapped to a file name below
+		r.file = file <= 0xffffffff ? file : 0xffffffff;
+		r.line = line > 0 && line <= 0xffffffffLL ? line : 0;
+
+		// bfd keeps the last row for a given address
+		if (in_sequence && rows.back().address == address)
+			rows.back() = r;
+		else if (in_sequence && rows.back().address > address)
+			return false;
+		else
+			rows.push_back(r);
+	}
+
+	if (!program.ok())
+		return false;
+
+	// rows of a sequence without end are dropped
+	rows.resize(seq_first);
+
+	// build the file names as bfd's concat_filename() does, the first
+	// file and directory are numbered 1 before DWARF 5, 0 after
+	unsigned int const first_index = version < 5 ? 1 : 0;
+	u32 const no_file = u32(-1);
+	vector<u32> file_ids(first_index, no_file);
+
+	for (size_t i = 0; i < files.size(); ++i) {
+		string const & name = files[i].first;
+		u64 const dir = files[i].second;
+
+		if (is_absolute(name)) {
+			file_ids.push_back(get_filename(name));
+			continue;
+		}
+
+		string subdir;
+		bool has_subdir = false;
+		if (dir && dir - first_index < dirs.size()) {
+			subdir = dirs[dir - first_index];
+			has_subdir = true;
+		}
+
+		string dir_name;
+		bool has_dir = false;
+		if (!has_subdir || !is_absolute(subdir)) {
+			dir_name = unit.comp_dir;
+			has_dir = unit.has_comp_dir;
+		}
+		if (!has_dir) {
+			dir_name = subdir;
+			has_dir = has_subdir;
+			has_subdir = false;
+		}
+
+		if (has_subdir)
+			file_ids.push_back(get_filename(
+				dir_name + '/' + subdir + '/' + name));
+		else if (has_dir)
+			file_ids.push_back(get_filename(dir_name + '/' + name));
+		else
+			file_ids.push_back(get_filename(name));
+	}
+
+	for (size_t i = first_row; i < rows.size(); ++i) {
+		u32 & file_id = rows[i].file;
+		file_id = file_id < file_ids.size() ? file_ids[file_id] : no_file;
+	}
+
+	return true;
+}
+
+
+u32 dwarf_line_table::get_filename(string const & name)
+{
+	map<string, u32>::const_iterator it = filename_index.find(name);
+	if (it != filename_index.end())
+		return it->second;
+
+	u32 const index = filenames.size();
+	filenames.push_back(name);
+	filename_index[name] = index;
+	return index;
+}
+
+
+bool dwarf_line_table::find(u64 address, string & filename,
+                            unsigned int & line) const
+{
+	if (sequences.empty())
+		return false;
+
+	// most lookups are for increasing addresses in the same sequence,
+	// only move forward from the previous row
+	size_t seq_index = last_sequence;
+	size_t row_index = last_row;
+	sequence const * seq = &sequences[seq_index];
+
+	if (address < seq->low || address >= seq->high ||
+	    address < rows[row_index].address) {
+		sequence key;
+		key.low = address;
+		vector<sequence>::const_iterator it =
+			upper_bound(sequences.begin(), sequences.end(), key);
+		if (it == sequences.begin())
+			return false;
+		--it;
+		if (address >= it->high)
+			return false;
+		seq_index = it - sequences.begin();
+		seq = &*it;
+		row_index = seq->first_row;
+	}
+
+	// a merge of the sorted addresses with the rows, with a binary
+	// search for the addresses far from the previous one
+	size_t steps = 0;
+	while (row_index + 1 < seq->last_row &&
+	       rows[row_index + 1].address <= address) {
+		if (++steps == 8) {
+			row key;
+			key.address = address;
+			row_index = upper_bound(rows.begin() + row_index,
+				rows.begin() + seq->last_row, key)
+				- rows.begin() - 1;
+			break;
+		}
+		++row_index;
+	}
+
+	last_sequence = seq_index;
+	last_row = row_index;
+
+	row const & r = rows[row_index];
+	if (r.file >= filenames.size() || !r.line)
+		return false;
+
+	filename = filenames[r.file];
+	line = r.line;
+	return true;
+}
@@ -0,0 +1,114 @@
+/**
+ * @file dwarf_line_table.h
+ * Decoding of the DWARF line number programs of an image
+ *
+ * @remark Copyright 2010 OProfile authors
+ * @remark Read the file COPYING
+ *
+ * bfd_find_nearest_line() looks up the compilation unit and walks its line
+ * table again for each address, which is very slow for large debug info.
+ * dwarf_line_table decodes the line programs of all compilation units once
+ * into sorted sequences of rows. Lookups done in increasing address order,
+ * as done for the sorted samples of a symbol, only move a cursor forward.
+ *
+ * File names are built as bfd_find_nearest_line() does, so the results are
+ * the same. An address which isn't found must be looked up through bfd,
+ * which has other ways to find a line number.
+ */
+
+#ifndef DWARF_LINE_TABLE_H
+#define DWARF_LINE_TABLE_H
+
+#include <string>
+#include <vector>
+#include <map>
+
+#include "utility.h"
+#include "op_types.h"
+
+class dwarf_line_table : noncopyable {
+public:
+	/// the content of the debug sections, missing ones are empty
+	struct sections {
+		std::string info;
+		std::string abbrev;
+		std::string line;
+		std::string str;
+		std::string line_str;
+	};
+
+	dwarf_line_table();
+
+	/**
+	 * read - decode the line programs
+	 * @param secs  the debug sections of the image
+	 * @param big_endian  byte order of the image
+	 * @param address_size  size of an address in bytes
+	 *
+	 * Return false if the debug information can't be decoded, or uses
+	 * a feature this decoder doesn't handle. The table is then empty.
+	 */
+	bool read(sections const & secs, bool big_endian,
+	          unsigned int address_size);
+
+	/**
+	 * find - look for the source line of an address
+	 * @param address  the address
+	 * @param filename  set to the source file name
+	 * @param line  set to the line number
+	 *
+	 * Return false if no line (or line zero) is known for this address.
+	 */
+	bool find(u64 address, std::string & filename,
+	          unsigned int & line) const;
+
+	/// return true if no line is known
+	bool empty() const { return sequences.empty(); }
+
+private:
+	class reader;
+	struct unit_info;
+
+	/// read the comp_dir of each compilation unit
+	bool read_units(sections const & secs, reader const & base,
+	                std::map<u64, unit_info> & units);
+
+	/// decode the line program at offset
+	bool read_program(sections const & secs, reader const & base,
+	                  u64 offset, unit_info const & unit);
+
+	/// return the index of a file name in filenames
+	u32 get_filename(std::string const & name);
+
+	struct row {
+		u64 address;
+		u32 file;
+		u32 line;
+		bool operator<(row const & rhs) const {
+			return address < rhs.address;
+		}
+	};
+
+	/// a range of addresses [low, high) described by contiguous rows
+	struct sequence {
+		u64 low;
+		u64 high;
+		size_t first_row;
+		size_t last_row;
+		bool operator<(sequence const & rhs) const {
+			return low < rhs.low;
+		}
+	};
+
+	std::vector<row> rows;
+	/// sorted by low address
+	std::vector<sequence> sequences;
+	std::vector<std::string> filenames;
+	std::map<std::string, u32> filename_index;
+
+	/// the sequence and row of the last find()
+	mutable size_t last_sequence;
+	mutable size_t last_row;
+};
+
+#endif /* !DWARF_LINE_TABLE_H */
@@ -14,6 +14,7 @@
 #include "config.h"
 
 #include <fcntl.h>
+#include <unistd.h>
 #include <cstring>
 
 #include <sys/stat.h>
@@ -37,24 +38,6 @@ using namespace std;
 verbose vbfd("bfd");
 
 
-namespace {
-
-/// function object for filtering symbols to remove
-struct remove_filter {
-	remove_filter(string_filter const & filter)
-		: filter_(filter) {}
-
-	bool operator()(op_bfd_symbol const & symbol) {
-		return !filter_.match(symbol.name());
-	}
-
-	string_filter filter_;
-};
-
-
-} // namespace anon
-
-
 op_bfd_symbol::op_bfd_symbol(asymbol const * a)
 	: bfd_symbol(a), symb_value(a->value),
 	  section_filepos(a->section->filepos),
@@ -86,6 +69,31 @@ op_bfd_symbol::op_bfd_symbol(bfd_vma vma, size_t size, string const & name)
 }
 
 
+op_bfd_symbol::op_bfd_symbol(op_bfd_cache::symbol const & sym)
+	: bfd_symbol(0), symb_value(sym.value),
+	  section_filepos(sym.filepos - sym.value),
+	  section_vma(sym.vma - sym.value),
+	  symb_size(sym.size), symb_name(sym.name),
+	  symb_hidden(sym.hidden), symb_weak(sym.weak),
+	  symb_artificial(false)
+{
+}
+
+
+op_bfd_cache::symbol const op_bfd_symbol::cache_symbol() const
+{
+	op_bfd_cache::symbol sym;
+	sym.name = symb_name;
+	sym.value = value();
+	sym.filepos = filepos();
+	sym.vma = vma();
+	sym.size = symb_size;
+	sym.hidden = symb_hidden;
+	sym.weak = symb_weak;
+	return sym;
+}
+
+
 bool op_bfd_symbol::operator<(op_bfd_symbol const & rhs) const
 {
 	return filepos() < rhs.filepos();
@@ -104,7 +112,33 @@ op_bfd::op_bfd(string const & fname, string_filter const & symbol_filter,
 	archive_path(extra_images.get_archive_path()),
 	extra_found_images(extra_images),
 	file_size(-1),
-	anon_obj(false)
+	anon_obj(false),
+	from_cache(false),
+	image_bfd_tried(false),
+	line_table_tried(false)
+{
+	init(symbol_filter, ok, true);
+}
+
+
+op_bfd::op_bfd(string const & fname, extra_images const & extra_images,
+               bool & ok)
+	:
+	filename(fname),
+	archive_path(extra_images.get_archive_path()),
+	extra_found_images(extra_images),
+	file_size(-1),
+	anon_obj(false),
+	from_cache(false),
+	image_bfd_tried(false),
+	line_table_tried(false)
+{
+	init(string_filter(), ok, false);
+}
+
+
+void op_bfd::init(string_filter const & symbol_filter, bool & ok,
+                  bool use_cache)
 {
 	int fd;
 	struct stat st;
@@ -117,7 +151,7 @@ op_bfd::op_bfd(string const & fname, string_filter const & symbol_filter,
 
 	image_error img_ok;
 	string const image_path =
-		extra_images.find_image_path(filename, img_ok, true);
+		extra_found_images.find_image_path(filename, img_ok, true);
 
 	cverb << vbfd << "op_bfd ctor for " << image_path << endl;
 
@@ -142,6 +176,25 @@ op_bfd::op_bfd(string const & fname, string_filter const & symbol_filter,
 
 	file_size = st.st_size;
 
+	string::size_type pos;
+	pos = filename.rfind(suf);
+	if (pos != string::npos && pos == filename.size() - suf.size())
+		anon_obj = true;
+
+	// JIT images are rewritten for each run, don't cache them
+	if (use_cache && !anon_obj && cache.open(op_bfd_cache_dir, image_path)) {
+		vector<op_bfd_cache::symbol> cached;
+
+		close(fd);
+		from_cache = true;
+		debug_info.reset(cache.has_debug_info());
+		cache.get_sections(filepos_map);
+		cache.get_symbols(cached);
+		for (size_t i = 0; i < cached.size(); ++i)
+			symbols.push_back(op_bfd_symbol(cached[i]));
+		goto out;
+	}
+
 	ibfd.abfd = fdopen_bfd(image_path, fd);
 
 	if (!ibfd.valid()) {
@@ -150,11 +203,6 @@ op_bfd::op_bfd(string const & fname, string_filter const & symbol_filter,
 		goto out_fail;
 	}
 
-	string::size_type pos;
-	pos = filename.rfind(suf);
-	if (pos != string::npos && pos == filename.size() - suf.size())
-		anon_obj = true;
-
 
 	// find .text and use it
 	for (sect = ibfd.abfd->sections; sect; sect = sect->next) {
@@ -175,6 +223,9 @@ op_bfd::op_bfd(string const & fname, string_filter const & symbol_filter,
 
 	get_symbols(symbols);
 
+	if (use_cache && !anon_obj)
+		create_cache(symbols);
+
 out:
 	add_symbols(symbols, symbol_filter);
 	return;
@@ -287,19 +338,79 @@ void op_bfd::add_symbols(op_bfd::symbols_found_t & symbols,
 	cverb << vbfd << "number of symbols before filtering "
 	      << dec << symbols.size() << hex << endl;
 
-	symbols_found_t::iterator it;
-	it = remove_if(symbols.begin(), symbols.end(),
-	               remove_filter(symbol_filter));
-
-	copy(symbols.begin(), it, back_inserter(syms));
+	// keep the index of each symbol before filtering, this is the index
+	// used by the cache and by the unfiltered image_bfd
+	symbols_found_t::const_iterator it = symbols.begin();
+	for (size_t i = 0; it != symbols.end(); ++it, ++i) {
+		if (!symbol_filter.match(it->name()))
+			continue;
+		syms.push_back(*it);
+		cache_index.push_back(i);
+	}
 
 	cverb << vbfd << "number of symbols now "
 	      << dec << syms.size() << hex << endl;
 }
 
 
+void op_bfd::create_cache(symbols_found_t const & symbols)
+{
+	vector<op_bfd_cache::symbol> cached;
+	symbols_found_t::const_iterator it = symbols.begin();
+	for (; it != symbols.end(); ++it)
+		cached.push_back(it->cache_symbol());
+
+	// the cache is outdated if one of these files appears or changes
+	bool const debug = has_debug_info();
+	vector<string> debug_files;
+	for (size_t i = 0; i < debug_candidates.size(); ++i) {
+		image_error img_ok;
+		debug_files.push_back(extra_found_images.find_image_path(
+			debug_candidates[i], img_ok, true));
+	}
+
+	cache.create(cached, filepos_map, debug, debug_files);
+}
+
+
+op_bfd const * op_bfd::get_image_bfd() const
+{
+	if (!from_cache || image_bfd_tried)
+		return image_bfd.get();
+
+	image_bfd_tried = true;
+
+	bool ok = true;
+	scoped_ptr<op_bfd> abfd(new op_bfd(filename, extra_found_images, ok));
+
+	// the image changed since the cache has been read
+	for (size_t i = 0; ok && i < syms.size(); ++i) {
+		if (syms[i].artificial())
+			continue;
+		size_t const index = cache_index[i];
+		ok = index < abfd->syms.size() &&
+			abfd->syms[index].name() == syms[i].name() &&
+			abfd->syms[index].filepos() == syms[i].filepos();
+	}
+
+	if (!ok) {
+		cverb << vbfd << "can't use " << filename << " for cached symbols"
+		      << endl;
+		return 0;
+	}
+
+	image_bfd.swap(abfd);
+	return image_bfd.get();
+}
+
+
 bfd_vma op_bfd::offset_to_pc(bfd_vma offset) const
 {
+	if (from_cache) {
+		op_bfd const * abfd = get_image_bfd();
+		return abfd ? abfd->offset_to_pc(offset) : 0;
+	}
+
 	asection const * sect = ibfd.abfd->sections;
 
 	for (; sect; sect = sect->next) {
@@ -317,7 +428,7 @@ symbol_has_contents(symbol_index_t sym_idx)
 {
 	op_bfd_symbol const & bfd_sym = syms[sym_idx];
 	string const name = bfd_sym.name();
-	if (name.size() == 0 || bfd_sym.artificial() || !ibfd.valid())
+	if (name.size() == 0 || bfd_sym.artificial() || !valid())
 		return false;
 	else
 		return true;
@@ -326,6 +437,12 @@ symbol_has_contents(symbol_index_t sym_idx)
 bool op_bfd::
 get_symbol_contents(symbol_index_t sym_index, unsigned char * contents) const
 {
+	if (from_cache) {
+		op_bfd const * abfd = get_image_bfd();
+		return abfd && abfd->get_symbol_contents(cache_index[sym_index],
+		                                         contents);
+	}
+
 	op_bfd_symbol const & bfd_sym = syms[sym_index];
 	size_t size = bfd_sym.size();
 
@@ -350,7 +467,8 @@ bool op_bfd::has_debug_info() const
 
 	// check to see if there is an .debug file
 
-	if (find_separate_debug_file(ibfd.abfd, filename, debug_filename, extra_found_images)) {
+	if (find_separate_debug_file(ibfd.abfd, filename, debug_filename,
+	                             extra_found_images, &debug_candidates)) {
 		cverb << vbfd << "now loading: " << debug_filename << endl;
 		dbfd.abfd = open_bfd(debug_filename);
 		if (dbfd.has_debug_info())
@@ -371,10 +489,28 @@ bool op_bfd::get_linenr(symbol_index_t sym_idx, bfd_vma offset,
 	if (!has_debug_info())
 		return false;
 
-	bfd_info const & b = dbfd.valid() ? dbfd : ibfd;
 	op_bfd_symbol const & sym = syms[sym_idx];
+	if (sym.artificial())
+		return false;
+
+	op_bfd_cache::linenr info;
+	size_t const index = cache_index[sym_idx];
 
-	linenr_info const info = find_nearest_line(b, sym, offset, anon_obj);
+	if (!cache.find_linenr(index, offset, info)) {
+		if (from_cache) {
+			op_bfd const * abfd = get_image_bfd();
+			if (!abfd)
+				return false;
+			info.found = abfd->get_linenr(index, offset,
+			                              info.filename, info.line);
+		} else {
+			linenr_info const found = find_linenr(sym, offset);
+			info.found = found.found;
+			info.filename = found.filename;
+			info.line = found.line;
+		}
+		cache.add_linenr(index, offset, info);
+	}
 
 	if (!info.found)
 		return false;
@@ -385,6 +521,31 @@ bool op_bfd::get_linenr(symbol_index_t sym_idx, bfd_vma offset,
 }
 
 
+linenr_info const op_bfd::find_linenr(op_bfd_symbol const & sym,
+                                      bfd_vma offset) const
+{
+	bfd_info const & b = dbfd.valid() ? dbfd : ibfd;
+
+	// the line table is not used for JIT code, its symbols are relative
+	// to the section vma
+	if (!line_table_tried && !anon_obj) {
+		line_table_tried = true;
+		scoped_ptr<dwarf_line_table> table(new dwarf_line_table);
+		if (read_line_table(b, *table))
+			line_table.swap(table);
+	}
+
+	if (line_table.get()) {
+		linenr_info const info =
+			find_line_in_table(*line_table, b, sym, offset);
+		if (info.found)
+			return info;
+	}
+
+	return find_nearest_line(b, sym, offset, anon_obj);
+}
+
+
 size_t op_bfd::symbol_size(op_bfd_symbol const & sym,
 			   op_bfd_symbol const * next) const
 {
@@ -462,8 +623,29 @@ string op_bfd::get_filename() const
 }
 
 
+size_t op_bfd::memory_size() const
+{
+	size_t size = sizeof(*this);
+
+	for (size_t i = 0; i < syms.size(); ++i)
+		size += sizeof(op_bfd_symbol) + syms[i].name().size();
+
+	// symbol tables read by libbfd, a target symbol is about twice
+	// the size of an asymbol
+	size_t const nr_syms = ibfd.nr_syms + dbfd.nr_syms;
+	size += nr_syms * (sizeof(asymbol *) + 2 * sizeof(asymbol));
+
+	if (image_bfd.get())
+		size += image_bfd->memory_size();
+
+	return size;
+}
+
+
 size_t op_bfd::bfd_arch_bits_per_address() const
 {
+	if (from_cache && get_image_bfd())
+		return get_image_bfd()->bfd_arch_bits_per_address();
 	if (ibfd.valid())
 		return ::bfd_arch_bits_per_address(ibfd.abfd);
 	// FIXME: this function should be called only if the underlined ibfd
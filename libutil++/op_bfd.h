@@ -24,6 +24,8 @@
 #include "locate_images.h"
 #include "utility.h"
 #include "cached_value.h"
+#include "op_bfd_cache.h"
+#include "dwarf_line_table.h"
 #include "op_types.h"
 
 class op_bfd;
@@ -47,6 +49,12 @@ public:
 	/// ctor for artificial symbols
 	op_bfd_symbol(bfd_vma vma, size_t size, std::string const & name);
 
+	/// ctor for symbols read from an op_bfd_cache, symbol() is null
+	op_bfd_symbol(op_bfd_cache::symbol const & sym);
+
+	/// return the op_bfd_cache description of a real symbol
+	op_bfd_cache::symbol const cache_symbol() const;
+
 	bfd_vma vma() const { return symb_value + section_vma; }
 	unsigned long value() const { return symb_value; }
 	unsigned long filepos() const { return symb_value + section_filepos; }
@@ -210,9 +218,33 @@ public:
 	bool get_symbol_contents(symbol_index_t sym_index,
 		unsigned char * contents) const;
 
-	bool valid() const { return ibfd.valid(); }
+	/// true if the image has been opened, or read from its cache
+	bool valid() const { return ibfd.valid() || from_cache; }
+
+	/// rough estimate of the memory used by this object, in bytes
+	size_t memory_size() const;
 
 private:
+	/// ctor for the unfiltered image behind a cached op_bfd
+	op_bfd(std::string const & filename,
+	       extra_images const & extra_images,
+	       bool & ok);
+
+	/// body of the ctors, see op_bfd_cache for use_cache
+	void init(string_filter const & symbol_filter, bool & ok,
+	          bool use_cache);
+
+	/**
+	 * Return the op_bfd opened with libbfd when the symbols were
+	 * read from the cache, or null if it can't be opened or does not
+	 * match the cache.
+	 */
+	op_bfd const * get_image_bfd() const;
+
+	/// look for a line number with libbfd
+	linenr_info const find_linenr(op_bfd_symbol const & sym,
+	                              bfd_vma offset) const;
+
 	/// temporary container type for getting symbols
 	typedef std::list<op_bfd_symbol> symbols_found_t;
 
@@ -242,6 +274,9 @@ private:
 	void add_symbols(symbols_found_t & symbols,
 	                 string_filter const & symbol_filter);
 
+	/// create the cache from the symbols found in the image
+	void create_cache(symbols_found_t const & symbols);
+
 	/**
 	 * symbol_size - return the size of a symbol
 	 * @param sym  symbol to get size
@@ -299,6 +334,26 @@ private:
 	std::string embedding_filename;
 
 	bool anon_obj;
+
+	/// symbols and line numbers cache, disabled if not opened
+	mutable op_bfd_cache cache;
+
+	/// index in the cached symbols of each entry of syms
+	std::vector<size_t> cache_index;
+
+	/// true if the symbols were read from the cache, ibfd is then closed
+	bool from_cache;
+
+	/// the image opened lazily by get_image_bfd()
+	mutable scoped_ptr<op_bfd> image_bfd;
+	mutable bool image_bfd_tried;
+
+	/// separate debug files looked for by has_debug_info()
+	mutable std::vector<std::string> debug_candidates;
+
+	/// the decoded DWARF line programs, read on the first lookup
+	mutable scoped_ptr<dwarf_line_table> line_table;
+	mutable bool line_table_tried;
 };
 
 
@@ -0,0 +1,683 @@
+/**
+ * @file op_bfd_cache.cpp
+ * On-disk cache of the symbols and line numbers of a binary image
+ *
+ * @remark Copyright 2010 OProfile authors
+ * @remark Read the file COPYING
+ */
+
+#include "op_bfd_cache.h"
+#include "op_file.h"
+#include "file_manip.h"
+#include "cverb.h"
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <elf.h>
+
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <iomanip>
+
+using namespace std;
+
+extern verbose vbfd;
+
+/*
+ * A cache file is a file_header, followed by the symbols, sections,
+ * debug files and lines arrays and the string table. All values are in
+ * the host byte order, a cache is never shared between hosts. Strings
+ * are stored as offsets in the string table.
+ */
+
+#define OP_BFD_CACHE_MAGIC "OPBFDC\n"
+#define OP_BFD_CACHE_VERSION 1
+
+struct op_bfd_cache::file_header {
+	char magic[8];
+	u32 version;
+	/// size of the header, to catch a different struct layout
+	u32 header_size;
+	u64 image_size;
+	u64 image_mtime;
+	u32 image_path;
+	/// hexadecimal build-id, empty if none
+	u32 build_id;
+	u32 has_debug_info;
+	u32 nr_symbols;
+	u32 nr_sections;
+	u32 nr_deps;
+	u32 nr_lines;
+	u32 strings_size;
+};
+
+struct op_bfd_cache::file_symbol {
+	u64 value;
+	u64 filepos;
+	u64 vma;
+	u64 size;
+	u32 name;
+	u32 flags;
+};
+
+enum {
+	symbol_hidden = 1,
+	symbol_weak = 2
+};
+
+struct op_bfd_cache::file_section {
+	u32 name;
+	u32 filepos;
+};
+
+/// a separate debug file, as it was when the cache was created
+struct op_bfd_cache::file_dep {
+	u32 path;
+	u32 exists;
+	u64 size;
+	u64 mtime;
+};
+
+struct op_bfd_cache::file_line {
+	u64 offset;
+	u32 sym_index;
+	u32 line;
+	u32 filename;
+	u32 found;
+};
+
+
+namespace {
+
+template <typename T>
+T swap_bytes(T value, bool swap)
+{
+	if (!swap)
+		return value;
+
+	T result;
+	unsigned char const * in = reinterpret_cast<unsigned char *>(&value);
+	unsigned char * out = reinterpret_cast<unsigned char *>(&result);
+	for (size_t i = 0; i < sizeof(T); ++i)
+		out[i] = in[sizeof(T) - 1 - i];
+	return result;
+}
+
+
+bool host_big_endian()
+{
+	u32 const value = 1;
+	return *reinterpret_cast<unsigned char const *>(&value) == 0;
+}
+
+
+/// return the build-id notes found in a section content, empty if none
+string find_build_id(string const & notes, bool swap)
+{
+	size_t pos = 0;
+
+	while (pos + 12 <= notes.size()) {
+		u32 namesz, descsz, type;
+		memcpy(&namesz, &notes[pos], 4);
+		memcpy(&descsz, &notes[pos + 4], 4);
+		memcpy(&type, &notes[pos + 8], 4);
+		namesz = swap_bytes(namesz, swap);
+		descsz = swap_bytes(descsz, swap);
+		type = swap_bytes(type, swap);
+		pos += 12;
+
+		size_t const name_pos = pos;
+		size_t const desc_pos = name_pos + ((namesz + 3) & ~3);
+		pos = desc_pos + ((descsz + 3) & ~3);
+		if (pos > notes.size())
+			break;
+
+		if (type == NT_GNU_BUILD_ID && namesz == 4 &&
+		    !memcmp(&notes[name_pos], "GNU", 4))
+			return notes.substr(desc_pos, descsz);
+	}
+
+	return string();
+}
+
+
+template <typename Ehdr, typename Shdr>
+string read_build_id(ifstream & in, bool swap)
+{
+	Ehdr ehdr;
+	in.seekg(0);
+	if (!in.read(reinterpret_cast<char *>(&ehdr), sizeof(ehdr)))
+		return string();
+
+	u64 const shoff = swap_bytes(ehdr.e_shoff, swap);
+	size_t const shentsize = swap_bytes(ehdr.e_shentsize, swap);
+	size_t const shnum = swap_bytes(ehdr.e_shnum, swap);
+	if (shentsize < sizeof(Shdr))
+		return string();
+
+	for (size_t i = 0; i < shnum; ++i) {
+		Shdr shdr;
+		in.seekg(shoff + i * shentsize);
+		if (!in.read(reinterpret_cast<char *>(&shdr), sizeof(shdr)))
+			return string();
+
+		size_t const size = swap_bytes(shdr.sh_size, swap);
+		// build-id notes are tiny, don't read an insane section
+		if (swap_bytes(shdr.sh_type, swap) != SHT_NOTE || size > 4096)
+			continue;
+
+		string notes(size, '\0');
+		in.seekg(swap_bytes(shdr.sh_offset, swap));
+		if (!in.read(&notes[0], size))
+			return string();
+
+		string const build_id = find_build_id(notes, swap);
+		if (!build_id.empty())
+			return build_id;
+	}
+
+	return string();
+}
+
+
+/// return the hexadecimal GNU build-id of an ELF file, empty if none
+string get_build_id(string const & path)
+{
+	ifstream in(path.c_str(), ios::in | ios::binary);
+	unsigned char ident[EI_NIDENT];
+	if (!in.read(reinterpret_cast<char *>(ident), sizeof(ident)) ||
+	    memcmp(ident, ELFMAG, SELFMAG))
+		return string();
+
+	bool const swap = (ident[EI_DATA] == ELFDATA2MSB) != host_big_endian();
+
+	string build_id;
+	if (ident[EI_CLASS] == ELFCLASS64)
+		build_id = read_build_id<Elf64_Ehdr, Elf64_Shdr>(in, swap);
+	else if (ident[EI_CLASS] == ELFCLASS32)
+		build_id = read_build_id<Elf32_Ehdr, Elf32_Shdr>(in, swap);
+
+	ostringstream os;
+	os << hex << setfill('0');
+	for (size_t i = 0; i < build_id.size(); ++i)
+		os << setw(2) << (unsigned int)(unsigned char)build_id[i];
+	return os.str();
+}
+
+
+/// build a string table, each string being stored once
+class string_table {
+public:
+	string_table(string & strings_) : strings(strings_) {
+		if (strings.empty())
+			strings.push_back('\0');
+	}
+
+	/// add the strings of an existing string table
+	void add_known(string const & str, u32 offset) {
+		index[str] = offset;
+	}
+
+	u32 get(string const & str) {
+		map<string, u32>::const_iterator it = index.find(str);
+		if (it != index.end())
+			return it->second;
+		u32 const offset = strings.size();
+		strings += str;
+		strings.push_back('\0');
+		index[str] = offset;
+		return offset;
+	}
+
+private:
+	string & strings;
+	map<string, u32> index;
+};
+
+
+template <typename T>
+void append(string & buf, T const * values, size_t nr)
+{
+	if (nr)
+		buf.append(reinterpret_cast<char const *>(values), nr * sizeof(T));
+}
+
+
+template <typename T>
+void append(string & buf, vector<T> const & values)
+{
+	if (!values.empty())
+		append(buf, &values[0], values.size());
+}
+
+
+bool write_all(int fd, char const * data, size_t size)
+{
+	while (size) {
+		ssize_t const ret = write(fd, data, size);
+		if (ret == -1 && errno == EINTR)
+			continue;
+		if (ret <= 0)
+			return false;
+		data += ret;
+		size -= ret;
+	}
+	return true;
+}
+
+}  // anon namespace
+
+
+op_bfd_cache::op_bfd_cache()
+	:
+	image_size(0),
+	image_mtime(0),
+	base(0),
+	base_size(0),
+	mapped(false),
+	header(0),
+	symbols(0),
+	sections(0),
+	deps(0),
+	lines(0),
+	strings(0),
+	dirty(false)
+{
+}
+
+
+op_bfd_cache::~op_bfd_cache()
+{
+	flush();
+	close();
+}
+
+
+void op_bfd_cache::close()
+{
+	if (mapped)
+		munmap(const_cast<char *>(base), base_size);
+	mapped = false;
+	base = 0;
+	base_size = 0;
+	created.erase();
+	pending_lines.clear();
+	dirty = false;
+}
+
+
+string op_bfd_cache::cache_filename() const
+{
+	// FNV-1a, only used to avoid collisions between images with the
+	// same basename, the full path is checked when opening the cache
+	u64 hash = 0xcbf29ce484222325ULL;
+	for (size_t i = 0; i < image_path.size(); ++i) {
+		hash ^= (unsigned char)image_path[i];
+		hash *= 0x100000001b3ULL;
+	}
+
+	ostringstream os;
+	os << cache_dir << '/' << op_basename(image_path) << '-'
+	   << hex << setfill('0') << setw(16) << hash;
+	return os.str();
+}
+
+
+bool op_bfd_cache::map_content(char const * data, size_t size)
+{
+	if (size < sizeof(file_header))
+		return false;
+
+	file_header const * h = reinterpret_cast<file_header const *>(data);
+	if (memcmp(h->magic, OP_BFD_CACHE_MAGIC, sizeof(h->magic)) ||
+	    h->version != OP_BFD_CACHE_VERSION ||
+	    h->header_size != sizeof(file_header))
+		return false;
+
+	size_t pos = sizeof(file_header);
+	size_t const symbols_pos = pos;
+	pos += u64(h->nr_symbols) * sizeof(file_symbol);
+	size_t const sections_pos = pos;
+	pos += u64(h->nr_sections) * sizeof(file_section);
+	size_t const deps_pos = pos;
+	pos += u64(h->nr_deps) * sizeof(file_dep);
+	size_t const lines_pos = pos;
+	pos += u64(h->nr_lines) * sizeof(file_line);
+	size_t const strings_pos = pos;
+	pos += h->strings_size;
+
+	if (pos != size || !h->strings_size || data[size - 1] != '\0')
+		return false;
+
+	base = data;
+	base_size = size;
+	header = h;
+	symbols = reinterpret_cast<file_symbol const *>(data + symbols_pos);
+	sections = reinterpret_cast<file_section const *>(data + sections_pos);
+	deps = reinterpret_cast<file_dep const *>(data + deps_pos);
+	lines = reinterpret_cast<file_line const *>(data + lines_pos);
+	strings = data + strings_pos;
+
+	return true;
+}
+
+
+char const * op_bfd_cache::get_string(u32 offset) const
+{
+	// the string table is known to end with a nul
+	if (offset >= header->strings_size)
+		return "";
+	return strings + offset;
+}
+
+
+bool op_bfd_cache::open(string const & dir, string const & path)
+{
+	close();
+
+	cache_dir = dir;
+	image_path = path;
+
+	if (cache_dir.empty())
+		return false;
+
+	struct stat st;
+	if (stat(image_path.c_str(), &st)) {
+		cache_dir.erase();
+		return false;
+	}
+
+	image_size = st.st_size;
+	image_mtime = st.st_mtime;
+	build_id = get_build_id(image_path);
+
+	string const filename = cache_filename();
+	int fd = ::open(filename.c_str(), O_RDONLY);
+	if (fd == -1)
+		return false;
+
+	void * data = MAP_FAILED;
+	if (!fstat(fd, &st) && st.st_size) {
+		data = mmap(0, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	}
+	::close(fd);
+
+	if (data == MAP_FAILED)
+		return false;
+
+	if (!map_content(static_cast<char const *>(data), st.st_size)) {
+		munmap(data, st.st_size);
+		cverb << vbfd << "invalid cache file " << filename << endl;
+		return false;
+	}
+	mapped = true;
+
+	bool ok = header->image_size == image_size &&
+		header->image_mtime == image_mtime &&
+		image_path == get_string(header->image_path) &&
+		build_id == get_string(header->build_id);
+
+	// a separate debug file appeared, disappeared or changed
+	for (size_t i = 0; ok && i < header->nr_deps; ++i) {
+		file_dep const & dep = deps[i];
+		bool const exists = !stat(get_string(dep.path), &st);
+		if (exists != bool(dep.exists))
+			ok = false;
+		else if (exists && (u64(st.st_size) != dep.size ||
+		                    u64(st.st_mtime) != dep.mtime))
+			ok = false;
+	}
+
+	if (!ok) {
+		cverb << vbfd << "outdated cache file " << filename << endl;
+		close();
+		return false;
+	}
+
+	cverb << vbfd << "using cache file " << filename << endl;
+	return true;
+}
+
+
+void op_bfd_cache::create(vector<symbol> const & syms,
+                          map<string, u32> const & secs,
+                          bool has_debug_info,
+                          vector<string> const & debug_files)
+{
+	if (cache_dir.empty())
+		return;
+
+	close();
+
+	string strings_buf;
+	string_table table(strings_buf);
+
+	file_header h;
+	memset(&h, '\0', sizeof(h));
+	memcpy(h.magic, OP_BFD_CACHE_MAGIC, sizeof(h.magic));
+	h.version = OP_BFD_CACHE_VERSION;
+	h.header_size = sizeof(file_header);
+	h.image_size = image_size;
+	h.image_mtime = image_mtime;
+	h.image_path = table.get(image_path);
+	h.build_id = table.get(build_id);
+	h.has_debug_info = has_debug_info;
+	h.nr_symbols = syms.size();
+	h.nr_sections = secs.size();
+	h.nr_deps = debug_files.size();
+	h.nr_lines = 0;
+
+	vector<file_symbol> file_syms(syms.size());
+	for (size_t i = 0; i < syms.size(); ++i) {
+		file_symbol & sym = file_syms[i];
+		memset(&sym, '\0', sizeof(sym));
+		sym.value = syms[i].value;
+		sym.filepos = syms[i].filepos;
+		sym.vma = syms[i].vma;
+		sym.size = syms[i].size;
+		sym.name = table.get(syms[i].name);
+		sym.flags = (syms[i].hidden ? symbol_hidden : 0) |
+			(syms[i].weak ? symbol_weak : 0);
+	}
+
+	vector<file_section> file_secs;
+	map<string, u32>::const_iterator it = secs.begin();
+	for (; it != secs.end(); ++it) {
+		file_section sec;
+		sec.name = table.get(it->first);
+		sec.filepos = it->second;
+		file_secs.push_back(sec);
+	}
+
+	vector<file_dep> file_deps(debug_files.size());
+	for (size_t i = 0; i < debug_files.size(); ++i) {
+		file_dep & dep = file_deps[i];
+		struct stat st;
+		memset(&dep, '\0', sizeof(dep));
+		dep.path = table.get(debug_files[i]);
+		dep.exists = !stat(debug_files[i].c_str(), &st);
+		if (dep.exists) {
+			dep.size = st.st_size;
+			dep.mtime = st.st_mtime;
+		}
+	}
+
+	h.strings_size = strings_buf.size();
+
+	append(created, &h, 1);
+	append(created, file_syms);
+	append(created, file_secs);
+	append(created, file_deps);
+	created += strings_buf;
+
+	map_content(created.data(), created.size());
+	dirty = true;
+}
+
+
+bool op_bfd_cache::has_debug_info() const
+{
+	return header->has_debug_info;
+}
+
+
+void op_bfd_cache::get_symbols(vector<symbol> & syms) const
+{
+	syms.resize(header->nr_symbols);
+	for (size_t i = 0; i < syms.size(); ++i) {
+		syms[i].name = get_string(symbols[i].name);
+		syms[i].value = symbols[i].value;
+		syms[i].filepos = symbols[i].filepos;
+		syms[i].vma = symbols[i].vma;
+		syms[i].size = symbols[i].size;
+		syms[i].hidden = symbols[i].flags & symbol_hidden;
+		syms[i].weak = symbols[i].flags & symbol_weak;
+	}
+}
+
+
+void op_bfd_cache::get_sections(map<string, u32> & secs) const
+{
+	for (size_t i = 0; i < header->nr_sections; ++i)
+		secs[get_string(sections[i].name)] = sections[i].filepos;
+}
+
+
+bool op_bfd_cache::find_linenr(size_t sym_index, u64 offset,
+                               linenr & info) const
+{
+	if (!valid())
+		return false;
+
+	pending_lines_t::const_iterator pending =
+		pending_lines.find(make_pair(sym_index, offset));
+	if (pending != pending_lines.end()) {
+		info = pending->second;
+		return true;
+	}
+
+	size_t first = 0;
+	size_t last = header->nr_lines;
+	while (first < last) {
+		size_t const mid = first + (last - first) / 2;
+		file_line const & line = lines[mid];
+		if (line.sym_index < sym_index ||
+		    (line.sym_index == sym_index && line.offset < offset))
+			first = mid + 1;
+		else
+			last = mid;
+	}
+
+	if (first == header->nr_lines || lines[first].sym_index != sym_index ||
+	    lines[first].offset != offset)
+		return false;
+
+	info.found = lines[first].found;
+	info.filename = get_string(lines[first].filename);
+	info.line = lines[first].line;
+	return true;
+}
+
+
+void op_bfd_cache::add_linenr(size_t sym_index, u64 offset,
+                              linenr const & info)
+{
+	if (!valid())
+		return;
+
+	pending_lines[make_pair(sym_index, offset)] = info;
+	dirty = true;
+}
+
+
+void op_bfd_cache::flush()
+{
+	if (!valid() || !dirty)
+		return;
+
+	dirty = false;
+
+	string strings_buf(strings, header->strings_size);
+	string_table table(strings_buf);
+
+	// merge the known lines with the new ones, re-using the filenames
+	// already in the string table
+	vector<file_line> merged;
+	merged.reserve(header->nr_lines + pending_lines.size());
+
+	size_t i = 0;
+	pending_lines_t::const_iterator it = pending_lines.begin();
+	while (i < header->nr_lines || it != pending_lines.end()) {
+		if (it == pending_lines.end() ||
+		    (i < header->nr_lines &&
+		     make_pair(size_t(lines[i].sym_index), lines[i].offset)
+		     < it->first)) {
+			merged.push_back(lines[i]);
+			table.add_known(get_string(lines[i].filename),
+			                lines[i].filename);
+			++i;
+			continue;
+		}
+
+		// a lookup done twice, keep the last result
+		if (i < header->nr_lines &&
+		    make_pair(size_t(lines[i].sym_index), lines[i].offset)
+		    == it->first)
+			++i;
+
+		file_line line;
+		memset(&line, '\0', sizeof(line));
+		line.sym_index = it->first.first;
+		line.offset = it->first.second;
+		line.found = it->second.found;
+		line.line = it->second.line;
+		line.filename = table.get(it->second.filename);
+		merged.push_back(line);
+		++it;
+	}
+
+	file_header h = *header;
+	h.nr_lines = merged.size();
+	h.strings_size = strings_buf.size();
+
+	string content;
+	append(content, &h, 1);
+	append(content, symbols, header->nr_symbols);
+	append(content, sections, header->nr_sections);
+	append(content, deps, header->nr_deps);
+	append(content, merged);
+	content += strings_buf;
+
+	// write a temporary file then rename it, so concurrent readers or
+	// writers always see a complete file
+	string const filename = cache_filename();
+	string temp = filename + ".XXXXXX";
+	if (create_path(filename.c_str())) {
+		cverb << vbfd << "can't create " << cache_dir << endl;
+		return;
+	}
+
+	int fd = mkstemp(&temp[0]);
+	if (fd == -1) {
+		cverb << vbfd << "can't create " << temp << endl;
+		return;
+	}
+
+	bool ok = write_all(fd, content.data(), content.size());
+	ok = !::close(fd) && ok;
+	if (!ok || rename(temp.c_str(), filename.c_str())) {
+		cverb << vbfd << "can't write " << filename << endl;
+		unlink(temp.c_str());
+		return;
+	}
+
+	cverb << vbfd << "wrote cache file " << filename << endl;
+}
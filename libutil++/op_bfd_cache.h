@@ -0,0 +1,156 @@
+/**
+ * @file op_bfd_cache.h
+ * On-disk cache of the symbols and line numbers of a binary image
+ *
+ * @remark Copyright 2010 OProfile authors
+ * @remark Read the file COPYING
+ *
+ * Reading the symbol table and the debug line information with libbfd
+ * is the most expensive part of most post-profiling tools runs, and the
+ * same images are read again and again. op_bfd keeps what it found in
+ * one cache file per image: the sorted symbols before filtering, the
+ * filepos of the code sections and the results of all line number
+ * lookups done so far. A cache is valid as long as the image path,
+ * size, mtime and build-id and the state of the separate debug files
+ * looked for are unchanged.
+ */
+
+#ifndef OP_BFD_CACHE_H
+#define OP_BFD_CACHE_H
+
+#include <string>
+#include <vector>
+#include <map>
+#include <utility>
+
+#include "utility.h"
+#include "op_types.h"
+
+class op_bfd_cache : noncopyable {
+public:
+	/// a symbol as found by op_bfd, before filtering
+	struct symbol {
+		std::string name;
+		u64 value;
+		u64 filepos;
+		u64 vma;
+		u64 size;
+		bool hidden;
+		bool weak;
+	};
+
+	/// the result of a line number lookup
+	struct linenr {
+		linenr() : found(false), line(0) {}
+		bool found;
+		std::string filename;
+		unsigned int line;
+	};
+
+	op_bfd_cache();
+
+	/// flush() the cache
+	~op_bfd_cache();
+
+	/**
+	 * open - read the cache of an image
+	 * @param dir  the cache directory, caching is disabled if empty
+	 * @param image_path  the image file
+	 *
+	 * Return false if there is no valid cache for this image, it can
+	 * then be created with create().
+	 */
+	bool open(std::string const & dir, std::string const & image_path);
+
+	/**
+	 * create - start a new cache for the image passed to open()
+	 * @param symbols  the sorted symbols, before filtering
+	 * @param sections  the filepos of each code section
+	 * @param has_debug_info  true if debug info is available
+	 * @param debug_files  the separate debug files looked for
+	 *
+	 * The cache file is written by flush(). Do nothing if caching
+	 * is disabled.
+	 */
+	void create(std::vector<symbol> const & symbols,
+	            std::map<std::string, u32> const & sections,
+	            bool has_debug_info,
+	            std::vector<std::string> const & debug_files);
+
+	/// return true if the cache has been opened or created
+	bool valid() const { return base != 0; }
+
+	/// return the has_debug_info passed to create()
+	bool has_debug_info() const;
+
+	/// return the symbols passed to create()
+	void get_symbols(std::vector<symbol> & symbols) const;
+
+	/// return the sections passed to create()
+	void get_sections(std::map<std::string, u32> & sections) const;
+
+	/**
+	 * find_linenr - look for a previous lookup
+	 * @param sym_index  the index of the symbol in the cached symbols
+	 * @param offset  the offset passed to the lookup
+	 * @param info  filled with the lookup result
+	 *
+	 * Return false if this lookup was never added.
+	 */
+	bool find_linenr(size_t sym_index, u64 offset, linenr & info) const;
+
+	/// record the result of a lookup, see find_linenr()
+	void add_linenr(size_t sym_index, u64 offset, linenr const & info);
+
+	/// write the cache file if it was created or lines were added
+	void flush();
+
+private:
+	/// the cache file layout, see op_bfd_cache.cpp
+	struct file_header;
+	struct file_symbol;
+	struct file_section;
+	struct file_dep;
+	struct file_line;
+
+	/// drop the current cache content
+	void close();
+
+	/// set up the pointers into a cache file content, false if invalid
+	bool map_content(char const * data, size_t size);
+
+	/// return the string at offset in the string table
+	char const * get_string(u32 offset) const;
+
+	/// the cache file name for image_path
+	std::string cache_filename() const;
+
+	std::string cache_dir;
+	std::string image_path;
+	u64 image_size;
+	u64 image_mtime;
+	std::string build_id;
+
+	/// mmapped cache file, or created content
+	char const * base;
+	size_t base_size;
+	bool mapped;
+	/// content built by create()
+	std::string created;
+
+	file_header const * header;
+	file_symbol const * symbols;
+	file_section const * sections;
+	file_dep const * deps;
+	/// sorted by symbol index then offset
+	file_line const * lines;
+	char const * strings;
+
+	typedef std::map<std::pair<size_t, u64>, linenr> pending_lines_t;
+	/// lookups added since the cache was opened
+	pending_lines_t pending_lines;
+	/// true if the cache file must be written
+	bool dirty;
+};
+
+#endif /* !OP_BFD_CACHE_H */
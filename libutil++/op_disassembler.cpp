@@ -0,0 +1,233 @@
+/**
+ * @file op_disassembler.cpp
+ * Disassemble part of an image with libopcodes
+ *
+ * @remark Copyright 2010 OProfile authors
+ * @remark Read the file COPYING
+ */
+
+#include "config.h"
+
+#include <cstdarg>
+#include <cstdio>
+#include <algorithm>
+#include <iostream>
+#include <sstream>
+#include <iomanip>
+
+#ifdef HAVE_LIBOPCODES
+#include <dis-asm.h>
+#endif
+
+#include "op_disassembler.h"
+#include "cverb.h"
+
+using namespace std;
+
+extern verbose vbfd;
+
+namespace {
+
+#ifdef HAVE_LIBOPCODES
+
+bool less_address(asymbol const * lhs, asymbol const * rhs)
+{
+	return bfd_asymbol_value(lhs) < bfd_asymbol_value(rhs);
+}
+
+
+bool address_less(bfd_vma addr, asymbol const * sym)
+{
+	return addr < bfd_asymbol_value(sym);
+}
+
+
+/// append the formatted text to the string passed as stream
+int vprint_text(void * stream, char const * fmt, va_list args)
+{
+	char buf[256];
+	int const len = vsnprintf(buf, sizeof(buf), fmt, args);
+	if (len > 0)
+		static_cast<string *>(stream)->append(buf,
+			min(size_t(len), sizeof(buf) - 1));
+	return len;
+}
+
+
+int print_text(void * stream, char const * fmt, ...)
+{
+	va_list args;
+	va_start(args, fmt);
+	int const len = vprint_text(stream, fmt, args);
+	va_end(args);
+	return len;
+}
+
+
+#ifdef DISASSEMBLE_INFO_STYLED
+int print_styled_text(void * stream, enum disassembler_style,
+                      char const * fmt, ...)
+{
+	va_list args;
+	va_start(args, fmt);
+	int const len = vprint_text(stream, fmt, args);
+	va_end(args);
+	return len;
+}
+#endif
+
+#endif /* HAVE_LIBOPCODES */
+
+}  // anonymous namespace
+
+
+op_disassembler::op_disassembler(string const & filename)
+	: address_digits(0), disasm(0)
+{
+#ifdef HAVE_LIBOPCODES
+	ibfd.abfd = open_bfd(filename);
+	if (!ibfd.valid())
+		return;
+
+	// relocations are not applied, objdump must be used to get the
+	// right branch targets
+	if (bfd_get_file_flags(ibfd.abfd) & HAS_RELOC) {
+		cverb << vbfd << filename << " is relocatable, "
+		      << "not disassembled in process" << endl;
+		return;
+	}
+
+#ifdef DISASSEMBLER_TAKES_ARCH
+	disasm = disassembler(bfd_get_arch(ibfd.abfd),
+	                      bfd_big_endian(ibfd.abfd),
+	                      bfd_get_mach(ibfd.abfd), ibfd.abfd);
+#else
+	disasm = disassembler(ibfd.abfd);
+#endif
+	if (!disasm) {
+		cverb << vbfd << "no disassembler for " << filename << endl;
+		return;
+	}
+
+	address_digits = bfd_arch_bits_per_address(ibfd.abfd) / 4;
+
+	ibfd.get_symbols();
+	for (size_t i = 0; i < ibfd.nr_syms; ++i) {
+		asymbol * sym = ibfd.syms[i];
+		if (interesting_symbol(sym) && sym->name && sym->name[0])
+			symbols.push_back(sym);
+	}
+	stable_sort(symbols.begin(), symbols.end(), less_address);
+#else
+	cverb << vbfd << "built without libopcodes, can't disassemble "
+	      << filename << endl;
+#endif
+}
+
+
+bool op_disassembler::disassemble(string const & name, bfd_vma start,
+                                  bfd_vma end, list<string> & lines) const
+{
+#ifdef HAVE_LIBOPCODES
+	if (!valid())
+		return false;
+
+	asection * sect = ibfd.abfd->sections;
+	for (; sect; sect = sect->next) {
+		bfd_vma const vma = bfd_section_vma(ibfd.abfd, sect);
+		if ((sect->flags & SEC_CODE) && start >= vma &&
+		    start < vma + bfd_section_size(ibfd.abfd, sect))
+			break;
+	}
+	if (!sect)
+		return false;
+
+	bfd_vma const sect_vma = bfd_section_vma(ibfd.abfd, sect);
+	end = min(end, sect_vma + bfd_section_size(ibfd.abfd, sect));
+	if (end <= start)
+		return false;
+
+	// only the symbol code is read, not the whole section
+	vector<bfd_byte> code(end - start);
+	if (!bfd_get_section_contents(ibfd.abfd, sect, &code[0],
+	                              start - sect_vma, code.size())) {
+		cverb << vbfd << "can't read code at " << hex << start << endl;
+		return false;
+	}
+
+	string text;
+	disassemble_info info;
+#ifdef DISASSEMBLE_INFO_STYLED
+	init_disassemble_info(&info, &text, print_text, print_styled_text);
+#else
+	init_disassemble_info(&info, &text, print_text);
+#endif
+	info.application_data = const_cast<op_disassembler *>(this);
+	info.arch = bfd_get_arch(ibfd.abfd);
+	info.mach = bfd_get_mach(ibfd.abfd);
+	info.endian = bfd_big_endian(ibfd.abfd)
+		? BFD_ENDIAN_BIG : BFD_ENDIAN_LITTLE;
+	info.section = sect;
+	info.buffer = &code[0];
+	info.buffer_vma = start;
+	info.buffer_length = code.size();
+	info.print_address_func = print_address;
+	disassemble_init_for_target(&info);
+
+	ostringstream os;
+	os << hex << setfill('0') << setw(address_digits) << start
+	   << " <" << name << ">:";
+	lines.push_back(string());
+	lines.push_back(os.str());
+
+	for (bfd_vma pc = start; pc < end; ) {
+		text.erase();
+		int const size = disasm(pc, &info);
+		if (size <= 0)
+			break;
+
+		ostringstream line;
+		line << hex << setw(8) << pc << ":\t" << text;
+		lines.push_back(line.str());
+		pc += size;
+	}
+
+	return true;
+#else
+	return false;
+#endif
+}
+
+
+void op_disassembler::print_address(bfd_vma addr, disassemble_info * info)
+{
+#ifdef HAVE_LIBOPCODES
+	op_disassembler const * self =
+		static_cast<op_disassembler const *>(info->application_data);
+	ostringstream os;
+	os << hex << addr << self->symbol_at(addr);
+	static_cast<string *>(info->stream)->append(os.str());
+#endif
+}
+
+
+string const op_disassembler::symbol_at(bfd_vma addr) const
+{
+#ifdef HAVE_LIBOPCODES
+	vector<asymbol *>::const_iterator it =
+		upper_bound(symbols.begin(), symbols.end(), addr, address_less);
+	if (it == symbols.begin())
+		return string();
+
+	--it;
+	bfd_vma const offset = addr - bfd_asymbol_value(*it);
+	ostringstream os;
+	os << " <" << (*it)->name;
+	if (offset)
+		os << "+0x" << hex << offset;
+	os << ">";
+	return os.str();
+#else
+	return string();
+#endif
+}
@@ -0,0 +1,68 @@
+/**
+ * @file op_disassembler.h
+ * Disassemble part of an image with libopcodes
+ *
+ * @remark Copyright 2010 OProfile authors
+ * @remark Read the file COPYING
+ *
+ * Running objdump on a large image is slow and its whole output must be
+ * parsed even when only a few symbols are annotated. op_disassembler
+ * decodes the code of a single symbol in process, and formats it the way
+ * "objdump -d --no-show-raw-insn" does.
+ */
+
+#ifndef OP_DISASSEMBLER_H
+#define OP_DISASSEMBLER_H
+
+#include <string>
+#include <list>
+#include <vector>
+
+#include "bfd_support.h"
+#include "utility.h"
+
+struct disassemble_info;
+
+class op_disassembler : noncopyable {
+public:
+	/**
+	 * @param filename  the image to disassemble
+	 *
+	 * The disassembler is not valid if oprofile is built without
+	 * libopcodes, if the image can't be read, or if it is a relocatable
+	 * object. objdump must be used in this case.
+	 */
+	explicit op_disassembler(std::string const & filename);
+
+	/// return true if the image can be disassembled
+	bool valid() const { return disasm != 0; }
+
+	/**
+	 * disassemble - disassemble the code of a symbol
+	 * @param name  the symbol name, printed in the symbol line
+	 * @param start  the first address to disassemble
+	 * @param end  the end address, excluded
+	 * @param lines  the objdump formatted output is appended to it
+	 *
+	 * Return false if start is not in a code section of the image.
+	 */
+	bool disassemble(std::string const & name, bfd_vma start, bfd_vma end,
+	                 std::list<std::string> & lines) const;
+
+private:
+	/// print an instruction operand address with its symbol
+	static void print_address(bfd_vma addr, disassemble_info * info);
+
+	/// return the objdump formatted "<symbol+offset>" for addr
+	std::string const symbol_at(bfd_vma addr) const;
+
+	bfd_info ibfd;
+	/// code symbols sorted by address
+	std::vector<asymbol *> symbols;
+	/// number of hex digits of an address in a symbol line
+	unsigned int address_digits;
+	/// the libopcodes disassembler for this architecture
+	int (*disasm)(bfd_vma, disassemble_info *);
+};
+
+#endif /* !OP_DISASSEMBLER_H */
@@ -0,0 +1,149 @@
+/**
+ * @file small_array.h
+ * Auto-expanding array type with inline storage
+ *
+ * @remark Copyright 2010 OProfile authors
+ * @remark Read the file COPYING
+ */
+
+#ifndef SMALL_ARRAY_H
+#define SMALL_ARRAY_H
+
+#include <cstddef>
+
+/**
+ * An auto-expanding array holding up to N elements without allocating
+ * memory. It is used for the sample counts of each profile class, kept
+ * by every symbol and sample: most profiles have a few classes so the
+ * counts almost never go to the heap.
+ */
+template <typename T, std::size_t N> class small_array {
+public:
+	typedef std::size_t size_type;
+
+	small_array() : data(inline_data), count(0), capacity(N) {}
+
+	small_array(small_array const & rhs)
+		: data(inline_data), count(0), capacity(N) {
+		assign(rhs);
+	}
+
+	~small_array() {
+		if (data != inline_data)
+			delete [] data;
+	}
+
+	small_array & operator=(small_array const & rhs) {
+		if (this != &rhs)
+			assign(rhs);
+		return *this;
+	}
+
+
+	/**
+	 * Index into the array for a value. An out of bounds index
+	 * will return a default-constructed value.
+	 */
+	T operator[](size_type index) const {
+		if (index >= count)
+			return T();
+		return data[index];
+	}
+
+
+	/**
+	 * Index into the array for a value. If the index is larger than
+	 * the current max index, the array is expanded, default-filling
+	 * any intermediary gaps.
+	 */
+	T & operator[](size_type index) {
+		if (index >= count)
+			resize(index + 1);
+		return data[index];
+	}
+
+
+	/**
+	 * vectorized += operator
+	 */
+	small_array & operator+=(small_array const & rhs) {
+		if (rhs.count > count)
+			resize(rhs.count);
+
+		for (size_type i = 0; i < rhs.count; ++i)
+			data[i] += rhs.data[i];
+
+		return *this;
+	}
+
+
+	/**
+	 * vectorized -= operator, overflow shouldn't occur during substraction
+	 * (iow: for each components lhs[i] >= rhs[i]
+	 */
+	small_array & operator-=(small_array const & rhs) {
+		if (rhs.count > count)
+			resize(rhs.count);
+
+		for (size_type i = 0; i < rhs.count; ++i)
+			data[i] -= rhs.data[i];
+
+		return *this;
+	}
+
+
+	/**
+	 * return the maximum index of the array + 1 or 0 if the array
+	 * is empty.
+	 */
+	size_type size() const {
+		return count;
+	}
+
+
+	/// return true if all elements have the default constructed value
+	bool zero() const {
+		for (size_type i = 0; i < count; ++i) {
+			if (data[i] != T())
+				return false;
+		}
+		return true;
+	}
+
+private:
+	/// grow to new_count elements, new elements are default-constructed
+	void resize(size_type new_count) {
+		if (new_count > capacity) {
+			size_type new_capacity = capacity * 2;
+			if (new_capacity < new_count)
+				new_capacity = new_count;
+			T * new_data = new T[new_capacity];
+			for (size_type i = 0; i < count; ++i)
+				new_data[i] = data[i];
+			if (data != inline_data)
+				delete [] data;
+			data = new_data;
+			capacity = new_capacity;
+		}
+
+		for (size_type i = count; i < new_count; ++i)
+			data[i] = T();
+		count = new_count;
+	}
+
+	void assign(small_array const & rhs) {
+		count = 0;
+		resize(rhs.count);
+		for (size_type i = 0; i < rhs.count; ++i)
+			data[i] = rhs.data[i];
+	}
+
+	/// inline_data or an array allocated with new []
+	T * data;
+	// not size_type, it keeps small_array<u64, 4> as small as a std::map
+	unsigned int count;
+	unsigned int capacity;
+	T inline_data[N];
+};
+
+#endif // SMALL_ARRAY_H
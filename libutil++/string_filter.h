@@ -45,6 +45,12 @@ public:
 	/// Returns true if the given string matches
 	virtual bool match(std::string const & str) const;
 
+	/**
+	 * Return a string identifying this filter, two filters with the
+	 * same identifier match the same strings.
+	 */
+	std::string const id() const;
+
 protected:
 	/// include patterns
 	std::vector<std::string> include;
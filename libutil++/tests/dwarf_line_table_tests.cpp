@@ -0,0 +1,269 @@
+/**
+ * @file dwarf_line_table_tests.cpp
+ * tests dwarf_line_table
+ *
+ * @remark Copyright 2010 OProfile authors
+ * @remark Read the file COPYING
+ */
+
+#include <cstdlib>
+#include <iostream>
+#include <string>
+
+#include "dwarf_line_table.h"
+
+using namespace std;
+
+namespace {
+
+int nr_error;
+
+/// build DWARF data in a given byte order
+struct dwarf_buffer {
+	dwarf_buffer(bool big_endian_) : big_endian(big_endian_) {}
+
+	dwarf_buffer & u8(unsigned int value) {
+		data.push_back(char(value));
+		return *this;
+	}
+
+	dwarf_buffer & fixed(u64 value, size_t size) {
+		for (size_t i = 0; i < size; ++i) {
+			size_t const shift = big_endian ? size - 1 - i : i;
+			data.push_back(char(value >> (8 * shift)));
+		}
+		return *this;
+	}
+
+	dwarf_buffer & uleb(u64 value) {
+		do {
+			unsigned char byte = value & 0x7f;
+			value >>= 7;
+			if (value)
+				byte |= 0x80;
+			data.push_back(char(byte));
+		} while (value);
+		return *this;
+	}
+
+	dwarf_buffer & sleb(long long value) {
+		bool more = true;
+		while (more) {
+			unsigned char byte = value & 0x7f;
+			value >>= 7;
+			if ((value == 0 && !(byte & 0x40)) ||
+			    (value == -1 && (byte & 0x40)))
+				more = false;
+			else
+				byte |= 0x80;
+			data.push_back(char(byte));
+		}
+		return *this;
+	}
+
+	dwarf_buffer & str(string const & value) {
+		data += value;
+		data.push_back('\0');
+		return *this;
+	}
+
+	dwarf_buffer & append(dwarf_buffer const & buf) {
+		data += buf.data;
+		return *this;
+	}
+
+	/// prefix with a 32 bits initial length
+	string unit() const {
+		dwarf_buffer buf(big_endian);
+		buf.fixed(data.size(), 4);
+		return buf.data + data;
+	}
+
+	bool big_endian;
+	string data;
+};
+
+
+/// the line program shared by all tests, file 2 must be b.h
+dwarf_buffer line_program(bool big_endian)
+{
+	dwarf_buffer prog(big_endian);
+	// DW_LNE_set_address 0x1000
+	prog.u8(0).uleb(9).u8(2).fixed(0x1000, 8);
+	// DW_LNS_advance_line 9, DW_LNS_copy: 0x1000 line 10
+	prog.u8(3).sleb(9).u8(1);
+	// special opcode, address + 4, line + 1: 0x1004 line 11
+	prog.u8((1 + 5) + 4 * 14 + 13);
+	// DW_LNS_set_file 2, DW_LNS_advance_pc 8, DW_LNS_copy:
+	// 0x100c line 11 in b.h
+	prog.u8(4).uleb(2).u8(2).uleb(8).u8(1);
+	// DW_LNS_advance_line -11, DW_LNS_advance_pc 2, DW_LNS_copy:
+	// 0x100e line 0
+	prog.u8(3).sleb(-11).u8(2).uleb(2).u8(1);
+	// DW_LNS_advance_pc 2, DW_LNE_end_sequence at 0x1010
+	prog.u8(2).uleb(2).u8(0).uleb(1).u8(1);
+	return prog;
+}
+
+
+/// the standard opcode lengths header fields shared by all tests
+void line_header_params(dwarf_buffer & header)
+{
+	// min_inst_length, max_ops_per_inst, default_is_stmt, line_base,
+	// line_range, opcode_base
+	header.u8(1).u8(1).u8(1).u8(-5 & 0xff).u8(14).u8(13);
+	unsigned int const lengths[] = { 0, 1, 1, 1, 1, 0, 0, 0, 1, 0, 0, 1 };
+	for (size_t i = 0; i < sizeof(lengths) / sizeof(lengths[0]); ++i)
+		header.u8(lengths[i]);
+}
+
+
+void sections_v4(dwarf_line_table::sections & secs, bool big_endian)
+{
+	// DW_TAG_compile_unit, no children, DW_AT_stmt_list sec_offset,
+	// DW_AT_comp_dir string, DW_AT_name string
+	dwarf_buffer abbrev(big_endian);
+	abbrev.uleb(1).uleb(0x11).u8(0);
+	abbrev.uleb(0x10).uleb(0x17).uleb(0x1b).uleb(0x08);
+	abbrev.uleb(0x03).uleb(0x08).uleb(0).uleb(0).uleb(0);
+	secs.abbrev = abbrev.data;
+
+	dwarf_buffer info(big_endian);
+	info.fixed(4, 2).fixed(0, 4).u8(8);
+	info.uleb(1).fixed(0, 4).str("/src").str("a.c");
+	secs.info = info.unit();
+
+	dwarf_buffer header(big_endian);
+	line_header_params(header);
+	header.str("inc").str("");
+	header.str("a.c").uleb(0).uleb(0).uleb(0);
+	header.str("b.h").uleb(1).uleb(0).uleb(0);
+	header.str("");
+
+	dwarf_buffer line(big_endian);
+	line.fixed(4, 2).fixed(header.data.size(), 4).append(header);
+	line.append(line_program(big_endian));
+	secs.line = line.unit();
+}
+
+
+void sections_v5(dwarf_line_table::sections & secs)
+{
+	secs.line_str = string("/src\0inc\0", 9);
+	secs.str = string("a.c\0", 4);
+
+	// DW_AT_stmt_list sec_offset, DW_AT_comp_dir line_strp,
+	// DW_AT_name strp
+	dwarf_buffer abbrev(false);
+	abbrev.uleb(1).uleb(0x11).u8(0);
+	abbrev.uleb(0x10).uleb(0x17).uleb(0x1b).uleb(0x1f);
+	abbrev.uleb(0x03).uleb(0x0e).uleb(0).uleb(0).uleb(0);
+	secs.abbrev = abbrev.data;
+
+	dwarf_buffer info(false);
+	info.fixed(5, 2).u8(1).u8(8).fixed(0, 4);
+	info.uleb(1).fixed(0, 4).fixed(0, 4).fixed(0, 4);
+	secs.info = info.unit();
+
+	dwarf_buffer header(false);
+	line_header_params(header);
+	// directories: DW_LNCT_path line_strp
+	header.u8(1).uleb(1).uleb(0x1f);
+	header.uleb(2).fixed(0, 4).fixed(5, 4);
+	// files: DW_LNCT_path string, DW_LNCT_directory_index udata
+	header.u8(2).uleb(1).uleb(0x08).uleb(2).uleb(0x0f);
+	header.uleb(3);
+	header.str("a.c").uleb(0);
+	header.str("a.c").uleb(0);
+	header.str("b.h").uleb(1);
+
+	dwarf_buffer line(false);
+	// version, address_size, seg_sel_size
+	line.fixed(5, 2).u8(8).u8(0);
+	line.fixed(header.data.size(), 4).append(header);
+	line.append(line_program(false));
+	secs.line = line.unit();
+}
+
+
+void check_find(dwarf_line_table const & table, u64 address,
+                char const * filename, unsigned int line, char const * test)
+{
+	string found_filename;
+	unsigned int found_line = 0;
+	bool const found = table.find(address, found_filename, found_line);
+
+	if (!filename) {
+		if (found) {
+			cerr << test << ": unexpected line for " << hex
+			     << address << ": " << found_filename << ":"
+			     << dec << found_line << endl;
+			++nr_error;
+		}
+		return;
+	}
+
+	if (!found || found_filename != filename || found_line != line) {
+		cerr << test << ": for " << hex << address << " expected "
+		     << filename << ":" << dec << line << ", got ";
+		if (found)
+			cerr << found_filename << ":" << found_line << endl;
+		else
+			cerr << "nothing" << endl;
+		++nr_error;
+	}
+}
+
+
+void check_table(dwarf_line_table::sections const & secs, bool big_endian,
+                 char const * test)
+{
+	dwarf_line_table table;
+	if (!table.read(secs, big_endian, 8)) {
+		cerr << test << ": read() failed" << endl;
+		++nr_error;
+		return;
+	}
+
+	// increasing addresses, as used for samples
+	check_find(table, 0xfff, 0, 0, test);
+	check_find(table, 0x1000, "/src/a.c", 10, test);
+	check_find(table, 0x1003, "/src/a.c", 10, test);
+	check_find(table, 0x1004, "/src/a.c", 11, test);
+	check_find(table, 0x100b, "/src/a.c", 11, test);
+	check_find(table, 0x100c, "/src/inc/b.h", 11, test);
+	check_find(table, 0x100e, 0, 0, test);
+	check_find(table, 0x1010, 0, 0, test);
+
+	// then going backward
+	check_find(table, 0x100d, "/src/inc/b.h", 11, test);
+	check_find(table, 0x1001, "/src/a.c", 10, test);
+}
+
+}  // anonymous namespace
+
+
+int main()
+{
+	dwarf_line_table::sections secs;
+
+	sections_v4(secs, false);
+	check_table(secs, false, "DWARF 4");
+
+	sections_v4(secs, true);
+	check_table(secs, true, "DWARF 4 big endian");
+
+	dwarf_line_table::sections v5;
+	sections_v5(v5);
+	check_table(v5, false, "DWARF 5");
+
+	// a truncated line program is rejected
+	secs.line.erase(secs.line.size() - 4);
+	dwarf_line_table table;
+	if (table.read(secs, true, 8) || !table.empty()) {
+		cerr << "truncated line program accepted" << endl;
+		++nr_error;
+	}
+
+	return nr_error ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -0,0 +1,213 @@
+/**
+ * @file op_bfd_cache_tests.cpp
+ * tests op_bfd_cache
+ *
+ * @remark Copyright 2010 OProfile authors
+ * @remark Read the file COPYING
+ */
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <dirent.h>
+
+#include <cstdlib>
+#include <cstdio>
+#include <iostream>
+#include <fstream>
+#include <string>
+#include <vector>
+#include <map>
+
+#include "op_bfd_cache.h"
+#include "cverb.h"
+
+using namespace std;
+
+// normally defined by op_bfd.cpp
+verbose vbfd("bfd");
+
+namespace {
+
+string test_dir;
+string cache_dir;
+string image;
+string debug_file;
+
+int nr_error;
+
+
+void check(bool cond, char const * what)
+{
+	if (!cond) {
+		cerr << "op_bfd_cache: " << what << endl;
+		++nr_error;
+	}
+}
+
+
+void write_file(string const & name, string const & content)
+{
+	ofstream out(name.c_str());
+	out << content;
+}
+
+
+void create_cache(bool with_debug_file)
+{
+	vector<op_bfd_cache::symbol> symbols(2);
+	symbols[0].name = "main";
+	symbols[0].value = 0x10;
+	symbols[0].filepos = 0x410;
+	symbols[0].vma = 0x8048410;
+	symbols[0].size = 0x20;
+	symbols[0].hidden = false;
+	symbols[0].weak = false;
+	symbols[1].name = "helper";
+	symbols[1].value = 0x30;
+	symbols[1].filepos = 0x430;
+	symbols[1].vma = 0x8048430;
+	symbols[1].size = 0x8;
+	symbols[1].hidden = true;
+	symbols[1].weak = true;
+
+	map<string, u32> sections;
+	sections[".text"] = 0x400;
+
+	vector<string> debug_files;
+	if (with_debug_file)
+		debug_files.push_back(debug_file);
+
+	op_bfd_cache cache;
+	check(!cache.open(cache_dir, image), "unexpected cache hit");
+	cache.create(symbols, sections, true, debug_files);
+	check(cache.valid(), "created cache not valid");
+
+	op_bfd_cache::linenr info;
+	check(!cache.find_linenr(1, 4, info), "line found in new cache");
+
+	info.found = true;
+	info.filename = "helper.c";
+	info.line = 12;
+	cache.add_linenr(1, 4, info);
+	check(cache.find_linenr(1, 4, info) && info.line == 12,
+	      "added line not found");
+}
+
+
+void check_content()
+{
+	op_bfd_cache cache;
+	if (!cache.open(cache_dir, image)) {
+		check(false, "cache not found");
+		return;
+	}
+
+	check(cache.has_debug_info(), "has_debug_info() lost");
+
+	vector<op_bfd_cache::symbol> symbols;
+	cache.get_symbols(symbols);
+	check(symbols.size() == 2, "wrong number of symbols");
+	if (symbols.size() == 2) {
+		check(symbols[0].name == "main" && symbols[0].vma == 0x8048410 &&
+		      symbols[0].filepos == 0x410 && symbols[0].size == 0x20 &&
+		      !symbols[0].hidden && !symbols[0].weak,
+		      "wrong first symbol");
+		check(symbols[1].name == "helper" && symbols[1].value == 0x30 &&
+		      symbols[1].hidden && symbols[1].weak,
+		      "wrong second symbol");
+	}
+
+	map<string, u32> sections;
+	cache.get_sections(sections);
+	check(sections.size() == 1 && sections[".text"] == 0x400,
+	      "wrong sections");
+
+	op_bfd_cache::linenr info;
+	check(cache.find_linenr(1, 4, info) && info.found &&
+	      info.filename == "helper.c" && info.line == 12,
+	      "line lost");
+	check(!cache.find_linenr(0, 4, info), "unexpected line");
+	check(!cache.find_linenr(1, 8, info), "unexpected line");
+
+	// failed lookups are recorded too
+	op_bfd_cache::linenr not_found;
+	cache.add_linenr(0, 4, not_found);
+}
+
+
+void check_lines_merged()
+{
+	op_bfd_cache cache;
+	check(cache.open(cache_dir, image), "cache lost after adding a line");
+
+	op_bfd_cache::linenr info;
+	check(cache.find_linenr(0, 4, info) && !info.found,
+	      "failed lookup not recorded");
+	check(cache.find_linenr(1, 4, info) && info.found && info.line == 12,
+	      "line lost after adding a line");
+}
+
+
+void remove_dir(string const & dir)
+{
+	DIR * d = opendir(dir.c_str());
+	if (!d)
+		return;
+	struct dirent * entry;
+	while ((entry = readdir(d)) != 0) {
+		string const name = entry->d_name;
+		if (name != "." && name != "..")
+			remove((dir + '/' + name).c_str());
+	}
+	closedir(d);
+	rmdir(dir.c_str());
+}
+
+}  // anonymous namespace
+
+
+int main()
+{
+	char dir[] = "/tmp/op_bfd_cache_tests.XXXXXX";
+	if (!mkdtemp(dir)) {
+		perror(dir);
+		return EXIT_FAILURE;
+	}
+
+	test_dir = dir;
+	cache_dir = test_dir + "/cache";
+	image = test_dir + "/image";
+	debug_file = test_dir + "/image.debug";
+
+	write_file(image, "not an elf file");
+
+	// caching disabled
+	op_bfd_cache disabled;
+	check(!disabled.open("", image), "cache enabled without a directory");
+	disabled.create(vector<op_bfd_cache::symbol>(), map<string, u32>(),
+	                false, vector<string>());
+	check(!disabled.valid(), "cache created without a directory");
+
+	create_cache(true);
+	check_content();
+	check_lines_merged();
+
+	// a separate debug file appeared
+	write_file(debug_file, "debug info");
+	op_bfd_cache outdated;
+	check(!outdated.open(cache_dir, image),
+	      "cache used after debug file creation");
+
+	// the image changed
+	create_cache(true);
+	check_content();
+	write_file(image, "still not an elf file");
+	check(!outdated.open(cache_dir, image),
+	      "cache used after image change");
+
+	remove_dir(cache_dir);
+	remove_dir(test_dir);
+
+	return nr_error ? EXIT_FAILURE : EXIT_SUCCESS;
+}
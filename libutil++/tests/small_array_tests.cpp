@@ -0,0 +1,111 @@
+/**
+ * @file small_array_tests.cpp
+ * tests small_array.h
+ *
+ * @remark Copyright 2010 OProfile authors
+ * @remark Read the file COPYING
+ */
+
+#include <stdlib.h>
+#include <new>
+#include <iostream>
+
+#include "small_array.h"
+
+using namespace std;
+
+static int nb_new_array;
+
+void* operator new[](size_t size) throw(bad_alloc)
+{
+	nb_new_array++;
+	return malloc(size);
+}
+
+void operator delete[](void * p) throw()
+{
+	nb_new_array--;
+	if (p)
+		free(p);
+}
+
+
+typedef small_array<unsigned long long, 4> array_t;
+
+
+static void check(bool ok, char const * what)
+{
+	if (!ok) {
+		cerr << "small_array: " << what << " failed\n";
+		exit(EXIT_FAILURE);
+	}
+}
+
+
+static void check_inline()
+{
+	array_t a;
+	array_t const & ca = a;
+
+	check(a.size() == 0 && a.zero(), "empty array");
+	check(ca[10] == 0 && a.size() == 0, "const out of bounds access");
+
+	a[2] = 5;
+	check(a.size() == 3 && ca[0] == 0 && ca[1] == 0 && ca[2] == 5,
+	      "expansion");
+	check(!a.zero(), "zero()");
+
+	array_t b;
+	b[0] = 1;
+	b[2] = 2;
+	a += b;
+	check(a.size() == 3 && ca[0] == 1 && ca[2] == 7, "operator+=");
+	a -= b;
+	check(a.size() == 3 && ca[0] == 0 && ca[2] == 5, "operator-=");
+
+	array_t c;
+	c[1] = 1;
+	c -= c;
+	check(c.size() == 2 && c.zero(), "zero() after operator-=");
+
+	check(nb_new_array == 0, "inline storage");
+}
+
+
+static void check_heap()
+{
+	array_t a;
+	for (size_t i = 0; i < 10; ++i)
+		a[i] = i;
+	check(a.size() == 10 && a[9] == 9 && a[3] == 3, "heap expansion");
+	check(nb_new_array == 1, "heap allocation");
+
+	array_t b(a);
+	check(b.size() == 10 && b[9] == 9, "heap copy");
+
+	array_t c;
+	c[1] = 3;
+	c += a;
+	check(c.size() == 10 && c[1] == 4 && c[9] == 9, "operator+= to heap");
+
+	b = c;
+	check(b.size() == 10 && b[1] == 4, "assignment");
+
+	array_t d;
+	d[0] = 1;
+	b = d;
+	array_t const & cb = b;
+	check(b.size() == 1 && cb[0] == 1 && cb[5] == 0, "assignment shrink");
+
+	b = b;
+	check(b.size() == 1 && b[0] == 1, "self assignment");
+}
+
+
+int main()
+{
+	check_inline();
+	check_heap();
+	check(nb_new_array == 0, "heap release");
+	return EXIT_SUCCESS;
+}
@@ -48,6 +48,31 @@ if test "$OS" = "Linux"; then
 	rm -f test-for-synth*
 
 fi
+
+dnl libopcodes is optional, opannotate runs objdump without it
+AC_CHECK_HEADERS(dis-asm.h)
+AC_CHECK_LIB(opcodes, disassembler, OPCODES_LIB="-lopcodes", OPCODES_LIB="")
+if test "$ac_cv_header_dis_asm_h" = "yes" -a -n "$OPCODES_LIB"; then
+	AC_DEFINE(HAVE_LIBOPCODES, 1, [libopcodes can be used to disassemble])
+
+	AC_MSG_CHECKING([whether disassembler() takes the architecture])
+	AC_TRY_COMPILE([#include <dis-asm.h>],
+		[disassembler_ftype f = disassembler(bfd_arch_unknown, 0, 0, 0);],
+		AC_MSG_RESULT([yes]);
+		AC_DEFINE(DISASSEMBLER_TAKES_ARCH, 1,
+			[disassembler() takes arch, big, mach and bfd]),
+		AC_MSG_RESULT([no]))
+
+	AC_MSG_CHECKING([whether init_disassemble_info() takes a styled printer])
+	AC_TRY_COMPILE([#include <dis-asm.h>],
+		[struct disassemble_info info; init_disassemble_info(&info, 0, 0, 0);],
+		AC_MSG_RESULT([yes]);
+		AC_DEFINE(DISASSEMBLE_INFO_STYLED, 1,
+			[init_disassemble_info() takes a styled fprintf function]),
+		AC_MSG_RESULT([no]))
+else
+	OPCODES_LIB=""
+fi
 AC_LANG_POP(C)
 ]
 )
@@ -23,6 +23,7 @@
 #include "cverb.h"
 #include "common_option.h"
 #include "file_manip.h"
+#include "image_cache.h"
 
 using namespace std;
 
@@ -33,6 +34,7 @@ namespace options {
 	string command_options;
 	vector<string> image_path;
 	string root_path;
+	int image_cache_size = 256;
 }
 
 namespace {
@@ -49,6 +51,9 @@ popt::option common_options_array[] = {
 		     "comma-separated path to search missing binaries", "path"),
 	popt::option(options::root_path, "root", 'R',
 		     "path to filesystem to search for missing binaries", "path"),
+	popt::option(options::image_cache_size, "image-cache-size", '\0',
+		     "memory used to keep binary images loaded, in megabytes (256)",
+		     "megabytes"),
 };
 
 
@@ -180,6 +185,13 @@ options::spec get_options(int argc, char const * argv[])
 		exit(EXIT_FAILURE);
 	}
 
+	if (options::image_cache_size < 0) {
+		cerr << "--image-cache-size must not be negative" << endl;
+		exit(EXIT_FAILURE);
+	}
+	image_cache::instance().set_memory_limit(
+		size_t(options::image_cache_size) * 1024 * 1024);
+
 	// XML generator needs command line options for its header
 	ostringstream str;
 	for (int i = 1; i < argc; ++i)
@@ -26,6 +26,7 @@ namespace options {
 	extern std::string command_options;
 	extern std::vector<std::string> image_path;
 	extern std::string root_path;
+	extern int image_cache_size;
 
 	struct spec {
 		std::list<std::string> common;
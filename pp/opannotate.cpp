@@ -32,6 +32,7 @@
 #include "profile_container.h"
 #include "symbol_sort.h"
 #include "image_errors.h"
+#include "op_disassembler.h"
 
 using namespace std;
 using namespace options;
@@ -56,6 +57,9 @@ string const end_comment(" */");
 /// field width for the sample count
 unsigned int const count_width = 6;
 
+/// up to this number of symbols objdump is run once per symbol
+size_t const max_objdump_exec = 50;
+
 string get_annotation_fill()
 {
 	string str;
@@ -287,22 +291,54 @@ bool is_symbol_line(string const & str, string::size_type pos)
 }
 
 
+/// return true if this line is a symbol line of objdump output
+bool is_objdump_symbol_line(string const & str)
+{
+	size_t pos = 0;
+	while (pos < str.length() && isspace(str[pos]))
+		++pos;
+
+	size_t const start = pos;
+	while (pos < str.length() && isxdigit(str[pos]))
+		++pos;
+
+	if (pos == start || pos + 1 >= str.length())
+		return false;
+
+	return is_symbol_line(str, pos);
+}
+
+
+/// state of the annotation of an objdump output, kept between the
+/// chunks of lines the output is annotated by
+struct objdump_state {
+	objdump_state()
+		: last_symbol(0), last_symbol_vma(0), do_output(true),
+		  samp_it(samples->begin()) {}
+
+	symbol_entry const * last_symbol;
+	bfd_vma last_symbol_vma;
+	/// to filter output of symbols (filter based on command line options)
+	bool do_output;
+	sample_container::samples_iterator samp_it;
+};
+
+
 void annotate_objdump_str_list(string const & app_name,
 			       symbol_collection const & symbols,
-			       list<string> & asm_lines)
+			       list<string> & asm_lines,
+			       objdump_state & state)
 {
-	symbol_entry const * last_symbol = 0;
-	bfd_vma last_symbol_vma = 0;
+	symbol_entry const *& last_symbol = state.last_symbol;
+	bfd_vma & last_symbol_vma = state.last_symbol_vma;
+	bool & do_output = state.do_output;
+	sample_container::samples_iterator & samp_it = state.samp_it;
 	int ret = 0;
 
-	// to filter output of symbols (filter based on command line options)
-	bool do_output = true;
-
 	// We simultaneously walk the two structures (list and sample_container)
 	// which are sorted by address. and do address comparision.
 	list<string>::iterator sit  = asm_lines.begin();
 	list<string>::iterator send = asm_lines.end();
-	sample_container::samples_iterator samp_it = samples->begin();
 
 	for (; sit != send; (!ret? sit++: sit)) {
 		// output of objdump is a human readable form and can contain some
@@ -374,10 +410,11 @@ void annotate_objdump_str_list(string const & app_name,
 
 void output_objdump_str_list(symbol_collection const & symbols,
 			string const & app_name,
-			list<string> & asm_lines)
+			list<string> & asm_lines,
+			objdump_state & state)
 {
 
-	annotate_objdump_str_list(app_name, symbols, asm_lines);
+	annotate_objdump_str_list(app_name, symbols, asm_lines, state);
 
 	// Printing objdump output to stdout
 	list<string>::iterator sit  = asm_lines.begin();
@@ -424,12 +461,20 @@ void do_one_output_objdump(symbol_collection const & symbols,
 		return;
 	}
 
-	// Read each output line from objdump and store in a list.
+	// Read objdump output a symbol at a time, rather than storing the
+	// whole disassembly of the image before annotating it.
+	objdump_state state;
 	string str;
-	while (reader.getline(str))
+	while (reader.getline(str)) {
+		if (is_objdump_symbol_line(str) && !asm_lines.empty()) {
+			output_objdump_str_list(symbols, app_name, asm_lines,
+			                        state);
+			asm_lines.clear();
+		}
 		asm_lines.push_back(str);
+	}
 
-	output_objdump_str_list(symbols, app_name, asm_lines);
+	output_objdump_str_list(symbols, app_name, asm_lines, state);
 
 	// objdump always returns SUCCESS so we must rely on the stderr state
 	// of objdump. If objdump error message is cryptic our own error
@@ -456,6 +501,37 @@ void do_one_output_objdump(symbol_collection const & symbols,
 }
 
 
+bool less_vma(symbol_entry const * lhs, symbol_entry const * rhs)
+{
+	return lhs->sample.vma < rhs->sample.vma;
+}
+
+
+void output_disassembled_asm(op_disassembler const & disasm,
+			     symbol_collection const & symbols,
+			     string const & app_name)
+{
+	// keep the order of the output of the objdump path below
+	symbol_collection ordered(symbols);
+	if (ordered.size() > max_objdump_exec)
+		stable_sort(ordered.begin(), ordered.end(), less_vma);
+
+	objdump_state state;
+	list<string> asm_lines;
+	symbol_collection::const_iterator cit = ordered.begin();
+	symbol_collection::const_iterator end = ordered.end();
+	for (; cit != end; ++cit) {
+		bfd_vma start = (*cit)->sample.vma;
+		bfd_vma end  = start + (*cit)->size;
+		asm_lines.clear();
+		if (disasm.disassemble(symbol_names.name((*cit)->name),
+		                       start, end, asm_lines))
+			output_objdump_str_list(symbols, app_name, asm_lines,
+			                        state);
+	}
+}
+
+
 void output_objdump_asm(symbol_collection const & symbols,
 			string const & app_name)
 {
@@ -464,13 +540,22 @@ void output_objdump_asm(symbol_collection const & symbols,
 		classes.extra_found_images.find_image_path(app_name, error,
 							   true);
 
+	// objdump is still needed to interleave the source or to use the
+	// user supplied objdump options
+	if (error == image_ok && !source && objdump_params.empty()) {
+		op_disassembler disasm(image);
+		if (disasm.valid()) {
+			output_disassembled_asm(disasm, symbols, app_name);
+			return;
+		}
+	}
+
 	// this is only an optimisation, we can either filter output by
 	// directly calling objdump and rely on the symbol filtering or
 	// we can call objdump with the right parameter to just disassemble
 	// the needed part. This is a real win only when calling objdump
 	// a medium number of times, I dunno if the used threshold is optimal
 	// but it is a conservative value.
-	size_t const max_objdump_exec = 50;
 	if (symbols.size() <= max_objdump_exec || error != image_ok) {
 		symbol_collection::const_iterator cit = symbols.begin();
 		symbol_collection::const_iterator end = symbols.end();
@@ -826,14 +911,11 @@ int opannotate(options::spec const & spec)
 	list<inverted_profile>::iterator const end = iprofiles.end();
 
 	bool debug_info = false;
-	for (; it != end; ++it) {
-		bool tmp = false;
-		populate_for_image(*samples, *it,
-				   options::symbol_filter, &tmp);
+	populate_for_images(*samples, iprofiles, options::symbol_filter,
+			    options::jobs, &debug_info);
+
+	for (; it != end; ++it)
 		images.push_back(it->image);
-		if (tmp)
-			debug_info = true;
-	}
 
 	if (!debug_info && !options::assembly) {
 		cerr << "opannotate (warning): no debug information available for binary "
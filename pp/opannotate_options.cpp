@@ -40,6 +40,7 @@ namespace options {
 	bool assembly;
 	vector<string> objdump_params;
 	bool exclude_dependent;
+	int jobs = 1;
 }
 
 
@@ -78,6 +79,9 @@ popt::option options_array[] = {
 		     "comma separated list", "cpu,tid,tgid,unitmask,all"),
 	popt::option(options::source, "source", 's', "output source"),
 	popt::option(options::assembly, "assembly", 'a', "output assembly"),
+	popt::option(options::jobs, "jobs", 'j',
+		     "number of binary images to load at once (default 1)",
+		     "jobs"),
 	popt::option(options::threshold_opt, "threshold", 't',
 		     "minimum percentage needed to produce output",
 		     "percent"),
@@ -117,6 +121,11 @@ void handle_options(options::spec const & spec)
 		exit(EXIT_FAILURE);
 	}
 
+	if (jobs < 1) {
+		cerr << "--jobs must be at least 1" << endl;
+		exit(EXIT_FAILURE);
+	}
+
 	options::symbol_filter = string_filter(include_symbols, exclude_symbols);
 
 	options::file_filter = path_filter(include_file, exclude_file);
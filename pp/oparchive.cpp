@@ -14,6 +14,7 @@
 
 #include <iostream>
 #include <fstream>
+#include <set>
 #include <cstdlib>
 
 #include <errno.h>
@@ -26,6 +27,7 @@
 #include "op_file.h"
 #include "op_bfd.h"
 #include "op_config.h"
+#include "odb.h"
 #include "oparchive_options.h"
 #include "file_manip.h"
 #include "cverb.h"
@@ -54,6 +56,19 @@ void copy_one_file(image_error err, string const & source, string const & dest)
 	}
 }
 
+/// return the container holding a sample file, empty if none
+string const sample_container(string const & sample_file)
+{
+	char * pack = odb_pack_container(sample_file.c_str());
+	if (!pack)
+		return string();
+
+	string const result(pack);
+	free(pack);
+	return result;
+}
+
+
 void copy_stats(string const & session_samples_dir,
 		string const & archive_path)
 {
@@ -188,15 +203,28 @@ int oparchive(options::spec const & spec)
 	list<string>::iterator sit = sample_files.begin();
 	list<string>::iterator const send = sample_files.end();
 
-	string a_sample_file = *sit;
-	int offset = a_sample_file.find('{');
-	string base_samples_dir = a_sample_file.substr(0, offset);
+	string base_samples_dir;
+	string const a_pack = sample_container(*sit);
+	if (a_pack.empty())
+		base_samples_dir = sit->substr(0, sit->find('{'));
+	else
+		base_samples_dir = a_pack.substr(0, a_pack.rfind('/') + 1);
 	copy_stats(base_samples_dir, archive_path);
 
 	cverb << vdebug << "(sample_names)" << endl << endl;
 
+	set<string> copied_packs;
 	for (; sit != send; ++sit) {
 		string sample_name = *sit;
+
+		/* a container holding many sample files is copied once */
+		string const pack = sample_container(sample_name);
+		if (!pack.empty()) {
+			if (!copied_packs.insert(pack).second)
+				continue;
+			sample_name = pack;
+		}
+
 		/* Get rid of the the archive_path from the name */
 		string sample_base = sample_name.substr(archive_path.size());
 		string sample_archive_file = options::outdirectory + sample_base;
@@ -9,12 +9,19 @@
  * @author Philippe Elie
  */
 
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include <errno.h>
+
 #include <iostream>
+#include <sstream>
 #include <cstdio>
+#include <vector>
 
 #include "op_header.h"
+#include "op_exception.h"
 #include "profile.h"
-#include "op_libiberty.h"
 #include "op_fileio.h"
 #include "string_filter.h"
 #include "profile_container.h"
@@ -23,6 +30,7 @@
 #include "opgprof_options.h"
 #include "cverb.h"
 #include "op_file.h"
+#include "file_manip.h"
 
 using namespace std;
 
@@ -41,21 +49,93 @@ struct gmon_hdr {
 };
 
 
-void op_write_vma(FILE * fp, op_bfd const & abfd, bfd_vma vma)
+/**
+ * Buffered writer of a gmon file, the data is written to the file in
+ * large blocks rather than one value at a time.
+ */
+class gmon_writer : noncopyable {
+public:
+	/// open filename, vmas are written with the size used by abfd
+	gmon_writer(string const & filename, op_bfd const & abfd);
+	/// flush and close the file
+	~gmon_writer();
+
+	void write(void const * data, size_t size);
+	void write_u8(u8 val) { write(&val, sizeof(val)); }
+	void write_u32(u32 val) { write(&val, sizeof(val)); }
+	void write_vma(bfd_vma vma);
+
+private:
+	void flush();
+
+	enum { block_size = 64 * 1024 };
+
+	FILE * fp;
+	bool vma64;
+	vector<char> buffer;
+};
+
+
+gmon_writer::gmon_writer(string const & filename, op_bfd const & abfd)
 {
 	// bfd vma write size is a per binary property not a bfd
 	// configuration property
 	switch (abfd.bfd_arch_bits_per_address()) {
 		case 32:
-			op_write_u32(fp, vma);
+			vma64 = false;
 			break;
 		case 64:
-			op_write_u64(fp, vma);
+			vma64 = true;
 			break;
 		default:
 			cerr << "oprofile: unknown vma size for this binary\n";
 			exit(EXIT_FAILURE);
 	}
+
+	fp = op_open_file(filename.c_str(), "w");
+	buffer.reserve(block_size);
+}
+
+
+gmon_writer::~gmon_writer()
+{
+	flush();
+	op_close_file(fp);
+}
+
+
+void gmon_writer::write(void const * data, size_t size)
+{
+	if (buffer.size() + size > block_size) {
+		flush();
+		if (size >= block_size) {
+			op_write_file(fp, data, size);
+			return;
+		}
+	}
+
+	char const * pos = static_cast<char const *>(data);
+	buffer.insert(buffer.end(), pos, pos + size);
+}
+
+
+void gmon_writer::write_vma(bfd_vma vma)
+{
+	if (vma64) {
+		u64 val = vma;
+		write(&val, sizeof(val));
+	} else {
+		u32 val = vma;
+		write(&val, sizeof(val));
+	}
+}
+
+
+void gmon_writer::flush()
+{
+	if (!buffer.empty())
+		op_write_file(fp, &buffer[0], buffer.size());
+	buffer.clear();
 }
 
 
@@ -105,7 +185,8 @@ bool aligned_samples(profile_container const & samples, int gap)
 }
 
 
-void output_cg(FILE * fp, op_bfd const & abfd, profile_t const & cg_db)
+void output_cg(gmon_writer & out, op_bfd const & abfd,
+               profile_t const & cg_db)
 {
 	opd_header const & header = cg_db.get_header();
 	bfd_vma offset = 0;
@@ -119,16 +200,16 @@ void output_cg(FILE * fp, op_bfd const & abfd, profile_t const & cg_db)
 		bfd_vma from = p_it.first.vma() >> 32;
 		bfd_vma to = p_it.first.vma() & 0xffffffff;
 
-		op_write_u8(fp, GMON_TAG_CG_ARC);
-		op_write_vma(fp, abfd, abfd.offset_to_pc(from + offset));
-		op_write_vma(fp, abfd, abfd.offset_to_pc(to + offset));
+		out.write_u8(GMON_TAG_CG_ARC);
+		out.write_vma(abfd.offset_to_pc(from + offset));
+		out.write_vma(abfd.offset_to_pc(to + offset));
 		u32 count = p_it.first.count();
 		if (count != p_it.first.count()) {
 			count = (u32)-1;
 			cerr << "Warning: capping sample count by "
 			     << p_it.first.count() - count << endl;
 		}
-		op_write_u32(fp, p_it.first.count());
+		out.write_u32(count);
 	}
 }
 
@@ -168,22 +249,7 @@ void output_gprof(op_bfd const & abfd, profile_container const & samples,
 	// this case user must gprof --no-flat-profile which is a bit boring
 	// and result *seems* weirds.
 
-	FILE * fp = op_open_file(gmon_filename.c_str(), "w");
-
-	op_write_file(fp, &hdr, sizeof(gmon_hdr));
-	op_write_u8(fp, GMON_TAG_TIME_HIST);
-
-	op_write_vma(fp, abfd, low_pc);
-	op_write_vma(fp, abfd, high_pc);
-	/* size of histogram */
-	op_write_u32(fp, histsize);
-	/* profiling rate */
-	op_write_u32(fp, 1);
-	op_write_file(fp, "samples\0\0\0\0\0\0\0\0", 15);
-	/* abbreviation */
-	op_write_u8(fp, '1');
-
-	u16 * hist = (u16*)xcalloc(histsize, sizeof(u16));
+	vector<count_type> hist(histsize);
 
 	profile_container::symbol_choice choice;
 	choice.threshold = options::threshold;
@@ -197,32 +263,67 @@ void output_gprof(op_bfd const & abfd, profile_container const & samples,
 		sample_container::samples_iterator end = samples.end(*sit);
 		for (; it != end ; ++it) {
 			u32 pos = (it->second.vma - low_pc) / multiplier;
-			count_type count = it->second.counts[0];
 
 			if (pos >= histsize) {
 				cerr << "Bogus histogram bin " << pos
 				     << ", larger than " << pos << " !\n";
 				continue;
 			}
-	
-			if (hist[pos] + count > (u16)-1) {
-				hist[pos] = (u16)-1;
-				cerr <<	"Warning: capping sample count by "
-				     << hist[pos] + count - ((u16)-1) << endl;
-			} else {
-				hist[pos] += (u16)count;
-			}
+
+			hist[pos] += it->second.counts[0];
 		}
 	}
 
-	op_write_file(fp, hist, histsize * sizeof(u16));
+	// gmon bins are 16 bits, rather than capping the hottest ones
+	// scale all of them by the smallest power of 2 which fits
+	count_type max_count = 0;
+	for (size_t i = 0; i < histsize; ++i)
+		max_count = max(max_count, hist[i]);
+
+	unsigned int shift = 0;
+	while ((max_count >> shift) > (u16)-1)
+		++shift;
+
+	// the dimension tells gprof users the unit of a bin
+	ostringstream dimension;
+	dimension << "samples";
+	if (shift) {
+		dimension.str("");
+		dimension << "2^" << shift << " samples";
+		cverb << vdebug << "opgprof histogram scaled by 2^"
+		      << shift << endl;
+	}
+	char dimension_buf[15] = { 0 };
+	dimension.str().copy(dimension_buf, sizeof(dimension_buf) - 1);
+
+	gmon_writer out(gmon_filename, abfd);
 
-	if (!cg_db.empty())
-		output_cg(fp, abfd, cg_db);
+	out.write(&hdr, sizeof(gmon_hdr));
+	out.write_u8(GMON_TAG_TIME_HIST);
 
-	op_close_file(fp);
+	out.write_vma(low_pc);
+	out.write_vma(high_pc);
+	/* size of histogram */
+	out.write_u32(histsize);
+	/* profiling rate */
+	out.write_u32(1);
+	out.write(dimension_buf, sizeof(dimension_buf));
+	/* abbreviation */
+	out.write_u8('1');
+
+	vector<u16> scaled(histsize);
+	for (size_t i = 0; i < histsize; ++i) {
+		scaled[i] = hist[i] >> shift;
+		// don't lose the cold bins
+		if (hist[i] && !scaled[i])
+			scaled[i] = 1;
+	}
+
+	if (histsize)
+		out.write(&scaled[0], histsize * sizeof(u16));
 
-	free(hist);
+	if (!cg_db.empty())
+		output_cg(out, abfd, cg_db);
 }
 
 
@@ -263,6 +364,7 @@ void load_cg(profile_t & cg_db, list<profile_sample_files> const & files)
 	 * call stack) so by using the list of non-cg file we are sure to get
 	 * all existing cg files.
 	 */
+	list<string> cg_files;
 	for (; it != end; ++it) {
 		list<string>::const_iterator cit;
 		list<string>::const_iterator const cend = it->cg_files.end();
@@ -272,42 +374,147 @@ void load_cg(profile_t & cg_db, list<profile_sample_files> const & files)
 			 * data in from/to eip. */
 			cverb << vsfile << "loading cg samples file : " 
 			      << *cit << endl;
-			cg_db.add_sample_file(*cit);
+			cg_files.push_back(*cit);
 		}
 	}
+
+	cg_db.add_sample_files(cg_files);
 }
 
 
-int opgprof(options::spec const & spec)
+/**
+ * Write the gmon file of one binary image. Image errors are fatal if
+ * fatal is true, else they are reported and the image is skipped.
+ */
+void output_image(inverted_profile const & ip, string const & gmon_filename,
+                  bool fatal)
 {
-	handle_options(spec);
-
 	profile_container samples(false, true, classes.extra_found_images);
 
-	bool ok = image_profile.error == image_ok;
+	image_error error = ip.error;
+	bool ok = error == image_ok;
 	// FIXME: symbol_filter would be allowed through option
-	op_bfd abfd(image_profile.image, string_filter(),
+	op_bfd abfd(ip.image, string_filter(),
 		    classes.extra_found_images, ok);
-	if (!ok && image_profile.error == image_ok)
-		image_profile.error = image_format_failure;
+	if (!ok && error == image_ok)
+		error = image_format_failure;
 
-	if (image_profile.error != image_ok) {
-		report_image_error(image_profile, true,
+	if (error != image_ok) {
+		report_image_error(ip.image, error, fatal,
 				   classes.extra_found_images);
-		exit(EXIT_FAILURE);
+		if (fatal)
+			exit(EXIT_FAILURE);
+		return;
 	}
 
 	profile_t cg_db;
 	
-	image_group_set const & groups = image_profile.groups[0];
+	image_group_set const & groups = ip.groups[0];
 	image_group_set::const_iterator it;
 	for (it = groups.begin(); it != groups.end(); ++it) {
-		load_samples(abfd, it->files, image_profile.image, samples);
+		load_samples(abfd, it->files, ip.image, samples);
 
 		load_cg(cg_db, it->files);
 	}
 
-	output_gprof(abfd, samples, cg_db, options::gmon_filename);
+	output_gprof(abfd, samples, cg_db, gmon_filename);
+}
+
+
+/// wait for one child of output_images(), return false if it failed
+bool wait_image()
+{
+	int status;
+	while (wait(&status) < 0) {
+		if (errno != EINTR)
+			throw op_runtime_error("opgprof: wait() failed", errno);
+	}
+
+	return WIFEXITED(status) && WEXITSTATUS(status) == EXIT_SUCCESS;
+}
+
+
+/**
+ * Write the gmon file of each binary image in --output-dir, up to
+ * --jobs images at once. Each image is written by a child process, bfd
+ * and profile_container can't be shared between threads.
+ */
+void output_images(list<inverted_profile> const & images)
+{
+	size_t const nr_jobs = options::jobs;
+	size_t running = 0;
+	bool failed = false;
+
+	list<inverted_profile>::const_iterator it;
+	for (it = images.begin(); it != images.end(); ++it) {
+		// anon mappings and missing binaries have nothing to output
+		if (it->error != image_ok) {
+			report_image_error(*it, false,
+			                   classes.extra_found_images);
+			continue;
+		}
+
+		string const filename =
+			options::output_dir + it->image + ".gmon.out";
+		if (create_path(filename.c_str())) {
+			cerr << "unable to create directory: "
+			     << '"' << op_dirname(filename) << '"' << endl;
+			failed = true;
+			continue;
+		}
+
+		cverb << vsfile << "output filename: " << filename << endl;
+
+		if (nr_jobs == 1) {
+			output_image(*it, filename, false);
+			continue;
+		}
+
+		for (; running >= nr_jobs; --running)
+			failed |= !wait_image();
+
+		// don't output twice what is buffered
+		cout.flush();
+		cerr.flush();
+
+		pid_t const pid = fork();
+		if (pid < 0)
+			throw op_runtime_error("opgprof: fork() failed", errno);
+
+		if (pid == 0) {
+			// never go back to the caller in the child
+			int status = EXIT_SUCCESS;
+			try {
+				output_image(*it, filename, false);
+			} catch (exception const & e) {
+				cerr << "opgprof error: " << e.what() << endl;
+				status = EXIT_FAILURE;
+			} catch (...) {
+				status = EXIT_FAILURE;
+			}
+			cerr.flush();
+			_exit(status);
+		}
+
+		++running;
+	}
+
+	for (; running; --running)
+		failed |= !wait_image();
+
+	if (failed)
+		exit(EXIT_FAILURE);
+}
+
+
+int opgprof(options::spec const & spec)
+{
+	handle_options(spec);
+
+	if (!options::output_dir.empty())
+		output_images(image_profiles);
+	else
+		output_image(image_profile, options::gmon_filename, true);
 
 	return 0;
 }
@@ -27,9 +27,12 @@ using namespace std;
 
 profile_classes classes;
 inverted_profile image_profile;
+list<inverted_profile> image_profiles;
 
 namespace options {
 	string gmon_filename = "gmon.out";
+	string output_dir;
+	int jobs = 1;
 
 	// Ugly, for build only
 	demangle_type demangle;
@@ -45,10 +48,17 @@ popt::option options_array[] = {
 	popt::option(options::threshold_opt, "threshold", 't',
 		     "minimum percentage needed to produce output",
 		     "percent"),
+	popt::option(options::output_dir, "output-dir", '\0',
+		     "output one gmon file per binary image in this directory",
+		     "directory"),
+	popt::option(options::jobs, "jobs", 'j',
+		     "number of binary images to output at once with "
+		     "--output-dir (default 1)", "jobs"),
 };
 
 
-bool try_merge_profiles(profile_spec const & spec, bool exclude_dependent)
+list<inverted_profile>
+merge_profiles(profile_spec const & spec, bool exclude_dependent)
 {
 	list<string> sample_files = spec.generate_file_list(exclude_dependent, false);
 
@@ -70,9 +80,16 @@ bool try_merge_profiles(profile_spec const & spec, bool exclude_dependent)
 
 	cverb << vsfile << "profile_classes:\n" << classes << endl;
 
-	size_t nr_classes = classes.v.size();
+	return invert_profiles(classes);
+}
+
 
-	list<inverted_profile> iprofiles = invert_profiles(classes);
+bool try_merge_profiles(profile_spec const & spec, bool exclude_dependent)
+{
+	list<inverted_profile> iprofiles =
+		merge_profiles(spec, exclude_dependent);
+
+	size_t nr_classes = classes.v.size();
 
 	if (nr_classes == 1 && iprofiles.size() == 1) {
 		image_profile = *(iprofiles.begin());
@@ -113,6 +130,37 @@ void handle_options(options::spec const & spec)
 		profile_spec::create(spec.common, options::image_path,
 				     options::root_path);
 
+	if (options::jobs < 1) {
+		cerr << "--jobs must be at least 1" << endl;
+		exit(EXIT_FAILURE);
+	}
+
+	// a single gmon file is written by a single process
+	if (options::jobs > 1 && options::output_dir.empty()) {
+		cerr << "--jobs requires --output-dir" << endl;
+		exit(EXIT_FAILURE);
+	}
+
+	if (!options::output_dir.empty()) {
+		cverb << vsfile << "output directory: " << options::output_dir
+		      << endl;
+
+		// all the binary images, each one has its own gmon file
+		image_profiles = merge_profiles(pspec, false);
+		if (image_profiles.empty()) {
+			cerr << "error: no sample files found: profile "
+			     "specification too strict ?" << endl;
+			exit(EXIT_FAILURE);
+		}
+		if (classes.v.size() > 1) {
+			cerr << "error: give an event: or count: "
+			     "specification to select only one event"
+			     << endl;
+			exit(EXIT_FAILURE);
+		}
+		return;
+	}
+
 	cverb << vsfile << "output filename: " << options::gmon_filename
 	      << endl;
 
@@ -13,11 +13,14 @@
 #define OPGPROF_OPTIONS_H
 
 #include <string>
+#include <list>
 
 #include "common_option.h"
 
 namespace options {
 	extern std::string gmon_filename;
+	extern std::string output_dir;
+	extern int jobs;
 }
 
 class inverted_profile;
@@ -25,6 +28,9 @@ class inverted_profile;
 /// a set of sample filenames to handle.
 extern inverted_profile image_profile;
 
+/// with --output-dir, the sample filenames of each binary image
+extern std::list<inverted_profile> image_profiles;
+
 /**
  * handle_options - process command line
  * @param spec  profile specification
@@ -17,6 +17,7 @@
 #include <numeric>
 
 #include "op_exception.h"
+#include "cverb.h"
 #include "stream_util.h"
 #include "string_manip.h"
 #include "file_manip.h"
@@ -24,6 +25,10 @@
 #include "op_header.h"
 #include "profile.h"
 #include "populate.h"
+#include "populate_for_spu.h"
+#include "parse_filename.h"
+#include "export_writer.h"
+#include "sample_spill.h"
 #include "arrange_profiles.h"
 #include "profile_container.h"
 #include "callgraph_container.h"
@@ -366,7 +371,8 @@ format_flags get_format_flags(column_flags const & cf)
 }
 
 
-void output_symbols(profile_container const & pc, bool multiple_apps)
+void output_symbols(profile_container const & pc, bool multiple_apps,
+                    sample_spill const * spill = 0)
 {
 	profile_container::symbol_choice choice;
 	choice.threshold = options::threshold;
@@ -387,6 +393,7 @@ void output_symbols(profile_container const & pc, bool multiple_apps)
 	} else {
 		text_out = new format_output::opreport_formatter(pc);
 		text_out->show_details(options::details);
+		text_out->set_sample_spill(spill);
 		out = text_out;
 		out->show_long_filenames(options::long_filenames);
 	}
@@ -493,6 +500,137 @@ void output_cg_symbols(callgraph_container const & cg, bool multiple_apps)
 }
 
 
+/// write the call graph arcs of an image to the export file
+void export_arcs(export_writer & out, inverted_profile const & ip)
+{
+	extra_images const & extra = classes.extra_found_images;
+
+	for (size_t i = 0; i < ip.groups.size(); ++i) {
+		image_group_set::const_iterator it = ip.groups[i].begin();
+		for (; it != ip.groups[i].end(); ++it) {
+			list<profile_sample_files>::const_iterator fit;
+			for (fit = it->files.begin(); fit != it->files.end(); ++fit) {
+				list<string>::const_iterator cit;
+				for (cit = fit->cg_files.begin();
+				     cit != fit->cg_files.end(); ++cit) {
+					// app name as chosen by callgraph_container
+					string app = ip.image;
+					if (!options::merge_by.lib)
+						app = parse_filename(*cit, extra).image;
+					out.add_arcs(*cit, app, i, extra);
+				}
+			}
+		}
+	}
+}
+
+
+/// write the data address samples of an image to the export file
+void export_data(export_writer & out, inverted_profile const & ip)
+{
+	extra_images const & extra = classes.extra_found_images;
+
+	for (size_t i = 0; i < ip.groups.size(); ++i) {
+		image_group_set::const_iterator it = ip.groups[i].begin();
+		for (; it != ip.groups[i].end(); ++it) {
+			list<profile_sample_files>::const_iterator fit;
+			for (fit = it->files.begin(); fit != it->files.end(); ++fit) {
+				if (fit->sample_filename.empty())
+					continue;
+				string app = ip.image;
+				if (!options::merge_by.lib) {
+					app = parse_filename(fit->sample_filename,
+					                     extra).image;
+				}
+				out.add_data(fit->sample_filename, ip.image, app, i);
+			}
+		}
+	}
+}
+
+
+/**
+ * Write the whole session to the export file. Images are written one
+ * at a time so only one of them is in memory at once.
+ */
+void export_profiles(list<inverted_profile> const & iprofiles)
+{
+	export_session session;
+	session.cpuinfo = classes.cpuinfo;
+	session.event = classes.event;
+	for (size_t i = 0; i < classes.v.size(); ++i) {
+		export_session::profile_class pclass;
+		pclass.name = classes.v[i].name;
+		pclass.longname = classes.v[i].longname;
+		session.classes.push_back(pclass);
+	}
+
+	export_writer out(options::export_file, session);
+
+	// only used to build the records, samples are always exported
+	profile_container pc(options::debug_info, true,
+	                     classes.extra_found_images);
+
+	list<inverted_profile>::const_iterator it;
+	list<inverted_profile>::const_iterator const end = iprofiles.end();
+	for (it = iprofiles.begin(); it != end; ++it) {
+		if (is_spu_profile(*it)) {
+			throw op_runtime_error("--export doesn't support "
+			                       "Cell SPU profiles");
+		}
+
+		vector<profile_container::add_record> records;
+		collect_for_image(records, pc, *it, options::symbol_filter);
+		for (size_t i = 0; i < records.size(); ++i)
+			out.add(records[i]);
+	}
+
+	for (it = iprofiles.begin(); it != end; ++it) {
+		export_arcs(out, *it);
+		export_data(out, *it);
+	}
+
+	out.close();
+}
+
+
+/**
+ * Load and output the symbols with the detail samples kept within
+ * --memory-limit. Images are loaded one at a time and their samples
+ * moved to a sample_spill, only the symbols stay in memory.
+ */
+void output_spilled_symbols(list<inverted_profile> const & iprofiles,
+                            bool multiple_apps)
+{
+	profile_container samples(options::debug_info, options::details,
+	                          classes.extra_found_images);
+	sample_spill spill(size_t(options::memory_limit) * 1024 * 1024);
+
+	list<inverted_profile>::const_iterator it;
+	list<inverted_profile>::const_iterator const end = iprofiles.end();
+	for (it = iprofiles.begin(); it != end; ++it) {
+		// SPU samples stay in the container, the formatter uses
+		// them when the spill knows nothing about a symbol
+		if (is_spu_profile(*it)) {
+			populate_for_spu_image(samples, *it,
+			                       options::symbol_filter, 0);
+			continue;
+		}
+
+		vector<profile_container::add_record> records;
+		collect_for_image(records, samples, *it,
+		                  options::symbol_filter);
+		for (size_t i = 0; i < records.size(); ++i)
+			spill.add(samples, records[i]);
+	}
+
+	cverb << vdebug << "--memory-limit: " << spill.spilled_size()
+	      << " bytes of samples spilled" << endl;
+
+	output_symbols(samples, multiple_apps, &spill);
+}
+
+
 int opreport(options::spec const & spec)
 {
 	want_xml = options::xml;
@@ -519,6 +657,11 @@ int opreport(options::spec const & spec)
 
 	report_image_errors(iprofiles, classes.extra_found_images);
 
+	if (!options::export_file.empty()) {
+		export_profiles(iprofiles);
+		return 0;
+	}
+
 	if (options::xml) {
 		xml_utils::output_xml_header(options::command_options,
 		                             classes.cpuinfo, classes.event);
@@ -535,12 +678,8 @@ int opreport(options::spec const & spec)
 		profile_container pc1(options::debug_info, options::details,
 				      classes.extra_found_images);
 
-		list<inverted_profile>::iterator it = iprofiles.begin();
-		list<inverted_profile>::iterator const end = iprofiles.end();
-
-		for (; it != end; ++it)
-			populate_for_image(pc1, *it,
-					   options::symbol_filter, 0);
+		populate_for_images(pc1, iprofiles, options::symbol_filter,
+				    options::jobs, 0);
 
 		list<inverted_profile> iprofiles2 = invert_profiles(classes2);
 
@@ -549,12 +688,8 @@ int opreport(options::spec const & spec)
 		profile_container pc2(options::debug_info, options::details,
 				      classes2.extra_found_images);
 
-		list<inverted_profile>::iterator it2 = iprofiles2.begin();
-		list<inverted_profile>::iterator const end2 = iprofiles2.end();
-
-		for (; it2 != end2; ++it2)
-			populate_for_image(pc2, *it2,
-					   options::symbol_filter, 0);
+		populate_for_images(pc2, iprofiles2, options::symbol_filter,
+				    options::jobs, 0);
 
 		output_diff_symbols(pc1, pc2, multiple_apps);
 	} else if (options::callgraph) {
@@ -564,16 +699,14 @@ int opreport(options::spec const & spec)
 			options::merge_by.lib, options::symbol_filter);
 
 		output_cg_symbols(cg_container, multiple_apps);
+	} else if (options::memory_limit) {
+		output_spilled_symbols(iprofiles, multiple_apps);
 	} else {
 		profile_container samples(options::debug_info,
 			options::details, classes.extra_found_images);
 
-		list<inverted_profile>::iterator it = iprofiles.begin();
-		list<inverted_profile>::iterator const end = iprofiles.end();
-
-		for (; it != end; ++it)
-			populate_for_image(samples, *it,
-					   options::symbol_filter, 0);
+		populate_for_images(samples, iprofiles, options::symbol_filter,
+				    options::jobs, 0);
 
 		output_symbols(samples, multiple_apps);
 	}
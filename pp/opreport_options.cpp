@@ -25,6 +25,7 @@
 #include "xml_output.h"
 #include "xml_utils.h"
 #include "cverb.h"
+#include "aggregate_cache.h"
 
 using namespace std;
 
@@ -49,6 +50,9 @@ namespace options {
 	bool global_percent;
 	bool xml;
 	string xml_options;
+	string export_file;
+	int jobs = 1;
+	int memory_limit;
 }
 
 
@@ -60,6 +64,7 @@ vector<string> sort;
 vector<string> exclude_symbols;
 vector<string> include_symbols;
 string demangle_option = "normal";
+string cache_dir;
 
 popt::option options_array[] = {
 	popt::option(options::callgraph, "callgraph", 'c',
@@ -108,6 +113,18 @@ popt::option options_array[] = {
 
 	popt::option(options::xml, "xml", 'X',
 		     "XML output"),
+	popt::option(options::export_file, "export", 'E',
+		     "write the whole session to file in the binary "
+		     "export format", "file"),
+	popt::option(options::jobs, "jobs", 'j',
+		     "number of binary images to load at once (default 1)",
+		     "jobs"),
+	popt::option(options::memory_limit, "memory-limit", '\0',
+		     "keep the samples of --details within this memory, "
+		     "in MB", "size"),
+	popt::option(cache_dir, "aggregate-cache", '\0',
+		     "reuse the per image results of previous runs stored "
+		     "in this directory", "dir"),
 
 };
 
@@ -178,6 +195,41 @@ void check_options(bool diff)
 		}
 	}
 
+	if (memory_limit) {
+		if (!details) {
+			cerr << "--memory-limit requires --details" << endl;
+			do_exit = true;
+		}
+
+		if (xml) {
+			cerr << "--memory-limit is incompatible with --xml" << endl;
+			do_exit = true;
+		}
+
+		if (callgraph) {
+			cerr << "--memory-limit is incompatible with --callgraph" << endl;
+			do_exit = true;
+		}
+
+		if (diff) {
+			cerr << "differential profiles are incompatible with --memory-limit" << endl;
+			do_exit = true;
+		}
+	}
+
+	if (!export_file.empty()) {
+		symbols = true;
+		if (xml) {
+			cerr << "--export is incompatible with --xml" << endl;
+			do_exit = true;
+		}
+
+		if (diff) {
+			cerr << "differential profiles are incompatible with --export" << endl;
+			do_exit = true;
+		}
+	}
+
 	if (xml) {
 		if (accumulated) {
 			cerr << "--accumulated is incompatible with --xml" << endl;
@@ -307,6 +359,18 @@ void handle_options(options::spec const & spec)
 			xml_utils::add_option(INCLUDE_SYMBOLS, include_symbols);
 	}
 
+	if (jobs < 1) {
+		cerr << "--jobs must be at least 1" << endl;
+		exit(EXIT_FAILURE);
+	}
+
+	if (memory_limit < 0) {
+		cerr << "--memory-limit must not be negative" << endl;
+		exit(EXIT_FAILURE);
+	}
+
+	aggregate_cache::instance().set_directory(cache_dir);
+
 	handle_sort_option();
 	merge_by = handle_merge_option(mergespec, true, exclude_dependent);
 	handle_output_file();
@@ -41,6 +41,9 @@ namespace options {
 	extern bool accumulated;
 	extern bool xml;
 	extern std::string xml_options;
+	extern std::string export_file;
+	extern int jobs;
+	extern int memory_limit;
 }
 
 /// All the chosen sample files.
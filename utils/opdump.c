@@ -0,0 +1,114 @@
+/**
+ * @file opdump.c
+ * Ask the daemon for a dump and wait for its completion
+ *
+ * @remark Copyright 2010 OProfile authors
+ * @remark Read the file COPYING
+ *
+ * Exit status is 0 once the samples are written, 1 if the dump failed
+ * and 2 if the daemon doesn't accept dump requests, the caller can then
+ * fall back to waiting for the complete_dump file.
+ */
+
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <limits.h>
+#include <unistd.h>
+
+#include "op_version.h"
+#include "op_config.h"
+#include "op_popt.h"
+
+static char * session_dir = OP_SESSION_DIR_DEFAULT;
+static int dirty;
+static int show_vers;
+
+static struct poptOption options[] = {
+	{ "session-dir", '\0', POPT_ARG_STRING, &session_dir, 0,
+	  "session directory of the daemon", "/var/lib/oprofile", },
+	{ "dirty", 'd', POPT_ARG_NONE, &dirty, 0,
+	  "dump as usual, then list the sample files written since the last "
+	  "--dirty dump", NULL, },
+	{ "version", 'v', POPT_ARG_NONE, &show_vers, 0,
+	   "show version", NULL, },
+	POPT_AUTOHELP
+	{ NULL, 0, 0, NULL, 0, NULL, NULL, },
+};
+
+
+/** return the connected socket, -1 if nobody listens */
+static int connect_daemon(void)
+{
+	struct sockaddr_un addr;
+	int fd;
+
+	if (strlen(op_control_socket) >= sizeof(addr.sun_path))
+		return -1;
+
+	memset(&addr, '\0', sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	strcpy(addr.sun_path, op_control_socket);
+
+	fd = socket(AF_UNIX, SOCK_STREAM, 0);
+	if (fd < 0)
+		return -1;
+
+	if (connect(fd, (struct sockaddr *)&addr, sizeof(addr))) {
+		close(fd);
+		return -1;
+	}
+
+	return fd;
+}
+
+
+int main(int argc, char const * argv[])
+{
+	poptContext optcon;
+	char const * request;
+	FILE * answer;
+	char line[PATH_MAX + 2];
+	int fd;
+
+	optcon = op_poptGetContext(NULL, argc, argv, options, 0);
+	if (show_vers)
+		show_version(argv[0]);
+	poptFreeContext(optcon);
+
+	init_op_config_dirs(session_dir);
+
+	fd = connect_daemon();
+	if (fd == -1)
+		return 2;
+
+	request = dirty ? OP_CONTROL_DUMP_DIRTY "\n" : OP_CONTROL_DUMP "\n";
+	if (write(fd, request, strlen(request)) != (ssize_t)strlen(request)) {
+		perror("opdump: couldn't send dump request");
+		return 1;
+	}
+
+	answer = fdopen(fd, "r");
+	if (!answer) {
+		perror("opdump: couldn't read answer");
+		return 1;
+	}
+
+	/* the daemon closes the connection if it dies */
+	while (fgets(line, sizeof(line), answer)) {
+		if (!strcmp(line, OP_CONTROL_OK "\n"))
+			return 0;
+		if (!strncmp(line, "error: ", strlen("error: "))) {
+			fprintf(stderr, "opdump: %s", line);
+			return 1;
+		}
+		fputs(line, stdout);
+	}
+
+	fprintf(stderr, "opdump: daemon died during dump\n");
+	return 1;
+}